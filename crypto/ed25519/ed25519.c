@@ -0,0 +1,683 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <string.h>
+#include "ed25519.h"
+#include "sha512.h"
+
+/*
+ *  Field arithmetic mod p = 2^255 - 19.
+ *
+ *  Hosts with a 128 bit integer type use 5 limbs of 51 bits.  Everything else
+ *  falls back to 16 limbs of 16 bits in int64_t, as in TweetNaCl, which only
+ *  needs 32x32->64 bit multiplies.
+ */
+
+#ifdef __SIZEOF_INT128__
+
+typedef uint64_t fe[5];
+typedef unsigned __int128 uint128_t;
+
+#define MASK51  ((((uint64_t)1) << 51) - 1)
+
+static uint64_t load64(const uint8_t * b)
+{
+    uint64_t r = 0;
+    int i;
+    for (i = 7; i >= 0; i--)
+    {
+        r = (r << 8) | b[i];
+    }
+    return r;
+}
+
+static void store64(uint8_t * b, uint64_t v)
+{
+    int i;
+    for (i = 0; i < 8; i++)
+    {
+        b[i] = v >> (8 * i);
+    }
+}
+
+static void fe_0(fe h)
+{
+    memset(h, 0, sizeof(fe));
+}
+
+static void fe_1(fe h)
+{
+    fe_0(h);
+    h[0] = 1;
+}
+
+static void fe_carry(fe h)
+{
+    uint64_t c;
+    c = h[0] >> 51; h[0] &= MASK51; h[1] += c;
+    c = h[1] >> 51; h[1] &= MASK51; h[2] += c;
+    c = h[2] >> 51; h[2] &= MASK51; h[3] += c;
+    c = h[3] >> 51; h[3] &= MASK51; h[4] += c;
+    c = h[4] >> 51; h[4] &= MASK51; h[0] += 19 * c;
+}
+
+static void fe_add(fe h, const fe f, const fe g)
+{
+    int i;
+    for (i = 0; i < 5; i++)
+    {
+        h[i] = f[i] + g[i];
+    }
+    fe_carry(h);
+}
+
+// Adds 2p first so limbs below 2^52 never underflow.
+static void fe_sub(fe h, const fe f, const fe g)
+{
+    h[0] = (f[0] + 0xfffffffffffdaULL) - g[0];
+    h[1] = (f[1] + 0xffffffffffffeULL) - g[1];
+    h[2] = (f[2] + 0xffffffffffffeULL) - g[2];
+    h[3] = (f[3] + 0xffffffffffffeULL) - g[3];
+    h[4] = (f[4] + 0xffffffffffffeULL) - g[4];
+    fe_carry(h);
+}
+
+static void fe_mul(fe h, const fe f, const fe g)
+{
+    uint128_t r0, r1, r2, r3, r4;
+    uint64_t g1_19 = 19 * g[1], g2_19 = 19 * g[2], g3_19 = 19 * g[3], g4_19 = 19 * g[4];
+    uint64_t c;
+
+    r0 = (uint128_t)f[0]*g[0] + (uint128_t)f[1]*g4_19 + (uint128_t)f[2]*g3_19 + (uint128_t)f[3]*g2_19 + (uint128_t)f[4]*g1_19;
+    r1 = (uint128_t)f[0]*g[1] + (uint128_t)f[1]*g[0]  + (uint128_t)f[2]*g4_19 + (uint128_t)f[3]*g3_19 + (uint128_t)f[4]*g2_19;
+    r2 = (uint128_t)f[0]*g[2] + (uint128_t)f[1]*g[1]  + (uint128_t)f[2]*g[0]  + (uint128_t)f[3]*g4_19 + (uint128_t)f[4]*g3_19;
+    r3 = (uint128_t)f[0]*g[3] + (uint128_t)f[1]*g[2]  + (uint128_t)f[2]*g[1]  + (uint128_t)f[3]*g[0]  + (uint128_t)f[4]*g4_19;
+    r4 = (uint128_t)f[0]*g[4] + (uint128_t)f[1]*g[3]  + (uint128_t)f[2]*g[2]  + (uint128_t)f[3]*g[1]  + (uint128_t)f[4]*g[0];
+
+    r1 += (uint64_t)(r0 >> 51);
+    r2 += (uint64_t)(r1 >> 51);
+    r3 += (uint64_t)(r2 >> 51);
+    r4 += (uint64_t)(r3 >> 51);
+    c = (uint64_t)(r4 >> 51);
+
+    h[0] = ((uint64_t)r0 & MASK51) + 19 * c;
+    h[1] = ((uint64_t)r1 & MASK51) + (h[0] >> 51);
+    h[0] &= MASK51;
+    h[2] = (uint64_t)r2 & MASK51;
+    h[3] = (uint64_t)r3 & MASK51;
+    h[4] = (uint64_t)r4 & MASK51;
+}
+
+static void fe_frombytes(fe h, const uint8_t * s)
+{
+    h[0] = load64(s) & MASK51;
+    h[1] = (load64(s + 6) >> 3) & MASK51;
+    h[2] = (load64(s + 12) >> 6) & MASK51;
+    h[3] = (load64(s + 19) >> 1) & MASK51;
+    h[4] = (load64(s + 24) >> 12) & MASK51;
+}
+
+static void fe_tobytes(uint8_t * s, const fe f)
+{
+    fe h;
+    uint64_t q;
+
+    memmove(h, f, sizeof(fe));
+    fe_carry(h);
+
+    // q = 1 iff h >= p
+    q = (h[0] + 19) >> 51;
+    q = (h[1] + q) >> 51;
+    q = (h[2] + q) >> 51;
+    q = (h[3] + q) >> 51;
+    q = (h[4] + q) >> 51;
+
+    h[0] += 19 * q;
+    h[1] += h[0] >> 51; h[0] &= MASK51;
+    h[2] += h[1] >> 51; h[1] &= MASK51;
+    h[3] += h[2] >> 51; h[2] &= MASK51;
+    h[4] += h[3] >> 51; h[3] &= MASK51;
+    h[4] &= MASK51;
+
+    store64(s,      h[0]         | (h[1] << 51));
+    store64(s + 8,  (h[1] >> 13) | (h[2] << 38));
+    store64(s + 16, (h[2] >> 26) | (h[3] << 25));
+    store64(s + 24, (h[3] >> 39) | (h[4] << 12));
+}
+
+// f = b ? g : f
+static void fe_cmov(fe f, const fe g, unsigned b)
+{
+    uint64_t mask = 0 - (uint64_t)b;
+    int i;
+    for (i = 0; i < 5; i++)
+    {
+        f[i] ^= (f[i] ^ g[i]) & mask;
+    }
+}
+
+#else
+
+typedef int64_t fe[16];
+
+static void fe_0(fe h)
+{
+    memset(h, 0, sizeof(fe));
+}
+
+static void fe_1(fe h)
+{
+    fe_0(h);
+    h[0] = 1;
+}
+
+static void fe_carry(fe o)
+{
+    int64_t c;
+    int i;
+    for (i = 0; i < 16; i++)
+    {
+        o[i] += ((int64_t)1 << 16);
+        c = o[i] >> 16;
+        o[(i + 1) * (i < 15)] += c - 1 + 37 * (c - 1) * (i == 15);
+        o[i] -= c << 16;
+    }
+}
+
+static void fe_add(fe h, const fe f, const fe g)
+{
+    int i;
+    for (i = 0; i < 16; i++)
+    {
+        h[i] = f[i] + g[i];
+    }
+}
+
+static void fe_sub(fe h, const fe f, const fe g)
+{
+    int i;
+    for (i = 0; i < 16; i++)
+    {
+        h[i] = f[i] - g[i];
+    }
+}
+
+static void fe_mul(fe h, const fe f, const fe g)
+{
+    int64_t t[31];
+    int i, j;
+
+    memset(t, 0, sizeof(t));
+    for (i = 0; i < 16; i++)
+    {
+        for (j = 0; j < 16; j++)
+        {
+            t[i + j] += f[i] * g[j];
+        }
+    }
+    for (i = 0; i < 15; i++)
+    {
+        t[i] += 38 * t[i + 16];
+    }
+    for (i = 0; i < 16; i++)
+    {
+        h[i] = t[i];
+    }
+    fe_carry(h);
+    fe_carry(h);
+}
+
+static void fe_frombytes(fe h, const uint8_t * s)
+{
+    int i;
+    for (i = 0; i < 16; i++)
+    {
+        h[i] = s[2 * i] + ((int64_t)s[2 * i + 1] << 8);
+    }
+    h[15] &= 0x7fff;
+}
+
+// f = b ? g : f
+static void fe_cmov(fe f, const fe g, unsigned b)
+{
+    int64_t mask = 0 - (int64_t)b;
+    int i;
+    for (i = 0; i < 16; i++)
+    {
+        f[i] ^= (f[i] ^ g[i]) & mask;
+    }
+}
+
+static void fe_tobytes(uint8_t * s, const fe f)
+{
+    fe m, t;
+    int i, j, b;
+
+    memmove(t, f, sizeof(fe));
+    fe_carry(t);
+    fe_carry(t);
+    fe_carry(t);
+    for (j = 0; j < 2; j++)
+    {
+        m[0] = t[0] - 0xffed;
+        for (i = 1; i < 15; i++)
+        {
+            m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+            m[i - 1] &= 0xffff;
+        }
+        m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+        b = (m[15] >> 16) & 1;
+        m[14] &= 0xffff;
+        fe_cmov(t, m, 1 - b);
+    }
+    for (i = 0; i < 16; i++)
+    {
+        s[2 * i] = t[i] & 0xff;
+        s[2 * i + 1] = t[i] >> 8;
+    }
+}
+
+#endif
+
+#define fe_sq(h,f)  fe_mul(h,f,f)
+
+static void fe_sqn(fe h, const fe f, int n)
+{
+    fe_sq(h, f);
+    while (--n)
+    {
+        fe_sq(h, h);
+    }
+}
+
+// out = z^(p-2)
+static void fe_invert(fe out, const fe z)
+{
+    fe t0, t1, t2, t3;
+
+    fe_sq(t0, z);
+    fe_sqn(t1, t0, 2);
+    fe_mul(t1, z, t1);
+    fe_mul(t0, t0, t1);
+    fe_sq(t2, t0);
+    fe_mul(t1, t1, t2);
+    fe_sqn(t2, t1, 5);
+    fe_mul(t1, t2, t1);
+    fe_sqn(t2, t1, 10);
+    fe_mul(t2, t2, t1);
+    fe_sqn(t3, t2, 20);
+    fe_mul(t2, t3, t2);
+    fe_sqn(t2, t2, 10);
+    fe_mul(t1, t2, t1);
+    fe_sqn(t2, t1, 50);
+    fe_mul(t2, t2, t1);
+    fe_sqn(t3, t2, 100);
+    fe_mul(t2, t3, t2);
+    fe_sqn(t2, t2, 50);
+    fe_mul(t1, t2, t1);
+    fe_sqn(t1, t1, 5);
+    fe_mul(out, t1, t0);
+}
+
+/*
+ *  Points on -x^2 + y^2 = 1 + d x^2 y^2 in extended coordinates
+ *  (X:Y:Z:T) with x = X/Z, y = Y/Z, xy = T/Z.
+ */
+
+typedef struct
+{
+    fe X, Y, Z, T;
+} ge;
+
+// Addend form of a point: (Y+X, Y-X, Z, 2dT).
+typedef struct
+{
+    fe YplusX, YminusX, Z, T2d;
+} ge_cached;
+
+static const uint8_t ed25519_d2[32] = {
+    0x59, 0xf1, 0xb2, 0x26, 0x94, 0x9b, 0xd6, 0xeb, 0x56, 0xb1, 0x83, 0x82, 0x9a, 0x14, 0xe0, 0x00,
+    0x30, 0xd1, 0xf3, 0xee, 0xf2, 0x80, 0x8e, 0x19, 0xe7, 0xfc, 0xdf, 0x56, 0xdc, 0xd9, 0x06, 0x24,
+};
+
+static const uint8_t ed25519_bx[32] = {
+    0x1a, 0xd5, 0x25, 0x8f, 0x60, 0x2d, 0x56, 0xc9, 0xb2, 0xa7, 0x25, 0x95, 0x60, 0xc7, 0x2c, 0x69,
+    0x5c, 0xdc, 0xd6, 0xfd, 0x31, 0xe2, 0xa4, 0xc0, 0xfe, 0x53, 0x6e, 0xcd, 0xd3, 0x36, 0x69, 0x21,
+};
+
+static const uint8_t ed25519_by[32] = {
+    0x58, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+    0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66,
+};
+
+static void ge_identity(ge * p)
+{
+    fe_0(p->X);
+    fe_1(p->Y);
+    fe_1(p->Z);
+    fe_0(p->T);
+}
+
+static void ge_base(ge * p)
+{
+    fe_frombytes(p->X, ed25519_bx);
+    fe_frombytes(p->Y, ed25519_by);
+    fe_1(p->Z);
+    fe_mul(p->T, p->X, p->Y);
+}
+
+static void ge_to_cached(ge_cached * c, const ge * p)
+{
+    fe d2;
+    fe_frombytes(d2, ed25519_d2);
+    fe_add(c->YplusX, p->Y, p->X);
+    fe_sub(c->YminusX, p->Y, p->X);
+    memmove(c->Z, p->Z, sizeof(fe));
+    fe_mul(c->T2d, p->T, d2);
+}
+
+// r = p + q (add-2008-hwcd-3), complete for all inputs.  r may alias p.
+static void ge_add(ge * r, const ge * p, const ge_cached * q)
+{
+    fe a, b, c, d, e, f, g, h;
+
+    fe_sub(a, p->Y, p->X);
+    fe_mul(a, a, q->YminusX);
+    fe_add(b, p->Y, p->X);
+    fe_mul(b, b, q->YplusX);
+    fe_mul(c, p->T, q->T2d);
+    fe_mul(d, p->Z, q->Z);
+    fe_add(d, d, d);
+
+    fe_sub(e, b, a);
+    fe_sub(f, d, c);
+    fe_add(g, d, c);
+    fe_add(h, b, a);
+
+    fe_mul(r->X, e, f);
+    fe_mul(r->Y, g, h);
+    fe_mul(r->T, e, h);
+    fe_mul(r->Z, f, g);
+}
+
+// r = 2p (dbl-2008-hwcd).  E, F, G, H are all negated, which leaves the
+// products unchanged.  r may alias p.
+static void ge_double(ge * r, const ge * p)
+{
+    fe a, b, c, e, f, g, h;
+
+    fe_sq(a, p->X);
+    fe_sq(b, p->Y);
+    fe_sq(c, p->Z);
+    fe_add(c, c, c);
+
+    fe_add(h, a, b);
+    fe_add(e, p->X, p->Y);
+    fe_sq(e, e);
+    fe_sub(e, h, e);
+    fe_sub(g, a, b);
+    fe_add(f, c, g);
+
+    fe_mul(r->X, e, f);
+    fe_mul(r->Y, g, h);
+    fe_mul(r->T, e, h);
+    fe_mul(r->Z, f, g);
+}
+
+static void ge_tobytes(uint8_t * s, const ge * p)
+{
+    fe zi, x, y;
+    uint8_t xb[32];
+
+    fe_invert(zi, p->Z);
+    fe_mul(x, p->X, zi);
+    fe_mul(y, p->Y, zi);
+    fe_tobytes(s, y);
+    fe_tobytes(xb, x);
+    s[31] ^= (xb[0] & 1) << 7;
+}
+
+#ifdef __SIZEOF_INT128__
+
+// Fixed 4 bit window over j*B, j = 0..15, built on first use.
+static ge_cached base_table[16];
+static int base_table_ready = 0;
+
+static void ge_scalarmult_base(ge * r, const uint8_t * s)
+{
+    ge_cached t;
+    unsigned w, j;
+    int i, k;
+
+    if (!base_table_ready)
+    {
+        ge p, b;
+        ge_identity(&p);
+        ge_base(&b);
+        ge_to_cached(&base_table[0], &p);
+        ge_to_cached(&t, &b);
+        for (j = 1; j < 16; j++)
+        {
+            ge_add(&p, &p, &t);
+            ge_to_cached(&base_table[j], &p);
+        }
+        base_table_ready = 1;
+    }
+
+    ge_identity(r);
+    for (i = 63; i >= 0; i--)
+    {
+        for (k = 0; k < 4; k++)
+        {
+            ge_double(r, r);
+        }
+
+        w = (s[i / 2] >> (4 * (i & 1))) & 0xf;
+        t = base_table[0];
+        for (j = 1; j < 16; j++)
+        {
+            unsigned eq = ((j ^ w) - 1) >> 31;
+            fe_cmov(t.YplusX, base_table[j].YplusX, eq);
+            fe_cmov(t.YminusX, base_table[j].YminusX, eq);
+            fe_cmov(t.Z, base_table[j].Z, eq);
+            fe_cmov(t.T2d, base_table[j].T2d, eq);
+        }
+        ge_add(r, r, &t);
+    }
+}
+
+#else
+
+static void ge_cswap(ge * p, ge * q, unsigned b)
+{
+    fe t;
+    memmove(t, p->X, sizeof(fe)); fe_cmov(p->X, q->X, b); fe_cmov(q->X, t, b);
+    memmove(t, p->Y, sizeof(fe)); fe_cmov(p->Y, q->Y, b); fe_cmov(q->Y, t, b);
+    memmove(t, p->Z, sizeof(fe)); fe_cmov(p->Z, q->Z, b); fe_cmov(q->Z, t, b);
+    memmove(t, p->T, sizeof(fe)); fe_cmov(p->T, q->T, b); fe_cmov(q->T, t, b);
+}
+
+// Constant time ladder without a table, which keeps RAM use low on 32 bit
+// targets.
+static void ge_scalarmult_base(ge * r, const uint8_t * s)
+{
+    ge q;
+    ge_cached c;
+    unsigned b;
+    int i;
+
+    ge_identity(r);
+    ge_base(&q);
+    for (i = 255; i >= 0; i--)
+    {
+        b = (s[i / 8] >> (i & 7)) & 1;
+        ge_cswap(r, &q, b);
+        ge_to_cached(&c, r);
+        ge_add(&q, &q, &c);
+        ge_double(r, r);
+        ge_cswap(r, &q, b);
+    }
+}
+
+#endif
+
+/*
+ *  Scalars mod L = 2^252 + 27742317777372353535851937790883648493.
+ */
+
+static const int64_t L[32] = {
+    0xed, 0xd3, 0xf5, 0x5c, 0x1a, 0x63, 0x12, 0x58, 0xd6, 0x9c, 0xf7, 0xa2, 0xde, 0xf9, 0xde, 0x14,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x10,
+};
+
+// r = x mod L, x is 64 signed radix 2^8 digits.
+static void sc_reduce_limbs(uint8_t * r, int64_t * x)
+{
+    int64_t carry;
+    int i, j;
+
+    for (i = 63; i >= 32; i--)
+    {
+        carry = 0;
+        for (j = i - 32; j < i - 12; j++)
+        {
+            x[j] += carry - 16 * x[i] * L[j - (i - 32)];
+            carry = (x[j] + 128) >> 8;
+            x[j] -= carry * 256;
+        }
+        x[j] += carry;
+        x[i] = 0;
+    }
+    carry = 0;
+    for (j = 0; j < 32; j++)
+    {
+        x[j] += carry - (x[31] >> 4) * L[j];
+        carry = x[j] >> 8;
+        x[j] &= 255;
+    }
+    for (j = 0; j < 32; j++)
+    {
+        x[j] -= carry * L[j];
+    }
+    for (i = 0; i < 32; i++)
+    {
+        x[i + 1] += x[i] >> 8;
+        r[i] = x[i] & 255;
+    }
+}
+
+// 64 byte little endian s is reduced in place, result in s[0..31].
+static void sc_reduce(uint8_t * s)
+{
+    int64_t x[64];
+    int i;
+    for (i = 0; i < 64; i++)
+    {
+        x[i] = s[i];
+    }
+    memset(s, 0, 64);
+    sc_reduce_limbs(s, x);
+}
+
+static void wipe(void * p, unsigned len)
+{
+    volatile uint8_t * b = (volatile uint8_t *)p;
+    while (len--)
+    {
+        *b++ = 0;
+    }
+}
+
+static void expand_key(uint8_t * az, const uint8_t * private_key)
+{
+    SHA512_CTX ctx;
+    sha512_init(&ctx);
+    sha512_update(&ctx, private_key, 32);
+    sha512_final(&ctx, az);
+    az[0] &= 248;
+    az[31] &= 127;
+    az[31] |= 64;
+    wipe(&ctx, sizeof(ctx));
+}
+
+void ed25519_public_key(uint8_t * public_key, const uint8_t * private_key)
+{
+    uint8_t az[64];
+    ge A;
+
+    expand_key(az, private_key);
+    ge_scalarmult_base(&A, az);
+    ge_tobytes(public_key, &A);
+
+    wipe(az, sizeof(az));
+    wipe(&A, sizeof(A));
+}
+
+void ed25519_sign(uint8_t * signature, const uint8_t * message, size_t len,
+                  const uint8_t * private_key, const uint8_t * public_key)
+{
+    SHA512_CTX ctx;
+    uint8_t az[64], r[64], h[64];
+    int64_t x[64];
+    ge R;
+    int i, j;
+
+    expand_key(az, private_key);
+
+    // r = H(prefix || M) mod L
+    sha512_init(&ctx);
+    sha512_update(&ctx, az + 32, 32);
+    sha512_update(&ctx, message, len);
+    sha512_final(&ctx, r);
+    sc_reduce(r);
+
+    ge_scalarmult_base(&R, r);
+    ge_tobytes(signature, &R);
+
+    // h = H(R || A || M) mod L
+    sha512_init(&ctx);
+    sha512_update(&ctx, signature, 32);
+    sha512_update(&ctx, public_key, 32);
+    sha512_update(&ctx, message, len);
+    sha512_final(&ctx, h);
+    sc_reduce(h);
+
+    // S = r + h*a mod L
+    memset(x, 0, sizeof(x));
+    for (i = 0; i < 32; i++)
+    {
+        x[i] = r[i];
+    }
+    for (i = 0; i < 32; i++)
+    {
+        for (j = 0; j < 32; j++)
+        {
+            x[i + j] += (int64_t)h[i] * az[j];
+        }
+    }
+    sc_reduce_limbs(signature + 32, x);
+
+    wipe(&ctx, sizeof(ctx));
+    wipe(az, sizeof(az));
+    wipe(r, sizeof(r));
+    wipe(x, sizeof(x));
+    wipe(&R, sizeof(R));
+}
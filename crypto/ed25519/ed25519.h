@@ -0,0 +1,39 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Ed25519 key derivation and signing (RFC 8032).
+ *
+ *  private_key is the 32 byte seed, public_key the 32 byte encoded point and
+ *  signature the 64 byte R||S.  Signing is deterministic and constant time.
+ */
+#ifndef _ED25519_H
+#define _ED25519_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+void ed25519_public_key(uint8_t * public_key, const uint8_t * private_key);
+
+void ed25519_sign(uint8_t * signature, const uint8_t * message, size_t len,
+                  const uint8_t * private_key, const uint8_t * public_key);
+
+#endif
@@ -0,0 +1,42 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#ifndef _SHA512_H
+#define _SHA512_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA512_BLOCK_SIZE   64      // SHA512 outputs a 64 byte digest
+
+typedef struct
+{
+    uint8_t data[128];
+    uint32_t datalen;
+    uint64_t bitlen;
+    uint64_t state[8];
+} SHA512_CTX;
+
+void sha512_init(SHA512_CTX * ctx);
+void sha512_update(SHA512_CTX * ctx, const uint8_t * data, size_t len);
+void sha512_final(SHA512_CTX * ctx, uint8_t * hash);
+
+#endif
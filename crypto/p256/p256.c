@@ -0,0 +1,920 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stddef.h>
+#include <string.h>
+#include "p256.h"
+
+/*
+ *  Field and scalar elements are little endian limbs kept in Montgomery form
+ *  (a * 2^256 mod m) and always fully reduced, so zero has a unique
+ *  representation.  All arithmetic on secret data is constant time.
+ *
+ *  Hosts with a 128 bit integer type use 4 limbs of 64 bits, everything else
+ *  8 limbs of 32 bits.  On x86-64 built with -mbmi2 -madx the 64 bit
+ *  Montgomery multiplication uses mulx/adcx/adox.
+ */
+
+#if defined(__SIZEOF_INT128__) && !defined(P256_LIMB32)
+
+#define P256_LIMBS      4
+#define P256_LIMB_BITS  64
+
+typedef uint64_t p256_limb;
+typedef unsigned __int128 p256_dlimb;
+
+// Tables and constants are written as 8 32 bit words.
+#define P256_FE(a0,a1,a2,a3,a4,a5,a6,a7)    {   \
+    ((uint64_t)(a1) << 32) | (a0),              \
+    ((uint64_t)(a3) << 32) | (a2),              \
+    ((uint64_t)(a5) << 32) | (a4),              \
+    ((uint64_t)(a7) << 32) | (a6),              \
+}
+
+#define P256_N0INV      0xccd1c8aaee00bc4fULL
+
+#if defined(__x86_64__) && defined(__BMI2__) && defined(__ADX__)
+#define P256_MULX
+#endif
+
+#else
+
+#define P256_LIMBS      8
+#define P256_LIMB_BITS  32
+
+typedef uint32_t p256_limb;
+typedef uint64_t p256_dlimb;
+
+#define P256_FE(a0,a1,a2,a3,a4,a5,a6,a7)    {a0,a1,a2,a3,a4,a5,a6,a7}
+
+#define P256_N0INV      0xee00bc4f
+
+#endif
+
+#define P256_LIMB_BYTES (P256_LIMB_BITS / 8)
+
+typedef struct
+{
+    p256_limb x[P256_LIMBS];
+    p256_limb y[P256_LIMBS];
+} p256_affine;
+
+typedef struct
+{
+    p256_limb x[P256_LIMBS];
+    p256_limb y[P256_LIMBS];
+    p256_limb z[P256_LIMBS];    // z == 0 is the point at infinity
+} p256_jacobian;
+
+typedef struct
+{
+    p256_limb m[P256_LIMBS];
+    p256_limb rr[P256_LIMBS];   // 2^512 mod m
+    p256_limb one[P256_LIMBS];  // 2^256 mod m
+    p256_limb m0inv;            // -m^-1 mod 2^P256_LIMB_BITS
+} p256_modulus;
+
+#include "p256_table.h"
+
+#if P256_COMB_TEETH * P256_COMB_TABLES * P256_COMB_SPACING < 256
+#error "p256_table.h does not cover 256 bit scalars, regenerate it"
+#endif
+
+// Entries kept ready by p256_precompute()
+#ifndef P256_PRESIGN_POOL
+#define P256_PRESIGN_POOL   4
+#endif
+#ifndef P256_KEY_POOL
+#define P256_KEY_POOL       2
+#endif
+
+static const p256_modulus p256_p = {
+    P256_FE(0xffffffff, 0xffffffff, 0xffffffff, 0x00000000, 0x00000000, 0x00000000, 0x00000001, 0xffffffff),
+    P256_FE(0x00000003, 0x00000000, 0xffffffff, 0xfffffffb, 0xfffffffe, 0xffffffff, 0xfffffffd, 0x00000004),
+    P256_FE(0x00000001, 0x00000000, 0x00000000, 0xffffffff, 0xffffffff, 0xffffffff, 0xfffffffe, 0x00000000),
+    1,
+};
+
+static const p256_modulus p256_n = {
+    P256_FE(0xfc632551, 0xf3b9cac2, 0xa7179e84, 0xbce6faad, 0xffffffff, 0xffffffff, 0x00000000, 0xffffffff),
+    P256_FE(0xbe79eea2, 0x83244c95, 0x49bd6fa6, 0x4699799c, 0x2b6bec59, 0x2845b239, 0xf3d95620, 0x66e12d94),
+    P256_FE(0x039cdaaf, 0x0c46353d, 0x58e8617b, 0x43190552, 0x00000000, 0x00000000, 0xffffffff, 0x00000000),
+    P256_N0INV,
+};
+
+// Curve coefficient b in normal form.
+static const p256_limb p256_b[P256_LIMBS] =
+    P256_FE(0x27d2604b, 0x3bce3c3e, 0xcc53b0f6, 0x651d06b0, 0x769886bc, 0xb3ebbd55, 0xaa3a93e7, 0x5ac635d8);
+
+static p256_rng_function p256_rng = NULL;
+
+void p256_set_rng(p256_rng_function rng)
+{
+    p256_rng = rng;
+}
+
+static void wipe(void * p, unsigned len)
+{
+    volatile uint8_t * b = (volatile uint8_t *)p;
+    while (len--)
+    {
+        *b++ = 0;
+    }
+}
+
+// All ones if a == 0, else 0.
+static p256_limb ct_is_zero(p256_limb a)
+{
+    return ((a | (0 - a)) >> (P256_LIMB_BITS - 1)) - 1;
+}
+
+static p256_limb vli_add(p256_limb * r, const p256_limb * a, const p256_limb * b)
+{
+    p256_dlimb c = 0;
+    int i;
+    for (i = 0; i < P256_LIMBS; i++)
+    {
+        c += (p256_dlimb)a[i] + b[i];
+        r[i] = (p256_limb)c;
+        c >>= P256_LIMB_BITS;
+    }
+    return (p256_limb)c;
+}
+
+static p256_limb vli_sub(p256_limb * r, const p256_limb * a, const p256_limb * b)
+{
+    p256_dlimb c = 0;
+    int i;
+    for (i = 0; i < P256_LIMBS; i++)
+    {
+        c = (p256_dlimb)a[i] - b[i] - c;
+        r[i] = (p256_limb)c;
+        c = (c >> P256_LIMB_BITS) & 1;
+    }
+    return (p256_limb)c;
+}
+
+// r = mask ? a : r
+static void vli_cmov(p256_limb * r, const p256_limb * a, p256_limb mask)
+{
+    int i;
+    for (i = 0; i < P256_LIMBS; i++)
+    {
+        r[i] ^= (r[i] ^ a[i]) & mask;
+    }
+}
+
+static p256_limb vli_is_zero(const p256_limb * a)
+{
+    p256_limb acc = 0;
+    int i;
+    for (i = 0; i < P256_LIMBS; i++)
+    {
+        acc |= a[i];
+    }
+    return ct_is_zero(acc);
+}
+
+static int vli_test_bit(const p256_limb * a, unsigned bit)
+{
+    return (a[bit / P256_LIMB_BITS] >> (bit % P256_LIMB_BITS)) & 1;
+}
+
+static void vli_from_bytes(p256_limb * r, const uint8_t * b)
+{
+    int i, j;
+    for (i = 0; i < P256_LIMBS; i++)
+    {
+        r[i] = 0;
+        for (j = 0; j < P256_LIMB_BYTES; j++)
+        {
+            r[i] |= (p256_limb)b[31 - i * P256_LIMB_BYTES - j] << (8 * j);
+        }
+    }
+}
+
+static void vli_to_bytes(uint8_t * b, const p256_limb * a)
+{
+    int i, j;
+    for (i = 0; i < P256_LIMBS; i++)
+    {
+        for (j = 0; j < P256_LIMB_BYTES; j++)
+        {
+            b[31 - i * P256_LIMB_BYTES - j] = a[i] >> (8 * j);
+        }
+    }
+}
+
+// Reduces r once if it is >= m, given r < 2m.
+static void mod_reduce_once(p256_limb * r, p256_limb carry, const p256_modulus * m)
+{
+    p256_limb t[P256_LIMBS];
+    p256_limb borrow = vli_sub(t, r, m->m);
+    vli_cmov(r, t, 0 - (carry | (borrow ^ 1)));
+}
+
+static void mod_add(p256_limb * r, const p256_limb * a, const p256_limb * b, const p256_modulus * m)
+{
+    p256_limb carry = vli_add(r, a, b);
+    mod_reduce_once(r, carry, m);
+}
+
+static void mod_sub(p256_limb * r, const p256_limb * a, const p256_limb * b, const p256_modulus * m)
+{
+    p256_limb t[P256_LIMBS];
+    p256_limb mask = 0 - vli_sub(r, a, b);
+    int i;
+    for (i = 0; i < P256_LIMBS; i++)
+    {
+        t[i] = m->m[i] & mask;
+    }
+    vli_add(r, r, t);
+}
+
+#ifdef P256_MULX
+
+// One row of the product, t += a * b[i], followed by one reduction step,
+// t = (t + q * m) / 2^64.  Carries run in two chains, adcx for the low
+// halves and adox for the high halves.  T0 is zero afterwards and becomes
+// the top word of the next row.
+#define P256_MULX_ACC(src, T0, T1, T2, T3, T4, T5)                          \
+    "xorl %%eax, %%eax\n\t"                                                 \
+    "mulxq 0(" src "), %%rbx, %%rcx\n\t"                                    \
+    "adcxq %%rbx, %%" T0 "\n\t"                                             \
+    "adoxq %%rcx, %%" T1 "\n\t"                                             \
+    "mulxq 8(" src "), %%rbx, %%rcx\n\t"                                    \
+    "adcxq %%rbx, %%" T1 "\n\t"                                             \
+    "adoxq %%rcx, %%" T2 "\n\t"                                             \
+    "mulxq 16(" src "), %%rbx, %%rcx\n\t"                                   \
+    "adcxq %%rbx, %%" T2 "\n\t"                                             \
+    "adoxq %%rcx, %%" T3 "\n\t"                                             \
+    "mulxq 24(" src "), %%rbx, %%rcx\n\t"                                   \
+    "adcxq %%rbx, %%" T3 "\n\t"                                             \
+    "adoxq %%rcx, %%" T4 "\n\t"                                             \
+    "adcxq %%rax, %%" T4 "\n\t"                                             \
+    "adoxq %%rax, %%" T5 "\n\t"                                             \
+    "adcxq %%rax, %%" T5 "\n\t"
+
+#define P256_MULX_ROW(i, T0, T1, T2, T3, T4, T5)                            \
+    "movq " #i "*8(%[b]), %%rdx\n\t"                                        \
+    P256_MULX_ACC("%[a]", T0, T1, T2, T3, T4, T5)                           \
+    "movq %%" T0 ", %%rdx\n\t"                                              \
+    "imulq %c[m0inv](%[m]), %%rdx\n\t"                                      \
+    P256_MULX_ACC("%[m]", T0, T1, T2, T3, T4, T5)
+
+// r = a * b / 2^256 mod m.  r may alias a or b.
+static void mont_mul(p256_limb * r, const p256_limb * a, const p256_limb * b, const p256_modulus * m)
+{
+    p256_limb t[P256_LIMBS + 1];
+
+    __asm__ volatile(
+        "xorl %%r8d, %%r8d\n\t"
+        "xorl %%r9d, %%r9d\n\t"
+        "xorl %%r10d, %%r10d\n\t"
+        "xorl %%r11d, %%r11d\n\t"
+        "xorl %%r12d, %%r12d\n\t"
+        "xorl %%r13d, %%r13d\n\t"
+        P256_MULX_ROW(0, "r8",  "r9",  "r10", "r11", "r12", "r13")
+        P256_MULX_ROW(1, "r9",  "r10", "r11", "r12", "r13", "r8")
+        P256_MULX_ROW(2, "r10", "r11", "r12", "r13", "r8",  "r9")
+        P256_MULX_ROW(3, "r11", "r12", "r13", "r8",  "r9",  "r10")
+        "movq %%r12, 0(%[t])\n\t"
+        "movq %%r13, 8(%[t])\n\t"
+        "movq %%r8, 16(%[t])\n\t"
+        "movq %%r9, 24(%[t])\n\t"
+        "movq %%r10, 32(%[t])\n\t"
+        :
+        : [a] "r" (a), [b] "r" (b), [m] "r" (m), [t] "r" (t),
+          [m0inv] "i" (offsetof(p256_modulus, m0inv))
+        : "rax", "rbx", "rcx", "rdx", "r8", "r9", "r10", "r11", "r12", "r13", "cc", "memory"
+    );
+
+    mod_reduce_once(t, t[P256_LIMBS], m);
+    memmove(r, t, sizeof(p256_limb) * P256_LIMBS);
+}
+
+#else
+
+// r = a * b / 2^256 mod m (CIOS).  r may alias a or b.
+static void mont_mul(p256_limb * r, const p256_limb * a, const p256_limb * b, const p256_modulus * m)
+{
+    p256_limb t[P256_LIMBS + 2];
+    p256_dlimb c;
+    p256_limb q;
+    int i, j;
+
+    memset(t, 0, sizeof(t));
+    for (i = 0; i < P256_LIMBS; i++)
+    {
+        c = 0;
+        for (j = 0; j < P256_LIMBS; j++)
+        {
+            c += (p256_dlimb)a[j] * b[i] + t[j];
+            t[j] = (p256_limb)c;
+            c >>= P256_LIMB_BITS;
+        }
+        c += t[P256_LIMBS];
+        t[P256_LIMBS] = (p256_limb)c;
+        t[P256_LIMBS + 1] = (p256_limb)(c >> P256_LIMB_BITS);
+
+        q = t[0] * m->m0inv;
+        c = ((p256_dlimb)q * m->m[0] + t[0]) >> P256_LIMB_BITS;
+        for (j = 1; j < P256_LIMBS; j++)
+        {
+            c += (p256_dlimb)q * m->m[j] + t[j];
+            t[j - 1] = (p256_limb)c;
+            c >>= P256_LIMB_BITS;
+        }
+        c += t[P256_LIMBS];
+        t[P256_LIMBS - 1] = (p256_limb)c;
+        t[P256_LIMBS] = t[P256_LIMBS + 1] + (p256_limb)(c >> P256_LIMB_BITS);
+    }
+
+    mod_reduce_once(t, t[P256_LIMBS], m);
+    memmove(r, t, sizeof(p256_limb) * P256_LIMBS);
+}
+
+#endif
+
+static void mont_to(p256_limb * r, const p256_limb * a, const p256_modulus * m)
+{
+    mont_mul(r, a, m->rr, m);
+}
+
+static void mont_from(p256_limb * r, const p256_limb * a, const p256_modulus * m)
+{
+    static const p256_limb one[P256_LIMBS] = {1};
+    mont_mul(r, a, one, m);
+}
+
+// r = a^(m-2) = a^-1 mod m with a fixed 4 bit window.  The exponent is public.
+static void mont_inv(p256_limb * r, const p256_limb * a, const p256_modulus * m)
+{
+    p256_limb e[P256_LIMBS];
+    p256_limb two[P256_LIMBS] = {2};
+    p256_limb pow[16][P256_LIMBS];
+    p256_limb t[P256_LIMBS];
+    p256_limb w;
+    int i;
+
+    vli_sub(e, m->m, two);
+    memmove(pow[0], m->one, sizeof(t));
+    memmove(pow[1], a, sizeof(t));
+    for (i = 2; i < 16; i++)
+    {
+        mont_mul(pow[i], pow[i - 1], a, m);
+    }
+
+    memmove(t, m->one, sizeof(t));
+    for (i = 63; i >= 0; i--)
+    {
+        mont_mul(t, t, t, m);
+        mont_mul(t, t, t, m);
+        mont_mul(t, t, t, m);
+        mont_mul(t, t, t, m);
+        w = (e[(4 * i) / P256_LIMB_BITS] >> ((4 * i) % P256_LIMB_BITS)) & 0xf;
+        if (w)
+        {
+            mont_mul(t, t, pow[w], m);
+        }
+    }
+    memmove(r, t, sizeof(t));
+    wipe(pow, sizeof(pow));
+}
+
+#define fe_add(r,a,b)   mod_add(r,a,b,&p256_p)
+#define fe_sub(r,a,b)   mod_sub(r,a,b,&p256_p)
+#define fe_mul(r,a,b)   mont_mul(r,a,b,&p256_p)
+#define fe_sqr(r,a)     mont_mul(r,a,a,&p256_p)
+
+// r = 2a, using dbl-2001-b for a = -3.  r may alias a.
+static void point_double(p256_jacobian * r, const p256_jacobian * a)
+{
+    p256_limb delta[P256_LIMBS], gamma[P256_LIMBS], beta[P256_LIMBS], alpha[P256_LIMBS];
+    p256_limb t[P256_LIMBS], t2[P256_LIMBS];
+
+    fe_sqr(delta, a->z);
+    fe_sqr(gamma, a->y);
+    fe_mul(beta, a->x, gamma);
+
+    fe_sub(t, a->x, delta);
+    fe_add(t2, a->x, delta);
+    fe_mul(alpha, t, t2);
+    fe_add(t, alpha, alpha);
+    fe_add(alpha, t, alpha);
+
+    fe_add(t, a->y, a->z);
+    fe_sqr(t, t);
+    fe_sub(t, t, gamma);
+    fe_sub(r->z, t, delta);
+
+    fe_add(beta, beta, beta);
+    fe_add(beta, beta, beta);
+    fe_sqr(t, alpha);
+    fe_add(t2, beta, beta);
+    fe_sub(r->x, t, t2);
+
+    fe_sub(t, beta, r->x);
+    fe_mul(t, alpha, t);
+    fe_sqr(gamma, gamma);
+    fe_add(gamma, gamma, gamma);
+    fe_add(gamma, gamma, gamma);
+    fe_add(gamma, gamma, gamma);
+    fe_sub(r->y, t, gamma);
+}
+
+// r = a + b using madd-2007-bl.  r may alias a.  Neither input may be the
+// point at infinity.  Returns all ones if a == b, in which case r is invalid
+// and the caller has to double instead.
+static p256_limb point_add_mixed(p256_jacobian * r, const p256_jacobian * a, const p256_affine * b)
+{
+    p256_limb z1z1[P256_LIMBS], h[P256_LIMBS], hh[P256_LIMBS], i[P256_LIMBS];
+    p256_limb j[P256_LIMBS], rr[P256_LIMBS], v[P256_LIMBS], t[P256_LIMBS];
+    p256_limb x3[P256_LIMBS], y3[P256_LIMBS];
+    p256_limb same;
+
+    fe_sqr(z1z1, a->z);
+    fe_mul(h, b->x, z1z1);
+    fe_sub(h, h, a->x);
+    fe_mul(t, a->z, z1z1);
+    fe_mul(t, b->y, t);
+    fe_sub(rr, t, a->y);
+    same = vli_is_zero(h) & vli_is_zero(rr);
+    fe_add(rr, rr, rr);
+
+    fe_sqr(hh, h);
+    fe_add(i, hh, hh);
+    fe_add(i, i, i);
+    fe_mul(j, h, i);
+    fe_mul(v, a->x, i);
+
+    fe_sqr(x3, rr);
+    fe_sub(x3, x3, j);
+    fe_sub(x3, x3, v);
+    fe_sub(x3, x3, v);
+
+    fe_sub(t, v, x3);
+    fe_mul(t, rr, t);
+    fe_mul(y3, a->y, j);
+    fe_add(y3, y3, y3);
+    fe_sub(y3, t, y3);
+
+    fe_add(t, a->z, h);
+    fe_sqr(t, t);
+    fe_sub(t, t, z1z1);
+    fe_sub(r->z, t, hh);
+
+    memmove(r->x, x3, sizeof(x3));
+    memmove(r->y, y3, sizeof(y3));
+    return same;
+}
+
+// Constant time read of comb entry idx (0 selects nothing).
+static void comb_select(p256_affine * r, const p256_affine * table, uint32_t idx)
+{
+    uint32_t i;
+    p256_limb mask;
+    int j;
+    memset(r, 0, sizeof(p256_affine));
+    for (i = 1; i < (1 << P256_COMB_TEETH); i++)
+    {
+        mask = ct_is_zero(i ^ idx);
+        for (j = 0; j < P256_LIMBS; j++)
+        {
+            r->x[j] |= table[i - 1].x[j] & mask;
+            r->y[j] |= table[i - 1].y[j] & mask;
+        }
+    }
+}
+
+// (x, y) = k*G in affine Montgomery form.  k is in normal form.
+// Returns 0 if the result is the point at infinity.
+static int comb_mul(p256_limb * x, p256_limb * y, const p256_limb * k)
+{
+    p256_jacobian acc, sum, prev;
+    p256_affine q;
+    p256_limb inf, same;
+    uint32_t idx, bit;
+    p256_limb zinv[P256_LIMBS], t[P256_LIMBS];
+    int i, j, b;
+
+    memset(&acc, 0, sizeof(acc));
+
+    for (j = P256_COMB_SPACING - 1; j >= 0; j--)
+    {
+        if (j != P256_COMB_SPACING - 1)
+        {
+            point_double(&acc, &acc);
+        }
+        for (b = 0; b < P256_COMB_TABLES; b++)
+        {
+            idx = 0;
+            for (i = 0; i < P256_COMB_TEETH; i++)
+            {
+                bit = (b * P256_COMB_TEETH + i) * P256_COMB_SPACING + j;
+                if (bit < 256)
+                {
+                    idx |= vli_test_bit(k, bit) << i;
+                }
+            }
+
+            comb_select(&q, p256_comb[b], idx);
+            inf = vli_is_zero(acc.z);
+            prev = acc;
+            same = point_add_mixed(&sum, &acc, &q);
+
+            // acc at infinity takes q, idx 0 leaves acc alone.
+            vli_cmov(sum.x, q.x, inf);
+            vli_cmov(sum.y, q.y, inf);
+            vli_cmov(sum.z, p256_p.one, inf);
+            vli_cmov(sum.x, acc.x, ct_is_zero(idx));
+            vli_cmov(sum.y, acc.y, ct_is_zero(idx));
+            vli_cmov(sum.z, acc.z, ct_is_zero(idx));
+            acc = sum;
+
+            // Only reachable for a negligible fraction of scalars.
+            if (same & ~inf & ~ct_is_zero(idx))
+            {
+                point_double(&acc, &prev);
+            }
+        }
+    }
+
+    inf = vli_is_zero(acc.z);
+
+    mont_inv(zinv, acc.z, &p256_p);
+    fe_sqr(t, zinv);
+    fe_mul(x, acc.x, t);
+    fe_mul(t, t, zinv);
+    fe_mul(y, acc.y, t);
+
+    wipe(&acc, sizeof(acc));
+    wipe(&prev, sizeof(prev));
+    wipe(&sum, sizeof(sum));
+    wipe(&q, sizeof(q));
+    return inf == 0;
+}
+
+// Returns 1 if 0 < k < n.
+static int scalar_is_valid(const p256_limb * k)
+{
+    p256_limb t[P256_LIMBS];
+    return (vli_sub(t, k, p256_n.m) & ~vli_is_zero(k)) == 1;
+}
+
+int p256_compute_public_key(const uint8_t * private_key, uint8_t * public_key)
+{
+    p256_limb d[P256_LIMBS], x[P256_LIMBS], y[P256_LIMBS];
+    int ret = 0;
+
+    vli_from_bytes(d, private_key);
+    if (scalar_is_valid(d) && comb_mul(x, y, d))
+    {
+        mont_from(x, x, &p256_p);
+        mont_from(y, y, &p256_p);
+        vli_to_bytes(public_key, x);
+        vli_to_bytes(public_key + 32, y);
+        ret = 1;
+    }
+
+    wipe(d, sizeof(d));
+    return ret;
+}
+
+// r = a + b using add-2007-bl.  r may alias a or b.  Either input may be
+// the point at infinity, but a == b is not handled; the ladder below never
+// adds a point to itself.
+static void point_add(p256_jacobian * r, const p256_jacobian * a, const p256_jacobian * b)
+{
+    p256_limb z1z1[P256_LIMBS], z2z2[P256_LIMBS], u1[P256_LIMBS], u2[P256_LIMBS];
+    p256_limb s1[P256_LIMBS], s2[P256_LIMBS], h[P256_LIMBS], i[P256_LIMBS];
+    p256_limb j[P256_LIMBS], rr[P256_LIMBS], v[P256_LIMBS], t[P256_LIMBS];
+    p256_jacobian sum;
+    p256_limb a_inf = vli_is_zero(a->z);
+    p256_limb b_inf = vli_is_zero(b->z);
+
+    fe_sqr(z1z1, a->z);
+    fe_sqr(z2z2, b->z);
+    fe_mul(u1, a->x, z2z2);
+    fe_mul(u2, b->x, z1z1);
+    fe_mul(t, b->z, z2z2);
+    fe_mul(s1, a->y, t);
+    fe_mul(t, a->z, z1z1);
+    fe_mul(s2, b->y, t);
+
+    fe_sub(h, u2, u1);
+    fe_add(i, h, h);
+    fe_sqr(i, i);
+    fe_mul(j, h, i);
+    fe_sub(rr, s2, s1);
+    fe_add(rr, rr, rr);
+    fe_mul(v, u1, i);
+
+    fe_sqr(sum.x, rr);
+    fe_sub(sum.x, sum.x, j);
+    fe_sub(sum.x, sum.x, v);
+    fe_sub(sum.x, sum.x, v);
+
+    fe_sub(t, v, sum.x);
+    fe_mul(t, rr, t);
+    fe_mul(s1, s1, j);
+    fe_add(s1, s1, s1);
+    fe_sub(sum.y, t, s1);
+
+    fe_add(t, a->z, b->z);
+    fe_sqr(t, t);
+    fe_sub(t, t, z1z1);
+    fe_sub(t, t, z2z2);
+    fe_mul(sum.z, t, h);
+
+    vli_cmov(sum.x, b->x, a_inf);
+    vli_cmov(sum.y, b->y, a_inf);
+    vli_cmov(sum.z, b->z, a_inf);
+    vli_cmov(sum.x, a->x, b_inf);
+    vli_cmov(sum.y, a->y, b_inf);
+    vli_cmov(sum.z, a->z, b_inf);
+    *r = sum;
+}
+
+static void point_cswap(p256_jacobian * a, p256_jacobian * b, p256_limb mask)
+{
+    p256_limb t[P256_LIMBS];
+    memmove(t, a->x, sizeof(t)); vli_cmov(a->x, b->x, mask); vli_cmov(b->x, t, mask);
+    memmove(t, a->y, sizeof(t)); vli_cmov(a->y, b->y, mask); vli_cmov(b->y, t, mask);
+    memmove(t, a->z, sizeof(t)); vli_cmov(a->z, b->z, mask); vli_cmov(b->z, t, mask);
+}
+
+// Returns 1 if (x, y) in Montgomery form is on the curve.
+static int point_is_on_curve(const p256_limb * x, const p256_limb * y)
+{
+    p256_limb lhs[P256_LIMBS], rhs[P256_LIMBS], t[P256_LIMBS];
+
+    fe_sqr(lhs, y);
+
+    fe_sqr(rhs, x);
+    fe_mul(rhs, rhs, x);
+    fe_add(t, x, x);
+    fe_add(t, t, x);
+    fe_sub(rhs, rhs, t);
+    mont_to(t, p256_b, &p256_p);
+    fe_add(rhs, rhs, t);
+
+    vli_sub(t, lhs, rhs);
+    return vli_is_zero(t) != 0;
+}
+
+int p256_shared_secret(const uint8_t * public_key, const uint8_t * private_key, uint8_t * secret)
+{
+    p256_jacobian r0, r1;
+    p256_limb d[P256_LIMBS], k[P256_LIMBS], k2[P256_LIMBS], t[P256_LIMBS];
+    p256_limb zinv[P256_LIMBS], carry, swap;
+    int i, ret = 0;
+
+    vli_from_bytes(r0.x, public_key);
+    vli_from_bytes(r0.y, public_key + 32);
+    vli_from_bytes(d, private_key);
+    if ((vli_sub(t, r0.x, p256_p.m) & vli_sub(t, r0.y, p256_p.m)) != 1 || !scalar_is_valid(d))
+    {
+        goto done;
+    }
+    mont_to(r0.x, r0.x, &p256_p);
+    mont_to(r0.y, r0.y, &p256_p);
+    if (!point_is_on_curve(r0.x, r0.y))
+    {
+        goto done;
+    }
+    memmove(r0.z, p256_p.one, sizeof(r0.z));
+
+    // Ladder over d + n or d + 2n, whichever has bit 256 set, so every
+    // scalar takes the same 256 steps starting from (P, 2P).
+    carry = vli_add(k, d, p256_n.m);
+    vli_add(k2, k, p256_n.m);
+    vli_cmov(k, k2, carry - 1);
+
+    point_double(&r1, &r0);
+    for (i = 255; i >= 0; i--)
+    {
+        swap = 0 - (p256_limb)vli_test_bit(k, i);
+        point_cswap(&r0, &r1, swap);
+        point_add(&r1, &r0, &r1);
+        point_double(&r0, &r0);
+        point_cswap(&r0, &r1, swap);
+    }
+
+    if (!vli_is_zero(r0.z))
+    {
+        mont_inv(zinv, r0.z, &p256_p);
+        fe_sqr(zinv, zinv);
+        fe_mul(t, r0.x, zinv);
+        mont_from(t, t, &p256_p);
+        vli_to_bytes(secret, t);
+        ret = 1;
+    }
+
+done:
+    wipe(&r0, sizeof(r0));
+    wipe(&r1, sizeof(r1));
+    wipe(d, sizeof(d));
+    wipe(k, sizeof(k));
+    wipe(k2, sizeof(k2));
+    return ret;
+}
+
+// Message independent half of an ECDSA signature.
+typedef struct
+{
+    p256_limb kinv[P256_LIMBS];  // k^-1 mod n, Montgomery form
+    p256_limb r[P256_LIMBS];     // x(k*G) mod n
+} p256_presig;
+
+typedef struct
+{
+    uint8_t pub[64];
+    uint8_t priv[32];
+} p256_key_pair;
+
+static p256_presig presig_pool[P256_PRESIGN_POOL];
+static p256_key_pair key_pool[P256_KEY_POOL];
+static int presig_count = 0;
+static int key_count = 0;
+
+static int presign(p256_presig * ps)
+{
+    uint8_t buf[32];
+    p256_limb k[P256_LIMBS], y[P256_LIMBS];
+    int ret = 0;
+
+    if (p256_rng == NULL || !p256_rng(buf, sizeof(buf)))
+    {
+        return 0;
+    }
+
+    vli_from_bytes(k, buf);
+    if (scalar_is_valid(k) && comb_mul(ps->r, y, k))
+    {
+        mont_from(ps->r, ps->r, &p256_p);
+        mod_reduce_once(ps->r, 0, &p256_n);
+        mont_to(k, k, &p256_n);
+        mont_inv(ps->kinv, k, &p256_n);
+        ret = !vli_is_zero(ps->r);
+    }
+
+    wipe(buf, sizeof(buf));
+    wipe(k, sizeof(k));
+    return ret;
+}
+
+// s = k^-1 * (e + r*d) mod n
+static int presig_finish(const p256_limb * d, const p256_limb * e, const p256_presig * ps, uint8_t * signature)
+{
+    p256_limb r[P256_LIMBS], s[P256_LIMBS], t[P256_LIMBS];
+
+    mont_to(r, ps->r, &p256_n);
+    mont_to(s, d, &p256_n);
+    mont_mul(s, r, s, &p256_n);
+    mont_to(t, e, &p256_n);
+    mod_add(s, s, t, &p256_n);
+    mont_mul(s, ps->kinv, s, &p256_n);
+    mont_from(s, s, &p256_n);
+    if (vli_is_zero(s))
+    {
+        return 0;
+    }
+
+    vli_to_bytes(signature, ps->r);
+    vli_to_bytes(signature + 32, s);
+    return 1;
+}
+
+// Removes a presignature from the pool so it can never be used twice.
+static int presig_take(p256_presig * ps)
+{
+    if (presig_count == 0)
+    {
+        return 0;
+    }
+    presig_count--;
+    *ps = presig_pool[presig_count];
+    wipe(&presig_pool[presig_count], sizeof(p256_presig));
+    return 1;
+}
+
+static int make_key(uint8_t * public_key, uint8_t * private_key)
+{
+    int tries;
+
+    if (p256_rng == NULL)
+    {
+        return 0;
+    }
+    for (tries = 0; tries < 64; tries++)
+    {
+        if (!p256_rng(private_key, 32))
+        {
+            break;
+        }
+        if (p256_compute_public_key(private_key, public_key))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int p256_precompute()
+{
+    if (p256_rng == NULL)
+    {
+        return 0;
+    }
+    if (presig_count < P256_PRESIGN_POOL)
+    {
+        if (presign(&presig_pool[presig_count]))
+        {
+            presig_count++;
+        }
+        return 1;
+    }
+    if (key_count < P256_KEY_POOL)
+    {
+        if (make_key(key_pool[key_count].pub, key_pool[key_count].priv))
+        {
+            key_count++;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+int p256_make_key(uint8_t * public_key, uint8_t * private_key)
+{
+    if (key_count > 0)
+    {
+        key_count--;
+        memmove(public_key, key_pool[key_count].pub, 64);
+        memmove(private_key, key_pool[key_count].priv, 32);
+        wipe(&key_pool[key_count], sizeof(p256_key_pair));
+        return 1;
+    }
+    return make_key(public_key, private_key);
+}
+
+int p256_sign(const uint8_t * private_key, const uint8_t * message_hash,
+              unsigned hash_size, uint8_t * signature)
+{
+    uint8_t buf[32];
+    p256_limb d[P256_LIMBS], e[P256_LIMBS];
+    p256_presig ps;
+    int tries;
+    int ret = 0;
+
+    vli_from_bytes(d, private_key);
+    if (!scalar_is_valid(d))
+    {
+        return 0;
+    }
+
+    // bits2int: leftmost 256 bits of the hash, reduced mod n.
+    memset(buf, 0, sizeof(buf));
+    if (hash_size > sizeof(buf))
+    {
+        hash_size = sizeof(buf);
+    }
+    memmove(buf + sizeof(buf) - hash_size, message_hash, hash_size);
+    vli_from_bytes(e, buf);
+    mod_reduce_once(e, 0, &p256_n);
+
+    for (tries = 0; tries < 64 && !ret; tries++)
+    {
+        if (presig_take(&ps) || presign(&ps))
+        {
+            ret = presig_finish(d, e, &ps, signature);
+        }
+        else if (p256_rng == NULL)
+        {
+            break;
+        }
+    }
+
+    wipe(&ps, sizeof(ps));
+    wipe(d, sizeof(d));
+    return ret;
+}
@@ -0,0 +1,69 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  P-256 key generation, ECDSA signing and ECDH.
+ *
+ *  Scalar multiplication of G uses a comb over a table generated at build
+ *  time by tools/gen_p256_table.py (see p256_table.h).  Keys, hashes and
+ *  signatures use the same big endian encoding as micro-ecc, so these can be
+ *  used in place of uECC_compute_public_key and uECC_sign on secp256r1.
+ *
+ *  Signing and key generation draw on a pool of precomputed nonces and key
+ *  pairs when it has entries.  p256_precompute() tops the pool up and is
+ *  meant to be called while the device is idle.  Each entry is removed from
+ *  the pool and wiped before it is used, so it is never used twice.
+ *
+ *  Field arithmetic uses 64 bit limbs on hosts that have a 128 bit integer
+ *  type, and mulx/adcx/adox when built for x86-64 with -mbmi2 -madx.
+ *
+ *  Functions return 1 on success and 0 on failure like micro-ecc.
+ */
+#ifndef _P256_H
+#define _P256_H
+
+#include <stdint.h>
+
+// Same contract as uECC_RNG_Function.
+typedef int (*p256_rng_function)(uint8_t * dest, unsigned size);
+
+void p256_set_rng(p256_rng_function rng);
+
+// public_key = x||y (64 bytes) for private_key (32 bytes).
+// Fails if private_key is not in [1, n-1].
+int p256_compute_public_key(const uint8_t * private_key, uint8_t * public_key);
+
+// Like uECC_make_key.
+int p256_make_key(uint8_t * public_key, uint8_t * private_key);
+
+// ECDSA signature r||s (64 bytes) of message_hash using a random nonce.
+int p256_sign(const uint8_t * private_key, const uint8_t * message_hash,
+              unsigned hash_size, uint8_t * signature);
+
+// ECDH: secret = x coordinate of private_key * public_key (32 bytes), like
+// uECC_shared_secret.  Uses a constant time ladder and rejects points that
+// are not on the curve.
+int p256_shared_secret(const uint8_t * public_key, const uint8_t * private_key, uint8_t * secret);
+
+// Adds one entry to the precomputation pool.  Returns 0 once it is full.
+int p256_precompute();
+
+#endif
@@ -0,0 +1,976 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  secp256k1 with the GLV endomorphism, see secp256k1.h.
+ *
+ *  Field elements are 5 limbs of 52 bits (48 in the top limb) and are kept
+ *  weakly reduced: every operation carries its result so that limbs 0-3 are
+ *  below 2^53 and limb 4 below 2^48, but the value may still be >= p.  fe_normalize() gives the canonical value.  p = 2^256 - 0x1000003d1
+ *  so reduction folds the bits above 2^256 back in with a small multiply.
+ *
+ *  Scalars mod n are 4 limbs of 64 bits in Montgomery form, as in p256.c.
+ */
+#include <string.h>
+#include "secp256k1.h"
+
+#ifdef SECP256K1_AVAILABLE
+
+typedef unsigned __int128 u128;
+
+#define M52     0xfffffffffffffULL
+#define M48     0xffffffffffffULL
+
+// 2^256 mod p, and 2^260 mod p for folding limbs 5-9 onto 0-4
+#define FOLD    0x1000003d1ULL
+#define FOLD4   0x1000003d10ULL
+
+// Signed window width for the GLV halves, the odd multiples per table
+// (1, 3, ... 2^WINDOW - 1) and the digits needed for 129 bit scalars (128
+// plus the skew).
+#define WINDOW          5
+#define TABLE_SIZE      (1 << (WINDOW - 1))
+#define DIGITS          26
+
+// Nonces kept ready by secp256k1_precompute()
+#ifndef SECP256K1_PRESIGN_POOL
+#define SECP256K1_PRESIGN_POOL  4
+#endif
+
+typedef struct
+{
+    uint64_t x[5];
+    uint64_t y[5];
+} secp256k1_affine;
+
+typedef struct
+{
+    uint64_t x[5];
+    uint64_t y[5];
+    uint64_t z[5];      // z == 0 is the point at infinity
+} secp256k1_jacobian;
+
+// 4p, limb by limb, so a - b can be done as a + 4p - b without borrows.
+static const uint64_t fe_4p[5] = {
+    0x3ffffbfffff0bcULL, 0x3ffffffffffffcULL, 0x3ffffffffffffcULL, 0x3ffffffffffffcULL, 0x3fffffffffffcULL,
+};
+
+static const secp256k1_affine secp256k1_g = {
+    {0x2815b16f81798ULL, 0xdb2dce28d959fULL, 0xe870b07029bfcULL, 0xbbac55a06295cULL, 0x079be667ef9dcULL},
+    {0x7d08ffb10d4b8ULL, 0x48a68554199c4ULL, 0xe1108a8fd17b4ULL, 0xc4655da4fbfc0ULL, 0x0483ada7726a3ULL},
+};
+
+// Cube root of unity mod p, lambda*(x, y) = (beta*x, y).
+static const uint64_t glv_beta[5] = {
+    0x96c28719501eeULL, 0x7512f58995c13ULL, 0xc3434e99cf049ULL, 0x07106e64479eaULL, 0x07ae96a2b657cULL,
+};
+
+static const uint64_t sc_n[4] = {
+    0xbfd25e8cd0364141ULL, 0xbaaedce6af48a03bULL, 0xfffffffffffffffeULL, 0xffffffffffffffffULL,
+};
+static const uint64_t sc_rr[4] = {     // 2^512 mod n
+    0x896cf21467d7d140ULL, 0x741496c20e7cf878ULL, 0xe697f5e45bcd07c6ULL, 0x9d671cd581c69bc5ULL,
+};
+static const uint64_t sc_one[4] = {    // 2^256 mod n
+    0x402da1732fc9bebfULL, 0x4551231950b75fc4ULL, 0x0000000000000001ULL, 0x0000000000000000ULL,
+};
+#define SC_N0INV    0x4b0dff665588b13fULL
+
+// Lattice constants for splitting k into k1 + k2*lambda (Gallant, Lambert,
+// Vanstone), with g1 = round(2^384 * b2 / n) and g2 = round(2^384 * -b1 / n).
+static const uint64_t glv_g1[4] = {
+    0xe893209a45dbb031ULL, 0x3daa8a1471e8ca7fULL, 0xe86c90e49284eb15ULL, 0x3086d221a7d46bcdULL,
+};
+static const uint64_t glv_g2[4] = {
+    0x1571b4ae8ac47f71ULL, 0x221208ac9df506c6ULL, 0x6f547fa90abfe4c4ULL, 0xe4437ed6010e8828ULL,
+};
+static const uint64_t glv_minus_b1[4] = {
+    0x6f547fa90abfe4c3ULL, 0xe4437ed6010e8828ULL, 0x0000000000000000ULL, 0x0000000000000000ULL,
+};
+static const uint64_t glv_minus_b2[4] = {
+    0xd765cda83db1562cULL, 0x8a280ac50774346dULL, 0xfffffffffffffffeULL, 0xffffffffffffffffULL,
+};
+static const uint64_t glv_minus_lambda[4] = {
+    0xe0cfc810b51283cfULL, 0xa880b9fc8ec739c2ULL, 0x5ad9e3fd77ed9ba4ULL, 0xac9c52b33fa3cf1fULL,
+};
+
+static secp256k1_rng_function secp256k1_rng = NULL;
+
+void secp256k1_set_rng(secp256k1_rng_function rng)
+{
+    secp256k1_rng = rng;
+}
+
+static void wipe(void * p, unsigned len)
+{
+    volatile uint8_t * b = (volatile uint8_t *)p;
+    while (len--)
+    {
+        *b++ = 0;
+    }
+}
+
+// All ones if a == 0, else 0.
+static uint64_t ct_is_zero(uint64_t a)
+{
+    return ((a | (0 - a)) >> 63) - 1;
+}
+
+/*
+ *  Field arithmetic mod p
+ */
+
+// One carry pass.  Enough for the sum or difference of two weakly reduced
+// values, or one times a small constant, to come back under the bounds.
+static inline void fe_carry(uint64_t * r)
+{
+    r[1] += r[0] >> 52; r[0] &= M52;
+    r[2] += r[1] >> 52; r[1] &= M52;
+    r[3] += r[2] >> 52; r[2] &= M52;
+    r[4] += r[3] >> 52; r[3] &= M52;
+    r[0] += (r[4] >> 48) * FOLD;
+    r[4] &= M48;
+}
+
+// Canonical value in [0, p).
+static void fe_normalize(uint64_t * r)
+{
+    uint64_t t[5], c, mask;
+    int i;
+
+    // Below 2^256 + 2^34 after this.
+    fe_carry(r);
+    fe_carry(r);
+    for (i = 0; i < 4; i++)
+    {
+        r[i + 1] += r[i] >> 52;
+        r[i] &= M52;
+    }
+
+    // r >= p iff r + (2^256 - p) reaches 2^256.
+    c = r[0] + FOLD;
+    t[0] = c & M52;
+    for (i = 1; i < 5; i++)
+    {
+        c = r[i] + (c >> 52);
+        t[i] = c & M52;
+    }
+    mask = 0 - (t[4] >> 48);
+    t[4] &= M48;
+    for (i = 0; i < 5; i++)
+    {
+        r[i] ^= (r[i] ^ t[i]) & mask;
+    }
+}
+
+static void fe_add(uint64_t * r, const uint64_t * a, const uint64_t * b)
+{
+    int i;
+    for (i = 0; i < 5; i++)
+    {
+        r[i] = a[i] + b[i];
+    }
+    fe_carry(r);
+}
+
+static void fe_sub(uint64_t * r, const uint64_t * a, const uint64_t * b)
+{
+    int i;
+    for (i = 0; i < 5; i++)
+    {
+        r[i] = a[i] + fe_4p[i] - b[i];
+    }
+    fe_carry(r);
+}
+
+static void fe_mul_small(uint64_t * r, const uint64_t * a, uint64_t k)
+{
+    int i;
+    for (i = 0; i < 5; i++)
+    {
+        r[i] = a[i] * k;
+    }
+    fe_carry(r);
+}
+
+// Reduces the 9 column sums of a 5x5 limb product into r.  Columns 5-8 are
+// carried down to 52 bits first so that multiplying them by 2^260 mod p
+// can't overflow.
+static inline void fe_reduce(uint64_t * r, u128 t0, u128 t1, u128 t2, u128 t3, u128 t4,
+                             u128 t5, u128 t6, u128 t7, u128 t8)
+{
+    u128 t9;
+
+    t6 += t5 >> 52; t5 &= M52;
+    t7 += t6 >> 52; t6 &= M52;
+    t8 += t7 >> 52; t7 &= M52;
+    t9 = t8 >> 52;  t8 &= M52;
+
+    t0 += t5 * FOLD4;
+    t1 += t6 * FOLD4;
+    t2 += t7 * FOLD4;
+    t3 += t8 * FOLD4;
+    t4 += t9 * FOLD4;
+
+    t1 += t0 >> 52; t0 &= M52;
+    t2 += t1 >> 52; t1 &= M52;
+    t3 += t2 >> 52; t2 &= M52;
+    t4 += t3 >> 52; t3 &= M52;
+    t0 += (t4 >> 48) * FOLD;
+    t4 &= M48;
+    t1 += t0 >> 52; t0 &= M52;
+
+    r[0] = (uint64_t)t0;
+    r[1] = (uint64_t)t1;
+    r[2] = (uint64_t)t2;
+    r[3] = (uint64_t)t3;
+    r[4] = (uint64_t)t4;
+}
+
+// r may alias a or b.
+static void fe_mul(uint64_t * r, const uint64_t * a, const uint64_t * b)
+{
+    uint64_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3], a4 = a[4];
+    uint64_t b0 = b[0], b1 = b[1], b2 = b[2], b3 = b[3], b4 = b[4];
+
+    fe_reduce(r,
+        (u128)a0 * b0,
+        (u128)a0 * b1 + (u128)a1 * b0,
+        (u128)a0 * b2 + (u128)a1 * b1 + (u128)a2 * b0,
+        (u128)a0 * b3 + (u128)a1 * b2 + (u128)a2 * b1 + (u128)a3 * b0,
+        (u128)a0 * b4 + (u128)a1 * b3 + (u128)a2 * b2 + (u128)a3 * b1 + (u128)a4 * b0,
+        (u128)a1 * b4 + (u128)a2 * b3 + (u128)a3 * b2 + (u128)a4 * b1,
+        (u128)a2 * b4 + (u128)a3 * b3 + (u128)a4 * b2,
+        (u128)a3 * b4 + (u128)a4 * b3,
+        (u128)a4 * b4);
+}
+
+static void fe_sqr(uint64_t * r, const uint64_t * a)
+{
+    uint64_t a0 = a[0], a1 = a[1], a2 = a[2], a3 = a[3], a4 = a[4];
+    uint64_t d0 = a0 * 2, d1 = a1 * 2, d2 = a2 * 2, d3 = a3 * 2;
+
+    fe_reduce(r,
+        (u128)a0 * a0,
+        (u128)d0 * a1,
+        (u128)d0 * a2 + (u128)a1 * a1,
+        (u128)d0 * a3 + (u128)d1 * a2,
+        (u128)d0 * a4 + (u128)d1 * a3 + (u128)a2 * a2,
+        (u128)d1 * a4 + (u128)d2 * a3,
+        (u128)d2 * a4 + (u128)a3 * a3,
+        (u128)d3 * a4,
+        (u128)a4 * a4);
+}
+
+static void fe_sqr_n(uint64_t * r, const uint64_t * a, int n)
+{
+    fe_sqr(r, a);
+    while (--n)
+    {
+        fe_sqr(r, r);
+    }
+}
+
+// r = a^(p-2) = a^-1.  Addition chain over the runs of ones in p-2.
+static void fe_inv(uint64_t * r, const uint64_t * a)
+{
+    uint64_t x2[5], x3[5], x6[5], x9[5], x11[5], x22[5], x44[5], x88[5], x176[5], x220[5], x223[5], t[5];
+
+    fe_sqr(x2, a);
+    fe_mul(x2, x2, a);
+    fe_sqr(x3, x2);
+    fe_mul(x3, x3, a);
+    fe_sqr_n(x6, x3, 3);
+    fe_mul(x6, x6, x3);
+    fe_sqr_n(x9, x6, 3);
+    fe_mul(x9, x9, x3);
+    fe_sqr_n(x11, x9, 2);
+    fe_mul(x11, x11, x2);
+    fe_sqr_n(x22, x11, 11);
+    fe_mul(x22, x22, x11);
+    fe_sqr_n(x44, x22, 22);
+    fe_mul(x44, x44, x22);
+    fe_sqr_n(x88, x44, 44);
+    fe_mul(x88, x88, x44);
+    fe_sqr_n(x176, x88, 88);
+    fe_mul(x176, x176, x88);
+    fe_sqr_n(x220, x176, 44);
+    fe_mul(x220, x220, x44);
+    fe_sqr_n(x223, x220, 3);
+    fe_mul(x223, x223, x3);
+
+    fe_sqr_n(t, x223, 23);
+    fe_mul(t, t, x22);
+    fe_sqr_n(t, t, 5);
+    fe_mul(t, t, a);
+    fe_sqr_n(t, t, 3);
+    fe_mul(t, t, x2);
+    fe_sqr_n(t, t, 2);
+    fe_mul(r, t, a);
+}
+
+static uint64_t fe_is_zero(const uint64_t * a)
+{
+    uint64_t t[5];
+    memmove(t, a, sizeof(t));
+    fe_normalize(t);
+    return ct_is_zero(t[0] | t[1] | t[2] | t[3] | t[4]);
+}
+
+// r = mask ? a : r
+static void fe_cmov(uint64_t * r, const uint64_t * a, uint64_t mask)
+{
+    int i;
+    for (i = 0; i < 5; i++)
+    {
+        r[i] ^= (r[i] ^ a[i]) & mask;
+    }
+}
+
+static void fe_to_bytes(uint8_t * b, const uint64_t * a)
+{
+    uint64_t t[5];
+    int i;
+
+    memmove(t, a, sizeof(t));
+    fe_normalize(t);
+    for (i = 0; i < 32; i++)
+    {
+        b[31 - i] = t[(8 * i) / 52] >> ((8 * i) % 52);
+        if ((8 * i) % 52 > 44 && i < 31)
+        {
+            b[31 - i] |= t[(8 * i) / 52 + 1] << (52 - (8 * i) % 52);
+        }
+    }
+}
+
+/*
+ *  Scalar arithmetic mod n
+ */
+
+static uint64_t sc_add_raw(uint64_t * r, const uint64_t * a, const uint64_t * b)
+{
+    u128 c = 0;
+    int i;
+    for (i = 0; i < 4; i++)
+    {
+        c += (u128)a[i] + b[i];
+        r[i] = (uint64_t)c;
+        c >>= 64;
+    }
+    return (uint64_t)c;
+}
+
+static uint64_t sc_sub_raw(uint64_t * r, const uint64_t * a, const uint64_t * b)
+{
+    u128 c = 0;
+    int i;
+    for (i = 0; i < 4; i++)
+    {
+        c = (u128)a[i] - b[i] - c;
+        r[i] = (uint64_t)c;
+        c = (c >> 64) & 1;
+    }
+    return (uint64_t)c;
+}
+
+static void sc_cmov(uint64_t * r, const uint64_t * a, uint64_t mask)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+    {
+        r[i] ^= (r[i] ^ a[i]) & mask;
+    }
+}
+
+// Reduces r once if it is >= n, given r < 2n.
+static void sc_reduce_once(uint64_t * r, uint64_t carry)
+{
+    uint64_t t[4];
+    uint64_t borrow = sc_sub_raw(t, r, sc_n);
+    sc_cmov(r, t, 0 - (carry | (borrow ^ 1)));
+}
+
+static void sc_add(uint64_t * r, const uint64_t * a, const uint64_t * b)
+{
+    sc_reduce_once(r, sc_add_raw(r, a, b));
+}
+
+static uint64_t sc_is_zero(const uint64_t * a)
+{
+    return ct_is_zero(a[0] | a[1] | a[2] | a[3]);
+}
+
+// 1 if 0 < k < n
+static int sc_is_valid(const uint64_t * k)
+{
+    uint64_t t[4];
+    return !sc_is_zero(k) && sc_sub_raw(t, k, sc_n);
+}
+
+static void sc_from_bytes(uint64_t * r, const uint8_t * b)
+{
+    int i, j;
+    for (i = 0; i < 4; i++)
+    {
+        r[i] = 0;
+        for (j = 0; j < 8; j++)
+        {
+            r[i] |= (uint64_t)b[31 - 8 * i - j] << (8 * j);
+        }
+    }
+}
+
+static void sc_to_bytes(uint8_t * b, const uint64_t * a)
+{
+    int i, j;
+    for (i = 0; i < 4; i++)
+    {
+        for (j = 0; j < 8; j++)
+        {
+            b[31 - 8 * i - j] = a[i] >> (8 * j);
+        }
+    }
+}
+
+// r = a * b / 2^256 mod n (CIOS), for a, b < n.  r may alias a or b.
+static void sc_mont_mul(uint64_t * r, const uint64_t * a, const uint64_t * b)
+{
+    uint64_t t[6];
+    u128 c;
+    uint64_t q;
+    int i, j;
+
+    memset(t, 0, sizeof(t));
+    for (i = 0; i < 4; i++)
+    {
+        c = 0;
+        for (j = 0; j < 4; j++)
+        {
+            c += (u128)a[j] * b[i] + t[j];
+            t[j] = (uint64_t)c;
+            c >>= 64;
+        }
+        c += t[4];
+        t[4] = (uint64_t)c;
+        t[5] = (uint64_t)(c >> 64);
+
+        q = t[0] * SC_N0INV;
+        c = ((u128)q * sc_n[0] + t[0]) >> 64;
+        for (j = 1; j < 4; j++)
+        {
+            c += (u128)q * sc_n[j] + t[j];
+            t[j - 1] = (uint64_t)c;
+            c >>= 64;
+        }
+        c += t[4];
+        t[3] = (uint64_t)c;
+        t[4] = t[5] + (uint64_t)(c >> 64);
+    }
+
+    sc_reduce_once(t, t[4]);
+    memmove(r, t, 32);
+}
+
+// r = a * b mod n in normal form.
+static void sc_mul(uint64_t * r, const uint64_t * a, const uint64_t * b)
+{
+    sc_mont_mul(r, a, b);
+    sc_mont_mul(r, r, sc_rr);
+}
+
+// r = a^(n-2) in Montgomery form, a in Montgomery form.  The exponent is public.
+static void sc_mont_inv(uint64_t * r, const uint64_t * a)
+{
+    uint64_t e[4];
+    uint64_t two[4] = {2};
+    uint64_t pow[16][4];
+    uint64_t t[4];
+    uint64_t w;
+    int i;
+
+    sc_sub_raw(e, sc_n, two);
+    memmove(pow[0], sc_one, sizeof(t));
+    memmove(pow[1], a, sizeof(t));
+    for (i = 2; i < 16; i++)
+    {
+        sc_mont_mul(pow[i], pow[i - 1], a);
+    }
+
+    memmove(t, sc_one, sizeof(t));
+    for (i = 63; i >= 0; i--)
+    {
+        sc_mont_mul(t, t, t);
+        sc_mont_mul(t, t, t);
+        sc_mont_mul(t, t, t);
+        sc_mont_mul(t, t, t);
+        w = (e[i / 16] >> ((4 * i) % 64)) & 0xf;
+        if (w)
+        {
+            sc_mont_mul(t, t, pow[w]);
+        }
+    }
+    memmove(r, t, sizeof(t));
+    wipe(pow, sizeof(pow));
+}
+
+/*
+ *  GLV decomposition
+ */
+
+// round(a * b / 2^384)
+static void mul_shift_384(uint64_t * r, const uint64_t * a, const uint64_t * b)
+{
+    uint64_t t[8];
+    u128 c;
+    int i, j;
+
+    memset(t, 0, sizeof(t));
+    for (i = 0; i < 4; i++)
+    {
+        c = 0;
+        for (j = 0; j < 4; j++)
+        {
+            c += (u128)a[i] * b[j] + t[i + j];
+            t[i + j] = (uint64_t)c;
+            c >>= 64;
+        }
+        t[i + 4] = (uint64_t)c;
+    }
+
+    c = (u128)t[6] + (t[5] >> 63);
+    r[0] = (uint64_t)c;
+    r[1] = t[7] + (uint64_t)(c >> 64);
+    r[2] = 0;
+    r[3] = 0;
+    wipe(t, sizeof(t));
+}
+
+// k = k1 + k2 * lambda mod n, with k1 and k2 within 2^128 of 0.
+static void glv_split(uint64_t * k1, uint64_t * k2, const uint64_t * k)
+{
+    uint64_t c1[4], c2[4];
+
+    mul_shift_384(c1, k, glv_g1);
+    mul_shift_384(c2, k, glv_g2);
+    sc_mul(c1, c1, glv_minus_b1);
+    sc_mul(c2, c2, glv_minus_b2);
+    sc_add(k2, c1, c2);
+    sc_mul(k1, k2, glv_minus_lambda);
+    sc_add(k1, k1, k);
+
+    wipe(c1, sizeof(c1));
+    wipe(c2, sizeof(c2));
+}
+
+// Splits k into |k| < 2^128 and a sign mask (all ones if negative).
+static uint64_t sc_abs_half(uint64_t * k)
+{
+    uint64_t t[4];
+    uint64_t neg = ~ct_is_zero(k[2] | k[3]);
+    sc_sub_raw(t, sc_n, k);
+    sc_cmov(k, t, neg);
+    return neg;
+}
+
+// Regular signed recoding: k = sum digits[i] * 2^(WINDOW*i), every digit odd
+// and |digit| < 2^WINDOW.  k is made odd first and the 1 added is returned
+// as a mask so the caller can take it back off.
+static uint64_t recode(int8_t * digits, const uint64_t * k)
+{
+    uint64_t a[3];
+    uint64_t skew = (k[0] & 1) ^ 1;
+    u128 c;
+    int i;
+
+    c = (u128)k[0] + skew;
+    a[0] = (uint64_t)c;
+    c = (u128)k[1] + (uint64_t)(c >> 64);
+    a[1] = (uint64_t)c;
+    a[2] = (uint64_t)(c >> 64);
+
+    for (i = 0; i < DIGITS - 1; i++)
+    {
+        digits[i] = (int8_t)((int)(a[0] & ((2 << WINDOW) - 1)) - (1 << WINDOW));
+        a[0] = (a[0] & ~(uint64_t)((2 << WINDOW) - 1)) | (1 << WINDOW);
+        a[0] = (a[0] >> WINDOW) | (a[1] << (64 - WINDOW));
+        a[1] = (a[1] >> WINDOW) | (a[2] << (64 - WINDOW));
+        a[2] >>= WINDOW;
+    }
+    digits[DIGITS - 1] = (int8_t)a[0];
+
+    wipe(a, sizeof(a));
+    return 0 - skew;
+}
+
+/*
+ *  Points, a = 0
+ */
+
+// r = 2a, dbl-2009-l.  r may alias a.
+static void point_double(secp256k1_jacobian * r, const secp256k1_jacobian * a)
+{
+    uint64_t A[5], B[5], C[5], D[5], E[5], F[5], t[5];
+
+    fe_sqr(A, a->x);
+    fe_sqr(B, a->y);
+    fe_sqr(C, B);
+
+    fe_add(t, a->x, B);
+    fe_sqr(t, t);
+    fe_sub(t, t, A);
+    fe_sub(t, t, C);
+    fe_add(D, t, t);
+
+    fe_mul_small(E, A, 3);
+    fe_sqr(F, E);
+
+    fe_mul(r->z, a->y, a->z);
+    fe_add(r->z, r->z, r->z);
+
+    fe_sub(r->x, F, D);
+    fe_sub(r->x, r->x, D);
+
+    fe_sub(t, D, r->x);
+    fe_mul(t, E, t);
+    fe_mul_small(C, C, 8);
+    fe_sub(r->y, t, C);
+}
+
+// r = a + b, madd-2007-bl.  r may alias a.  a at infinity is handled in
+// constant time.  a == b only happens for scalars an attacker can't pick, and
+// falls back to point_double.
+static void point_add_mixed(secp256k1_jacobian * r, const secp256k1_jacobian * a, const secp256k1_affine * b)
+{
+    static const uint64_t one[5] = {1};
+    uint64_t z1z1[5], u2[5], s2[5], h[5], hh[5], i[5], j[5], rr[5], v[5], t[5];
+    secp256k1_jacobian out;
+    uint64_t inf = fe_is_zero(a->z);
+
+    fe_sqr(z1z1, a->z);
+    fe_mul(u2, b->x, z1z1);
+    fe_mul(s2, b->y, a->z);
+    fe_mul(s2, s2, z1z1);
+    fe_sub(h, u2, a->x);
+    fe_sub(rr, s2, a->y);
+
+    if (~inf & fe_is_zero(h) & fe_is_zero(rr))
+    {
+        point_double(r, a);
+        return;
+    }
+
+    fe_sqr(hh, h);
+    fe_mul_small(i, hh, 4);
+    fe_mul(j, h, i);
+    fe_add(rr, rr, rr);
+    fe_mul(v, a->x, i);
+
+    fe_sqr(out.x, rr);
+    fe_sub(out.x, out.x, j);
+    fe_sub(out.x, out.x, v);
+    fe_sub(out.x, out.x, v);
+
+    fe_sub(t, v, out.x);
+    fe_mul(t, rr, t);
+    fe_mul(out.y, a->y, j);
+    fe_add(out.y, out.y, out.y);
+    fe_sub(out.y, t, out.y);
+
+    fe_add(out.z, a->z, h);
+    fe_sqr(out.z, out.z);
+    fe_sub(out.z, out.z, z1z1);
+    fe_sub(out.z, out.z, hh);
+
+    fe_cmov(out.x, b->x, inf);
+    fe_cmov(out.y, b->y, inf);
+    fe_cmov(out.z, one, inf);
+    *r = out;
+}
+
+static void point_to_affine(uint64_t * x, uint64_t * y, const secp256k1_jacobian * a)
+{
+    uint64_t zi[5], zi2[5];
+
+    fe_inv(zi, a->z);
+    fe_sqr(zi2, zi);
+    fe_mul(x, a->x, zi2);
+    fe_mul(zi2, zi2, zi);
+    fe_mul(y, a->y, zi2);
+    fe_normalize(x);
+    fe_normalize(y);
+}
+
+// Odd multiples 1G, 3G, ... of G and of lambda*G, built on first use.
+static secp256k1_affine table_g[TABLE_SIZE];
+static secp256k1_affine table_lambda_g[TABLE_SIZE];
+static int tables_ready = 0;
+
+static void build_tables()
+{
+    secp256k1_jacobian p, g2;
+    secp256k1_affine two_g;
+    int i;
+
+    memmove(p.x, secp256k1_g.x, sizeof(p.x));
+    memmove(p.y, secp256k1_g.y, sizeof(p.y));
+    memset(p.z, 0, sizeof(p.z));
+    p.z[0] = 1;
+    point_double(&g2, &p);
+    point_to_affine(two_g.x, two_g.y, &g2);
+
+    table_g[0] = secp256k1_g;
+    for (i = 1; i < TABLE_SIZE; i++)
+    {
+        point_add_mixed(&p, &p, &two_g);
+        point_to_affine(table_g[i].x, table_g[i].y, &p);
+    }
+    for (i = 0; i < TABLE_SIZE; i++)
+    {
+        fe_mul(table_lambda_g[i].x, table_g[i].x, glv_beta);
+        fe_normalize(table_lambda_g[i].x);
+        memmove(table_lambda_g[i].y, table_g[i].y, sizeof(table_g[i].y));
+    }
+    tables_ready = 1;
+}
+
+// r = digit * T, negated again if neg.  Reads every entry.
+static void table_select(secp256k1_affine * r, const secp256k1_affine * table, int digit, uint64_t neg)
+{
+    uint64_t y[5];
+    int sign = digit >> 31;
+    uint64_t idx = (uint64_t)(((digit ^ sign) - sign) >> 1);
+    uint64_t mask;
+    int i;
+
+    memset(r, 0, sizeof(secp256k1_affine));
+    for (i = 0; i < TABLE_SIZE; i++)
+    {
+        mask = ct_is_zero(idx ^ i);
+        fe_cmov(r->x, table[i].x, mask);
+        fe_cmov(r->y, table[i].y, mask);
+    }
+    fe_sub(y, fe_4p, r->y);
+    fe_cmov(r->y, y, ((uint64_t)(int64_t)sign) ^ neg);
+}
+
+// (x, y) = k*G for 0 < k < n, coordinates as canonical field elements.
+static void mul_g(uint64_t * x, uint64_t * y, const uint64_t * k)
+{
+    uint64_t k1[4], k2[4];
+    int8_t d1[DIGITS], d2[DIGITS];
+    uint64_t neg1, neg2, skew1, skew2;
+    secp256k1_jacobian q, q2;
+    secp256k1_affine t;
+    int i, j;
+
+    if (!tables_ready)
+    {
+        build_tables();
+    }
+
+    glv_split(k1, k2, k);
+    neg1 = sc_abs_half(k1);
+    neg2 = sc_abs_half(k2);
+    skew1 = recode(d1, k1);
+    skew2 = recode(d2, k2);
+
+    memset(&q, 0, sizeof(q));
+    for (i = DIGITS - 1; i >= 0; i--)
+    {
+        for (j = 0; j < WINDOW && i != DIGITS - 1; j++)
+        {
+            point_double(&q, &q);
+        }
+        table_select(&t, table_g, d1[i], neg1);
+        point_add_mixed(&q, &q, &t);
+        table_select(&t, table_lambda_g, d2[i], neg2);
+        point_add_mixed(&q, &q, &t);
+    }
+
+    // Take off the skew: add -(+-G) where it was added.
+    table_select(&t, table_g, -1, neg1);
+    point_add_mixed(&q2, &q, &t);
+    fe_cmov(q.x, q2.x, skew1);
+    fe_cmov(q.y, q2.y, skew1);
+    fe_cmov(q.z, q2.z, skew1);
+
+    table_select(&t, table_lambda_g, -1, neg2);
+    point_add_mixed(&q2, &q, &t);
+    fe_cmov(q.x, q2.x, skew2);
+    fe_cmov(q.y, q2.y, skew2);
+    fe_cmov(q.z, q2.z, skew2);
+
+    point_to_affine(x, y, &q);
+
+    wipe(k1, sizeof(k1));
+    wipe(k2, sizeof(k2));
+    wipe(d1, sizeof(d1));
+    wipe(d2, sizeof(d2));
+    wipe(&q, sizeof(q));
+    wipe(&q2, sizeof(q2));
+}
+
+int secp256k1_compute_public_key(const uint8_t * private_key, uint8_t * public_key)
+{
+    uint64_t d[4], x[5], y[5];
+
+    sc_from_bytes(d, private_key);
+    if (!sc_is_valid(d))
+    {
+        return 0;
+    }
+    mul_g(x, y, d);
+    fe_to_bytes(public_key, x);
+    fe_to_bytes(public_key + 32, y);
+    wipe(d, sizeof(d));
+    return 1;
+}
+
+/*
+ *  ECDSA
+ */
+
+// Message independent half of a signature.
+typedef struct
+{
+    uint64_t kinv[4];   // k^-1 mod n, Montgomery form
+    uint64_t r[4];      // x(k*G) mod n
+} secp256k1_presig;
+
+static secp256k1_presig presig_pool[SECP256K1_PRESIGN_POOL];
+static int presig_count = 0;
+
+static int presign(secp256k1_presig * ps)
+{
+    uint8_t buf[32];
+    uint64_t k[4], x[5], y[5];
+    int ret = 0;
+
+    if (secp256k1_rng == NULL || !secp256k1_rng(buf, sizeof(buf)))
+    {
+        return 0;
+    }
+
+    sc_from_bytes(k, buf);
+    if (sc_is_valid(k))
+    {
+        mul_g(x, y, k);
+        fe_to_bytes(buf, x);
+        sc_from_bytes(ps->r, buf);
+        sc_reduce_once(ps->r, 0);
+        sc_mont_mul(k, k, sc_rr);
+        sc_mont_inv(ps->kinv, k);
+        ret = !sc_is_zero(ps->r);
+    }
+
+    wipe(buf, sizeof(buf));
+    wipe(k, sizeof(k));
+    return ret;
+}
+
+// s = k^-1 * (e + r*d) mod n
+static int presig_finish(const uint64_t * d, const uint64_t * e, const secp256k1_presig * ps, uint8_t * signature)
+{
+    uint64_t s[4];
+
+    sc_mul(s, ps->r, d);
+    sc_add(s, s, e);
+    sc_mont_mul(s, ps->kinv, s);
+    if (sc_is_zero(s))
+    {
+        return 0;
+    }
+
+    sc_to_bytes(signature, ps->r);
+    sc_to_bytes(signature + 32, s);
+    return 1;
+}
+
+// Removes a presignature from the pool so it can never be used twice.
+static int presig_take(secp256k1_presig * ps)
+{
+    if (presig_count == 0)
+    {
+        return 0;
+    }
+    presig_count--;
+    *ps = presig_pool[presig_count];
+    wipe(&presig_pool[presig_count], sizeof(secp256k1_presig));
+    return 1;
+}
+
+int secp256k1_precompute()
+{
+    if (secp256k1_rng == NULL || presig_count == SECP256K1_PRESIGN_POOL)
+    {
+        return 0;
+    }
+    if (presign(&presig_pool[presig_count]))
+    {
+        presig_count++;
+    }
+    return 1;
+}
+
+int secp256k1_sign(const uint8_t * private_key, const uint8_t * message_hash,
+                   unsigned hash_size, uint8_t * signature)
+{
+    uint8_t buf[32];
+    uint64_t d[4], e[4];
+    secp256k1_presig ps;
+    int tries;
+    int ret = 0;
+
+    sc_from_bytes(d, private_key);
+    if (!sc_is_valid(d))
+    {
+        return 0;
+    }
+
+    // bits2int: leftmost 256 bits of the hash, reduced mod n.
+    memset(buf, 0, sizeof(buf));
+    if (hash_size > sizeof(buf))
+    {
+        hash_size = sizeof(buf);
+    }
+    memmove(buf + sizeof(buf) - hash_size, message_hash, hash_size);
+    sc_from_bytes(e, buf);
+    sc_reduce_once(e, 0);
+
+    for (tries = 0; tries < 64 && !ret; tries++)
+    {
+        if (presig_take(&ps) || presign(&ps))
+        {
+            ret = presig_finish(d, e, &ps, signature);
+        }
+        else if (secp256k1_rng == NULL)
+        {
+            break;
+        }
+    }
+
+    wipe(&ps, sizeof(ps));
+    wipe(d, sizeof(d));
+    return ret;
+}
+
+#endif
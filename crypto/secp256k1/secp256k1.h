@@ -0,0 +1,64 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  secp256k1 key derivation and ECDSA signing for the wallet extension.
+ *
+ *  k*G is split with the GLV endomorphism into two 128 bit halves,
+ *  k = k1 + k2*lambda, which are recoded into signed 5 bit windows and
+ *  evaluated together against tables of odd multiples of G and
+ *  lambda*G = (beta*x, y).  The recoding is regular and the table lookups
+ *  scan every entry, so the timing does not depend on the nonce.
+ *
+ *  Field elements use 5x52 bit limbs, so the module needs a 128 bit integer
+ *  type (64 bit hosts).  SECP256K1_AVAILABLE is defined when it is built.
+ *
+ *  As with p256.h, signing draws on a pool of precomputed nonces that
+ *  secp256k1_precompute() fills while idle, encodings match micro-ecc and
+ *  functions return 1 on success and 0 on failure.
+ */
+#ifndef _SECP256K1_H
+#define _SECP256K1_H
+
+#include <stdint.h>
+
+#ifdef __SIZEOF_INT128__
+#define SECP256K1_AVAILABLE
+#endif
+
+// Same contract as uECC_RNG_Function.
+typedef int (*secp256k1_rng_function)(uint8_t * dest, unsigned size);
+
+void secp256k1_set_rng(secp256k1_rng_function rng);
+
+// public_key = x||y (64 bytes) for private_key (32 bytes).
+// Fails if private_key is not in [1, n-1].
+int secp256k1_compute_public_key(const uint8_t * private_key, uint8_t * public_key);
+
+// ECDSA signature r||s (64 bytes) of message_hash using a random nonce,
+// like uECC_sign.  s is not normalized to the lower half.
+int secp256k1_sign(const uint8_t * private_key, const uint8_t * message_hash,
+                   unsigned hash_size, uint8_t * signature);
+
+// Adds one nonce to the precomputation pool.  Returns 0 once it is full.
+int secp256k1_precompute();
+
+#endif
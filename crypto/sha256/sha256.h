@@ -29,6 +29,7 @@ typedef struct {
 /*********************** FUNCTION DECLARATIONS **********************/
 void sha256_init(SHA256_CTX *ctx);
 void sha256_update(SHA256_CTX *ctx, const BYTE data[], size_t len);
+void sha256_transform(SHA256_CTX *ctx, const BYTE data[]);
 void sha256_final(SHA256_CTX *ctx, BYTE hash[]);
 
 #endif   // SHA256_H
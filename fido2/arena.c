@@ -0,0 +1,70 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdint.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "log.h"
+
+#define ARENA_ALIGN     8
+
+static uint64_t arena[(ARENA_SIZE + 7) / 8];
+static size_t arena_top = 0;
+static size_t arena_high = 0;
+
+void * arena_alloc(size_t size)
+{
+    size_t start = arena_top;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (size > sizeof(arena) - start)
+    {
+        printf2(TAG_ERR, "arena: %d bytes requested, %d of %d free\n",
+                (int)size, (int)(sizeof(arena) - start), (int)sizeof(arena));
+        return NULL;
+    }
+
+    arena_top += size;
+    if (arena_top > arena_high)
+    {
+        arena_high = arena_top;
+    }
+    return (uint8_t *)arena + start;
+}
+
+size_t arena_mark()
+{
+    return arena_top;
+}
+
+void arena_release(size_t mark)
+{
+    if (mark <= arena_top)
+    {
+        arena_top = mark;
+    }
+}
+
+size_t arena_peak()
+{
+    return arena_high;
+}
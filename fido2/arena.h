@@ -0,0 +1,55 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Bump allocator for memory that only lives as long as one request.
+ *
+ *  The large per-command structures (parsed requests, the response buffer,
+ *  authenticator data) are taken from a fixed static arena instead of the
+ *  stack, so the peak is bounded by ARENA_SIZE and can be measured.
+ *  Allocations are released in LIFO order with arena_mark/arena_release;
+ *  ctap_request releases everything it allocated before returning.
+ */
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Budget in bytes, override per target.  The default fits the response
+// buffer plus the largest command with some room to spare.
+#ifndef ARENA_SIZE
+#define ARENA_SIZE      2560
+#endif
+
+// Returns size bytes aligned for any type, or NULL if the budget would be
+// exceeded.  The memory is not cleared.
+void * arena_alloc(size_t size);
+
+size_t arena_mark();
+
+// Frees everything allocated since mark was taken.
+void arena_release(size_t mark);
+
+// Highest number of bytes in use since boot.
+size_t arena_peak();
+
+#endif
@@ -31,7 +31,12 @@
 #define COSE_KEY_KTY_EC2        2
 #define COSE_KEY_CRV_P256       1
 
+#define COSE_KEY_KTY_OKP        1
+#define COSE_KEY_CRV_ED25519    6
+
 
 #define COSE_ALG_ES256              -7
+#define COSE_ALG_EDDSA              -8
+#define COSE_ALG_ECDH_ES_HKDF_256   -25
 
 #endif
@@ -10,6 +10,7 @@
 
 #include "util.h"
 #include "crypto.h"
+#include "crypto_backend.h"
 
 #ifdef USE_SOFTWARE_IMPLEMENTATION
 
@@ -19,6 +20,19 @@
 #include "ctap.h"
 #include "device.h"
 #include "app.h"
+#include "probes.h"
+#include "profile.h"
+
+#ifdef ENABLE_P256_COMB
+#include "p256.h"
+#endif
+
+#ifdef ENABLE_SECP256K1_GLV
+#include "secp256k1.h"
+#ifndef SECP256K1_AVAILABLE
+#undef ENABLE_SECP256K1_GLV
+#endif
+#endif
 
 #ifdef USING_PC
 typedef enum
@@ -47,10 +61,10 @@ const uint16_t attestation_key_size;
 
 
 
-static SHA256_CTX sha256_ctx;
 static const struct uECC_Curve_t * _es256_curve = NULL;
 static const uint8_t * _signing_key = NULL;
 static int _key_len = 0;
+static const crypto_backend * backend = &crypto_backend_soft;
 
 // Secrets for testing only
 static uint8_t master_secret[32] = "\x00\x11\x22\x33\x44\x55\x66\x77\x88\x99\xaa\xbb\xcc\xdd\xee\xff"
@@ -63,7 +77,7 @@ static uint8_t transport_secret[32] = "\x10\x01\x22\x33\x44\x55\x66\x77\x87\x90\
 
 void crypto_sha256_init()
 {
-    sha256_init(&sha256_ctx);
+    backend->sha256_init();
 }
 
 void crypto_reset_master_secret()
@@ -74,17 +88,17 @@ void crypto_reset_master_secret()
 
 void crypto_sha256_update(uint8_t * data, size_t len)
 {
-    sha256_update(&sha256_ctx, data, len);
+    backend->sha256_update(data, len);
 }
 
 void crypto_sha256_update_secret()
 {
-    sha256_update(&sha256_ctx, master_secret, 32);
+    backend->sha256_update(master_secret, 32);
 }
 
 void crypto_sha256_final(uint8_t * hash)
 {
-    sha256_final(&sha256_ctx, hash);
+    backend->sha256_final(hash);
 }
 
 void crypto_sha256_hmac_init(uint8_t * key, uint32_t klen, uint8_t * hmac)
@@ -147,13 +161,31 @@ void crypto_sha256_hmac_final(uint8_t * key, uint32_t klen, uint8_t * hmac)
     crypto_sha256_final(hmac);
 }
 
+void crypto_sha256_compress(uint32_t * state, const uint8_t * block)
+{
+    backend->sha256_compress(state, block);
+}
+
 
 void crypto_ecc256_init()
 {
     uECC_set_rng((uECC_RNG_Function)ctap_generate_rng);
     _es256_curve = uECC_secp256r1();
+#ifdef ENABLE_P256_COMB
+    p256_set_rng((p256_rng_function)ctap_generate_rng);
+#endif
+#ifdef ENABLE_SECP256K1_GLV
+    secp256k1_set_rng((secp256k1_rng_function)ctap_generate_rng);
+#endif
+#ifdef USING_PC
+    backend = crypto_backend_select();
+#endif
 }
 
+const crypto_backend * crypto_backend_current()
+{
+    return backend;
+}
 
 void crypto_ecc256_load_attestation_key()
 {
@@ -163,11 +195,15 @@ void crypto_ecc256_load_attestation_key()
 
 void crypto_ecc256_sign(uint8_t * data, int len, uint8_t * sig)
 {
-    if ( uECC_sign(_signing_key, data, len, sig, _es256_curve) == 0)
+    PROBE1(crypto_start, PROBE_CRYPTO_SIGN);
+    PROFILE_BEGIN(PROFILE_ECC_SIGN);
+    if ( backend->ecc256_sign(_signing_key, data, len, sig) == 0)
     {
-        printf("error, uECC failed\n");
+        printf("error, %s sign failed\n", backend->name);
         exit(1);
     }
+    PROFILE_END(PROFILE_ECC_SIGN);
+    PROBE1(crypto_done, PROBE_CRYPTO_SIGN);
 }
 
 void crypto_ecc256_load_key(uint8_t * data, int len, uint8_t * data2, int len2)
@@ -183,6 +219,9 @@ void crypto_ecdsa_sign(uint8_t * data, int len, uint8_t * sig, int MBEDTLS_ECP_I
 
     const struct uECC_Curve_t * curve = NULL;
 
+    PROBE1(crypto_start, PROBE_CRYPTO_ECDSA_SIGN);
+    PROFILE_BEGIN(PROFILE_ECC_SIGN);
+
     switch(MBEDTLS_ECP_ID)
     {
         case MBEDTLS_ECP_DP_SECP192R1:
@@ -206,11 +245,27 @@ void crypto_ecdsa_sign(uint8_t * data, int len, uint8_t * sig, int MBEDTLS_ECP_I
             exit(1);
     }
 
+#ifdef ENABLE_SECP256K1_GLV
+    if (MBEDTLS_ECP_ID == MBEDTLS_ECP_DP_SECP256K1)
+    {
+        if ( secp256k1_sign(_signing_key, data, len, sig) == 0)
+        {
+            printf("error, secp256k1 sign failed\n");
+            exit(1);
+        }
+        PROFILE_END(PROFILE_ECC_SIGN);
+        PROBE1(crypto_done, PROBE_CRYPTO_ECDSA_SIGN);
+        return;
+    }
+#endif
+
     if ( uECC_sign(_signing_key, data, len, sig, curve) == 0)
     {
         printf("error, uECC failed\n");
         exit(1);
     }
+    PROFILE_END(PROFILE_ECC_SIGN);
+    PROBE1(crypto_done, PROBE_CRYPTO_ECDSA_SIGN);
     return;
 
 fail:
@@ -235,12 +290,14 @@ void crypto_ecc256_derive_public_key(uint8_t * data, int len, uint8_t * x, uint8
     uint8_t privkey[32];
     uint8_t pubkey[64];
 
+    PROBE1(crypto_start, PROBE_CRYPTO_DERIVE);
     generate_private_key(data,len,NULL,0,privkey);
 
     memset(pubkey,0,sizeof(pubkey));
-    uECC_compute_public_key(privkey, pubkey, _es256_curve);
+    backend->ecc256_compute_public_key(privkey, pubkey);
     memmove(x,pubkey,32);
     memmove(y,pubkey+32,32);
+    PROBE1(crypto_done, PROBE_CRYPTO_DERIVE);
 }
 
 void crypto_load_external_key(uint8_t * key, int len)
@@ -252,67 +309,199 @@ void crypto_load_external_key(uint8_t * key, int len)
 
 void crypto_ecc256_make_key_pair(uint8_t * pubkey, uint8_t * privkey)
 {
-    if (uECC_make_key(pubkey, privkey, _es256_curve) != 1)
+    PROBE1(crypto_start, PROBE_CRYPTO_MAKE_KEY);
+    if (backend->ecc256_make_key(pubkey, privkey) != 1)
     {
-        printf("Error, uECC_make_key failed\n");
+        printf("Error, %s make_key failed\n", backend->name);
         exit(1);
     }
+    PROBE1(crypto_done, PROBE_CRYPTO_MAKE_KEY);
 }
 
-void crypto_ecc256_shared_secret(const uint8_t * pubkey, const uint8_t * privkey, uint8_t * shared_secret)
+int crypto_ecc256_precompute()
 {
-    if (uECC_shared_secret(pubkey, privkey, shared_secret, _es256_curve) != 1)
+#ifdef ENABLE_P256_COMB
+    if (backend == &crypto_backend_soft && p256_precompute())
     {
-        printf("Error, uECC_shared_secret failed\n");
-        exit(1);
+        return 1;
     }
+#endif
+#ifdef ENABLE_SECP256K1_GLV
+    return secp256k1_precompute();
+#else
+    return 0;
+#endif
+}
 
+int crypto_ecc256_shared_secret(const uint8_t * pubkey, const uint8_t * privkey, uint8_t * shared_secret)
+{
+    int ret;
+    PROBE1(crypto_start, PROBE_CRYPTO_SHARED_SECRET);
+    ret = backend->ecc256_shared_secret(pubkey, privkey, shared_secret);
+    if (ret != 1)
+    {
+        printf("Error, %s shared_secret failed\n", backend->name);
+    }
+    PROBE1(crypto_done, PROBE_CRYPTO_SHARED_SECRET);
+    return ret == 1;
 }
 
-struct AES_ctx aes_ctx;
 void crypto_aes256_init(uint8_t * key, uint8_t * nonce)
 {
     if (key == CRYPTO_TRANSPORT_KEY)
     {
-        AES_init_ctx(&aes_ctx, transport_secret);
-    }
-    else
-    {
-        AES_init_ctx(&aes_ctx, key);
-    }
-    if (nonce == NULL)
-    {
-        memset(aes_ctx.Iv, 0, 16);
-    }
-    else
-    {
-        memmove(aes_ctx.Iv, nonce, 16);
+        key = transport_secret;
     }
+    backend->aes256_init(key, nonce);
 }
 
 // prevent round key recomputation
 void crypto_aes256_reset_iv(uint8_t * nonce)
 {
-    if (nonce == NULL)
+    backend->aes256_reset_iv(nonce);
+}
+
+void crypto_aes256_decrypt(uint8_t * buf, int length)
+{
+    PROFILE_BEGIN(PROFILE_AES);
+    backend->aes256_decrypt(buf, length);
+    PROFILE_END(PROFILE_AES);
+}
+
+void crypto_aes256_encrypt(uint8_t * buf, int length)
+{
+    PROFILE_BEGIN(PROFILE_AES);
+    backend->aes256_encrypt(buf, length);
+    PROFILE_END(PROFILE_AES);
+}
+
+
+/*
+ * Software backend: crypto/sha256, tiny-AES and micro-ecc, with the P-256
+ * comb and ladder when they are enabled.
+ */
+
+static SHA256_CTX sha256_ctx;
+struct AES_ctx aes_ctx;
+
+static int soft_init()
+{
+    return 1;
+}
+
+static void soft_sha256_init()
+{
+    sha256_init(&sha256_ctx);
+}
+
+static void soft_sha256_update(const uint8_t * data, size_t len)
+{
+    sha256_update(&sha256_ctx, data, len);
+}
+
+static void soft_sha256_final(uint8_t * hash)
+{
+    sha256_final(&sha256_ctx, hash);
+}
+
+static void soft_sha256_compress(uint32_t * state, const uint8_t * block)
+{
+    SHA256_CTX ctx;
+
+    memmove(ctx.state, state, 32);
+    sha256_transform(&ctx, block);
+    memmove(state, ctx.state, 32);
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+static void soft_aes256_reset_iv(const uint8_t * iv)
+{
+    if (iv == NULL)
     {
         memset(aes_ctx.Iv, 0, 16);
     }
     else
     {
-        memmove(aes_ctx.Iv, nonce, 16);
+        memmove(aes_ctx.Iv, iv, 16);
     }
 }
 
-void crypto_aes256_decrypt(uint8_t * buf, int length)
+static void soft_aes256_init(const uint8_t * key, const uint8_t * iv)
 {
-    AES_CBC_decrypt_buffer(&aes_ctx, buf, length);
+    AES_init_ctx(&aes_ctx, key);
+    soft_aes256_reset_iv(iv);
 }
 
-void crypto_aes256_encrypt(uint8_t * buf, int length)
+static void soft_aes256_encrypt(uint8_t * buf, int len)
+{
+    AES_CBC_encrypt_buffer(&aes_ctx, buf, len);
+}
+
+static void soft_aes256_decrypt(uint8_t * buf, int len)
+{
+    AES_CBC_decrypt_buffer(&aes_ctx, buf, len);
+}
+
+static int soft_ecc256_compute_public_key(const uint8_t * privkey, uint8_t * pubkey)
+{
+#ifdef ENABLE_P256_COMB
+    return p256_compute_public_key(privkey, pubkey);
+#else
+    return uECC_compute_public_key(privkey, pubkey, uECC_secp256r1());
+#endif
+}
+
+static int soft_ecc256_make_key(uint8_t * pubkey, uint8_t * privkey)
 {
-    AES_CBC_encrypt_buffer(&aes_ctx, buf, length);
+#ifdef ENABLE_P256_COMB
+    return p256_make_key(pubkey, privkey);
+#else
+    return uECC_make_key(pubkey, privkey, uECC_secp256r1());
+#endif
 }
 
+static int soft_ecc256_sign(const uint8_t * privkey, const uint8_t * hash, int len, uint8_t * sig)
+{
+#ifdef ENABLE_P256_COMB
+    return p256_sign(privkey, hash, len, sig);
+#else
+    return uECC_sign(privkey, hash, len, sig, uECC_secp256r1());
+#endif
+}
+
+static int soft_ecc256_verify(const uint8_t * pubkey, const uint8_t * hash, int len, const uint8_t * sig)
+{
+    return uECC_verify(pubkey, hash, len, sig, uECC_secp256r1());
+}
+
+static int soft_ecc256_shared_secret(const uint8_t * pubkey, const uint8_t * privkey, uint8_t * secret)
+{
+#ifdef ENABLE_P256_COMB
+    return p256_shared_secret(pubkey, privkey, secret);
+#else
+    return uECC_shared_secret(pubkey, privkey, secret, uECC_secp256r1());
+#endif
+}
+
+const crypto_backend crypto_backend_soft =
+{
+    .name = "soft",
+    .init = soft_init,
+    .sha256_init = soft_sha256_init,
+    .sha256_update = soft_sha256_update,
+    .sha256_final = soft_sha256_final,
+    .sha256_compress = soft_sha256_compress,
+    .aes256_init = soft_aes256_init,
+    .aes256_reset_iv = soft_aes256_reset_iv,
+    .aes256_encrypt = soft_aes256_encrypt,
+    .aes256_decrypt = soft_aes256_decrypt,
+    .ecc256_compute_public_key = soft_ecc256_compute_public_key,
+    .ecc256_make_key = soft_ecc256_make_key,
+    .ecc256_sign = soft_ecc256_sign,
+    .ecc256_verify = soft_ecc256_verify,
+    .ecc256_shared_secret = soft_ecc256_shared_secret,
+};
+
 
 const uint8_t attestation_cert_der[] =
 "\x30\x82\x01\xfb\x30\x82\x01\xa1\xa0\x03\x02\x01\x02\x02\x01\x00\x30\x0a\x06\x08"
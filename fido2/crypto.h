@@ -34,6 +34,23 @@ void crypto_sha256_final(uint8_t * hash);
 void crypto_sha256_hmac_init(uint8_t * key, uint32_t klen, uint8_t * hmac);
 void crypto_sha256_hmac_final(uint8_t * key, uint32_t klen, uint8_t * hmac);
 
+// SHA-256 states after the inner and outer HMAC key blocks.  Preparing them
+// once saves two compressions on every later HMAC with the same key.
+typedef struct
+{
+    uint32_t inner[8];
+    uint32_t outer[8];
+} crypto_hmac_midstate;
+
+// Implemented once in hmac_midstate.c on top of crypto_sha256_compress.
+void crypto_sha256_hmac_prepare(uint8_t * key, uint32_t klen, crypto_hmac_midstate * st);
+// hmac = HMAC(key, data || data2), data2 may be NULL
+void crypto_sha256_hmac_compute(const crypto_hmac_midstate * st, uint8_t * data, int len, uint8_t * data2, int len2, uint8_t * hmac);
+
+// Per target: run the SHA-256 compression function over one 64 byte block,
+// updating state in place.
+void crypto_sha256_compress(uint32_t * state, const uint8_t * block);
+
 
 void crypto_ecc256_init();
 void crypto_ecc256_derive_public_key(uint8_t * data, int len, uint8_t * x, uint8_t * y);
@@ -47,7 +64,18 @@ void crypto_ecdsa_sign(uint8_t * data, int len, uint8_t * sig, int MBEDTLS_ECP_I
 
 void generate_private_key(uint8_t * data, int len, uint8_t * data2, int len2, uint8_t * privkey);
 void crypto_ecc256_make_key_pair(uint8_t * pubkey, uint8_t * privkey);
-void crypto_ecc256_shared_secret(const uint8_t * pubkey, const uint8_t * privkey, uint8_t * shared_secret);
+// Returns 1 on success, 0 if pubkey is not a valid point.
+int crypto_ecc256_shared_secret(const uint8_t * pubkey, const uint8_t * privkey, uint8_t * shared_secret);
+
+// Precompute signature nonces and key pairs ahead of time, call when idle.
+// Returns 1 while the pools are not full yet.
+int crypto_ecc256_precompute();
+
+// Ed25519 credential keys, derived the same way as the P-256 ones.
+// x is the 32 byte encoded public key, sig the 64 byte R || S.
+void crypto_ed25519_derive_public_key(uint8_t * data, int len, uint8_t * x);
+void crypto_ed25519_load_key(uint8_t * data, int len, uint8_t * data2, int len2);
+void crypto_ed25519_sign(uint8_t * data, int len, uint8_t * sig);
 
 // Key must be 32 bytes
 #define CRYPTO_TRANSPORT_KEY            NULL
@@ -0,0 +1,88 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Primitive backends behind crypto.h.
+ *
+ *  crypto.c keeps the policy (master/transport secrets, key derivation,
+ *  which key is loaded) and forwards the primitives to one backend, picked
+ *  once by crypto_backend_select() when crypto_ecc256_init() runs.
+ *
+ *  Keys and signatures use the micro-ecc encodings: 32 byte big endian
+ *  private keys, 64 byte X||Y public keys and 64 byte R||S signatures.
+ *  The ecc256 functions return 1 on success and 0 on failure.
+ *
+ *  A backend keeps its own sha256 and aes state, so only one sha256 stream
+ *  and one aes context are live at a time, same as crypto.h.
+ */
+#ifndef _CRYPTO_BACKEND_H
+#define _CRYPTO_BACKEND_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "crypto.h"
+
+typedef struct
+{
+    const char * name;
+
+    // Returns 0 if the backend can't run on this host.
+    int (*init)();
+
+    void (*sha256_init)();
+    void (*sha256_update)(const uint8_t * data, size_t len);
+    void (*sha256_final)(uint8_t * hash);
+
+    // One block, see crypto_sha256_compress in crypto.h.
+    void (*sha256_compress)(uint32_t * state, const uint8_t * block);
+
+    // AES-256-CBC, the IV chains across calls until it is reset.
+    void (*aes256_init)(const uint8_t * key, const uint8_t * iv);
+    void (*aes256_reset_iv)(const uint8_t * iv);
+    void (*aes256_encrypt)(uint8_t * buf, int len);
+    void (*aes256_decrypt)(uint8_t * buf, int len);
+
+    int (*ecc256_compute_public_key)(const uint8_t * privkey, uint8_t * pubkey);
+    int (*ecc256_make_key)(uint8_t * pubkey, uint8_t * privkey);
+    int (*ecc256_sign)(const uint8_t * privkey, const uint8_t * hash, int len, uint8_t * sig);
+    int (*ecc256_verify)(const uint8_t * pubkey, const uint8_t * hash, int len, const uint8_t * sig);
+    int (*ecc256_shared_secret)(const uint8_t * pubkey, const uint8_t * privkey, uint8_t * secret);
+} crypto_backend;
+
+// micro-ecc (or the P-256 comb), tiny-AES and crypto/sha256.
+extern const crypto_backend crypto_backend_soft;
+
+#ifdef ENABLE_OPENSSL_BACKEND
+// The host libcrypto, see pc/crypto_openssl.c.
+extern const crypto_backend crypto_backend_openssl;
+#endif
+
+// Self-tests every registered backend and returns the fastest one that
+// passes.  CRYPTO_BACKEND=<name> in the environment skips the benchmark.
+const crypto_backend * crypto_backend_select();
+
+// The backend crypto.h forwards to.
+const crypto_backend * crypto_backend_current();
+
+// Known answer tests, returns 1 if every primitive checks out.
+int crypto_backend_self_test(const crypto_backend * b);
+
+#endif
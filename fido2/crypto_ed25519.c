@@ -0,0 +1,56 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Ed25519 (COSE alg -8) credential keys, shared by every target.
+ *
+ *  The private key comes from the target's generate_private_key, so the
+ *  same credential ID gives the same key as the P-256 path would.
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#include "crypto.h"
+#include "ed25519.h"
+#include "probes.h"
+
+static uint8_t _ed25519_key[32];
+static uint8_t _ed25519_pub[32];
+
+void crypto_ed25519_derive_public_key(uint8_t * data, int len, uint8_t * x)
+{
+    uint8_t privkey[32];
+    generate_private_key(data,len,NULL,0,privkey);
+    ed25519_public_key(x, privkey);
+}
+
+void crypto_ed25519_load_key(uint8_t * data, int len, uint8_t * data2, int len2)
+{
+    generate_private_key(data,len,data2,len2,_ed25519_key);
+    ed25519_public_key(_ed25519_pub, _ed25519_key);
+}
+
+void crypto_ed25519_sign(uint8_t * data, int len, uint8_t * sig)
+{
+    PROBE1(crypto_start, PROBE_CRYPTO_ED25519_SIGN);
+    ed25519_sign(sig, data, len, _ed25519_key, _ed25519_pub);
+    PROBE1(crypto_done, PROBE_CRYPTO_ED25519_SIGN);
+}
@@ -35,21 +35,42 @@
 #include "device.h"
 #include "app.h"
 #include "wallet.h"
+#include "arena.h"
+#include "metrics.h"
+#include "probes.h"
+#include "profile.h"
 
 #include "device.h"
 
 #define PIN_TOKEN_SIZE      16
+
+// makeCredential authenticator data, COSE key and attested credential
+#define MC_AUTH_DATA_SIZE   300
 uint8_t PIN_TOKEN[PIN_TOKEN_SIZE];
 uint8_t KEY_AGREEMENT_PUB[64];
 static uint8_t KEY_AGREEMENT_PRIV[32];
+static uint32_t KEY_AGREEMENT_EPOCH;    // bumped whenever KEY_AGREEMENT_PRIV changes
 static uint8_t PIN_CODE_HASH[32];
 
+// Shared secret with the platform key last seen in a clientPin command, so
+// getPinToken/setPin/changePin in one session only do ECDH once.
+static struct {
+    uint8_t valid;
+    uint32_t epoch;
+    uint8_t platform_pubkey[64];
+    uint8_t shared_secret[32];      // SHA-256 of the ECDH x coordinate, the AES key
+    crypto_hmac_midstate hmac;      // HMAC key schedule for shared_secret
+} pinSession;
+
 AuthenticatorState STATE;
 
 static struct {
     CTAP_authDataHeader authData;
     uint8_t clientDataHash[CLIENT_DATA_HASH_SIZE];
-    CTAP_credentialDescriptor creds[ALLOW_LIST_MAX_SIZE-1];
+    CTAP_credentialRef creds[ASSERTION_CREDS_MAX_SIZE-1];
+    uint8_t * request;      // the getAssertion request, still in ctap_buffer
+    int length;
+    uint8_t resident;       // creds are STATE.rks slots, not request offsets
     uint8_t lastcmd;
     uint32_t count;
     uint32_t index;
@@ -78,7 +99,60 @@ uint8_t verify_pin_auth(uint8_t * pinAuth, uint8_t * clientDataHash)
 
 }
 
-uint8_t ctap_get_info(CborEncoder * encoder)
+// CBOR head (major type and argument) in canonical form.
+// @return number of bytes written to buf, at most 5
+static int cbor_head(uint8_t * buf, uint8_t major, uint32_t val)
+{
+    if (val < 24)
+    {
+        buf[0] = major | val;
+        return 1;
+    }
+    else if (val < 0x100)
+    {
+        buf[0] = major | 24;
+        buf[1] = val;
+        return 2;
+    }
+    else if (val < 0x10000)
+    {
+        buf[0] = major | 25;
+        buf[1] = val >> 8;
+        buf[2] = val;
+        return 3;
+    }
+    buf[0] = major | 26;
+    buf[1] = val >> 24;
+    buf[2] = val >> 16;
+    buf[3] = val >> 8;
+    buf[4] = val;
+    return 5;
+}
+
+// Reserves len bytes in encoder for @items complete, pre-encoded CBOR items
+// and points *out at them.  tinycbor has no raw append, so this does the
+// same bookkeeping cbor_encode_* would for the container being filled.
+static CborError ctap_encode_reserve(CborEncoder * encoder, size_t len, int items, uint8_t ** out)
+{
+    if (encoder->end == NULL || (size_t)(encoder->end - encoder->data.ptr) < len)
+    {
+        return CborErrorOutOfMemory;
+    }
+    *out = encoder->data.ptr;
+    encoder->data.ptr += len;
+    encoder->remaining = (encoder->remaining > items) ? encoder->remaining - items : 0;
+    return CborNoError;
+}
+
+// getInfo only changes with the clientPin option, so it's encoded once into
+// infoTemplate and then copied with that byte patched.
+static struct {
+    uint8_t data[128];
+    uint16_t size;
+    uint16_t pin_offset;
+} infoTemplate;
+
+static uint8_t ctap_encode_info(CborEncoder * encoder, uint8_t * buf, uint16_t * pin_offset)
 {
     int ret;
     CborEncoder array;
@@ -152,7 +226,7 @@ uint8_t ctap_get_info(CborEncoder * encoder)
                 ret = cbor_encode_text_string(&options, "rk", 2);
                 check_ret(ret);
                 {
-                    ret = cbor_encode_boolean(&options, 0);     // State-less device, requires allowList parameter.
+                    ret = cbor_encode_boolean(&options, 1);     // Resident keys, see STATE.rks
                     check_ret(ret);
                 }
 
@@ -172,7 +246,8 @@ uint8_t ctap_get_info(CborEncoder * encoder)
                 ret = cbor_encode_text_string(&options, "clientPin", 9);
                 check_ret(ret);
                 {
-                    ret = cbor_encode_boolean(&options, ctap_is_pin_set());     // NOT [yet] capable of verifying user
+                    *pin_offset = cbor_encoder_get_buffer_size(&options, buf);
+                    ret = cbor_encode_boolean(&options, 0);     // patched by ctap_get_info
                     check_ret(ret);
                 }
 
@@ -190,58 +265,92 @@ uint8_t ctap_get_info(CborEncoder * encoder)
     return CTAP1_ERR_SUCCESS;
 }
 
-
-
-static int ctap_add_cose_key(CborEncoder * cose_key, uint8_t * x, uint8_t * y, uint8_t credtype, int32_t algtype)
+uint8_t ctap_get_info(CborEncoder * encoder)
 {
     int ret;
-    CborEncoder map;
+    CborEncoder tmpl;
+    uint8_t * out;
 
-    ret = cbor_encoder_create_map(cose_key, &map, 5);
+    if (infoTemplate.size == 0)
+    {
+        cbor_encoder_init(&tmpl, infoTemplate.data, sizeof(infoTemplate.data), 0);
+        ret = ctap_encode_info(&tmpl, infoTemplate.data, &infoTemplate.pin_offset);
+        check_retr(ret);
+        infoTemplate.size = cbor_encoder_get_buffer_size(&tmpl, infoTemplate.data);
+    }
+
+    ret = ctap_encode_reserve(encoder, infoTemplate.size, 1, &out);
     check_ret(ret);
 
+    memmove(out, infoTemplate.data, infoTemplate.size);
+    out[infoTemplate.pin_offset] = ctap_is_pin_set() ? 0xf5 : 0xf4;     // true : false
 
-    {
-        ret = cbor_encode_int(&map, COSE_KEY_LABEL_KTY);
-        check_ret(ret);
-        ret = cbor_encode_int(&map, COSE_KEY_KTY_EC2);
-        check_ret(ret);
-    }
+    return CTAP1_ERR_SUCCESS;
+}
 
-    {
-        ret = cbor_encode_int(&map, COSE_KEY_LABEL_ALG);
-        check_ret(ret);
-        ret = cbor_encode_int(&map, algtype);
-        check_ret(ret);
-    }
 
-    {
-        ret = cbor_encode_int(&map, COSE_KEY_LABEL_CRV);
-        check_ret(ret);
-        ret = cbor_encode_int(&map, COSE_KEY_CRV_P256);
-        check_ret(ret);
-    }
 
+// Fixed-shape COSE keys.  Only the alg value and coordinates change, so the
+// map is copied and patched instead of encoded.
+static const uint8_t cose_key_ec2_template[] = {
+    0xa5,                           // map(5)
+    0x01, 0x02,                     //   kty: EC2
+    0x03, 0x20,                     //   alg: patched
+    0x20, 0x01,                     //   crv: P-256
+    0x21, 0x58, 0x20,               //   x: bytes(32)
+          0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    0x22, 0x58, 0x20,               //   y: bytes(32)
+          0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+};
+#define COSE_TEMPLATE_ALG       4
+#define COSE_TEMPLATE_X         10
+#define COSE_TEMPLATE_Y         45
+
+static const uint8_t cose_key_okp_template[] = {
+    0xa4,                           // map(4)
+    0x01, 0x01,                     //   kty: OKP
+    0x03, 0x20,                     //   alg: patched
+    0x20, 0x06,                     //   crv: Ed25519
+    0x21, 0x58, 0x20,               //   x: bytes(32)
+          0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+};
+
+// Copies a COSE key template and patches in alg, which must fit the one
+// byte negative integer form (-1 to -24), and the coordinates.
+static int ctap_add_cose_template(CborEncoder * cose_key, const uint8_t * tmpl, int len, int32_t algtype, uint8_t * x, uint8_t * y)
+{
+    int ret;
+    uint8_t * out;
 
+    if (algtype > -1 || algtype < -24)
     {
-        ret = cbor_encode_int(&map, COSE_KEY_LABEL_X);
-        check_ret(ret);
-        ret = cbor_encode_byte_string(&map, x, 32);
-        check_ret(ret);
+        printf2(TAG_ERR,"Error, COSE alg %d not supported\n", algtype);
+        return CTAP2_ERR_UNSUPPORTED_ALGORITHM;
     }
 
+    ret = ctap_encode_reserve(cose_key, len, 1, &out);
+    check_ret(ret);
+
+    memmove(out, tmpl, len);
+    out[COSE_TEMPLATE_ALG] = 0x20 | (-1 - algtype);
+    memmove(out + COSE_TEMPLATE_X, x, 32);
+    if (y != NULL)
     {
-        ret = cbor_encode_int(&map, COSE_KEY_LABEL_Y);
-        check_ret(ret);
-        ret = cbor_encode_byte_string(&map, y, 32);
-        check_ret(ret);
+        memmove(out + COSE_TEMPLATE_Y, y, 32);
     }
+    return 0;
+}
 
-    ret = cbor_encoder_close_container(cose_key, &map);
-    check_ret(ret);
+static int ctap_add_cose_key(CborEncoder * cose_key, uint8_t * x, uint8_t * y, uint8_t credtype, int32_t algtype)
+{
+    return ctap_add_cose_template(cose_key, cose_key_ec2_template, sizeof(cose_key_ec2_template), algtype, x, y);
+}
 
-    return 0;
+static int ctap_add_okp_cose_key(CborEncoder * cose_key, uint8_t * x, int32_t algtype)
+{
+    return ctap_add_cose_template(cose_key, cose_key_okp_template, sizeof(cose_key_okp_template), algtype, x, NULL);
 }
+
 static int ctap_generate_cose_key(CborEncoder * cose_key, uint8_t * hmac_input, int len, uint8_t credtype, int32_t algtype)
 {
     uint8_t x[32], y[32];
@@ -256,12 +365,14 @@ static int ctap_generate_cose_key(CborEncoder * cose_key, uint8_t * hmac_input,
         case COSE_ALG_ES256:
             crypto_ecc256_derive_public_key(hmac_input, len, x, y);
             break;
+        case COSE_ALG_EDDSA:
+            crypto_ed25519_derive_public_key(hmac_input, len, x);
+            return ctap_add_okp_cose_key(cose_key, x, algtype);
         default:
             printf2(TAG_ERR,"Error, COSE alg %d not supported\n", algtype);
             return -1;
     }
-    ctap_add_cose_key(cose_key, x, y, credtype, algtype);
-    return 0;
+    return ctap_add_cose_key(cose_key, x, y, credtype, algtype);
 }
 
 void make_auth_tag(struct rpId * rp, CTAP_userEntity * user, uint32_t count, uint8_t * tag)
@@ -302,6 +413,7 @@ static int ctap_make_auth_data(struct rpId * rp, CborEncoder * map, uint8_t * au
     CborEncoder cose_key;
     int auth_data_sz, ret;
     uint32_t count;
+    uint32_t t;
     CTAP_authData * authData = (CTAP_authData *)auth_data_buf;
 
     uint8_t * cose_key_buf = auth_data_buf + sizeof(CTAP_authData);
@@ -343,11 +455,14 @@ static int ctap_make_auth_data(struct rpId * rp, CborEncoder * map, uint8_t * au
 
         memmove(&authData->attest.credential.enc.user, user, sizeof(CTAP_userEntity)); //TODO encrypt this
         authData->attest.credential.enc.count = count;
+        authData->attest.credential.enc.alg = (algtype == COSE_ALG_EDDSA) ? CREDENTIAL_ALG_EDDSA : CREDENTIAL_ALG_ES256;
 
         crypto_aes256_init(CRYPTO_TRANSPORT_KEY, NULL);
         crypto_aes256_encrypt((uint8_t*)&authData->attest.credential.enc, CREDENTIAL_ENC_SIZE);
 
+        t = micros();
         ctap_generate_cose_key(&cose_key, (uint8_t*)&authData->attest.credential, sizeof(struct Credential), credtype, algtype);
+        metrics_record(METRIC_KEY_DERIVATION, t);
 
         printf1(TAG_MC,"COSE_KEY: "); dump_hex1(TAG_MC, cose_key_buf, cbor_encoder_get_buffer_size(&cose_key, cose_key_buf));
 
@@ -425,45 +540,66 @@ int ctap_calculate_signature(uint8_t * data, int datalen, uint8_t * clientDataHa
     return ctap_encode_der_sig(sigbuf,sigder);
 }
 
-uint8_t ctap_add_attest_statement(CborEncoder * map, uint8_t * sigder, int len)
+// require crypto_ed25519_load_key prior to this
+// EdDSA signs authData || clientDataHash as is, no prehash and no DER.
+// @sig location to deposit signature (must be 64 bytes)
+// @return length of signature
+static int ctap_calculate_eddsa_signature(uint8_t * data, int datalen, uint8_t * clientDataHash, uint8_t * sig)
 {
-    int ret;
+    uint8_t msg[sizeof(CTAP_authDataHeader) + CLIENT_DATA_HASH_SIZE];
 
-    CborEncoder stmtmap;
-    CborEncoder x5carr;
+    if (datalen > (int)sizeof(CTAP_authDataHeader))
+    {
+        printf2(TAG_ERR,"Error, authData too long for EdDSA\n");
+        exit(1);
+    }
+    memmove(msg, data, datalen);
+    memmove(msg + datalen, clientDataHash, CLIENT_DATA_HASH_SIZE);
 
+    crypto_ed25519_sign(msg, datalen + CLIENT_DATA_HASH_SIZE, sig);
+
+    return 64;
+}
+
+// attStmt is {"alg": ES256, "sig": <sig>, "x5c": [<cert>]}, only the
+// signature changes, so it is assembled from these and the certificate.
+static const uint8_t attest_statement_head[] = {
+    0xa3,                           // map(3)
+    0x63, 'a', 'l', 'g', 0x26,      //   "alg": -7 (ES256)
+    0x63, 's', 'i', 'g',            //   "sig":
+};
+static const uint8_t attest_statement_x5c[] = {
+    0x63, 'x', '5', 'c', 0x81,      //   "x5c": array(1)
+};
+
+uint8_t ctap_add_attest_statement(CborEncoder * map, uint8_t * sigder, int len)
+{
+    int ret;
+    uint8_t sig_head[5];
+    uint8_t cert_head[5];
+    int sig_head_sz = cbor_head(sig_head, CborByteStringType, len);
+    int cert_head_sz = cbor_head(cert_head, CborByteStringType, attestation_cert_der_size);
+    uint8_t * out;
 
     ret = cbor_encode_int(map,RESP_attStmt);
     check_ret(ret);
-    ret = cbor_encoder_create_map(map, &stmtmap, 3);
-    check_ret(ret);
-    {
-        ret = cbor_encode_text_stringz(&stmtmap,"alg");
-        check_ret(ret);
-        ret = cbor_encode_int(&stmtmap,COSE_ALG_ES256);
-        check_ret(ret);
-    }
-    {
-        ret = cbor_encode_text_stringz(&stmtmap,"sig");
-        check_ret(ret);
-        ret = cbor_encode_byte_string(&stmtmap, sigder, len);
-        check_ret(ret);
-    }
-    {
-        ret = cbor_encode_text_stringz(&stmtmap,"x5c");
-        check_ret(ret);
-        ret = cbor_encoder_create_array(&stmtmap, &x5carr, 1);
-        check_ret(ret);
-        {
-            ret = cbor_encode_byte_string(&x5carr, attestation_cert_der, attestation_cert_der_size);
-            check_ret(ret);
-            ret = cbor_encoder_close_container(&stmtmap, &x5carr);
-            check_ret(ret);
-        }
-    }
 
-    ret = cbor_encoder_close_container(map, &stmtmap);
+    ret = ctap_encode_reserve(map, sizeof(attest_statement_head) + sig_head_sz + len +
+                              sizeof(attest_statement_x5c) + cert_head_sz + attestation_cert_der_size, 1, &out);
     check_ret(ret);
+
+    memmove(out, attest_statement_head, sizeof(attest_statement_head));
+    out += sizeof(attest_statement_head);
+    memmove(out, sig_head, sig_head_sz);
+    out += sig_head_sz;
+    memmove(out, sigder, len);
+    out += len;
+    memmove(out, attest_statement_x5c, sizeof(attest_statement_x5c));
+    out += sizeof(attest_statement_x5c);
+    memmove(out, cert_head, cert_head_sz);
+    out += cert_head_sz;
+    memmove(out, attestation_cert_der, attestation_cert_der_size);
+
     return 0;
 }
 
@@ -482,30 +618,140 @@ int ctap_authenticate_credential(struct rpId * rp, CTAP_credentialDescriptor * d
     return (memcmp(desc->credential.tag, tag, CREDENTIAL_TAG_SIZE) == 0);
 }
 
+// RAM index over STATE.rks, chained by the first byte of the rpIdHash so an
+// empty allow list only looks at slots that can belong to the RP.
+#define RK_INDEX_BUCKETS    16
+#define RK_NONE             0xff
+
+static struct {
+    uint8_t head[RK_INDEX_BUCKETS];
+    uint8_t next[RK_NUM];
+} rkIndex;
+
+static int rk_bucket(uint8_t * rp_tag)
+{
+    return rp_tag[0] & (RK_INDEX_BUCKETS - 1);
+}
+
+static void rk_index_insert(int slot)
+{
+    int b = rk_bucket(STATE.rks[slot].rp_tag);
+    rkIndex.next[slot] = rkIndex.head[b];
+    rkIndex.head[b] = slot;
+}
+
+static void rk_index_build()
+{
+    int i;
+    memset(&rkIndex, RK_NONE, sizeof(rkIndex));
+    for (i = 0; i < RK_NUM; i++)
+    {
+        if (STATE.rks[i].in_use == RK_SLOT_MARKER)
+        {
+            rk_index_insert(i);
+        }
+    }
+}
+
+// Next slot after @slot filed under rpIdHash, RK_NONE starts and ends the
+// walk.  Tags are truncated, so callers must authenticate what they get.
+static uint8_t rk_next_candidate(uint8_t * rpIdHash, uint8_t slot)
+{
+    slot = (slot == RK_NONE) ? rkIndex.head[rk_bucket(rpIdHash)] : rkIndex.next[slot];
+    while (slot != RK_NONE && memcmp(STATE.rks[slot].rp_tag, rpIdHash, RK_RPID_TAG_SIZE) != 0)
+    {
+        slot = rkIndex.next[slot];
+    }
+    return slot;
+}
+
+// Picks the slot for a new resident credential: the one already holding
+// this user for this RP, otherwise a free one.
+// @return slot index, -1 if the store is full
+static int rk_pick_slot(struct rpId * rp, uint8_t * rpIdHash, CTAP_userEntity * user)
+{
+    CTAP_credentialDescriptor desc;
+    uint8_t i;
+
+    crypto_aes256_init(CRYPTO_TRANSPORT_KEY, NULL);
+    for (i = rk_next_candidate(rpIdHash, RK_NONE); i != RK_NONE; i = rk_next_candidate(rpIdHash, i))
+    {
+        desc.type = PUB_KEY_CRED_PUB_KEY;
+        memmove(&desc.credential, &STATE.rks[i].credential, sizeof(struct Credential));
+        crypto_aes256_reset_iv(NULL);
+        crypto_aes256_decrypt((uint8_t*)&desc.credential.enc, CREDENTIAL_ENC_SIZE);
+
+        if (ctap_authenticate_credential(rp, &desc) &&
+            desc.credential.enc.user.id_size == user->id_size &&
+            memcmp(desc.credential.enc.user.id, user->id, user->id_size) == 0)
+        {
+            printf1(TAG_MC, "replacing resident key in slot %d\n", i);
+            return i;
+        }
+    }
+
+    for (i = 0; i < RK_NUM; i++)
+    {
+        if (STATE.rks[i].in_use != RK_SLOT_MARKER)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void rk_store(int slot, uint8_t * rpIdHash, struct Credential * credential)
+{
+    int fresh = STATE.rks[slot].in_use != RK_SLOT_MARKER;
+
+    STATE.rks[slot].in_use = RK_SLOT_MARKER;
+    memmove(STATE.rks[slot].rp_tag, rpIdHash, RK_RPID_TAG_SIZE);
+    memmove(&STATE.rks[slot].credential, credential, sizeof(struct Credential));
+    if (fresh)
+    {
+        rk_index_insert(slot);
+    }
+
+    ctap_state_dirty(STATE_RKS);
+    printf1(TAG_MC, "stored resident key in slot %d\n", slot);
+}
+
 
 
 uint8_t ctap_make_credential(CborEncoder * encoder, uint8_t * request, int length)
 {
-    CTAP_makeCredential MC;
+    CTAP_makeCredential * MC = arena_alloc(sizeof(CTAP_makeCredential));
+    uint8_t * auth_data_buf = arena_alloc(MC_AUTH_DATA_SIZE);
     int ret, i;
-    uint8_t auth_data_buf[300];
+    int rk_slot = -1;
+    uint8_t rpIdHash[32];
+    uint32_t t;
     CTAP_credentialDescriptor * excl_cred = (CTAP_credentialDescriptor *) auth_data_buf;
     uint8_t * sigbuf = auth_data_buf + 32;
     uint8_t * sigder = auth_data_buf + 32 + 64;
 
-    ret = ctap_parse_make_credential(&MC,encoder,request,length);
+    if (MC == NULL || auth_data_buf == NULL)
+    {
+        return CTAP1_ERR_OTHER;
+    }
+
+    t = micros();
+    PROFILE_BEGIN(PROFILE_CBOR_PARSE);
+    ret = ctap_parse_make_credential(MC,encoder,request,length);
+    PROFILE_END(PROFILE_CBOR_PARSE);
+    metrics_record(METRIC_PARSE, t);
     if (ret != 0)
     {
         printf2(TAG_ERR,"error, parse_make_credential failed\n");
         return ret;
     }
-    if ((MC.paramsParsed & MC_requiredMask) != MC_requiredMask)
+    if ((MC->paramsParsed & MC_requiredMask) != MC_requiredMask)
     {
         printf2(TAG_ERR,"error, required parameter(s) for makeCredential are missing\n");
         return CTAP2_ERR_MISSING_PARAMETER;
     }
 
-    if (ctap_is_pin_set() == 1 && MC.pinAuthPresent == 0)
+    if (ctap_is_pin_set() == 1 && MC->pinAuthPresent == 0)
     {
         printf2(TAG_ERR,"pinAuth is required\n");
         return CTAP2_ERR_PIN_REQUIRED;
@@ -514,43 +760,68 @@ uint8_t ctap_make_credential(CborEncoder * encoder, uint8_t * request, int lengt
     {
         if (ctap_is_pin_set())
         {
-            ret = verify_pin_auth(MC.pinAuth, MC.clientDataHash);
+            t = micros();
+            ret = verify_pin_auth(MC->pinAuth, MC->clientDataHash);
+            metrics_record(METRIC_PIN, t);
             check_retr(ret);
         }
     }
 
-    for (i = 0; i < MC.excludeListSize; i++)
+    t = micros();
+    for (i = 0; i < MC->excludeListSize; i++)
     {
-        ret = parse_credential_descriptor(&MC.excludeList, excl_cred);
+        ret = parse_credential_descriptor(&MC->excludeList, excl_cred);
         if (ret == CTAP2_ERR_CBOR_UNEXPECTED_TYPE)
         {
             continue;
         }
         check_retr(ret);
 
-        if (ctap_authenticate_credential(&MC.rp, excl_cred))
+        if (ctap_authenticate_credential(&MC->rp, excl_cred))
         {
             return CTAP2_ERR_CREDENTIAL_EXCLUDED;
         }
+    }
+    metrics_record(METRIC_CREDENTIALS, t);
 
-        ret = cbor_value_advance(&MC.excludeList);
-        check_ret(ret);
+    if (MC->rk)
+    {
+        crypto_sha256_init();
+        crypto_sha256_update(MC->rp.id, MC->rp.size);
+        crypto_sha256_final(rpIdHash);
+
+        rk_slot = rk_pick_slot(&MC->rp, rpIdHash, &MC->user);
+        if (rk_slot < 0)
+        {
+            printf2(TAG_ERR,"error, no room for another resident key\n");
+            return CTAP2_ERR_KEY_STORE_FULL;
+        }
     }
 
     CborEncoder map;
     ret = cbor_encoder_create_map(encoder, &map, 3);
     check_ret(ret);
 
-    int auth_data_sz = ctap_make_auth_data(&MC.rp, &map, auth_data_buf, sizeof(auth_data_buf),
-            &MC.user, MC.publicKeyCredentialType, MC.COSEAlgorithmIdentifier);
+    int auth_data_sz = ctap_make_auth_data(&MC->rp, &map, auth_data_buf, MC_AUTH_DATA_SIZE,
+            &MC->user, MC->publicKeyCredentialType, MC->COSEAlgorithmIdentifier);
 
+    // Save it before the signature below reuses auth_data_buf
+    if (rk_slot >= 0)
+    {
+        rk_store(rk_slot, rpIdHash, &((CTAP_authData *)auth_data_buf)->attest.credential);
+    }
+
+    t = micros();
     crypto_ecc256_load_attestation_key();
-    int sigder_sz = ctap_calculate_signature(auth_data_buf, auth_data_sz, MC.clientDataHash, auth_data_buf, sigbuf, sigder);
+    int sigder_sz = ctap_calculate_signature(auth_data_buf, auth_data_sz, MC->clientDataHash, auth_data_buf, sigbuf, sigder);
+    metrics_record(METRIC_SIGN, t);
 
     printf1(TAG_MC,"der sig [%d]: ", sigder_sz); dump_hex1(TAG_MC, sigder, sigder_sz);
 
+    t = micros();
     ret = ctap_add_attest_statement(&map, sigder, sigder_sz);
     check_retr(ret);
+    metrics_record(METRIC_ENCODE, t);
 
     {
         ret = cbor_encode_int(&map,RESP_fmt);
@@ -641,68 +912,168 @@ uint8_t ctap_add_user_entity(CborEncoder * map, CTAP_userEntity * user)
 
 static int cred_cmp_func(const void * _a, const void * _b)
 {
-    CTAP_credentialDescriptor * a = (CTAP_credentialDescriptor * )_a;
-    CTAP_credentialDescriptor * b = (CTAP_credentialDescriptor * )_b;
-    return b->credential.enc.count - a->credential.enc.count;
+    CTAP_credentialRef * a = (CTAP_credentialRef * )_a;
+    CTAP_credentialRef * b = (CTAP_credentialRef * )_b;
+    return b->count - a->count;
 }
 
-// @return the number of valid credentials
-// sorts the credentials.  Most recent creds will be first, invalid ones last.
-int ctap_filter_invalid_credentials(CTAP_getAssertion * GA)
+// Decrypts and authenticates desc, keeping a reference to it in GA->creds if
+// it belongs to this RP.  Once GA->creds is full the least recent credential
+// gives way.  The least recent one kept so far is also copied, decrypted, to
+// first, since getAssertion returns it.
+static void ctap_keep_if_authentic(CTAP_getAssertion * GA, CTAP_credentialDescriptor * desc, uint16_t ref,
+                                   CTAP_credentialDescriptor * first)
 {
-    int i;
-    int count = 0;
-    crypto_aes256_init(CRYPTO_TRANSPORT_KEY, NULL);
+    int i, oldest = 0;
+    uint32_t count;
 
+    crypto_aes256_reset_iv(NULL);
+    crypto_aes256_decrypt((uint8_t*)&desc->credential.enc, CREDENTIAL_ENC_SIZE);
+    count = desc->credential.enc.count;
+    if (! ctap_authenticate_credential(&GA->rp, desc))
+    {
+        printf1(TAG_GA, "CRED #%d is invalid\n", count);
+        return;
+    }
 
-    for (i = 0; i < GA->credLen; i++)
+    if (GA->credLen < ASSERTION_CREDS_MAX_SIZE)
     {
-        crypto_aes256_reset_iv(NULL);
-        crypto_aes256_decrypt((uint8_t*)&GA->creds[i].credential.enc, CREDENTIAL_ENC_SIZE);
-        if (! ctap_authenticate_credential(&GA->rp, &GA->creds[i]))
+        oldest = GA->credLen++;
+    }
+    else
+    {
+        for (i = 1; i < GA->credLen; i++)
         {
-            printf1(TAG_GA, "CRED #%d is invalid\n", GA->creds[i].credential.enc.count);
-            GA->creds[i].credential.enc.count = 0;      // invalidate
+            if (GA->creds[i].count < GA->creds[oldest].count)
+            {
+                oldest = i;
+            }
         }
-        else
+        if (count <= GA->creds[oldest].count)
         {
-            count++;
+            return;
         }
     }
-    printf1(TAG_GA, "qsort length: %d\n", GA->credLen);
-    qsort(GA->creds, GA->credLen, sizeof(CTAP_credentialDescriptor), cred_cmp_func);
-    return count;
-}
+    GA->creds[oldest].count = count;
+    GA->creds[oldest].ref = ref;
 
+    if (GA->credLen == 1 || count < first->credential.enc.count)
+    {
+        memmove(first, desc, sizeof(CTAP_credentialDescriptor));
+    }
+}
 
-static void save_credential_list(CTAP_authDataHeader * head, uint8_t * clientDataHash, CTAP_credentialDescriptor * creds, uint32_t count)
+// Walks the allow list in place, or the resident keys for rpIdHash if there
+// is none, leaving references to the authentic credentials in GA->creds and
+// GA->credLen.  Sorts them so the most recent creds are first.  first gets
+// the last of them decrypted, unless it gave way to a more recent one.
+// @return 0 or the error from a malformed descriptor
+static uint8_t ctap_collect_credentials(CTAP_getAssertion * GA, uint8_t * request, uint8_t * rpIdHash,
+                                        CTAP_credentialDescriptor * first)
 {
-    if(count)
+    CTAP_credentialDescriptor desc;
+    int ret;
+    size_t i;
+    uint16_t ref;
+    uint8_t slot;
+
+    GA->credLen = 0;
+    crypto_aes256_init(CRYPTO_TRANSPORT_KEY, NULL);
+
+    for (i = 0; i < GA->allowListSize; i++)
     {
-        if (count > ALLOW_LIST_MAX_SIZE-1)
+        ref = cbor_value_get_next_byte(&GA->allowList) - request;
+        ret = parse_credential_descriptor(&GA->allowList, &desc);
+        if (ret == 0)
         {
-            printf2(TAG_ERR, "ALLOW_LIST_MAX_SIZE Exceeded\n");
-            exit(1);
+            ctap_keep_if_authentic(GA, &desc, ref, first);
+        }
+        else if (ret != CTAP2_ERR_CBOR_UNEXPECTED_TYPE)     // foreign ID length, skip it
+        {
+            return ret;
         }
-        memmove(getAssertionState.clientDataHash, clientDataHash, CLIENT_DATA_HASH_SIZE);
-        memmove(&getAssertionState.authData, head, sizeof(CTAP_authDataHeader));
-        memmove(getAssertionState.creds, creds, sizeof(CTAP_credentialDescriptor) * (count));
     }
-    getAssertionState.count = count;
-    printf1(TAG_GA,"saved %d credentials\n",count);
+
+    if (GA->allowListSize == 0)
+    {
+        for (slot = rk_next_candidate(rpIdHash, RK_NONE); slot != RK_NONE; slot = rk_next_candidate(rpIdHash, slot))
+        {
+            desc.type = PUB_KEY_CRED_PUB_KEY;
+            memmove(&desc.credential, &STATE.rks[slot].credential, sizeof(struct Credential));
+            ctap_keep_if_authentic(GA, &desc, slot, first);
+        }
+    }
+
+    printf1(TAG_GA, "qsort length: %d\n", GA->credLen);
+    qsort(GA->creds, GA->credLen, sizeof(CTAP_credentialRef), cred_cmp_func);
+    return 0;
 }
 
-static CTAP_credentialDescriptor * pop_credential()
+// Fetches the credential ref points to, a slot in STATE.rks or a descriptor
+// at that offset in request, still encrypted.
+static uint8_t ctap_fetch_credential(uint8_t * request, int length, uint8_t resident,
+                                     CTAP_credentialRef * ref, CTAP_credentialDescriptor * desc)
 {
-    if (getAssertionState.count > 0)
+    CborParser parser;
+    CborValue it;
+    int ret;
+
+    if (resident)
     {
-        getAssertionState.count--;
-        return &getAssertionState.creds[getAssertionState.count];
+        desc->type = PUB_KEY_CRED_PUB_KEY;
+        memmove(&desc->credential, &STATE.rks[ref->ref].credential, sizeof(struct Credential));
     }
     else
     {
-        return NULL;
+        ret = cbor_parser_init(request + ref->ref, length - ref->ref, 0, &parser, &it);
+        check_ret(ret);
+        ret = parse_credential_descriptor(&it, desc);
+        check_retr(ret);
+    }
+    return 0;
+}
+
+// Decrypts a fetched credential and checks it is the one ref was made for.
+static uint8_t ctap_decrypt_credential(CTAP_credentialRef * ref, CTAP_credentialDescriptor * desc)
+{
+    crypto_aes256_init(CRYPTO_TRANSPORT_KEY, NULL);
+    crypto_aes256_decrypt((uint8_t*)&desc->credential.enc, CREDENTIAL_ENC_SIZE);
+
+    if (desc->credential.enc.count != ref->count)
+    {
+        printf2(TAG_ERR, "credential changed under its reference\n");
+        return CTAP2_ERR_NOT_ALLOWED;
+    }
+    return 0;
+}
+
+static uint8_t ctap_load_credential(uint8_t * request, int length, uint8_t resident,
+                                    CTAP_credentialRef * ref, CTAP_credentialDescriptor * desc)
+{
+    int ret = ctap_fetch_credential(request, length, resident, ref, desc);
+    check_retr(ret);
+    return ctap_decrypt_credential(ref, desc);
+}
+
+// Keeps what getNextAssertion needs: the auth data header and references to
+// the credentials still to be returned.  Resident ones are STATE.rks slots,
+// the others offsets into the request, which stays in ctap_buffer until the
+// next CTAPHID message overwrites it (see ctaphid.c).  Each credential is
+// checked against its recorded counter when it is loaded again.
+static void save_credential_list(CTAP_authDataHeader * head, uint8_t * clientDataHash, CTAP_getAssertion * GA,
+                                 uint8_t * request, int length, uint32_t count)
+{
+    if(count)
+    {
+        memmove(getAssertionState.clientDataHash, clientDataHash, CLIENT_DATA_HASH_SIZE);
+        memmove(&getAssertionState.authData, head, sizeof(CTAP_authDataHeader));
+        memmove(getAssertionState.creds, GA->creds, count * sizeof(CTAP_credentialRef));
+        getAssertionState.request = request;
+        getAssertionState.length = length;
+        getAssertionState.resident = (GA->allowListSize == 0);
     }
+    getAssertionState.count = count;
+    printf1(TAG_GA,"saved %d credentials\n",count);
 }
 
 uint8_t ctap_end_get_assertion(CborEncoder * map, CTAP_credentialDescriptor * cred, uint8_t * auth_data_buf, uint8_t * clientDataHash)
@@ -710,6 +1081,9 @@ uint8_t ctap_end_get_assertion(CborEncoder * map, CTAP_credentialDescriptor * cr
     int ret;
     uint8_t sigbuf[64];
     uint8_t sigder[72];
+    int sigder_sz;
+    uint8_t alg = cred->credential.enc.alg;
+    uint32_t t = micros();
 
     ret = ctap_add_user_entity(map, &cred->credential.enc.user);
     check_retr(ret);
@@ -721,15 +1095,30 @@ uint8_t ctap_end_get_assertion(CborEncoder * map, CTAP_credentialDescriptor * cr
 
     ret = ctap_add_credential_descriptor(map, cred);
     check_retr(ret);
+    metrics_record(METRIC_ENCODE, t);
 
-    crypto_ecc256_load_key((uint8_t*)&cred->credential, sizeof(struct Credential), NULL, 0);
+    t = micros();
+    if (alg == CREDENTIAL_ALG_EDDSA)
+    {
+        crypto_ed25519_load_key((uint8_t*)&cred->credential, sizeof(struct Credential), NULL, 0);
+        metrics_record(METRIC_KEY_DERIVATION, t);
+        t = micros();
+        sigder_sz = ctap_calculate_eddsa_signature(auth_data_buf, sizeof(CTAP_authDataHeader), clientDataHash, sigder);
+    }
+    else
+    {
+        crypto_ecc256_load_key((uint8_t*)&cred->credential, sizeof(struct Credential), NULL, 0);
+        metrics_record(METRIC_KEY_DERIVATION, t);
+        t = micros();
+        sigder_sz = ctap_calculate_signature(auth_data_buf, sizeof(CTAP_authDataHeader), clientDataHash, auth_data_buf, sigbuf, sigder);
+    }
+    metrics_record(METRIC_SIGN, t);
 
     /*printf1(TAG_GREEN,"auth_data_buf: "); dump_hex1(TAG_DUMP, auth_data_buf, sizeof(CTAP_authDataHeader));*/
     /*printf1(TAG_GREEN,"clientdatahash: "); dump_hex1(TAG_DUMP, clientDataHash, 32);*/
     /*printf1(TAG_GREEN,"credential: # %d\n", cred->credential.enc.count);*/
     /*dump_hex1(TAG_DUMP, clientDataHash, 32);*/
 
-    int sigder_sz = ctap_calculate_signature(auth_data_buf, sizeof(CTAP_authDataHeader), clientDataHash, auth_data_buf, sigbuf, sigder);
 
     {
         ret = cbor_encode_int(map, RESP_signature);
@@ -745,13 +1134,26 @@ uint8_t ctap_get_next_assertion(CborEncoder * encoder)
     int ret;
     CborEncoder map;
     CTAP_authDataHeader * authData = &getAssertionState.authData;
+    CTAP_credentialDescriptor cred;
+    CTAP_credentialRef * ref;
+    uint32_t t;
 
-    CTAP_credentialDescriptor * cred = pop_credential();
+    if (getAssertionState.count == 0)
+    {
+        return CTAP2_ERR_NOT_ALLOWED;
+    }
+    getAssertionState.count--;
+    ref = &getAssertionState.creds[getAssertionState.count];
 
-    if (cred == NULL)
+    t = micros();
+    ret = ctap_load_credential(getAssertionState.request, getAssertionState.length, getAssertionState.resident, ref, &cred);
+    if (ret != 0)
     {
+        printf2(TAG_ERR, "credential for getNextAssertion is gone\n");
+        getAssertionState.count = 0;
         return CTAP2_ERR_NOT_ALLOWED;
     }
+    metrics_record(METRIC_CREDENTIALS, t);
 
     auth_data_update_count(authData);
 
@@ -766,7 +1168,7 @@ uint8_t ctap_get_next_assertion(CborEncoder * encoder)
         check_ret(ret);
     }
 
-    ret = ctap_end_get_assertion(&map, cred, (uint8_t *)authData, getAssertionState.clientDataHash);
+    ret = ctap_end_get_assertion(&map, &cred, (uint8_t *)authData, getAssertionState.clientDataHash);
     check_retr(ret);
 
     ret = cbor_encoder_close_container(encoder, &map);
@@ -777,9 +1179,22 @@ uint8_t ctap_get_next_assertion(CborEncoder * encoder)
 
 uint8_t ctap_get_assertion(CborEncoder * encoder, uint8_t * request, int length)
 {
-    CTAP_getAssertion GA;
+    CTAP_getAssertion * GA = arena_alloc(sizeof(CTAP_getAssertion));
+    CTAP_credentialDescriptor cred;
     uint8_t auth_data_buf[sizeof(CTAP_authDataHeader)];
-    int ret = ctap_parse_get_assertion(&GA,request,length);
+    uint32_t t;
+    int ret;
+
+    if (GA == NULL)
+    {
+        return CTAP1_ERR_OTHER;
+    }
+
+    t = micros();
+    PROFILE_BEGIN(PROFILE_CBOR_PARSE);
+    ret = ctap_parse_get_assertion(GA,request,length);
+    PROFILE_END(PROFILE_CBOR_PARSE);
+    metrics_record(METRIC_PARSE, t);
 
     if (ret != 0)
     {
@@ -787,7 +1202,7 @@ uint8_t ctap_get_assertion(CborEncoder * encoder, uint8_t * request, int length)
         return ret;
     }
 
-    if (ctap_is_pin_set() && GA.pinAuthPresent == 0)
+    if (ctap_is_pin_set() && GA->pinAuthPresent == 0)
     {
         printf2(TAG_ERR,"pinAuth is required\n");
         return CTAP2_ERR_PIN_REQUIRED;
@@ -796,7 +1211,9 @@ uint8_t ctap_get_assertion(CborEncoder * encoder, uint8_t * request, int length)
     {
         if (ctap_is_pin_set())
         {
-            ret = verify_pin_auth(GA.pinAuth, GA.clientDataHash);
+            t = micros();
+            ret = verify_pin_auth(GA->pinAuth, GA->clientDataHash);
+            metrics_record(METRIC_PIN, t);
             check_retr(ret);
         }
     }
@@ -806,41 +1223,29 @@ uint8_t ctap_get_assertion(CborEncoder * encoder, uint8_t * request, int length)
     ret = cbor_encoder_create_map(encoder, &map, 5);
     check_ret(ret);
 
-    ctap_make_auth_data(&GA.rp, &map, auth_data_buf, sizeof(auth_data_buf), NULL, 0,0);
+    ctap_make_auth_data(&GA->rp, &map, auth_data_buf, sizeof(auth_data_buf), NULL, 0,0);
 
-    printf1(TAG_GA, "ALLOW_LIST has %d creds\n", GA.credLen);
-    /*for (int j = 0; j < GA.credLen; j++)*/
-    /*{*/
-        /*printf1(TAG_GA,"CRED ID (# %d): ", GA.creds[j].credential.enc.count);*/
-        /*dump_hex1(TAG_GA, (uint8_t*)&GA.creds[j].credential, sizeof(struct Credential));*/
-        /*if (ctap_authenticate_credential(&GA.rp, &GA.creds[j]))   // warning encryption will break this*/
-        /*{*/
-            /*printf1(TAG_GA,"  Authenticated.\n");*/
-        /*}*/
-        /*else*/
-        /*{*/
-            /*printf1(TAG_GA,"  NOT authentic.\n");*/
-        /*}*/
-    /*}*/
+    printf1(TAG_GA, "ALLOW_LIST has %d creds\n", GA->allowListSize);
 
-    // Decrypt here
+    t = micros();
+    ret = ctap_collect_credentials(GA, request, ((CTAP_authDataHeader*)auth_data_buf)->rpIdHash, &cred);
+    check_retr(ret);
 
-    //
-    int validCredCount = ctap_filter_invalid_credentials(&GA);
+    int validCredCount = GA->credLen;
     if (validCredCount > 0)
     {
-        save_credential_list((CTAP_authDataHeader*)auth_data_buf, GA.clientDataHash, GA.creds, validCredCount-1);   // skip last one
+        save_credential_list((CTAP_authDataHeader*)auth_data_buf, GA->clientDataHash, GA, request, length, validCredCount-1);   // skip last one
     }
     else
     {
         printf2(TAG_ERR,"Error, no authentic credential\n");
-        return CTAP2_ERR_CREDENTIAL_NOT_VALID;
+        return (GA->allowListSize == 0) ? CTAP2_ERR_NO_CREDENTIALS : CTAP2_ERR_CREDENTIAL_NOT_VALID;
     }
 
     printf1(TAG_RED,"resulting order of creds:\n");
-    for (int j = 0; j < GA.credLen; j++)
+    for (int j = 0; j < GA->credLen; j++)
     {
-        printf1(TAG_RED,"CRED ID (# %d)\n", GA.creds[j].credential.enc.count);
+        printf1(TAG_RED,"CRED ID (# %d)\n", GA->creds[j].count);
     }
 
     {
@@ -850,9 +1255,16 @@ uint8_t ctap_get_assertion(CborEncoder * encoder, uint8_t * request, int length)
         check_ret(ret);
     }
 
-    CTAP_credentialDescriptor * cred = &GA.creds[validCredCount - 1];
+    // Already decrypted while collecting, unless more than
+    // ASSERTION_CREDS_MAX_SIZE matched and it gave way.
+    if (cred.credential.enc.count != GA->creds[validCredCount - 1].count)
+    {
+        ret = ctap_load_credential(request, length, GA->allowListSize == 0, &GA->creds[validCredCount - 1], &cred);
+        check_retr(ret);
+    }
+    metrics_record(METRIC_CREDENTIALS, t);
 
-    ret = ctap_end_get_assertion(&map, cred, auth_data_buf, GA.clientDataHash);
+    ret = ctap_end_get_assertion(&map, &cred, auth_data_buf, GA->clientDataHash);
     check_retr(ret);
 
     ret = cbor_encoder_close_container(encoder, &map);
@@ -861,9 +1273,43 @@ uint8_t ctap_get_assertion(CborEncoder * encoder, uint8_t * request, int length)
     return 0;
 }
 
+static void ctap_new_key_agreement()
+{
+    crypto_ecc256_make_key_pair(KEY_AGREEMENT_PUB, KEY_AGREEMENT_PRIV);
+    KEY_AGREEMENT_EPOCH++;
+    memset(&pinSession, 0, sizeof(pinSession));
+}
+
+// Returns the key shared with platform_pubkey (also used as the AES key),
+// doing ECDH only if the platform key or our key agreement key changed
+// since the last call.  Returns NULL if platform_pubkey is not a valid point.
+static uint8_t * ctap_pin_shared_secret(uint8_t * platform_pubkey)
+{
+    if (!pinSession.valid || pinSession.epoch != KEY_AGREEMENT_EPOCH ||
+        memcmp(pinSession.platform_pubkey, platform_pubkey, 64) != 0)
+    {
+        if (!crypto_ecc256_shared_secret(platform_pubkey, KEY_AGREEMENT_PRIV, pinSession.shared_secret))
+        {
+            memset(&pinSession, 0, sizeof(pinSession));
+            return NULL;
+        }
+
+        crypto_sha256_init();
+        crypto_sha256_update(pinSession.shared_secret, 32);
+        crypto_sha256_final(pinSession.shared_secret);
+
+        crypto_sha256_hmac_prepare(pinSession.shared_secret, 32, &pinSession.hmac);
+
+        memmove(pinSession.platform_pubkey, platform_pubkey, 64);
+        pinSession.epoch = KEY_AGREEMENT_EPOCH;
+        pinSession.valid = 1;
+    }
+    return pinSession.shared_secret;
+}
+
 uint8_t ctap_update_pin_if_verified(uint8_t * pinEnc, int len, uint8_t * platform_pubkey, uint8_t * pinAuth, uint8_t * pinHashEnc)
 {
-    uint8_t shared_secret[32];
+    uint8_t * shared_secret;
     uint8_t hmac[32];
     int ret;
 
@@ -880,19 +1326,13 @@ uint8_t ctap_update_pin_if_verified(uint8_t * pinEnc, int len, uint8_t * platfor
         }
     }
 
-    crypto_ecc256_shared_secret(platform_pubkey, KEY_AGREEMENT_PRIV, shared_secret);
-
-    crypto_sha256_init();
-    crypto_sha256_update(shared_secret, 32);
-    crypto_sha256_final(shared_secret);
-
-    crypto_sha256_hmac_init(shared_secret, 32, hmac);
-    crypto_sha256_update(pinEnc, len);
-    if (pinHashEnc != NULL)
+    shared_secret = ctap_pin_shared_secret(platform_pubkey);
+    if (shared_secret == NULL)
     {
-        crypto_sha256_update(pinHashEnc, 16);
+        return CTAP1_ERR_INVALID_PARAMETER;
     }
-    crypto_sha256_hmac_final(shared_secret, 32, hmac);
+
+    crypto_sha256_hmac_compute(&pinSession.hmac, pinEnc, len, pinHashEnc, (pinHashEnc != NULL) ? 16 : 0, hmac);
 
     if (memcmp(hmac, pinAuth, 16) != 0)
     {
@@ -935,7 +1375,7 @@ uint8_t ctap_update_pin_if_verified(uint8_t * pinEnc, int len, uint8_t * platfor
         crypto_aes256_decrypt(pinHashEnc, 16);
         if (memcmp(pinHashEnc, PIN_CODE_HASH, 16) != 0)
         {
-            crypto_ecc256_make_key_pair(KEY_AGREEMENT_PUB, KEY_AGREEMENT_PRIV);
+            ctap_new_key_agreement();
             ctap_decrement_pin_attempts();
             return CTAP2_ERR_PIN_INVALID;
         }
@@ -952,13 +1392,11 @@ uint8_t ctap_update_pin_if_verified(uint8_t * pinEnc, int len, uint8_t * platfor
 
 uint8_t ctap_add_pin_if_verified(uint8_t * pinTokenEnc, uint8_t * platform_pubkey, uint8_t * pinHashEnc)
 {
-    uint8_t shared_secret[32];
-
-    crypto_ecc256_shared_secret(platform_pubkey, KEY_AGREEMENT_PRIV, shared_secret);
-
-    crypto_sha256_init();
-    crypto_sha256_update(shared_secret, 32);
-    crypto_sha256_final(shared_secret);
+    uint8_t * shared_secret = ctap_pin_shared_secret(platform_pubkey);
+    if (shared_secret == NULL)
+    {
+        return CTAP1_ERR_INVALID_PARAMETER;
+    }
 
     crypto_aes256_init(shared_secret, NULL);
 
@@ -974,7 +1412,7 @@ uint8_t ctap_add_pin_if_verified(uint8_t * pinTokenEnc, uint8_t * platform_pubke
         printf2(TAG_ERR,"platform-pubkey: "); dump_hex1(TAG_ERR, platform_pubkey, 64);
         printf2(TAG_ERR,"device-pubkey: "); dump_hex1(TAG_ERR, KEY_AGREEMENT_PUB, 64);
         // Generate new keyAgreement pair
-        crypto_ecc256_make_key_pair(KEY_AGREEMENT_PUB, KEY_AGREEMENT_PRIV);
+        ctap_new_key_agreement();
         ctap_decrement_pin_attempts();
         return CTAP2_ERR_PIN_INVALID;
     }
@@ -990,10 +1428,22 @@ uint8_t ctap_add_pin_if_verified(uint8_t * pinTokenEnc, uint8_t * platform_pubke
 
 uint8_t ctap_client_pin(CborEncoder * encoder, uint8_t * request, int length)
 {
-    CTAP_clientPin CP;
+    CTAP_clientPin * CP = arena_alloc(sizeof(CTAP_clientPin));
     CborEncoder map;
     uint8_t pinTokenEnc[PIN_TOKEN_SIZE];
-    int ret = ctap_parse_client_pin(&CP,request,length);
+    uint32_t t;
+    int ret;
+
+    if (CP == NULL)
+    {
+        return CTAP1_ERR_OTHER;
+    }
+
+    t = micros();
+    PROFILE_BEGIN(PROFILE_CBOR_PARSE);
+    ret = ctap_parse_client_pin(CP,request,length);
+    PROFILE_END(PROFILE_CBOR_PARSE);
+    metrics_record(METRIC_PARSE, t);
 
 
     if (ret != 0)
@@ -1002,21 +1452,21 @@ uint8_t ctap_client_pin(CborEncoder * encoder, uint8_t * request, int length)
         return ret;
     }
 
-    if (CP.pinProtocol != 1 || CP.subCommand == 0)
+    if (CP->pinProtocol != 1 || CP->subCommand == 0)
     {
         return CTAP1_ERR_OTHER;
     }
 
-    int num_map = (CP.getRetries ? 1 : 0);
+    int num_map = (CP->getRetries ? 1 : 0);
 
-    switch(CP.subCommand)
+    switch(CP->subCommand)
     {
         case CP_cmdGetRetries:
             printf1(TAG_CP,"CP_cmdGetRetries\n");
             ret = cbor_encoder_create_map(encoder, &map, 1);
             check_ret(ret);
 
-            CP.getRetries = 1;
+            CP->getRetries = 1;
 
             break;
         case CP_cmdGetKeyAgreement:
@@ -1038,12 +1488,14 @@ uint8_t ctap_client_pin(CborEncoder * encoder, uint8_t * request, int length)
             {
                 return CTAP2_ERR_NOT_ALLOWED;
             }
-            if (!CP.newPinEncSize || !CP.pinAuthPresent || !CP.keyAgreementPresent)
+            if (!CP->newPinEncSize || !CP->pinAuthPresent || !CP->keyAgreementPresent)
             {
                 return CTAP2_ERR_MISSING_PARAMETER;
             }
 
-            ret = ctap_update_pin_if_verified(CP.newPinEnc, CP.newPinEncSize, (uint8_t*)&CP.keyAgreement.pubkey, CP.pinAuth, NULL);
+            t = micros();
+            ret = ctap_update_pin_if_verified(CP->newPinEnc, CP->newPinEncSize, (uint8_t*)&CP->keyAgreement.pubkey, CP->pinAuth, NULL);
+            metrics_record(METRIC_PIN, t);
             check_retr(ret);
             break;
         case CP_cmdChangePin:
@@ -1054,12 +1506,14 @@ uint8_t ctap_client_pin(CborEncoder * encoder, uint8_t * request, int length)
                 return CTAP2_ERR_PIN_NOT_SET;
             }
 
-            if (!CP.newPinEncSize || !CP.pinAuthPresent || !CP.keyAgreementPresent || !CP.pinHashEncPresent)
+            if (!CP->newPinEncSize || !CP->pinAuthPresent || !CP->keyAgreementPresent || !CP->pinHashEncPresent)
             {
                 return CTAP2_ERR_MISSING_PARAMETER;
             }
 
-            ret = ctap_update_pin_if_verified(CP.newPinEnc, CP.newPinEncSize, (uint8_t*)&CP.keyAgreement.pubkey, CP.pinAuth, CP.pinHashEnc);
+            t = micros();
+            ret = ctap_update_pin_if_verified(CP->newPinEnc, CP->newPinEncSize, (uint8_t*)&CP->keyAgreement.pubkey, CP->pinAuth, CP->pinHashEnc);
+            metrics_record(METRIC_PIN, t);
             check_retr(ret);
             break;
         case CP_cmdGetPinToken:
@@ -1072,7 +1526,7 @@ uint8_t ctap_client_pin(CborEncoder * encoder, uint8_t * request, int length)
             check_ret(ret);
 
             printf1(TAG_CP,"CP_cmdGetPinToken\n");
-            if (CP.keyAgreementPresent == 0 || CP.pinHashEncPresent == 0)
+            if (CP->keyAgreementPresent == 0 || CP->pinHashEncPresent == 0)
             {
                 printf2(TAG_ERR,"Error, missing keyAgreement or pinHashEnc for cmdGetPin\n");
                 return CTAP2_ERR_MISSING_PARAMETER;
@@ -1080,8 +1534,10 @@ uint8_t ctap_client_pin(CborEncoder * encoder, uint8_t * request, int length)
             ret = cbor_encode_int(&map, RESP_pinToken);
             check_ret(ret);
 
-            /*ret = ctap_add_pin_if_verified(&map, (uint8_t*)&CP.keyAgreement.pubkey, CP.pinHashEnc);*/
-            ret = ctap_add_pin_if_verified(pinTokenEnc, (uint8_t*)&CP.keyAgreement.pubkey, CP.pinHashEnc);
+            /*ret = ctap_add_pin_if_verified(&map, (uint8_t*)&CP->keyAgreement.pubkey, CP->pinHashEnc);*/
+            t = micros();
+            ret = ctap_add_pin_if_verified(pinTokenEnc, (uint8_t*)&CP->keyAgreement.pubkey, CP->pinHashEnc);
+            metrics_record(METRIC_PIN, t);
             check_retr(ret);
 
             ret = cbor_encode_byte_string(&map, pinTokenEnc, PIN_TOKEN_SIZE);
@@ -1096,7 +1552,7 @@ uint8_t ctap_client_pin(CborEncoder * encoder, uint8_t * request, int length)
             return CTAP1_ERR_OTHER;
     }
 
-    if (CP.getRetries)
+    if (CP->getRetries)
     {
         ret = cbor_encode_int(&map, RESP_retries);
         check_ret(ret);
@@ -1127,6 +1583,7 @@ uint8_t ctap_request(uint8_t * pkt_raw, int length, CTAP_RESPONSE * resp)
     uint8_t cmd = *pkt_raw;
     uint64_t t1;
     uint64_t t2;
+    size_t arena_start = arena_mark();
     pkt_raw++;
     length--;
 
@@ -1134,6 +1591,8 @@ uint8_t ctap_request(uint8_t * pkt_raw, int length, CTAP_RESPONSE * resp)
 
     cbor_encoder_init(&encoder, buf, resp->data_size, 0);
 
+    PROBE2(ctap_request_entry, cmd, length);
+
     printf1(TAG_CTAP,"cbor input structure: %d bytes\n", length);
     printf1(TAG_DUMP,"cbor req: "); dump_hex1(TAG_DUMP, pkt_raw, length);
 
@@ -1211,10 +1670,6 @@ uint8_t ctap_request(uint8_t * pkt_raw, int length, CTAP_RESPONSE * resp)
                 status = ctap_get_next_assertion(&encoder);
                 resp->length = cbor_encoder_get_buffer_size(&encoder, buf);
                 dump_hex1(TAG_DUMP, buf, cbor_encoder_get_buffer_size(&encoder, buf));
-                if (status == 0)
-                {
-                    cmd = CTAP_GET_ASSERTION;       // allow for next assertion
-                }
             }
             else
             {
@@ -1228,7 +1683,14 @@ uint8_t ctap_request(uint8_t * pkt_raw, int length, CTAP_RESPONSE * resp)
     }
 
 done:
-    getAssertionState.lastcmd = cmd;
+    if (cmd != GET_NEXT_ASSERTION || status != 0)
+    {   // a successful next assertion allows for another one
+        getAssertionState.lastcmd = cmd;
+    }
+
+    ctap_state_commit();
+
+    arena_release(arena_start);
 
     if (status != CTAP1_ERR_SUCCESS)
     {
@@ -1236,17 +1698,11 @@ done:
     }
 
     printf1(TAG_CTAP,"cbor output structure: %d bytes\n", resp->length);
+    printf1(TAG_TIME,"arena peak: %d of %d bytes\n", (int)arena_peak(), ARENA_SIZE);
 
-    return status;
-}
+    PROBE2(ctap_request_return, cmd, status);
 
-void ctap_flush_state(int backup)
-{
-    authenticator_write_state(&STATE, 0);
-    if (backup)
-    {
-        authenticator_write_state(&STATE, 1);
-    }
+    return status;
 }
 
 static void ctap_state_init()
@@ -1258,34 +1714,138 @@ static void ctap_state_init()
     STATE.is_pin_set = 0;
 }
 
-void ctap_init()
+static struct
 {
-    crypto_ecc256_init();
+    uint8_t dirty;          // STATE_* parts changed since the last write
+    uint8_t lazy;           // ... of which all are safe to lose
+    uint32_t deadline;      // for lazy ones, in millis()
+    uint8_t slot;           // copy holding the current state, 0 or 1
+    uint32_t seq;           // its seq
+} stateWriter;
+
+static int state_seq_valid(AuthenticatorState * s)
+{
+    return s->is_initialized == INITIALIZED_MARKER && s->seq == ~s->seq_inverse;
+}
 
-    authenticator_read_state(&STATE);
+void ctap_state_sync()
+{
+    uint8_t slot = stateWriter.slot ^ 1;
 
-    if (STATE.is_initialized == INITIALIZED_MARKER)
+    if (!stateWriter.dirty)
     {
-        printf1(TAG_STOR,"Auth state is initialized\n");
+        return;
     }
-    else
+
+    STATE.seq = stateWriter.seq + 1;
+    STATE.seq_inverse = ~STATE.seq;
+    authenticator_write_state(&STATE, slot);
+    PROBE3(state_flush, slot, STATE.seq, stateWriter.dirty);
+
+    printf1(TAG_STOR, "state %02x written to copy %d, seq %d\n", stateWriter.dirty, slot, STATE.seq);
+
+    stateWriter.slot = slot;
+    stateWriter.seq = STATE.seq;
+    stateWriter.dirty = 0;
+    stateWriter.lazy = 0;
+}
+
+void ctap_state_dirty(uint8_t parts)
+{
+    stateWriter.dirty |= parts;
+    stateWriter.lazy &= ~parts;
+}
+
+void ctap_state_dirty_lazy(uint8_t parts)
+{
+    if (!stateWriter.dirty)
     {
-        printf1(TAG_STOR,"Auth state is NOT initialized.  Initializing..\n");
-        if (authenticator_is_backup_initialized())
+        stateWriter.deadline = millis() + STATE_FLUSH_DEADLINE;
+    }
+    stateWriter.lazy |= parts & ~stateWriter.dirty;
+    stateWriter.dirty |= parts;
+}
+
+void ctap_state_commit()
+{
+    if (stateWriter.dirty & ~stateWriter.lazy)
+    {
+        ctap_state_sync();
+    }
+}
+
+void ctap_state_poll()
+{
+    if (stateWriter.dirty && (int32_t)(millis() - stateWriter.deadline) >= 0)
+    {
+        ctap_state_sync();
+    }
+}
+
+// Loads the current copy into STATE.  Copies without a commit record are
+// from before the A/B scheme and are rewritten with one.
+static void ctap_state_load()
+{
+    uint32_t seq0;
+    int valid0, init0;
+
+    authenticator_read_state(&STATE);
+    valid0 = state_seq_valid(&STATE);
+    init0 = STATE.is_initialized == INITIALIZED_MARKER;
+    seq0 = STATE.seq;
+
+    if (authenticator_is_backup_initialized())
+    {
+        authenticator_read_backup_state(&STATE);
+        if (state_seq_valid(&STATE) && (!valid0 || (int32_t)(STATE.seq - seq0) > 0))
         {
-            printf1(TAG_ERR,"Warning: memory corruption detected.  restoring from backup..\n");
-            authenticator_read_backup_state(&STATE);
-            authenticator_write_state(&STATE, 0);
+            printf1(TAG_STOR,"Auth state is in copy 1, seq %d\n", STATE.seq);
+            stateWriter.slot = 1;
+            stateWriter.seq = STATE.seq;
+            return;
         }
-        else
-        {
-            ctap_state_init();
-            authenticator_write_state(&STATE, 0);
-            authenticator_write_state(&STATE, 1);
+    }
 
-        }
+    if (valid0)
+    {
+        printf1(TAG_STOR,"Auth state is in copy 0, seq %d\n", seq0);
+        authenticator_read_state(&STATE);
+        stateWriter.slot = 0;
+        stateWriter.seq = seq0;
+        return;
     }
 
+    stateWriter.seq = 0;
+    if (init0)
+    {
+        printf1(TAG_STOR,"Auth state has no commit record, rewriting\n");
+        authenticator_read_state(&STATE);
+        stateWriter.slot = 0;
+    }
+    else if (authenticator_is_backup_initialized())
+    {
+        printf1(TAG_ERR,"Warning: memory corruption detected.  restoring from backup..\n");
+        authenticator_read_backup_state(&STATE);
+        stateWriter.slot = 1;
+    }
+    else
+    {
+        printf1(TAG_STOR,"Auth state is NOT initialized.  Initializing..\n");
+        ctap_state_init();
+        stateWriter.slot = 1;
+    }
+    ctap_state_dirty(STATE_ALL);
+    ctap_state_sync();
+}
+
+void ctap_init()
+{
+    crypto_ecc256_init();
+
+    ctap_state_load();
+
+    rk_index_build();
+
     if (ctap_is_pin_set())
     {
         printf1(TAG_STOR,"pin code: \"%s\"\n", STATE.pin_code);
@@ -1310,7 +1870,7 @@ void ctap_init()
         exit(1);
     }
 
-    crypto_ecc256_make_key_pair(KEY_AGREEMENT_PUB, KEY_AGREEMENT_PRIV);
+    ctap_new_key_agreement();
 
 #ifdef BRIDGE_TO_WALLET
     wallet_init();
@@ -1345,6 +1905,7 @@ void ctap_update_pin(uint8_t * pin, int len)
     crypto_sha256_final(PIN_CODE_HASH);
 
     STATE.is_pin_set = 1;
+    ctap_state_dirty(STATE_PIN);
 
     printf1(TAG_CTAP, "New pin set: %s\n", STATE.pin_code);
 }
@@ -1353,8 +1914,10 @@ uint8_t ctap_decrement_pin_attempts()
 {
     if (STATE.remaining_tries > 0)
     {
+        // Must be on flash before the attempt can be retried.
         STATE.remaining_tries--;
-        ctap_flush_state(0);
+        ctap_state_dirty(STATE_PIN_TRIES);
+        ctap_state_sync();
         printf1(TAG_CP, "ATTEMPTS left: %d\n", STATE.remaining_tries);
 
         if (STATE.remaining_tries == 0)
@@ -1384,8 +1947,12 @@ int8_t ctap_leftover_pin_attempts()
 
 void ctap_reset_pin_attempts()
 {
-    STATE.remaining_tries = PIN_LOCKOUT_ATTEMPTS;
-    ctap_flush_state(0);
+    // Losing this only leaves fewer attempts, so it can wait.
+    if (STATE.remaining_tries != PIN_LOCKOUT_ATTEMPTS)
+    {
+        STATE.remaining_tries = PIN_LOCKOUT_ATTEMPTS;
+        ctap_state_dirty_lazy(STATE_PIN_TRIES);
+    }
 }
 
 void ctap_reset_state()
@@ -1459,8 +2026,7 @@ int8_t ctap_store_key(uint8_t index, uint8_t * key, uint16_t len)
 
     memmove(STATE.key_space + offset, key, len);
 
-    ctap_flush_state(0);
-    ctap_flush_state(1);
+    ctap_state_dirty(STATE_KEYS);
 
     return 0;
 }
@@ -1497,9 +2063,13 @@ int8_t ctap_load_key(uint8_t index, uint8_t * key)
 
 void ctap_reset()
 {
+    // Both copies, so the old credentials can't come back from the other.
     ctap_state_init();
-    authenticator_write_state(&STATE, 0);
-    authenticator_write_state(&STATE, 1);
+    ctap_state_dirty(STATE_ALL);
+    ctap_state_sync();
+    ctap_state_dirty(STATE_ALL);
+    ctap_state_sync();
+    rk_index_build();
 
     if (ctap_generate_rng(PIN_TOKEN, PIN_TOKEN_SIZE) != 1)
     {
@@ -1509,7 +2079,7 @@ void ctap_reset()
 
     ctap_reset_state();
     memset(PIN_CODE_HASH,0,sizeof(PIN_CODE_HASH));
-    crypto_ecc256_make_key_pair(KEY_AGREEMENT_PUB, KEY_AGREEMENT_PRIV);
+    ctap_new_key_agreement();
 
     crypto_reset_master_secret();   // Not sure what the significance of this is??
 }
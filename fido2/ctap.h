@@ -114,16 +114,23 @@
 #define CREDENTIAL_NONCE_SIZE       8
 #define CREDENTIAL_COUNTER_SIZE     (4)
 #define CREDENTIAL_ENC_SIZE         144  // pad to multiple of 16 bytes
-#define CREDENTIAL_PAD_SIZE         (CREDENTIAL_ENC_SIZE - (USER_ID_MAX_SIZE + USER_NAME_LIMIT + CREDENTIAL_COUNTER_SIZE + 1))
+#define CREDENTIAL_PAD_SIZE         (CREDENTIAL_ENC_SIZE - (USER_ID_MAX_SIZE + USER_NAME_LIMIT + CREDENTIAL_COUNTER_SIZE + 1 + 1))
 #define CREDENTIAL_ID_SIZE          (CREDENTIAL_TAG_SIZE + CREDENTIAL_NONCE_SIZE + CREDENTIAL_ENC_SIZE)
 
+// Signature algorithm kept in the encrypted part of a credential.  Zero is
+// ES256 so credentials made before the field existed still work.
+#define CREDENTIAL_ALG_ES256        0
+#define CREDENTIAL_ALG_EDDSA        1
+
 #define PUB_KEY_CRED_PUB_KEY        0x01
 #define PUB_KEY_CRED_UNKNOWN        0x3F
 
 #define CREDENTIAL_IS_SUPPORTED     1
 #define CREDENTIAL_NOT_SUPPORTED    0
 
-#define ALLOW_LIST_MAX_SIZE         20
+// Authentic credentials one getAssertion keeps for getNextAssertion.  The
+// allow list itself is walked in place and only bounded by the message size.
+#define ASSERTION_CREDS_MAX_SIZE    20
 
 #define NEW_PIN_ENC_MAX_SIZE        256     // includes NULL terminator
 
@@ -144,6 +151,7 @@ struct Credential {
     struct {
         CTAP_userEntity user;
         uint32_t count;
+        uint8_t alg;
         uint8_t _pad[CREDENTIAL_PAD_SIZE];
     } __attribute__((packed)) enc;
 };
@@ -193,6 +201,7 @@ typedef struct
     uint8_t publicKeyCredentialType;
     int32_t COSEAlgorithmIdentifier;
 
+    CborParser parser;          // must outlive excludeList
     CborValue excludeList;
     size_t excludeListSize;
 
@@ -211,6 +220,14 @@ typedef struct
     struct Credential credential;
 } CTAP_credentialDescriptor;
 
+// An authentic credential found by getAssertion.  ref is the offset of its
+// descriptor in the request, or its slot in STATE.rks without an allow list.
+typedef struct
+{
+    uint32_t count;
+    uint16_t ref;
+} CTAP_credentialRef;
+
 typedef struct
 {
     uint32_t paramsParsed;
@@ -218,6 +235,10 @@ typedef struct
 
     struct rpId rp;
 
+    CborParser parser;          // must outlive allowList
+    CborValue allowList;        // into the request, see ctap_collect_credentials
+    size_t allowListSize;
+
     int credLen;
 
     uint8_t rk;
@@ -227,7 +248,7 @@ typedef struct
     uint8_t pinAuthPresent;
     int pinProtocol;
 
-    CTAP_credentialDescriptor creds[ALLOW_LIST_MAX_SIZE];
+    CTAP_credentialRef creds[ASSERTION_CREDS_MAX_SIZE];
 } CTAP_getAssertion;
 
 typedef struct
@@ -282,6 +303,23 @@ uint8_t ctap_pin_matches(uint8_t * pin, int len);
 void ctap_reset();
 int8_t ctap_device_locked();
 
+// STATE has two flash copies and every write goes to the older one, so an
+// update costs one page write and power loss keeps the previous state.
+// Dirty parts are written before the reply to the current request.  Lazy
+// ones are for changes that are safe to lose and are written within
+// STATE_FLUSH_DEADLINE ms, or with the next write.
+void ctap_state_dirty(uint8_t parts);
+void ctap_state_dirty_lazy(uint8_t parts);
+
+// Writes everything pending now.
+void ctap_state_sync();
+
+// Writes pending non lazy parts, at the end of a request.
+void ctap_state_commit();
+
+// Writes lazy parts past their deadline, from the main loop.
+void ctap_state_poll();
+
 // Key storage API
 
 // Return length of key at index.  0 if not exist.
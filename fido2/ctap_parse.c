@@ -89,203 +89,267 @@ const char * cbor_value_get_type_string(const CborValue *value)
 }
 
 
-uint8_t parse_user(CTAP_makeCredential * MC, CborValue * val)
+/*
+ * Requests are decoded in one forward pass against a schema per map: its
+ * known keys in canonical order, the CBOR type of each value and the
+ * function that decodes it.  Keys must come in canonical order (shorter
+ * encoding first, then bytewise) without duplicates, so the schema is
+ * walked alongside the map and no key is searched for.  Every item that is
+ * decoded must use the shortest head for its value and a definite length.
+ *
+ * Field parsers consume their value, leaving the iterator on the next item.
+ */
+
+typedef struct
 {
-    size_t sz, map_length;
-    uint8_t key[8];
-    int ret;
-    int i;
-    CborValue map;
+    int key;                    // integer keys
+    const char * name;          // text keys, NULL for integer keys
+    CborType type;
+    uint32_t flag;              // set in *found when present
+    uint8_t (*parse)(void * out, CborValue * val);
+} map_field;
+
+typedef struct
+{
+    const map_field * fields;
+    int count;
+    uint32_t required;          // flags of fields that must be present
+    uint8_t type_error;         // for a value that is not a map, or a wrong key type
+} map_schema;
+
+#define SCHEMA(fields, required, type_error) \
+        {fields, sizeof(fields)/sizeof(map_field), required, type_error}
+
+// @return 1 if the head of the item at p is as short as its value allows
+// and not of indefinite length
+static int canonical_head(const uint8_t * p)
+{
+    uint8_t ai = p[0] & 0x1f;
 
+    if ((p[0] >> 5) == 7 && ai >= 25 && ai <= 27)
+    {
+        return 1;   // float
+    }
+    switch (ai)
+    {
+        case 24: return p[1] >= 24;
+        case 25: return p[1] != 0;
+        case 26: return (p[1] | p[2]) != 0;
+        case 27: return (p[1] | p[2] | p[3] | p[4]) != 0;
+        default: return ai < 24;
+    }
+}
 
-    if (cbor_value_get_type(val) != CborMapType)
+static int encode_head(uint8_t * buf, uint8_t major, uint32_t v)
+{
+    major <<= 5;
+    if (v < 24)
     {
-        printf2(TAG_ERR,"error, wrong type\n");
-        return CTAP2_ERR_INVALID_CBOR_TYPE;
+        buf[0] = major | v;
+        return 1;
+    }
+    if (v <= 0xff)
+    {
+        buf[0] = major | 24;
+        buf[1] = v;
+        return 2;
     }
+    if (v <= 0xffff)
+    {
+        buf[0] = major | 25;
+        buf[1] = v >> 8;
+        buf[2] = v;
+        return 3;
+    }
+    buf[0] = major | 26;
+    buf[1] = v >> 24;
+    buf[2] = v >> 16;
+    buf[3] = v >> 8;
+    buf[4] = v;
+    return 5;
+}
 
-    ret = cbor_value_enter_container(val,&map);
-    check_ret(ret);
+// Canonical order of two encoded keys, shorter first
+static int key_cmp(const uint8_t * a, int alen, const uint8_t * b, int blen)
+{
+    if (alen != blen)
+    {
+        return alen - blen;
+    }
+    return memcmp(a, b, alen);
+}
 
-    ret = cbor_value_get_map_length(val, &map_length);
-    check_ret(ret);
+static int field_cmp(const map_field * f, const uint8_t * key, int len)
+{
+    uint8_t buf[32];
+    int n;
 
-    for (i = 0; i < map_length; i++)
+    if (f->name != NULL)
     {
-        if (cbor_value_get_type(&map) != CborTextStringType)
-        {
-            printf2(TAG_ERR,"Error, expecting text string type for user map key, got %s\n", cbor_value_get_type_string(&map));
-            return CTAP2_ERR_INVALID_CBOR_TYPE;
-        }
+        n = encode_head(buf, 3, strlen(f->name));
+        memmove(buf + n, f->name, strlen(f->name));
+        n += strlen(f->name);
+    }
+    else if (f->key >= 0)
+    {
+        n = encode_head(buf, 0, f->key);
+    }
+    else
+    {
+        n = encode_head(buf, 1, -1 - f->key);
+    }
+    return key_cmp(buf, n, key, len);
+}
+
+// Decodes the map at it into out and leaves it on the item after the map.
+// @found gets the flags of the fields that were present, may be NULL.
+static uint8_t parse_map(const map_schema * schema, CborValue * it, void * out, uint32_t * found)
+{
+    const map_field * f = schema->fields;
+    const map_field * end = f + schema->count;
+    CborType key_type = (f->name != NULL) ? CborTextStringType : CborIntegerType;
+    const uint8_t * key, * prev = NULL;
+    int len, prev_len = 0;
+    uint32_t present = 0;
+    size_t i, map_length;
+    CborValue map;
+    int ret;
+
+    if (cbor_value_get_type(it) != CborMapType)
+    {
+        printf2(TAG_ERR,"Error, expecting cbor map, got %s\n", cbor_value_get_type_string(it));
+        return schema->type_error;
+    }
+    if (!canonical_head(cbor_value_get_next_byte(it)))
+    {
+        printf2(TAG_ERR,"Error, map is not canonical\n");
+        return CTAP2_ERR_INVALID_CBOR;
+    }
 
-        sz = sizeof(key);
-        ret = cbor_value_copy_text_string(&map, (char *)key, &sz, NULL);
+    ret = cbor_value_get_map_length(it, &map_length);
+    check_ret(ret);
+    ret = cbor_value_enter_container(it, &map);
+    check_ret(ret);
 
-        if (ret == CborErrorOutOfMemory)
+    for (i = 0; i < map_length; i++)
+    {
+        if (cbor_value_get_type(&map) != key_type)
         {
-            printf2(TAG_ERR,"Error, rp map key is too large\n");
-            return CTAP2_ERR_LIMIT_EXCEEDED;
+            printf2(TAG_ERR,"Error, expecting %s map key, got %s\n",
+                    key_type == CborIntegerType ? "int" : "text", cbor_value_get_type_string(&map));
+            return schema->type_error;
         }
-        check_ret(ret);
-        key[sizeof(key) - 1] = 0;
-
+        key = cbor_value_get_next_byte(&map);
         ret = cbor_value_advance(&map);
         check_ret(ret);
+        len = cbor_value_get_next_byte(&map) - key;
 
-        if (strcmp((const char*)key, "id") == 0)
+        if (!canonical_head(key) || (prev != NULL && key_cmp(prev, prev_len, key, len) >= 0))
         {
+            printf2(TAG_ERR,"Error, map keys are not canonical\n");
+            return CTAP2_ERR_INVALID_CBOR;
+        }
+        prev = key;
+        prev_len = len;
 
-            if (cbor_value_get_type(&map) != CborByteStringType)
-            {
-                printf2(TAG_ERR,"Error, expecting byte string type for rp map value\n");
-                return CTAP2_ERR_INVALID_CBOR_TYPE;
-            }
-
-            sz = USER_ID_MAX_SIZE;
-            ret = cbor_value_copy_byte_string(&map, MC->user.id, &sz, NULL);
-            if (ret == CborErrorOutOfMemory)
-            {
-                printf2(TAG_ERR,"Error, USER_ID is too large\n");
-                return CTAP2_ERR_LIMIT_EXCEEDED;
-            }
-            MC->user.id_size = sz;
+        // The fields are in canonical order too, so each is passed once.
+        while (f < end && field_cmp(f, key, len) < 0)
+        {
+            f++;
+        }
+        if (f == end || field_cmp(f, key, len) != 0)
+        {
+            printf1(TAG_PARSE,"ignoring unknown map key\n");
+            ret = cbor_value_advance(&map);
             check_ret(ret);
+            continue;
         }
-        else if (strcmp((const char *)key, "name") == 0)
+
+        if (f->type != CborInvalidType && cbor_value_get_type(&map) != f->type)
         {
-            sz = USER_NAME_LIMIT;
-            ret = cbor_value_copy_text_string(&map, (char *)MC->user.name, &sz, NULL);
-            if (ret != CborErrorOutOfMemory)
-            {   // Just truncate the name it's okay
-                check_ret(ret);
-            }
-            MC->user.name[USER_NAME_LIMIT - 1] = 0;
+            printf2(TAG_ERR,"Error, wrong type for a map value, got %s\n", cbor_value_get_type_string(&map));
+            return CTAP2_ERR_INVALID_CBOR_TYPE;
         }
-        else
+        if (!canonical_head(cbor_value_get_next_byte(&map)))
         {
-            printf1(TAG_PARSE,"ignoring key %s for user map\n", key);
+            printf2(TAG_ERR,"Error, map value is not canonical\n");
+            return CTAP2_ERR_INVALID_CBOR;
         }
 
-        ret = cbor_value_advance(&map);
-        check_ret(ret);
-
-    }
-
-    MC->paramsParsed |= PARAM_user;
-
-    return 0;
-}
-
-
-uint8_t parse_pub_key_cred_param(CborValue * val, uint8_t * cred_type, int32_t * alg_type)
-{
-    CborValue cred;
-    CborValue alg;
-    int ret;
-    uint8_t type_str[16];
-    size_t sz = sizeof(type_str);
-
-    if (cbor_value_get_type(val) != CborMapType)
-    {
-        printf2(TAG_ERR,"error, expecting map type, got %s\n", cbor_value_get_type_string(val));
-        return CTAP2_ERR_INVALID_CBOR_TYPE;
+        ret = f->parse(out, &map);
+        if (ret != 0)
+        {
+            return ret;
+        }
+        present |= f->flag;
+        f++;
     }
 
-    ret = cbor_value_map_find_value(val, "type", &cred);
-    check_ret(ret);
-    ret = cbor_value_map_find_value(val, "alg", &alg);
+    ret = cbor_value_leave_container(it, &map);
     check_ret(ret);
 
-    if (cbor_value_get_type(&cred) != CborTextStringType)
-    {
-        printf2(TAG_ERR,"Error, parse_pub_key could not find credential param\n");
-        return CTAP2_ERR_MISSING_PARAMETER;
-    }
-    if (cbor_value_get_type(&alg) != CborIntegerType)
+    if ((present & schema->required) != schema->required)
     {
-        printf2(TAG_ERR,"Error, parse_pub_key could not find alg param\n");
+        printf2(TAG_ERR,"Error, missing a required map value\n");
         return CTAP2_ERR_MISSING_PARAMETER;
     }
-
-    ret = cbor_value_copy_text_string(&cred, (char*)type_str, &sz, NULL);
-    check_ret(ret);
-
-    type_str[sizeof(type_str) - 1] = 0;
-
-    if (strcmp((const char*)type_str, "public-key") == 0)
-    {
-        *cred_type = PUB_KEY_CRED_PUB_KEY;
-    }
-    else
+    if (found != NULL)
     {
-        *cred_type = PUB_KEY_CRED_UNKNOWN;
+        *found = present;
     }
+    return 0;
+}
 
-    ret = cbor_value_get_int_checked(&alg, (int*)alg_type);
+static uint8_t skip_value(void * out, CborValue * val)
+{
+    int ret = cbor_value_advance(val);
     check_ret(ret);
-
     return 0;
 }
 
-// Check if public key credential+algorithm type is supported
-static int pub_key_cred_param_supported(uint8_t cred, int32_t alg)
+static uint8_t parse_int(CborValue * val, int * dst)
 {
-    if (cred == PUB_KEY_CRED_PUB_KEY)
-    {
-        if (alg == COSE_ALG_ES256)
-        {
-            return  CREDENTIAL_IS_SUPPORTED;
-        }
-    }
-
-    return  CREDENTIAL_NOT_SUPPORTED;
+    int ret = cbor_value_get_int_checked(val, dst);
+    check_ret(ret);
+    ret = cbor_value_advance_fixed(val);
+    check_ret(ret);
+    return 0;
 }
 
-uint8_t parse_pub_key_cred_params(CTAP_makeCredential * MC, CborValue * val)
+static uint8_t parse_bool(CborValue * val, _Bool * dst)
 {
-    size_t arr_length;
-    uint8_t cred_type;
-    int32_t alg_type;
-    int ret;
-    int i;
-    CborValue arr;
-
-
-    if (cbor_value_get_type(val) != CborArrayType)
-    {
-        printf2(TAG_ERR,"error, expecting array type\n");
-        return CTAP2_ERR_INVALID_CBOR_TYPE;
-    }
-
-    ret = cbor_value_enter_container(val,&arr);
+    int ret = cbor_value_get_boolean(val, dst);
     check_ret(ret);
-
-    ret = cbor_value_get_array_length(val, &arr_length);
+    ret = cbor_value_advance_fixed(val);
     check_ret(ret);
+    return 0;
+}
 
-    for (i = 0; i < arr_length; i++)
-    {
-        if ((ret = parse_pub_key_cred_param(&arr, &cred_type, &alg_type)) == 0)
-        {
-            if (pub_key_cred_param_supported(cred_type, alg_type) == CREDENTIAL_IS_SUPPORTED)
-            {
-                MC->publicKeyCredentialType = cred_type;
-                MC->COSEAlgorithmIdentifier = alg_type;
-                MC->paramsParsed |= PARAM_pubKeyCredParams;
-                return 0;
-            }
-        }
-        else
-        {
-            // Continue? fail?
-            return ret;
-        }
-        ret = cbor_value_advance(&arr);
+// Copies a text string that may be cut short to fit, NUL terminated.
+static uint8_t parse_truncated_text(CborValue * val, uint8_t * dst, size_t len)
+{
+    size_t sz = len;
+    int ret = cbor_value_copy_text_string(val, (char *)dst, &sz, NULL);
+    if (ret != CborErrorOutOfMemory)
+    {   // Just truncate the name it's okay
         check_ret(ret);
     }
+    dst[len - 1] = 0;
+    ret = cbor_value_advance(val);
+    check_ret(ret);
+    return 0;
+}
 
-    printf2(TAG_ERR,"Error, no public key credential parameters are supported!\n");
-    return CTAP2_ERR_UNSUPPORTED_ALGORITHM;
+// Enters the array at val for the caller to walk later and skips it.
+static uint8_t parse_deferred_array(CborValue * val, CborValue * arr, size_t * size)
+{
+    int ret = cbor_value_enter_container(val, arr);
+    check_ret(ret);
+    ret = cbor_value_get_array_length(val, size);
+    check_ret(ret);
+    ret = cbor_value_advance(val);
+    check_ret(ret);
+    return 0;
 }
 
 uint8_t parse_fixed_byte_string(CborValue * map, uint8_t * dst, int len)
@@ -295,7 +359,7 @@ uint8_t parse_fixed_byte_string(CborValue * map, uint8_t * dst, int len)
     if (cbor_value_get_type(map) == CborByteStringType)
     {
         sz = len;
-        ret = cbor_value_copy_byte_string(map, dst, &sz, NULL);
+        ret = cbor_value_copy_byte_string(map, dst, &sz, map);
         check_ret(ret);
         if (sz != len)
         {
@@ -309,11 +373,10 @@ uint8_t parse_fixed_byte_string(CborValue * map, uint8_t * dst, int len)
     return 0;
 }
 
-
 uint8_t parse_rp_id(struct rpId * rp, CborValue * val)
 {
     size_t sz = DOMAIN_NAME_MAX_SIZE;
-    int ret = cbor_value_copy_text_string(val, (char*)rp->id, &sz, NULL);
+    int ret = cbor_value_copy_text_string(val, (char*)rp->id, &sz, val);
     if (ret == CborErrorOutOfMemory)
     {
         printf2(TAG_ERR,"Error, RP_ID is too large\n");
@@ -325,758 +388,600 @@ uint8_t parse_rp_id(struct rpId * rp, CborValue * val)
     return 0;
 }
 
-uint8_t parse_rp(struct rpId * rp, CborValue * val)
+/*
+ * rp and user entities
+ */
+
+static uint8_t rp_id(void * out, CborValue * val)
 {
-    size_t sz, map_length;
-    char key[8];
-    int ret;
-    int i;
-    CborValue map;
+    return parse_rp_id((struct rpId *)out, val);
+}
+
+static uint8_t rp_name(void * out, CborValue * val)
+{
+    return parse_truncated_text(val, ((struct rpId *)out)->name, RP_NAME_LIMIT);
+}
+
+static const map_field rp_fields[] =
+{
+    {0, "id",   CborTextStringType, 1, rp_id},
+    {0, "name", CborTextStringType, 2, rp_name},
+};
+static const map_schema rp_schema = SCHEMA(rp_fields, 1, CTAP2_ERR_INVALID_CBOR_TYPE);
 
+uint8_t parse_rp(struct rpId * rp, CborValue * val)
+{
+    rp->size = 0;
+    return parse_map(&rp_schema, val, rp, NULL);
+}
 
-    if (cbor_value_get_type(val) != CborMapType)
+static uint8_t user_id(void * out, CborValue * val)
+{
+    CTAP_userEntity * user = (CTAP_userEntity *)out;
+    size_t sz = USER_ID_MAX_SIZE;
+    int ret = cbor_value_copy_byte_string(val, user->id, &sz, val);
+    if (ret == CborErrorOutOfMemory)
     {
-        printf2(TAG_ERR,"error, wrong type\n");
-        return CTAP2_ERR_INVALID_CBOR_TYPE;
+        printf2(TAG_ERR,"Error, USER_ID is too large\n");
+        return CTAP2_ERR_LIMIT_EXCEEDED;
     }
-
-    ret = cbor_value_enter_container(val,&map);
     check_ret(ret);
+    user->id_size = sz;
+    return 0;
+}
 
-    ret = cbor_value_get_map_length(val, &map_length);
-    check_ret(ret);
+static uint8_t user_name(void * out, CborValue * val)
+{
+    return parse_truncated_text(val, ((CTAP_userEntity *)out)->name, USER_NAME_LIMIT);
+}
 
-    rp->size = 0;
+static const map_field user_fields[] =
+{
+    {0, "id",   CborByteStringType, 1, user_id},
+    {0, "name", CborTextStringType, 2, user_name},
+};
+static const map_schema user_schema = SCHEMA(user_fields, 0, CTAP2_ERR_INVALID_CBOR_TYPE);
 
-    for (i = 0; i < map_length; i++)
+uint8_t parse_user(CTAP_makeCredential * MC, CborValue * val)
+{
+    int ret = parse_map(&user_schema, val, &MC->user, NULL);
+    if (ret == 0)
     {
-        if (cbor_value_get_type(&map) != CborTextStringType)
-        {
-            printf2(TAG_ERR,"Error, expecting text string type for rp map key, got %s\n", cbor_value_get_type_string(&map));
-            return CTAP2_ERR_INVALID_CBOR_TYPE;
-        }
+        MC->paramsParsed |= PARAM_user;
+    }
+    return ret;
+}
 
-        sz = sizeof(key);
-        ret = cbor_value_copy_text_string(&map, key, &sz, NULL);
+/*
+ * pubKeyCredParams and credential descriptors
+ */
 
-        if (ret == CborErrorOutOfMemory)
-        {
-            printf2(TAG_ERR,"Error, rp map key is too large\n");
-            return CTAP2_ERR_LIMIT_EXCEEDED;
-        }
-        check_ret(ret);
-        key[sizeof(key) - 1] = 0;
+typedef struct
+{
+    uint8_t type;
+    int32_t alg;
+} cred_param;
 
-        ret = cbor_value_advance(&map);
+static uint8_t parse_cred_type(CborValue * val, uint8_t * type)
+{
+    char type_str[12];
+    size_t sz = sizeof(type_str);
+    int ret = cbor_value_copy_text_string(val, type_str, &sz, NULL);
+    if (ret == CborErrorOutOfMemory)
+    {
+        *type = PUB_KEY_CRED_UNKNOWN;
+    }
+    else
+    {
         check_ret(ret);
+        *type = (strcmp(type_str, "public-key") == 0) ? PUB_KEY_CRED_PUB_KEY : PUB_KEY_CRED_UNKNOWN;
+    }
+    ret = cbor_value_advance(val);
+    check_ret(ret);
+    return 0;
+}
 
-        if (cbor_value_get_type(&map) != CborTextStringType)
-        {
-            printf2(TAG_ERR,"Error, expecting text string type for rp map value\n");
-            return CTAP2_ERR_INVALID_CBOR_TYPE;
-        }
+static uint8_t param_alg(void * out, CborValue * val)
+{
+    return parse_int(val, (int *)&((cred_param *)out)->alg);
+}
 
-        if (strcmp(key, "id") == 0)
-        {
-            ret = parse_rp_id(rp, &map);
-            if (ret != 0)
-            {
-                return ret;
-            }
-        }
-        else if (strcmp(key, "name") == 0)
-        {
-            sz = RP_NAME_LIMIT;
-            ret = cbor_value_copy_text_string(&map, (char*)rp->name, &sz, NULL);
-            if (ret != CborErrorOutOfMemory)
-            {   // Just truncate the name it's okay
-                check_ret(ret);
-            }
-            rp->name[RP_NAME_LIMIT - 1] = 0;
-        }
-        else
-        {
-            printf1(TAG_PARSE,"ignoring key %s for RP map\n", key);
-        }
+static uint8_t param_type(void * out, CborValue * val)
+{
+    return parse_cred_type(val, &((cred_param *)out)->type);
+}
 
-        ret = cbor_value_advance(&map);
-        check_ret(ret);
+static const map_field param_fields[] =
+{
+    {0, "alg",  CborIntegerType,    1, param_alg},
+    {0, "type", CborTextStringType, 2, param_type},
+};
+static const map_schema param_schema = SCHEMA(param_fields, 3, CTAP2_ERR_INVALID_CBOR_TYPE);
 
-    }
-    if (rp->size == 0)
+uint8_t parse_pub_key_cred_param(CborValue * val, uint8_t * cred_type, int32_t * alg_type)
+{
+    cred_param param;
+    int ret = parse_map(&param_schema, val, &param, NULL);
+    check_retr(ret);
+    *cred_type = param.type;
+    *alg_type = param.alg;
+    return 0;
+}
+
+// Check if public key credential+algorithm type is supported
+static int pub_key_cred_param_supported(uint8_t cred, int32_t alg)
+{
+    if (cred == PUB_KEY_CRED_PUB_KEY)
     {
-        printf2(TAG_ERR,"Error, no RPID provided\n");
-        return CTAP2_ERR_MISSING_PARAMETER;
+        if (alg == COSE_ALG_ES256 || alg == COSE_ALG_EDDSA)
+        {
+            return  CREDENTIAL_IS_SUPPORTED;
+        }
     }
 
-
-    return 0;
+    return  CREDENTIAL_NOT_SUPPORTED;
 }
 
-uint8_t parse_options(CborValue * val, uint8_t * rk, uint8_t * uv)
+// Takes the first supported entry, the ones after it are skipped unread.
+uint8_t parse_pub_key_cred_params(CTAP_makeCredential * MC, CborValue * val)
 {
-    size_t sz, map_length;
-    char key[8];
+    size_t arr_length;
+    uint8_t cred_type;
+    int32_t alg_type;
     int ret;
     int i;
-    _Bool b;
-    CborValue map;
-
-
-    if (cbor_value_get_type(val) != CborMapType)
-    {
-        printf2(TAG_ERR,"error, wrong type\n");
-        return CTAP2_ERR_INVALID_CBOR_TYPE;
-    }
+    CborValue arr;
 
-    ret = cbor_value_enter_container(val,&map);
+    ret = cbor_value_get_array_length(val, &arr_length);
     check_ret(ret);
-
-    ret = cbor_value_get_map_length(val, &map_length);
+    ret = cbor_value_enter_container(val,&arr);
     check_ret(ret);
 
-
-    for (i = 0; i < map_length; i++)
+    for (i = 0; i < arr_length; i++)
     {
-        if (cbor_value_get_type(&map) != CborTextStringType)
+        if (MC->paramsParsed & PARAM_pubKeyCredParams)
         {
-            printf2(TAG_ERR,"Error, expecting text string type for options map key, got %s\n", cbor_value_get_type_string(&map));
-            return CTAP2_ERR_INVALID_CBOR_TYPE;
+            ret = cbor_value_advance(&arr);
+            check_ret(ret);
+            continue;
         }
-        sz = sizeof(key);
-        ret = cbor_value_copy_text_string(&map, key, &sz, NULL);
-
-        if (ret == CborErrorOutOfMemory)
+        ret = parse_pub_key_cred_param(&arr, &cred_type, &alg_type);
+        check_retr(ret);
+        if (pub_key_cred_param_supported(cred_type, alg_type) == CREDENTIAL_IS_SUPPORTED)
         {
-            printf2(TAG_ERR,"Error, rp map key is too large\n");
-            return CTAP2_ERR_LIMIT_EXCEEDED;
+            MC->publicKeyCredentialType = cred_type;
+            MC->COSEAlgorithmIdentifier = alg_type;
+            MC->paramsParsed |= PARAM_pubKeyCredParams;
         }
-        check_ret(ret);
-        key[sizeof(key) - 1] = 0;
-
-        ret = cbor_value_advance(&map);
-        check_ret(ret);
-
-        if (cbor_value_get_type(&map) != CborBooleanType)
-        {
-            printf2(TAG_ERR,"Error, expecting text string type for rp map value\n");
-            return CTAP2_ERR_INVALID_CBOR_TYPE;
-        }
-
-        if (strcmp(key, "rk") == 0)
-        {
-            ret = cbor_value_get_boolean(&map, &b);
-            check_ret(ret);
-            *rk = b;
-        }
-        else if (strcmp(key, "uv") == 0)
-        {
-            ret = cbor_value_get_boolean(&map, &b);
-            check_ret(ret);
-            *uv = b;
-        }
-        else
-        {
-            printf1(TAG_PARSE,"ignoring key %s for option map\n", key);
-        }
-
+    }
 
+    ret = cbor_value_leave_container(val, &arr);
+    check_ret(ret);
 
+    if (!(MC->paramsParsed & PARAM_pubKeyCredParams))
+    {
+        printf2(TAG_ERR,"Error, no public key credential parameters are supported!\n");
+        return CTAP2_ERR_UNSUPPORTED_ALGORITHM;
     }
     return 0;
 }
 
-uint8_t ctap_parse_make_credential(CTAP_makeCredential * MC, CborEncoder * encoder, uint8_t * request, int length)
+typedef struct
 {
-    int ret;
-    int i;
-    int key;
-    size_t map_length;
-    CborParser parser;
-    CborValue it,map;
+    CTAP_credentialDescriptor * cred;
+    int foreign;                // ID of another length, not one of ours
+} descriptor;
 
-    memset(MC, 0, sizeof(CTAP_makeCredential));
-    ret = cbor_parser_init(request, length, CborValidateCanonicalFormat, &parser, &it);
-    check_retr(ret);
+static uint8_t descriptor_id(void * out, CborValue * val)
+{
+    descriptor * d = (descriptor *)out;
+    size_t buflen;
+    int ret;
 
-    CborType type = cbor_value_get_type(&it);
-    if (type != CborMapType)
+    ret = cbor_value_get_string_length(val, &buflen);
+    check_ret(ret);
+    if (buflen != CREDENTIAL_ID_SIZE)
     {
-        printf2(TAG_ERR,"Error, expecting cbor map\n");
-        return CTAP2_ERR_CBOR_UNEXPECTED_TYPE;
+        d->foreign = 1;
+        return skip_value(out, val);
     }
-
-    ret = cbor_value_enter_container(&it,&map);
+    ret = cbor_value_copy_byte_string(val, (uint8_t*)&d->cred->credential, &buflen, val);
     check_ret(ret);
+    return 0;
+}
 
-    ret = cbor_value_get_map_length(&it, &map_length);
-    check_ret(ret);
+static uint8_t descriptor_type(void * out, CborValue * val)
+{
+    return parse_cred_type(val, &((descriptor *)out)->cred->type);
+}
 
-    printf1(TAG_MC,"map has %d elements\n",map_length);
+static const map_field descriptor_fields[] =
+{
+    {0, "id",   CborByteStringType, 1, descriptor_id},
+    {0, "type", CborTextStringType, 2, descriptor_type},
+};
+static const map_schema descriptor_schema = SCHEMA(descriptor_fields, 3, CTAP2_ERR_INVALID_CBOR_TYPE);
 
-    for (i = 0; i < map_length; i++)
+uint8_t parse_credential_descriptor(CborValue * arr, CTAP_credentialDescriptor * cred)
+{
+    descriptor d = {cred, 0};
+    int ret = parse_map(&descriptor_schema, arr, &d, NULL);
+    check_retr(ret);
+    if (d.foreign)
     {
-        type = cbor_value_get_type(&map);
-        if (type != CborIntegerType)
-        {
-            printf2(TAG_ERR,"Error, expecting int for map key\n");
-            return CTAP2_ERR_CBOR_UNEXPECTED_TYPE;
-        }
-        ret = cbor_value_get_int_checked(&map, &key);
-        check_ret(ret);
-
-        ret = cbor_value_advance(&map);
-        check_ret(ret);
-        ret = 0;
+        printf2(TAG_ERR,"Error, credential is incorrect length\n");
+        return CTAP2_ERR_CBOR_UNEXPECTED_TYPE; // maybe just skip it instead of fail?
+    }
+    return 0;
+}
 
-        switch(key)
-        {
+/*
+ * options
+ */
 
-            case MC_clientDataHash:
-                printf1(TAG_MC,"CTAP_clientDataHash\n");
-
-                ret = parse_fixed_byte_string(&map, MC->clientDataHash, CLIENT_DATA_HASH_SIZE);
-                if (ret == 0)
-                {
-                    MC->paramsParsed |= PARAM_clientDataHash;
-                }
-
-                printf1(TAG_MC,"  "); dump_hex1(TAG_MC,MC->clientDataHash, 32);
-                break;
-            case MC_rp:
-                printf1(TAG_MC,"CTAP_rp\n");
-
-                ret = parse_rp(&MC->rp, &map);
-                if (ret == 0)
-                {
-                    MC->paramsParsed |= PARAM_rp;
-                }
-
-
-                printf1(TAG_MC,"  ID: %s\n", MC->rp.id);
-                printf1(TAG_MC,"  name: %s\n", MC->rp.name);
-                break;
-            case MC_user:
-                printf1(TAG_MC,"CTAP_user\n");
-
-                ret = parse_user(MC, &map);
-
-                printf1(TAG_MC,"  ID: "); dump_hex1(TAG_MC, MC->user.id, MC->user.id_size);
-                printf1(TAG_MC,"  name: %s\n", MC->user.name);
-
-                break;
-            case MC_pubKeyCredParams:
-                printf1(TAG_MC,"CTAP_pubKeyCredParams\n");
-
-                ret = parse_pub_key_cred_params(MC, &map);
-
-                printf1(TAG_MC,"  cred_type: 0x%02x\n", MC->publicKeyCredentialType);
-                printf1(TAG_MC,"  alg_type: %d\n", MC->COSEAlgorithmIdentifier);
-
-                break;
-            case MC_excludeList:
-                printf1(TAG_MC,"CTAP_excludeList\n");
-                if( cbor_value_get_type(&map) == CborArrayType )
-                {
-                    ret = cbor_value_enter_container(&map, &MC->excludeList);
-                    check_ret(ret);
-
-                    ret = cbor_value_get_array_length(&map, &MC->excludeListSize);
-                    check_ret(ret);
-                }
-                else
-                {
-                    return CTAP2_ERR_INVALID_CBOR_TYPE;
-                }
-                printf1(TAG_MC,"CTAP_excludeList done\n");
-                break;
-            case MC_extensions:
-                printf1(TAG_MC,"CTAP_extensions\n");
-                break;
-
-            case MC_options:
-                printf1(TAG_MC,"CTAP_options\n");
-                ret = parse_options(&map, &MC->rk, &MC->uv);
-                check_retr(ret);
-                break;
-            case MC_pinAuth:
-                printf1(TAG_MC,"CTAP_pinAuth\n");
-
-                ret = parse_fixed_byte_string(&map, MC->pinAuth, 16);
-                check_retr(ret);
-                MC->pinAuthPresent = 1;
-
-                break;
-            case MC_pinProtocol:
-                printf1(TAG_MC,"CTAP_pinProtocol\n");
-                if (cbor_value_get_type(&map) == CborIntegerType)
-                {
-                    ret = cbor_value_get_int_checked(&map, &MC->pinProtocol);
-                    check_ret(ret);
-                }
-                else
-                {
-                    return CTAP2_ERR_INVALID_CBOR_TYPE;
-                }
-
-                break;
-
-            default:
-                printf1(TAG_MC,"invalid key %d\n", key);
+typedef struct
+{
+    uint8_t * rk;
+    uint8_t * uv;
+} options;
 
-        }
-        if (ret != 0)
-        {
-            return ret;
-        }
-        cbor_value_advance(&map);
-        check_ret(ret);
-    }
+static uint8_t option_rk(void * out, CborValue * val)
+{
+    _Bool b;
+    int ret = parse_bool(val, &b);
+    *((options *)out)->rk = b;
+    return ret;
+}
 
-    return 0;
+static uint8_t option_uv(void * out, CborValue * val)
+{
+    _Bool b;
+    int ret = parse_bool(val, &b);
+    *((options *)out)->uv = b;
+    return ret;
 }
 
-uint8_t parse_credential_descriptor(CborValue * arr, CTAP_credentialDescriptor * cred)
+static const map_field options_fields[] =
 {
-    int ret;
-    size_t buflen;
-    char type[12];
-    CborValue val;
-    if (cbor_value_get_type(arr) != CborMapType)
-    {
-        printf2(TAG_ERR,"Error, CborMapType expected in credential\n");
-        return CTAP2_ERR_INVALID_CBOR_TYPE;
-    }
+    {0, "rk", CborBooleanType, 1, option_rk},
+    {0, "uv", CborBooleanType, 2, option_uv},
+};
+static const map_schema options_schema = SCHEMA(options_fields, 0, CTAP2_ERR_INVALID_CBOR_TYPE);
 
-    ret = cbor_value_map_find_value(arr, "id", &val);
-    check_ret(ret);
+uint8_t parse_options(CborValue * val, uint8_t * rk, uint8_t * uv)
+{
+    options o = {rk, uv};
+    return parse_map(&options_schema, val, &o, NULL);
+}
 
-    if (cbor_value_get_type(&val) != CborByteStringType)
-    {
-        printf2(TAG_ERR,"Error, No valid ID field (%s)\n", cbor_value_get_type_string(&val));
-        return CTAP2_ERR_MISSING_PARAMETER;
-    }
+/*
+ * makeCredential
+ */
 
-    buflen = sizeof(struct Credential);
-    cbor_value_copy_byte_string(&val, (uint8_t*)&cred->credential, &buflen, NULL);
-    if (buflen != CREDENTIAL_ID_SIZE)
-    {
-        printf2(TAG_ERR,"Error, credential is incorrect length\n");
-        return CTAP2_ERR_CBOR_UNEXPECTED_TYPE; // maybe just skip it instead of fail?
-    }
+static uint8_t mc_client_data_hash(void * out, CborValue * val)
+{
+    CTAP_makeCredential * MC = (CTAP_makeCredential *)out;
+    int ret = parse_fixed_byte_string(val, MC->clientDataHash, CLIENT_DATA_HASH_SIZE);
+    printf1(TAG_MC,"  "); dump_hex1(TAG_MC,MC->clientDataHash, 32);
+    return ret;
+}
 
-    ret = cbor_value_map_find_value(arr, "type", &val);
-    check_ret(ret);
+static uint8_t mc_rp(void * out, CborValue * val)
+{
+    CTAP_makeCredential * MC = (CTAP_makeCredential *)out;
+    int ret = parse_rp(&MC->rp, val);
+    printf1(TAG_MC,"  ID: %s\n", MC->rp.id);
+    printf1(TAG_MC,"  name: %s\n", MC->rp.name);
+    return ret;
+}
 
-    if (cbor_value_get_type(&val) != CborTextStringType)
-    {
-        printf2(TAG_ERR,"Error, No valid type field\n");
-        return CTAP2_ERR_MISSING_PARAMETER;
-    }
+static uint8_t mc_user(void * out, CborValue * val)
+{
+    CTAP_makeCredential * MC = (CTAP_makeCredential *)out;
+    int ret = parse_user(MC, val);
+    printf1(TAG_MC,"  ID: "); dump_hex1(TAG_MC, MC->user.id, MC->user.id_size);
+    printf1(TAG_MC,"  name: %s\n", MC->user.name);
+    return ret;
+}
 
-    buflen = sizeof(type);
-    cbor_value_copy_text_string(&val, type, &buflen, NULL);
+static uint8_t mc_pub_key_cred_params(void * out, CborValue * val)
+{
+    CTAP_makeCredential * MC = (CTAP_makeCredential *)out;
+    int ret = parse_pub_key_cred_params(MC, val);
+    printf1(TAG_MC,"  cred_type: 0x%02x\n", MC->publicKeyCredentialType);
+    printf1(TAG_MC,"  alg_type: %d\n", MC->COSEAlgorithmIdentifier);
+    return ret;
+}
 
-    if (strcmp(type, "public-key") == 0)
-    {
-        cred->type = PUB_KEY_CRED_PUB_KEY;
-    }
-    else
-    {
-        cred->type = PUB_KEY_CRED_UNKNOWN;
-    }
+static uint8_t mc_exclude_list(void * out, CborValue * val)
+{
+    CTAP_makeCredential * MC = (CTAP_makeCredential *)out;
+    return parse_deferred_array(val, &MC->excludeList, &MC->excludeListSize);
+}
 
-    return 0;
+static uint8_t mc_options(void * out, CborValue * val)
+{
+    CTAP_makeCredential * MC = (CTAP_makeCredential *)out;
+    return parse_options(val, &MC->rk, &MC->uv);
 }
 
-uint8_t parse_allow_list(CTAP_getAssertion * GA, CborValue * it)
+static uint8_t mc_pin_auth(void * out, CborValue * val)
 {
-    CborValue arr;
-    size_t len;
-    int i,ret;
-    CTAP_credentialDescriptor * cred;
+    CTAP_makeCredential * MC = (CTAP_makeCredential *)out;
+    int ret = parse_fixed_byte_string(val, MC->pinAuth, 16);
+    check_retr(ret);
+    MC->pinAuthPresent = 1;
+    return 0;
+}
 
-    if (cbor_value_get_type(it) != CborArrayType)
-    {
-        printf2(TAG_ERR,"Error, expecting cbor array\n");
-        return CTAP2_ERR_INVALID_CBOR_TYPE;
-    }
+static uint8_t mc_pin_protocol(void * out, CborValue * val)
+{
+    return parse_int(val, &((CTAP_makeCredential *)out)->pinProtocol);
+}
 
-    ret = cbor_value_enter_container(it,&arr);
-    check_ret(ret);
+static const map_field mc_fields[] =
+{
+    {MC_clientDataHash,     NULL, CborByteStringType, PARAM_clientDataHash,   mc_client_data_hash},
+    {MC_rp,                 NULL, CborMapType,        PARAM_rp,               mc_rp},
+    {MC_user,               NULL, CborMapType,        0,                      mc_user},
+    {MC_pubKeyCredParams,   NULL, CborArrayType,      0,                      mc_pub_key_cred_params},
+    {MC_excludeList,        NULL, CborArrayType,      PARAM_excludeList,      mc_exclude_list},
+    {MC_extensions,         NULL, CborInvalidType,    PARAM_extensions,       skip_value},
+    {MC_options,            NULL, CborMapType,        PARAM_options,          mc_options},
+    {MC_pinAuth,            NULL, CborByteStringType, PARAM_pinAuth,          mc_pin_auth},
+    {MC_pinProtocol,        NULL, CborIntegerType,    PARAM_pinProtocol,      mc_pin_protocol},
+};
+static const map_schema mc_schema = SCHEMA(mc_fields, 0, CTAP2_ERR_CBOR_UNEXPECTED_TYPE);
 
-    ret = cbor_value_get_array_length(it, &len);
-    check_ret(ret);
+uint8_t ctap_parse_make_credential(CTAP_makeCredential * MC, CborEncoder * encoder, uint8_t * request, int length)
+{
+    int ret;
+    uint32_t found = 0;
+    CborValue it;
 
-    GA->credLen = 0;
+    memset(MC, 0, sizeof(CTAP_makeCredential));
+    ret = cbor_parser_init(request, length, 0, &MC->parser, &it);
+    check_retr(ret);
 
-    for(i = 0; i < len; i++)
-    {
-        if (i >= ALLOW_LIST_MAX_SIZE)
-        {
-            printf1(TAG_PARSE,"Error, out of memory for allow list.\n");
-            return CTAP2_ERR_TOO_MANY_ELEMENTS;
-        }
+    ret = parse_map(&mc_schema, &it, MC, &found);
+    MC->paramsParsed |= found;
+    return ret;
+}
 
-        GA->credLen += 1;
-        cred = &GA->creds[i];
+/*
+ * getAssertion
+ */
 
-        ret = parse_credential_descriptor(&arr,cred);
-        check_retr(ret);
+static uint8_t ga_rp_id(void * out, CborValue * val)
+{
+    CTAP_getAssertion * GA = (CTAP_getAssertion *)out;
+    int ret = parse_rp_id(&GA->rp, val);
+    printf1(TAG_GA,"  ID: %s\n", GA->rp.id);
+    return ret;
+}
 
-        ret = cbor_value_advance(&arr);
-        check_ret(ret);
+static uint8_t ga_client_data_hash(void * out, CborValue * val)
+{
+    CTAP_getAssertion * GA = (CTAP_getAssertion *)out;
+    int ret = parse_fixed_byte_string(val, GA->clientDataHash, CLIENT_DATA_HASH_SIZE);
+    printf1(TAG_GA,"  "); dump_hex1(TAG_GA, GA->clientDataHash, 32);
+    return ret;
+}
 
-    }
-    return 0;
+static uint8_t ga_allow_list(void * out, CborValue * val)
+{
+    return parse_allow_list((CTAP_getAssertion *)out, val);
 }
 
+static uint8_t ga_options(void * out, CborValue * val)
+{
+    CTAP_getAssertion * GA = (CTAP_getAssertion *)out;
+    return parse_options(val, &GA->rk, &GA->uv);
+}
 
-uint8_t ctap_parse_get_assertion(CTAP_getAssertion * GA, uint8_t * request, int length)
+static uint8_t ga_pin_auth(void * out, CborValue * val)
 {
-    int ret;
-    int i;
-    int key;
-    size_t map_length;
-    CborParser parser;
-    CborValue it,map;
+    CTAP_getAssertion * GA = (CTAP_getAssertion *)out;
+    int ret = parse_fixed_byte_string(val, GA->pinAuth, 16);
+    check_retr(ret);
+    GA->pinAuthPresent = 1;
+    return 0;
+}
 
-    memset(GA, 0, sizeof(CTAP_getAssertion));
-    ret = cbor_parser_init(request, length, CborValidateCanonicalFormat, &parser, &it);
-    check_ret(ret);
+static uint8_t ga_pin_protocol(void * out, CborValue * val)
+{
+    return parse_int(val, &((CTAP_getAssertion *)out)->pinProtocol);
+}
 
-    CborType type = cbor_value_get_type(&it);
-    if (type != CborMapType)
+static const map_field ga_fields[] =
+{
+    {GA_rpId,               NULL, CborTextStringType, PARAM_rpId,             ga_rp_id},
+    {GA_clientDataHash,     NULL, CborByteStringType, PARAM_clientDataHash,   ga_client_data_hash},
+    {GA_allowList,          NULL, CborArrayType,      PARAM_allowList,        ga_allow_list},
+    {GA_extensions,         NULL, CborInvalidType,    PARAM_extensions,       skip_value},
+    {GA_options,            NULL, CborMapType,        PARAM_options,          ga_options},
+    {GA_pinAuth,            NULL, CborByteStringType, PARAM_pinAuth,          ga_pin_auth},
+    {GA_pinProtocol,        NULL, CborIntegerType,    PARAM_pinProtocol,      ga_pin_protocol},
+};
+static const map_schema ga_schema = SCHEMA(ga_fields, 0, CTAP2_ERR_INVALID_CBOR_TYPE);
+
+// The descriptors are left in the request and read by ctap_collect_credentials.
+uint8_t parse_allow_list(CTAP_getAssertion * GA, CborValue * it)
+{
+    if (cbor_value_get_type(it) != CborArrayType)
     {
-        printf2(TAG_ERR,"Error, expecting cbor map\n");
+        printf2(TAG_ERR,"Error, expecting cbor array\n");
         return CTAP2_ERR_INVALID_CBOR_TYPE;
     }
+    return parse_deferred_array(it, &GA->allowList, &GA->allowListSize);
+}
 
-    ret = cbor_value_enter_container(&it,&map);
-    check_ret(ret);
+uint8_t ctap_parse_get_assertion(CTAP_getAssertion * GA, uint8_t * request, int length)
+{
+    int ret;
+    uint32_t found = 0;
+    CborValue it;
 
-    ret = cbor_value_get_map_length(&it, &map_length);
+    memset(GA, 0, sizeof(CTAP_getAssertion));
+    ret = cbor_parser_init(request, length, 0, &GA->parser, &it);
     check_ret(ret);
 
-    printf1(TAG_GA,"GA map has %d elements\n",map_length);
-
-    for (i = 0; i < map_length; i++)
+    ret = parse_map(&ga_schema, &it, GA, &found);
+    GA->paramsParsed |= found;
+    if (ret != 0)
     {
-        type = cbor_value_get_type(&map);
-        if (type != CborIntegerType)
-        {
-            printf2(TAG_ERR,"Error, expecting int for map key\n");
-            return CTAP2_ERR_INVALID_CBOR_TYPE;
-        }
-        ret = cbor_value_get_int_checked(&map, &key);
-        check_ret(ret);
-
-        ret = cbor_value_advance(&map);
-        check_ret(ret);
-        ret = 0;
+        printf2(TAG_ERR,"error, parsing failed\n");
+    }
+    return ret;
+}
 
-        switch(key)
-        {
+/*
+ * clientPin
+ */
 
-            case GA_clientDataHash:
-                printf1(TAG_GA,"GA_clientDataHash\n");
-
-                ret = parse_fixed_byte_string(&map, GA->clientDataHash, CLIENT_DATA_HASH_SIZE);
-                check_retr(ret);
-
-                printf1(TAG_GA,"  "); dump_hex1(TAG_GA, GA->clientDataHash, 32);
-                break;
-            case GA_rpId:
-                printf1(TAG_GA,"GA_rpId\n");
-
-                ret = parse_rp_id(&GA->rp, &map);
-
-                printf1(TAG_GA,"  ID: %s\n", GA->rp.id);
-                break;
-            case GA_allowList:
-                printf1(TAG_GA,"GA_allowList\n");
-                ret = parse_allow_list(GA, &map);
-                if (ret == 0)
-                {
-
-                }
-                break;
-            case GA_extensions:
-                printf1(TAG_GA,"GA_extensions\n");
-                break;
-
-            case GA_options:
-                printf1(TAG_GA,"CTAP_options\n");
-                ret = parse_options(&map, &GA->rk, &GA->uv);
-                check_retr(ret);
-                break;
-            case GA_pinAuth:
-                printf1(TAG_GA,"CTAP_pinAuth\n");
-
-                ret = parse_fixed_byte_string(&map, GA->pinAuth, 16);
-                check_retr(ret);
-                GA->pinAuthPresent = 1;
-
-                break;
-            case GA_pinProtocol:
-                printf1(TAG_GA,"CTAP_pinProtocol\n");
-                if (cbor_value_get_type(&map) == CborIntegerType)
-                {
-                    ret = cbor_value_get_int_checked(&map, &GA->pinProtocol);
-                    check_ret(ret);
-                }
-                else
-                {
-                    return CTAP2_ERR_INVALID_CBOR_TYPE;
-                }
-
-                break;
+typedef struct
+{
+    uint8_t * x;
+    uint8_t * y;
+    int * kty;
+    int * crv;
+} cose_key;
 
-        }
-        if (ret != 0)
-        {
-            printf2(TAG_ERR,"error, parsing failed\n");
-            return ret;
-        }
+static uint8_t cose_kty(void * out, CborValue * val)
+{
+    return parse_int(val, ((cose_key *)out)->kty);
+}
 
-        cbor_value_advance(&map);
-        check_ret(ret);
-    }
+static uint8_t cose_crv(void * out, CborValue * val)
+{
+    return parse_int(val, ((cose_key *)out)->crv);
+}
 
+static uint8_t cose_x(void * out, CborValue * val)
+{
+    return parse_fixed_byte_string(val, ((cose_key *)out)->x, 32);
+}
 
-    return 0;
+static uint8_t cose_y(void * out, CborValue * val)
+{
+    return parse_fixed_byte_string(val, ((cose_key *)out)->y, 32);
 }
 
+// Canonical order is 1, 3, -1, -2, -3.  The algorithm is not checked.
+static const map_field cose_fields[] =
+{
+    {COSE_KEY_LABEL_KTY,    NULL, CborIntegerType,    1, cose_kty},
+    {COSE_KEY_LABEL_CRV,    NULL, CborIntegerType,    2, cose_crv},
+    {COSE_KEY_LABEL_X,      NULL, CborByteStringType, 4, cose_x},
+    {COSE_KEY_LABEL_Y,      NULL, CborByteStringType, 8, cose_y},
+};
+static const map_schema cose_schema = SCHEMA(cose_fields, 0xf, CTAP2_ERR_INVALID_CBOR_TYPE);
+
 uint8_t parse_cose_key(CborValue * it, uint8_t * x, uint8_t * y, int * kty, int * crv)
 {
-    CborValue map;
-    size_t map_length;
-    int i,ret,key;
-    int xkey = 0,ykey = 0;
+    cose_key key = {x, y, kty, crv};
+    int ret;
+
     *kty = 0;
     *crv = 0;
-
-
-    CborType type = cbor_value_get_type(it);
-    if (type != CborMapType)
+    ret = parse_map(&cose_schema, it, &key, NULL);
+    check_retr(ret);
+    if (*kty == 0 || *crv == 0)
     {
-        printf2(TAG_ERR,"Error, expecting cbor map\n");
-        return CTAP2_ERR_INVALID_CBOR_TYPE;
+        return CTAP2_ERR_MISSING_PARAMETER;
     }
+    return 0;
+}
 
-    ret = cbor_value_enter_container(it,&map);
-    check_ret(ret);
-
-    ret = cbor_value_get_map_length(it, &map_length);
-    check_ret(ret);
-
-    printf1(TAG_PARSE,"cose key has %d elements\n",map_length);
-
-    for (i = 0; i < map_length; i++)
-    {
-        if (cbor_value_get_type(&map) != CborIntegerType)
-        {
-            printf2(TAG_ERR,"Error, expecting int for map key\n");
-            return CTAP2_ERR_INVALID_CBOR_TYPE;
-        }
-
-        ret = cbor_value_get_int_checked(&map, &key);
-        check_ret(ret);
+static uint8_t cp_pin_protocol(void * out, CborValue * val)
+{
+    return parse_int(val, &((CTAP_clientPin *)out)->pinProtocol);
+}
 
-        ret = cbor_value_advance(&map);
-        check_ret(ret);
+static uint8_t cp_sub_command(void * out, CborValue * val)
+{
+    return parse_int(val, &((CTAP_clientPin *)out)->subCommand);
+}
 
-        switch(key)
-        {
-            case COSE_KEY_LABEL_KTY:
-                printf1(TAG_PARSE,"COSE_KEY_LABEL_KTY\n");
-                if (cbor_value_get_type(&map) == CborIntegerType)
-                {
-                    ret = cbor_value_get_int_checked(&map, kty);
-                    check_ret(ret);
-                }
-                else
-                {
-                    return CTAP2_ERR_INVALID_CBOR_TYPE;
-                }
-                break;
-            case COSE_KEY_LABEL_ALG:
-                printf1(TAG_PARSE,"COSE_KEY_LABEL_ALG\n");
-                break;
-            case COSE_KEY_LABEL_CRV:
-                printf1(TAG_PARSE,"COSE_KEY_LABEL_CRV\n");
-                if (cbor_value_get_type(&map) == CborIntegerType)
-                {
-                    ret = cbor_value_get_int_checked(&map, crv);
-                    check_ret(ret);
-                }
-                else
-                {
-                    return CTAP2_ERR_INVALID_CBOR_TYPE;
-                }
-                break;
-            case COSE_KEY_LABEL_X:
-                printf1(TAG_PARSE,"COSE_KEY_LABEL_X\n");
-                ret = parse_fixed_byte_string(&map, x, 32);
-                check_retr(ret);
-                xkey = 1;
-
-                break;
-            case COSE_KEY_LABEL_Y:
-                printf1(TAG_PARSE,"COSE_KEY_LABEL_Y\n");
-                ret = parse_fixed_byte_string(&map, y, 32);
-                check_retr(ret);
-                ykey = 1;
-
-                break;
-            default:
-                printf1(TAG_PARSE,"Warning, unrecognized cose key option %d\n", key);
-        }
+static uint8_t cp_key_agreement(void * out, CborValue * val)
+{
+    CTAP_clientPin * CP = (CTAP_clientPin *)out;
+    int ret = parse_cose_key(val, CP->keyAgreement.pubkey.x, CP->keyAgreement.pubkey.y,
+                             &CP->keyAgreement.kty, &CP->keyAgreement.crv);
+    check_retr(ret);
+    CP->keyAgreementPresent = 1;
+    return 0;
+}
 
-        ret = cbor_value_advance(&map);
-        check_ret(ret);
-    }
-    if (xkey == 0 || ykey == 0 || *kty == 0 || *crv == 0)
-    {
-        return CTAP2_ERR_MISSING_PARAMETER;
-    }
+static uint8_t cp_pin_auth(void * out, CborValue * val)
+{
+    CTAP_clientPin * CP = (CTAP_clientPin *)out;
+    int ret = parse_fixed_byte_string(val, CP->pinAuth, 16);
+    check_retr(ret);
+    CP->pinAuthPresent = 1;
     return 0;
 }
 
-uint8_t ctap_parse_client_pin(CTAP_clientPin * CP, uint8_t * request, int length)
+static uint8_t cp_new_pin_enc(void * out, CborValue * val)
 {
-    int ret;
-    int i;
-    int key;
-    size_t map_length;
+    CTAP_clientPin * CP = (CTAP_clientPin *)out;
     size_t sz;
-    CborParser parser;
-    CborValue it,map;
+    int ret;
 
-    memset(CP, 0, sizeof(CTAP_clientPin));
-    ret = cbor_parser_init(request, length, CborValidateCanonicalFormat, &parser, &it);
+    ret = cbor_value_get_string_length(val, &sz);
     check_ret(ret);
-
-    CborType type = cbor_value_get_type(&it);
-    if (type != CborMapType)
+    if (sz > NEW_PIN_ENC_MAX_SIZE)
     {
-        printf2(TAG_ERR,"Error, expecting cbor map\n");
-        return CTAP2_ERR_INVALID_CBOR_TYPE;
+        return CTAP1_ERR_OTHER;
     }
-
-    ret = cbor_value_enter_container(&it,&map);
+    CP->newPinEncSize = sz;
+    sz = NEW_PIN_ENC_MAX_SIZE;
+    ret = cbor_value_copy_byte_string(val, CP->newPinEnc, &sz, val);
     check_ret(ret);
+    return 0;
+}
 
-    ret = cbor_value_get_map_length(&it, &map_length);
-    check_ret(ret);
-
-    printf1(TAG_CP,"CP map has %d elements\n",map_length);
-
-    for (i = 0; i < map_length; i++)
-    {
-        type = cbor_value_get_type(&map);
-        if (type != CborIntegerType)
-        {
-            printf2(TAG_ERR,"Error, expecting int for map key\n");
-            return CTAP2_ERR_INVALID_CBOR_TYPE;
-        }
-        ret = cbor_value_get_int_checked(&map, &key);
-        check_ret(ret);
+static uint8_t cp_pin_hash_enc(void * out, CborValue * val)
+{
+    CTAP_clientPin * CP = (CTAP_clientPin *)out;
+    int ret = parse_fixed_byte_string(val, CP->pinHashEnc, 16);
+    check_retr(ret);
+    CP->pinHashEncPresent = 1;
+    return 0;
+}
 
-        ret = cbor_value_advance(&map);
-        check_ret(ret);
-        ret = 0;
+static uint8_t cp_get_key_agreement(void * out, CborValue * val)
+{
+    return parse_bool(val, &((CTAP_clientPin *)out)->getKeyAgreement);
+}
 
-        switch(key)
-        {
-            case CP_pinProtocol:
-                printf1(TAG_CP,"CP_pinProtocol\n");
-                if (cbor_value_get_type(&map) == CborIntegerType)
-                {
-                    cbor_value_get_int_checked(&map, &CP->pinProtocol);
-                    check_ret(ret);
-                }
-                else
-                {
-                    return CTAP2_ERR_INVALID_CBOR_TYPE;
-                }
-                break;
-            case CP_subCommand:
-                printf1(TAG_CP,"CP_subCommand\n");
-                if (cbor_value_get_type(&map) == CborIntegerType)
-                {
-                    cbor_value_get_int_checked(&map, &CP->subCommand);
-                    check_ret(ret);
-                }
-                else
-                {
-                    return CTAP2_ERR_INVALID_CBOR_TYPE;
-                }
-
-                break;
-            case CP_keyAgreement:
-                printf1(TAG_CP,"CP_keyAgreement\n");
-                ret = parse_cose_key(&map, CP->keyAgreement.pubkey.x, CP->keyAgreement.pubkey.y, &CP->keyAgreement.kty, &CP->keyAgreement.crv);
-                check_retr(ret);
-                CP->keyAgreementPresent = 1;
-                break;
-            case CP_pinAuth:
-                printf1(TAG_CP,"CP_pinAuth\n");
-
-                ret = parse_fixed_byte_string(&map, CP->pinAuth, 16);
-                check_retr(ret);
-                CP->pinAuthPresent = 1;
-                break;
-            case CP_newPinEnc:
-                printf1(TAG_CP,"CP_newPinEnc\n");
-                if (cbor_value_get_type(&map) == CborByteStringType)
-                {
-                    ret = cbor_value_calculate_string_length(&map, &sz);
-                    check_ret(ret);
-                    if (sz > NEW_PIN_ENC_MAX_SIZE)
-                    {
-                        return CTAP1_ERR_OTHER;
-                    }
-                    CP->newPinEncSize = sz;
-                    sz = NEW_PIN_ENC_MAX_SIZE;
-                    ret = cbor_value_copy_byte_string(&map, CP->newPinEnc, &sz, NULL);
-                    check_ret(ret);
-                }
-                else
-                {
-                    return CTAP2_ERR_INVALID_CBOR_TYPE;
-                }
-
-                break;
-            case CP_pinHashEnc:
-                printf1(TAG_CP,"CP_pinHashEnc\n");
-
-                ret = parse_fixed_byte_string(&map, CP->pinHashEnc, 16);
-                check_retr(ret);
-                CP->pinHashEncPresent = 1;
-
-                break;
-            case CP_getKeyAgreement:
-                printf1(TAG_CP,"CP_getKeyAgreement\n");
-                ret = cbor_value_get_boolean(&map, &CP->getKeyAgreement);
-                check_ret(ret);
-                break;
-            case CP_getRetries:
-                printf1(TAG_CP,"CP_getRetries\n");
-                ret = cbor_value_get_boolean(&map, &CP->getRetries);
-                check_ret(ret);
-                break;
-            default:
-                printf1(TAG_CP,"Unknown key %d\n", key);
-        }
+static uint8_t cp_get_retries(void * out, CborValue * val)
+{
+    return parse_bool(val, &((CTAP_clientPin *)out)->getRetries);
+}
 
-        ret = cbor_value_advance(&map);
-        check_ret(ret);
+static const map_field cp_fields[] =
+{
+    {CP_pinProtocol,        NULL, CborIntegerType,    0, cp_pin_protocol},
+    {CP_subCommand,         NULL, CborIntegerType,    0, cp_sub_command},
+    {CP_keyAgreement,       NULL, CborMapType,        0, cp_key_agreement},
+    {CP_pinAuth,            NULL, CborByteStringType, 0, cp_pin_auth},
+    {CP_newPinEnc,          NULL, CborByteStringType, 0, cp_new_pin_enc},
+    {CP_pinHashEnc,         NULL, CborByteStringType, 0, cp_pin_hash_enc},
+    {CP_getKeyAgreement,    NULL, CborBooleanType,    0, cp_get_key_agreement},
+    {CP_getRetries,         NULL, CborBooleanType,    0, cp_get_retries},
+};
+static const map_schema cp_schema = SCHEMA(cp_fields, 0, CTAP2_ERR_INVALID_CBOR_TYPE);
 
-    }
+uint8_t ctap_parse_client_pin(CTAP_clientPin * CP, uint8_t * request, int length)
+{
+    int ret;
+    CborParser parser;
+    CborValue it;
 
+    memset(CP, 0, sizeof(CTAP_clientPin));
+    ret = cbor_parser_init(request, length, 0, &parser, &it);
+    check_ret(ret);
 
-    return 0;
+    return parse_map(&cp_schema, &it, CP, NULL);
 }
-
-
@@ -36,6 +36,8 @@ extern void _check_ret(CborError ret, int line, const char * filename);
 const char * cbor_value_get_type_string(const CborValue *value);
 
 
+// The parse_ functions decode the item at val and leave val on the item
+// after it, see the schemas in ctap_parse.c.
 uint8_t parse_user(CTAP_makeCredential * MC, CborValue * val);
 uint8_t parse_pub_key_cred_param(CborValue * val, uint8_t * cred_type, int32_t * alg_type);
 uint8_t parse_pub_key_cred_params(CTAP_makeCredential * MC, CborValue * val);
@@ -31,6 +31,11 @@
 #include "util.h"
 #include "log.h"
 #include "app.h"
+#include "arena.h"
+#include "stack_watch.h"
+#include "metrics.h"
+#include "probes.h"
+#include "profile.h"
 
 typedef enum
 {
@@ -75,12 +80,19 @@ static struct CID CIDS[10];
 
 static uint64_t active_cid_timestamp;
 
+// The last message received.  A getAssertion request stays here for the
+// getNextAssertion calls after it, which re-read their allow list entries
+// from it (see save_credential_list in ctap.c).  Any other message, such as
+// a PING, a U2F MSG or another channel's request, overwrites it and ends
+// the series with CTAP2_ERR_NOT_ALLOWED.  GET_NEXT_ASSERTION itself only
+// writes the command byte.
 static uint8_t ctap_buffer[CTAPHID_BUFFER_SIZE];
 static uint32_t ctap_buffer_cid;
 static int ctap_buffer_cmd;
 static uint16_t ctap_buffer_bcnt;
 static int ctap_buffer_offset;
 static int ctap_packet_seq;
+static uint32_t ctap_buffer_start;     // micros() at the init packet
 
 static void buffer_reset();
 
@@ -192,6 +204,7 @@ static int buffer_packet(CTAPHID_PACKET * pkt)
         ctap_buffer_cid = pkt->cid;
         ctap_buffer_offset = pkt_len;
         ctap_packet_seq = -1;
+        ctap_buffer_start = micros();
         memmove(ctap_buffer, pkt->pkt.init.payload, pkt_len);
     }
     else
@@ -265,6 +278,7 @@ static int buffer_len()
 static void ctaphid_write(CTAPHID_WRITE_BUFFER * wb, void * _data, int len)
 {
     uint8_t * data = (uint8_t *)_data;
+    PROFILE_BEGIN(PROFILE_CTAPHID_WRITE);
     if (_data == NULL)
     {
         if (wb->offset == 0 && wb->bytes_written == 0)
@@ -283,6 +297,7 @@ static void ctaphid_write(CTAPHID_WRITE_BUFFER * wb, void * _data, int len)
             memset(wb->buf + wb->offset, 0, HID_MESSAGE_SIZE - wb->offset);
             ctaphid_write_block(wb->buf);
         }
+        PROFILE_END(PROFILE_CTAPHID_WRITE);
         return;
     }
     int i;
@@ -314,6 +329,7 @@ static void ctaphid_write(CTAPHID_WRITE_BUFFER * wb, void * _data, int len)
             wb->offset = 0;
         }
     }
+    PROFILE_END(PROFILE_CTAPHID_WRITE);
 }
 
 
@@ -372,6 +388,8 @@ void ctaphid_handle_packet(uint8_t * pkt_raw)
 {
     CTAPHID_PACKET * pkt = (CTAPHID_PACKET *)(pkt_raw);
 
+    PROBE2(hid_packet, pkt->cid, pkt->pkt.init.cmd);
+
     printf1(TAG_HID, "Recv packet\n");
     printf1(TAG_HID, "  CID: %08x \n", pkt->cid);
     printf1(TAG_HID, "  cmd: %02x\n", pkt->pkt.init.cmd);
@@ -384,8 +402,10 @@ void ctaphid_handle_packet(uint8_t * pkt_raw)
     static CTAPHID_WRITE_BUFFER wb;
     uint32_t active_cid;
     uint32_t t1,t2;
+    uint32_t m1,m2;
 
-    CTAP_RESPONSE ctap_resp;
+    CTAP_RESPONSE * ctap_resp;
+    size_t arena_start;
 
 
     if (is_init_pkt(pkt))
@@ -411,6 +431,7 @@ void ctaphid_handle_packet(uint8_t * pkt_raw)
             oldcid = CTAPHID_BROADCAST_CID;
             newcid = get_new_cid();
             ret = add_cid(newcid);
+            PROBE1(cid_assign, newcid);
             // handle init here
         }
         else
@@ -517,6 +538,7 @@ void ctaphid_handle_packet(uint8_t * pkt_raw)
         case EMPTY:
             printf1(TAG_HID,"empty buffer!\n");
         case BUFFERED:
+            PROBE3(message_complete, active_cid, buffer_cmd(), buffer_len());
             switch(buffer_cmd())
             {
 
@@ -562,19 +584,35 @@ void ctaphid_handle_packet(uint8_t * pkt_raw)
                         return;
                     }
 
-                    ctap_response_init(&ctap_resp);
-                    status = ctap_request(ctap_buffer, buffer_len(), &ctap_resp);
+                    arena_start = arena_mark();
+                    ctap_resp = arena_alloc(sizeof(CTAP_RESPONSE));
+                    if (ctap_resp == NULL)
+                    {
+                        ctaphid_send_error(pkt->cid, CTAP1_ERR_OTHER);
+                        return;
+                    }
+                    ctap_response_init(ctap_resp);
+                    metrics_command(metrics_ctap_command(ctap_buffer[0]));
+                    metrics_record(METRIC_REASSEMBLY, ctap_buffer_start);
+                    m1 = micros();
+                    stack_watch_begin();
+                    status = ctap_request(ctap_buffer, buffer_len(), ctap_resp);
+                    stack_watch_end(CTAPHID_CBOR, ctap_buffer[0]);
 
                     ctaphid_write_buffer_init(&wb);
                     wb.cid = active_cid;
                     wb.cmd = CTAPHID_CBOR;
-                    wb.bcnt = (ctap_resp.length+1);
+                    wb.bcnt = (ctap_resp->length+1);
 
 
                     t1 = millis();
+                    m2 = micros();
                     ctaphid_write(&wb, &status, 1);
-                    ctaphid_write(&wb, ctap_resp.data, ctap_resp.length);
+                    ctaphid_write(&wb, ctap_resp->data, ctap_resp->length);
                     ctaphid_write(&wb, NULL, 0);
+                    arena_release(arena_start);
+                    metrics_record(METRIC_WRITEBACK, m2);
+                    metrics_record(METRIC_TOTAL, m1);
                     t2 = millis();
                     printf1(TAG_TIME,"CBOR writeback: %d ms\n",(uint32_t)(t2-t1));
                     break;
@@ -588,18 +626,60 @@ void ctaphid_handle_packet(uint8_t * pkt_raw)
                         return;
                     }
 
-                    ctap_response_init(&ctap_resp);
-                    u2f_request((struct u2f_request_apdu*)ctap_buffer, &ctap_resp);
+                    arena_start = arena_mark();
+                    ctap_resp = arena_alloc(sizeof(CTAP_RESPONSE));
+                    if (ctap_resp == NULL)
+                    {
+                        ctaphid_send_error(pkt->cid, CTAP1_ERR_OTHER);
+                        return;
+                    }
+                    ctap_response_init(ctap_resp);
+                    metrics_command(metrics_u2f_command(((struct u2f_request_apdu*)ctap_buffer)->ins));
+                    metrics_record(METRIC_REASSEMBLY, ctap_buffer_start);
+                    m1 = micros();
+                    stack_watch_begin();
+                    u2f_request((struct u2f_request_apdu*)ctap_buffer, ctap_resp);
+                    stack_watch_end(CTAPHID_MSG, ((struct u2f_request_apdu*)ctap_buffer)->ins);
 
                     ctaphid_write_buffer_init(&wb);
                     wb.cid = active_cid;
                     wb.cmd = CTAPHID_MSG;
-                    wb.bcnt = (ctap_resp.length);
+                    wb.bcnt = (ctap_resp->length);
 
-                    ctaphid_write(&wb, ctap_resp.data, ctap_resp.length);
+                    m2 = micros();
+                    ctaphid_write(&wb, ctap_resp->data, ctap_resp->length);
                     ctaphid_write(&wb, NULL, 0);
+                    arena_release(arena_start);
+                    metrics_record(METRIC_WRITEBACK, m2);
+                    metrics_record(METRIC_TOTAL, m1);
                     break;
 
+#ifndef DISABLE_METRICS
+                case CTAPHID_METRICS:
+                    printf1(TAG_HID,"CTAPHID_METRICS\n");
+                    ctaphid_write_buffer_init(&wb);
+                    wb.cid = active_cid;
+                    wb.cmd = CTAPHID_METRICS;
+                    wb.bcnt = sizeof(metrics_table);
+                    ctaphid_write(&wb, metrics_get(), sizeof(metrics_table));
+                    ctaphid_write(&wb, NULL, 0);
+                    if (buffer_len() > 0 && ctap_buffer[0] == METRICS_READ_RESET)
+                    {
+                        metrics_reset();
+                    }
+                    break;
+#endif
+#ifdef ENABLE_STACK_WATCH
+                case CTAPHID_STACK_WATCH:
+                    printf1(TAG_HID,"CTAPHID_STACK_WATCH\n");
+                    ctaphid_write_buffer_init(&wb);
+                    wb.cid = active_cid;
+                    wb.cmd = CTAPHID_STACK_WATCH;
+                    wb.bcnt = stack_watch_report(ctap_buffer, CTAPHID_BUFFER_SIZE);
+                    ctaphid_write(&wb, ctap_buffer, wb.bcnt);
+                    ctaphid_write(&wb, NULL, 0);
+                    break;
+#endif
                 default:
                     printf2(TAG_ERR,"error, unimplemented HID cmd: %02x\r\n", buffer_cmd());
                     ctaphid_send_error(pkt->cid, CTAP1_ERR_INVALID_COMMAND);
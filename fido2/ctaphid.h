@@ -37,6 +37,10 @@
 #define CTAPHID_CANCEL       (TYPE_INIT | 0x11)
 #define CTAPHID_ERROR        (TYPE_INIT | 0x3f)
 
+// Vendor commands
+#define CTAPHID_STACK_WATCH  (TYPE_INIT | 0x40)     // see stack_watch.h
+#define CTAPHID_METRICS      (TYPE_INIT | 0x41)     // see metrics.h
+
     #define ERR_INVALID_CMD         0x01
     #define ERR_INVALID_PAR         0x02
     #define ERR_INVALID_SEQ         0x04
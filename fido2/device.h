@@ -28,6 +28,9 @@ void device_init();
 
 uint32_t millis();
 
+// Free running microsecond counter for timing, wraps around.
+uint32_t micros();
+
 // HID message size in bytes
 #define HID_MESSAGE_SIZE        64
 
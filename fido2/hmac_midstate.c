@@ -0,0 +1,156 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  HMAC-SHA256 from precomputed key midstates, shared by every target.
+ *
+ *  The hash is finished here from the midstate, so a target only provides
+ *  crypto_sha256_compress (one SHA-256 block, see crypto.h).  It keeps its
+ *  own state and leaves the crypto_sha256 stream alone.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crypto.h"
+
+typedef struct
+{
+    uint32_t state[8];
+    uint8_t block[64];
+    uint32_t fill;
+    uint32_t total;     // bytes after the key block
+} midstate_sha256;
+
+static const uint32_t sha256_iv[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static void midstate_update(midstate_sha256 * h, const uint8_t * data, int len)
+{
+    int n;
+
+    while (len > 0)
+    {
+        n = 64 - h->fill;
+        if (n > len)
+        {
+            n = len;
+        }
+        memmove(h->block + h->fill, data, n);
+        h->fill += n;
+        h->total += n;
+        data += n;
+        len -= n;
+
+        if (h->fill == 64)
+        {
+            crypto_sha256_compress(h->state, h->block);
+            h->fill = 0;
+        }
+    }
+}
+
+static void midstate_final(midstate_sha256 * h, uint8_t * hash)
+{
+    uint64_t bits = ((uint64_t)h->total + 64) * 8;
+    int i;
+
+    h->block[h->fill++] = 0x80;
+    if (h->fill > 56)
+    {
+        memset(h->block + h->fill, 0, 64 - h->fill);
+        crypto_sha256_compress(h->state, h->block);
+        h->fill = 0;
+    }
+    memset(h->block + h->fill, 0, 56 - h->fill);
+    for (i = 0; i < 8; i++)
+    {
+        h->block[56 + i] = bits >> (56 - 8 * i);
+    }
+    crypto_sha256_compress(h->state, h->block);
+
+    for (i = 0; i < 8; i++)
+    {
+        hash[4 * i + 0] = h->state[i] >> 24;
+        hash[4 * i + 1] = h->state[i] >> 16;
+        hash[4 * i + 2] = h->state[i] >> 8;
+        hash[4 * i + 3] = h->state[i];
+    }
+    memset(h, 0, sizeof(midstate_sha256));
+}
+
+static void midstate_resume(midstate_sha256 * h, const uint32_t * state)
+{
+    memmove(h->state, state, 32);
+    h->fill = 0;
+    h->total = 0;
+}
+
+void crypto_sha256_hmac_prepare(uint8_t * key, uint32_t klen, crypto_hmac_midstate * st)
+{
+    uint8_t buf[64];
+    int i;
+
+    if(klen > 64)
+    {
+        printf("Error, key size must be <= 64\n");
+        exit(1);
+    }
+    memset(buf, 0, sizeof(buf));
+    memmove(buf, key, klen);
+
+    for (i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] ^= 0x36;
+    }
+    memmove(st->inner, sha256_iv, 32);
+    crypto_sha256_compress(st->inner, buf);
+
+    for (i = 0; i < sizeof(buf); i++)
+    {
+        buf[i] ^= 0x36 ^ 0x5c;
+    }
+    memmove(st->outer, sha256_iv, 32);
+    crypto_sha256_compress(st->outer, buf);
+
+    memset(buf, 0, sizeof(buf));
+}
+
+void crypto_sha256_hmac_compute(const crypto_hmac_midstate * st, uint8_t * data, int len, uint8_t * data2, int len2, uint8_t * hmac)
+{
+    midstate_sha256 h;
+
+    midstate_resume(&h, st->inner);
+    midstate_update(&h, data, len);
+    if (data2 != NULL)
+    {
+        midstate_update(&h, data2, len2);
+    }
+    midstate_final(&h, hmac);
+
+    midstate_resume(&h, st->outer);
+    midstate_update(&h, hmac, 32);
+    midstate_final(&h, hmac);
+}
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 #include "log.h"
 #include "util.h"
 
@@ -31,30 +32,41 @@ void set_logging_mask(uint32_t mask)
 {
     LOGMASK = mask;
 }
-struct logtag
-{
-    uint32_t tagn;
-    const char * tag;
+// Indexed by tag bit, see LOG_TAG.
+static const char * const tagtable[16] = {
+    "",
+    "MC",
+    "GA",
+    "CP",
+    "ERR",
+    "PARSE",
+    "CTAP",
+    "U2F",
+    "DUMP",
+    "[1;32mDEBUG[0m",
+    "[1;31mDEBUG[0m",
+    "[1;33mTIME[0m",
+    "HID",
+    "USB",
+    "[1;34mWALLET[0m",
+    "[1;35mSTOR[0m",
 };
 
-struct logtag tagtable[] = {
-    {TAG_GEN,""},
-    {TAG_MC,"MC"},
-    {TAG_GA,"GA"},
-    {TAG_CP,"CP"},
-    {TAG_ERR,"ERR"},
-    {TAG_PARSE,"PARSE"},
-    {TAG_CTAP,"CTAP"},
-    {TAG_U2F,"U2F"},
-    {TAG_DUMP,"DUMP"},
-    {TAG_HID,"HID"},
-    {TAG_USB,"USB"},
-    {TAG_GREEN,"[1;32mDEBUG[0m"},
-    {TAG_RED,"[1;31mDEBUG[0m"},
-    {TAG_TIME,"[1;33mTIME[0m"},
-    {TAG_WALLET,"[1;34mWALLET[0m"},
-    {TAG_STOR,"[1;35mSTOR[0m"},
-};
+// @return the tagtable index for @tag, exits if it has no tag bit
+static int tag_bit(uint32_t tag)
+{
+    if ((tag & 0xffff) == 0)
+    {
+        printf2(TAG_ERR,"INVALID LOG TAG\n");
+        exit(1);
+    }
+    return __builtin_ctz(tag & 0xffff);
+}
+
+static void print_tag(int bit)
+{
+    if (tagtable[bit][0]) printf("[%s] ", tagtable[bit]);
+}
 
 
 __attribute__((weak)) void set_logging_tag(uint32_t tag)
@@ -64,26 +76,11 @@ __attribute__((weak)) void set_logging_tag(uint32_t tag)
 
 void LOG(uint32_t tag, const char * filename, int num, const char * fmt, ...)
 {
-    int i;
-
     if (((tag & 0x7fffffff) & LOGMASK) == 0)
     {
         return;
     }
-    for (i = 0; i < sizeof(tagtable)/sizeof(struct logtag); i++)
-    {
-        if (tag & tagtable[i].tagn)
-        {
-            if (tagtable[i].tag[0]) printf("[%s] ", tagtable[i].tag);
-            i = 0;
-            break;
-        }
-    }
-    if (i != 0)
-    {
-        printf2(TAG_ERR,"INVALID LOG TAG\n");
-        exit(1);
-    }
+    print_tag(tag_bit(tag));
     set_logging_tag(tag);
 #ifdef ENABLE_FILE_LOGGING
     if (tag & TAG_FILENO)
@@ -106,3 +103,310 @@ void LOG_HEX(uint32_t tag, uint8_t * data, int length)
     set_logging_tag(tag);
     dump_hex(data,length);
 }
+
+#ifdef ENABLE_TRACE_LOG
+
+#if TRACE_LOG_WORDS & (TRACE_LOG_WORDS - 1)
+#error "TRACE_LOG_WORDS must be a power of two"
+#endif
+
+#define TRACE_STAGE_WORDS   48
+
+// Records are written at head and read at tail, both counted in words and
+// never wrapped.  A writer reserves its space with a CAS on head, so an
+// interrupt can log too, and publishes the record by storing its header
+// last.  The reader zeroes each record it consumes, so a zero header is a
+// record still being written.
+static struct
+{
+    uint32_t buf[TRACE_LOG_WORDS];
+    uint32_t head;
+    uint32_t tail;
+    uint32_t dropped;
+} ring;
+
+extern const char __start_trace_fmt[];
+
+// Keeps the section, and so __start_trace_fmt, around with no callers.
+static const char trace_fmt_base[] __attribute__((section("trace_fmt"), used)) = "";
+
+static uint32_t * trace_reserve(int words)
+{
+    uint32_t h, t, off, pad;
+
+    do
+    {
+        h = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+        t = __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE);
+        off = h & (TRACE_LOG_WORDS - 1);
+        pad = (off + words > TRACE_LOG_WORDS) ? TRACE_LOG_WORDS - off : 0;
+        if (h + pad + words - t > TRACE_LOG_WORDS)
+        {
+            __atomic_fetch_add(&ring.dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    }
+    while (!__atomic_compare_exchange_n(&ring.head, &h, h + pad + words, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    if (pad)
+    {
+        __atomic_store_n(&ring.buf[off], TRACE_HEADER(pad, 0, TRACE_KIND_PAD), __ATOMIC_RELEASE);
+    }
+    return &ring.buf[(h + pad) & (TRACE_LOG_WORDS - 1)];
+}
+
+static void trace_commit(uint32_t * rec, uint32_t header, const uint32_t * body, int words)
+{
+    memmove(rec + 1, body, (words - 1) * 4);
+    __atomic_store_n(rec, header, __ATOMIC_RELEASE);
+}
+
+// Skips the flags, width, precision and length of the conversion after a
+// '%'.  @return the conversion character, @longs gets 1 for l/z/j/t, 2 for ll
+static const char * trace_spec(const char * p, int * longs)
+{
+    *longs = 0;
+    while (*p && strchr("-+ #0123456789.", *p)) p++;
+    while (*p && strchr("hlzjt", *p))
+    {
+        if (*p != 'h') *longs += 1;
+        p++;
+    }
+    return p;
+}
+
+void log_trace(uint32_t tag, const char * fmt, ...)
+{
+    uint32_t stage[TRACE_STAGE_WORDS];
+    int words = 2;
+    int longs, len;
+    uint64_t v;
+    double d;
+    const char * p, * str;
+    uint32_t * rec;
+    va_list args;
+
+    if (((tag & 0x7fffffff) & LOGMASK) == 0)
+    {
+        return;
+    }
+
+    stage[1] = fmt - __start_trace_fmt;
+
+    va_start(args, fmt);
+    for (p = fmt; *p; p++)
+    {
+        if (*p != '%')
+        {
+            continue;
+        }
+        p = trace_spec(p + 1, &longs);
+        if (*p == '%' || *p == 0)
+        {
+            if (*p == 0) break;
+            continue;
+        }
+        if (strchr("fFeEgGaA", *p))
+        {
+            if (words + 2 > TRACE_STAGE_WORDS) break;
+            d = va_arg(args, double);
+            memmove(&stage[words], &d, 8);
+            words += 2;
+        }
+        else if (*p == 's')
+        {
+            str = va_arg(args, const char *);
+            len = str ? strnlen(str, TRACE_STR_MAX) : 0;
+            if (words + 1 + (len + 3) / 4 > TRACE_STAGE_WORDS) break;
+            stage[words] = len;
+            memmove(&stage[words + 1], str, len);
+            words += 1 + (len + 3) / 4;
+        }
+        else if (*p == 'p' || longs)
+        {
+            if (words + 2 > TRACE_STAGE_WORDS) break;
+            if (*p == 'p') v = (uintptr_t)va_arg(args, void *);
+            else if (longs > 1) v = va_arg(args, unsigned long long);
+            else v = va_arg(args, unsigned long);
+            memmove(&stage[words], &v, 8);
+            words += 2;
+        }
+        else
+        {
+            if (words + 1 > TRACE_STAGE_WORDS) break;
+            stage[words++] = va_arg(args, unsigned int);
+        }
+    }
+    va_end(args);
+
+    rec = trace_reserve(words);
+    if (rec != NULL)
+    {
+        trace_commit(rec, TRACE_HEADER(words, tag_bit(tag), TRACE_KIND_LOG), stage + 1, words);
+    }
+}
+
+void log_trace_hex(uint32_t tag, uint8_t * data, int length)
+{
+    int kept = length > TRACE_HEX_MAX ? TRACE_HEX_MAX : length;
+    int words = 3 + (kept + 3) / 4;
+    uint32_t * rec;
+
+    if (((tag & 0x7fffffff) & LOGMASK) == 0)
+    {
+        return;
+    }
+
+    rec = trace_reserve(words);
+    if (rec != NULL)
+    {
+        // Copied in place, the record is not visible until its header is.
+        rec[1] = length;
+        rec[2] = kept;
+        memmove(rec + 3, data, kept);
+        __atomic_store_n(rec, TRACE_HEADER(words, tag_bit(tag), TRACE_KIND_HEX), __ATOMIC_RELEASE);
+    }
+}
+
+// Prints one conversion, @spec is the text from '%' to the conversion.
+static const uint32_t * print_arg(const char * spec, char conv, int longs,
+                                  const uint32_t * arg, const uint32_t * end)
+{
+    char str[TRACE_STR_MAX + 1];
+    uint64_t v;
+    double d;
+    int len;
+
+    if (strchr("fFeEgGaA", conv))
+    {
+        if (arg + 2 > end) goto missing;
+        memmove(&d, arg, 8);
+        printf(spec, d);
+        return arg + 2;
+    }
+    if (conv == 's')
+    {
+        if (arg + 1 > end || arg + 1 + (arg[0] + 3) / 4 > end) goto missing;
+        len = arg[0];
+        memmove(str, arg + 1, len);
+        str[len] = 0;
+        printf(spec, str);
+        return arg + 1 + (len + 3) / 4;
+    }
+    if (conv == 'p' || longs)
+    {
+        if (arg + 2 > end) goto missing;
+        memmove(&v, arg, 8);
+        if (conv == 'p') printf(spec, (void *)(uintptr_t)v);
+        else if (longs > 1) printf(spec, (unsigned long long)v);
+        else printf(spec, (unsigned long)v);
+        return arg + 2;
+    }
+    if (arg + 1 > end) goto missing;
+    printf(spec, arg[0]);
+    return arg + 1;
+
+missing:
+    printf("%s", spec);
+    return end;
+}
+
+void log_trace_print(const uint32_t * rec)
+{
+    const uint32_t * arg = rec + 2, * end = rec + TRACE_WORDS(rec[0]);
+    const char * fmt, * p, * q;
+    char spec[16];
+    int longs, i;
+
+    set_logging_tag(1 << TRACE_TAGBIT(rec[0]));
+
+    if (TRACE_KIND(rec[0]) == TRACE_KIND_HEX)
+    {
+        dump_hex((uint8_t *)(rec + 3), rec[2]);
+        if (rec[2] != rec[1])
+        {
+            printf("... (%d bytes)\n", (int)rec[1]);
+        }
+        return;
+    }
+
+    print_tag(TRACE_TAGBIT(rec[0]));
+    fmt = __start_trace_fmt + rec[1];
+    for (p = fmt; *p; p = q)
+    {
+        for (q = p; *q && *q != '%'; q++)
+            ;
+        printf("%.*s", (int)(q - p), p);
+        if (*q == 0)
+        {
+            break;
+        }
+        p = q;
+        q = trace_spec(q + 1, &longs);
+        if (*q == 0)
+        {
+            break;
+        }
+        q++;
+        if (q[-1] == '%')
+        {
+            printf("%%");
+            continue;
+        }
+        i = q - p < sizeof(spec) ? q - p : sizeof(spec) - 1;
+        memmove(spec, p, i);
+        spec[i] = 0;
+        arg = print_arg(spec, q[-1], longs, arg, end);
+    }
+}
+
+__attribute__((weak)) void log_trace_output(const uint32_t * rec)
+{
+    log_trace_print(rec);
+}
+
+int log_drain(int max)
+{
+    uint32_t rec[4];
+    uint32_t t, h, header, dropped;
+    int n = 0;
+
+    dropped = __atomic_exchange_n(&ring.dropped, 0, __ATOMIC_RELAXED);
+    if (dropped)
+    {
+        rec[0] = TRACE_HEADER(3, tag_bit(TAG_ERR), TRACE_KIND_LOG);
+        rec[1] = TRACE_FMT("trace: %d records dropped\n") - __start_trace_fmt;
+        rec[2] = dropped;
+        log_trace_output(rec);
+    }
+
+    t = ring.tail;
+    h = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+    while (t != h && n < max)
+    {
+        uint32_t * slot = &ring.buf[t & (TRACE_LOG_WORDS - 1)];
+        header = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (header == 0)
+        {
+            break;
+        }
+        if (TRACE_KIND(header) != TRACE_KIND_PAD)
+        {
+            log_trace_output(slot);
+            n++;
+        }
+        memset(slot, 0, TRACE_WORDS(header) * 4);
+        t += TRACE_WORDS(header);
+        __atomic_store_n(&ring.tail, t, __ATOMIC_RELEASE);
+    }
+    return n;
+}
+
+void log_flush()
+{
+    while (log_drain(16) > 0)
+        ;
+}
+
+#endif
@@ -29,6 +29,10 @@
 #define DEBUG_LEVEL 0
 #endif
 
+#if DEBUG_LEVEL != 1
+#undef ENABLE_TRACE_LOG
+#endif
+
 #define ENABLE_FILE_LOGGING
 
 void LOG(uint32_t tag, const char * filename, int num, const char * fmt, ...);
@@ -36,6 +40,50 @@ void LOG_HEX(uint32_t tag, uint8_t * data, int length);
 void set_logging_mask(uint32_t mask);
 void set_logging_tag(uint32_t tag);
 
+#ifdef ENABLE_TRACE_LOG
+/*
+ *  Deferred logging.  printf1/2/3 and dump_hex1 only copy the format id and
+ *  raw arguments into a RAM ring; nothing is formatted on the request path.
+ *  log_drain() turns the records into the same text as LOG() in idle time,
+ *  or a target can override log_trace_output() to stream them out raw and
+ *  decode them on the host with tools/convert_log_to_c.py --elf.
+ *
+ *  Format strings are placed in their own "trace_fmt" section and a record
+ *  carries the offset into it, so it needs GNU ld (ELF) and literal formats.
+ *  %s arguments are copied, up to TRACE_STR_MAX bytes.
+ */
+#ifndef TRACE_LOG_WORDS
+#define TRACE_LOG_WORDS     1024        // ring size, power of two
+#endif
+#define TRACE_STR_MAX       32
+#define TRACE_HEX_MAX       1024
+
+// First word of a record: size in words, tag bit and kind.
+#define TRACE_KIND_PAD      1
+#define TRACE_KIND_LOG      2
+#define TRACE_KIND_HEX      3
+#define TRACE_HEADER(words, tagbit, kind)   ((words) | ((tagbit) << 16) | ((kind) << 24))
+#define TRACE_WORDS(h)      ((h) & 0xffff)
+#define TRACE_TAGBIT(h)     (((h) >> 16) & 0x1f)
+#define TRACE_KIND(h)       ((h) >> 24)
+
+void log_trace(uint32_t tag, const char * fmt, ...);
+void log_trace_hex(uint32_t tag, uint8_t * data, int length);
+
+// Hands up to @max records to log_trace_output().  Returns how many.
+int log_drain(int max);
+// Drains everything, e.g. before exit.
+void log_flush();
+
+// Where drained records go.  The default prints them with log_trace_print().
+void log_trace_output(const uint32_t * rec);
+void log_trace_print(const uint32_t * rec);
+
+#define _TRACE_STR(x) #x
+#define TRACE_STR(x) _TRACE_STR(x)
+#define TRACE_FMT(fmt) ({ static const char _fmt[] __attribute__((section("trace_fmt"), used)) = fmt; _fmt; })
+#endif
+
 typedef enum
 {
     TAG_GEN = (1 << 0),
@@ -60,12 +108,30 @@ typedef enum
 
 #if DEBUG_LEVEL == 1
 
+#ifdef ENABLE_TRACE_LOG
+
+#ifdef ENABLE_FILE_LOGGING
+#define TRACE_FILENO(fmt) __FILE__ ":" TRACE_STR(__LINE__) ": " fmt
+#else
+#define TRACE_FILENO(fmt) fmt
+#endif
+
+#define printf1(tag,fmt, ...) log_trace(tag & ~(TAG_FILENO), TRACE_FMT(fmt), ##__VA_ARGS__)
+#define printf2(tag,fmt, ...) log_trace(tag | TAG_FILENO, TRACE_FMT(TRACE_FILENO(fmt)), ##__VA_ARGS__)
+#define printf3(tag,fmt, ...) log_trace(tag | TAG_FILENO, TRACE_FMT(TRACE_FILENO(fmt)), ##__VA_ARGS__)
+
+#define dump_hex1(tag,data,len) log_trace_hex(tag,data,len)
+
+#else
+
 #define printf1(tag,fmt, ...) LOG(tag & ~(TAG_FILENO), NULL, 0, fmt, ##__VA_ARGS__)
 #define printf2(tag,fmt, ...) LOG(tag | TAG_FILENO,__FILE__, __LINE__, fmt, ##__VA_ARGS__)
 #define printf3(tag,fmt, ...) LOG(tag | TAG_FILENO,__FILE__, __LINE__, fmt, ##__VA_ARGS__)
 
 #define dump_hex1(tag,data,len) LOG_HEX(tag,data,len)
 
+#endif
+
 #else
 
 #define printf1(fmt, ...)
@@ -75,4 +141,9 @@ typedef enum
 
 #endif
 
+#ifndef ENABLE_TRACE_LOG
+#define log_drain(max)
+#define log_flush()
+#endif
+
 #endif
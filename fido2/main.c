@@ -30,7 +30,10 @@
 #include "util.h"
 #include "log.h"
 #include "ctap.h"
+#include "crypto.h"
 #include "app.h"
+#include "stack_watch.h"
+#include "profile.h"
 
 #if !defined(TEST)
 
@@ -43,6 +46,8 @@ int main(int argc, char * argv[])
     uint32_t dt = 0;
     uint8_t hidmsg[64];
 
+    stack_watch_init();
+
     set_logging_mask(
             /*0*/
            TAG_GEN|
@@ -65,6 +70,8 @@ int main(int argc, char * argv[])
     device_init();
     printf1(TAG_GEN,"init device\n");
 
+    profile_init();
+
     printf1(TAG_GEN,"init ctaphid\n");
     ctaphid_init();
 
@@ -85,6 +92,12 @@ int main(int argc, char * argv[])
             t1 = millis();
         }
 
+#ifdef ENABLE_BENCH_MODE
+        // Refill the pools before every packet instead of while idle, so
+        // the keys and nonces a request gets do not depend on timing.
+        while (crypto_ecc256_precompute())
+            ;
+#endif
         if (usbhid_recv(hidmsg) > 0)
         {
             printf1(TAG_DUMP,"%d>> ",count++); dump_hex1(TAG_DUMP, hidmsg,sizeof(hidmsg));
@@ -98,9 +111,13 @@ int main(int argc, char * argv[])
         }
         else
         {
+            crypto_ecc256_precompute();
+            log_drain(4);
+            profile_poll();
             /*main_loop_delay();*/
         }
         ctaphid_check_timeouts();
+        ctap_state_poll();
     }
 
     // Should never get here
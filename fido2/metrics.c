@@ -0,0 +1,114 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdint.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "ctap.h"
+#include "u2f.h"
+#include "device.h"
+
+#ifndef DISABLE_METRICS
+
+static metrics_table metrics;
+static metric_command current = METRIC_CMD_OTHER;
+
+void metrics_reset()
+{
+    memset(&metrics, 0, sizeof(metrics));
+    metrics.version = METRICS_VERSION;
+    metrics.commands = METRIC_COMMANDS;
+    metrics.phases = METRIC_PHASES;
+    metrics.buckets = METRIC_BUCKETS;
+    metrics.bucket0_us = METRIC_BUCKET0_US;
+}
+
+metrics_table * metrics_get()
+{
+    if (metrics.version == 0)
+    {
+        metrics_reset();
+    }
+    return &metrics;
+}
+
+void metrics_command(metric_command cmd)
+{
+    current = cmd;
+}
+
+metric_command metrics_ctap_command(uint8_t cmd)
+{
+    switch(cmd)
+    {
+        case CTAP_MAKE_CREDENTIAL:
+            return METRIC_CMD_MAKE_CREDENTIAL;
+        case CTAP_GET_ASSERTION:
+            return METRIC_CMD_GET_ASSERTION;
+        case GET_NEXT_ASSERTION:
+            return METRIC_CMD_GET_NEXT_ASSERTION;
+        case CTAP_CLIENT_PIN:
+            return METRIC_CMD_CLIENT_PIN;
+    }
+    return METRIC_CMD_OTHER;
+}
+
+metric_command metrics_u2f_command(uint8_t ins)
+{
+    switch(ins)
+    {
+        case U2F_REGISTER:
+            return METRIC_CMD_U2F_REGISTER;
+        case U2F_AUTHENTICATE:
+            return METRIC_CMD_U2F_AUTHENTICATE;
+    }
+    return METRIC_CMD_OTHER;
+}
+
+void metrics_record(metric_phase phase, uint32_t start)
+{
+    uint32_t us = micros() - start;
+    uint32_t v = us / METRIC_BUCKET0_US;
+    int b = 0;
+
+    if (metrics.version == 0)
+    {
+        metrics_reset();
+    }
+
+    while (v && b < METRIC_BUCKETS - 1)
+    {
+        v >>= 1;
+        b++;
+    }
+
+    if (metrics.counts[current][phase][b] != 0xffff)
+    {
+        metrics.counts[current][phase][b]++;
+    }
+    if (us > metrics.max_us[current][phase])
+    {
+        metrics.max_us[current][phase] = us;
+    }
+}
+
+#endif
@@ -0,0 +1,108 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Latency histograms per command and phase, in microseconds.
+ *
+ *  Code that runs a phase takes t = micros() and calls
+ *  metrics_record(METRIC_x, t) when it is done; the sample goes to the
+ *  command set by the last metrics_command().  Buckets double in width:
+ *  bucket 0 is below METRIC_BUCKET0_US, bucket i below METRIC_BUCKET0_US << i
+ *  and the last one takes the rest.  Counts saturate.
+ *
+ *  The table is read, and optionally cleared, with the CTAPHID_METRICS
+ *  vendor command.  Build with DISABLE_METRICS to leave it out.
+ */
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <stdint.h>
+
+#define METRICS_VERSION     1
+#define METRIC_BUCKETS      16
+#define METRIC_BUCKET0_US   64
+
+typedef enum
+{
+    METRIC_REASSEMBLY = 0,      // first to last HID packet of the request
+    METRIC_PARSE,
+    METRIC_PIN,                 // pinAuth or PIN hash check
+    METRIC_CREDENTIALS,         // exclude/allow list and key handle checks
+    METRIC_KEY_DERIVATION,
+    METRIC_SIGN,
+    METRIC_ENCODE,
+    METRIC_WRITEBACK,           // response to HID packets
+    METRIC_TOTAL,               // whole request, from the last packet
+    METRIC_PHASES,
+} metric_phase;
+
+typedef enum
+{
+    METRIC_CMD_OTHER = 0,
+    METRIC_CMD_MAKE_CREDENTIAL,
+    METRIC_CMD_GET_ASSERTION,
+    METRIC_CMD_GET_NEXT_ASSERTION,
+    METRIC_CMD_CLIENT_PIN,
+    METRIC_CMD_U2F_REGISTER,
+    METRIC_CMD_U2F_AUTHENTICATE,
+    METRIC_COMMANDS,
+} metric_command;
+
+// Layout returned by CTAPHID_METRICS, little endian.
+typedef struct
+{
+    uint8_t version;
+    uint8_t commands;
+    uint8_t phases;
+    uint8_t buckets;
+    uint32_t bucket0_us;
+    uint32_t max_us[METRIC_COMMANDS][METRIC_PHASES];
+    uint16_t counts[METRIC_COMMANDS][METRIC_PHASES][METRIC_BUCKETS];
+} __attribute__((packed)) metrics_table;
+
+// Argument byte of CTAPHID_METRICS
+#define METRICS_READ        0x00
+#define METRICS_READ_RESET  0x01
+
+#ifndef DISABLE_METRICS
+
+void metrics_command(metric_command cmd);
+
+// Maps a CTAP command byte or U2F INS to its metric_command.
+metric_command metrics_ctap_command(uint8_t cmd);
+metric_command metrics_u2f_command(uint8_t ins);
+
+// Records micros() - start for phase of the current command.
+void metrics_record(metric_phase phase, uint32_t start);
+
+metrics_table * metrics_get();
+void metrics_reset();
+
+#else
+
+#define metrics_command(cmd)
+#define metrics_ctap_command(cmd)   METRIC_CMD_OTHER
+#define metrics_u2f_command(ins)    METRIC_CMD_OTHER
+#define metrics_record(phase, start)
+
+#endif
+
+#endif
@@ -0,0 +1,116 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  USDT (user level statically defined tracing) probes for the PC build.
+ *
+ *  make usdt=1 builds them in, otherwise they expand to nothing.  A probe
+ *  is a single nop plus an ELF note, so it costs nothing until perf or
+ *  bpftrace attaches to it, see tools/usdt_latency.bt.  All probes use the
+ *  provider "solo":
+ *
+ *      hid_packet(cid, cmd)                  any HID packet received
+ *      cid_assign(cid)                       new channel handed out
+ *      message_complete(cid, cmd, len)       reassembled, about to dispatch
+ *      ctap_request_entry(cmd, len)
+ *      ctap_request_return(cmd, status)
+ *      crypto_start(op), crypto_done(op)     op is a PROBE_CRYPTO_* value
+ *      state_flush(slot, seq, dirty)         authenticator state written
+ *      write_block(cid, cmd)                 HID packet sent
+ *
+ *  <sys/sdt.h> (systemtap-sdt-dev) is used when it is installed.  Without
+ *  it a minimal copy of its note format is used, which only handles 64 bit
+ *  ELF targets and passes every argument as 8 bytes in a register.
+ */
+#ifndef _PROBES_H
+#define _PROBES_H
+
+#include <stdint.h>
+
+#define PROBE_CRYPTO_SIGN           1
+#define PROBE_CRYPTO_ECDSA_SIGN     2
+#define PROBE_CRYPTO_DERIVE         3
+#define PROBE_CRYPTO_MAKE_KEY       4
+#define PROBE_CRYPTO_SHARED_SECRET  5
+#define PROBE_CRYPTO_ED25519_SIGN   6
+
+#ifdef ENABLE_USDT
+
+#if defined(__has_include) && __has_include(<sys/sdt.h>)
+
+#include <sys/sdt.h>
+
+#define PROBE0(name)            DTRACE_PROBE(solo, name)
+#define PROBE1(name,a)          DTRACE_PROBE1(solo, name, a)
+#define PROBE2(name,a,b)        DTRACE_PROBE2(solo, name, a, b)
+#define PROBE3(name,a,b,c)      DTRACE_PROBE3(solo, name, a, b, c)
+
+#else
+
+#if !defined(__ELF__) || !defined(__LP64__)
+#error "ENABLE_USDT needs <sys/sdt.h> on this target"
+#endif
+
+// Same note layout as <sys/sdt.h>: probe address, base used to undo
+// prelinking, semaphore (none), provider, name and argument description.
+#define _PROBE(name, args, ...)                                             \
+    __asm__ __volatile__ (                                                  \
+        "990: nop\n"                                                        \
+        ".pushsection .note.stapsdt,\"?\",\"note\"\n"                       \
+        ".balign 4\n"                                                       \
+        ".4byte 992f-991f, 994f-993f, 3\n"                                  \
+        "991: .asciz \"stapsdt\"\n"                                         \
+        "992: .balign 4\n"                                                  \
+        "993: .8byte 990b\n"                                                \
+        ".8byte _.stapsdt.base\n"                                           \
+        ".8byte 0\n"                                                        \
+        ".asciz \"solo\"\n"                                                 \
+        ".asciz \"" #name "\"\n"                                            \
+        ".asciz \"" args "\"\n"                                             \
+        "994: .balign 4\n"                                                  \
+        ".popsection\n"                                                     \
+        ".ifndef _.stapsdt.base\n"                                          \
+        ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+        ".weak _.stapsdt.base\n"                                            \
+        ".hidden _.stapsdt.base\n"                                          \
+        "_.stapsdt.base: .space 1\n"                                        \
+        ".size _.stapsdt.base, 1\n"                                         \
+        ".popsection\n"                                                     \
+        ".endif\n"                                                          \
+        :: __VA_ARGS__)
+
+#define PROBE0(name)            _PROBE(name, "")
+#define PROBE1(name,a)          _PROBE(name, "8@%0", "r"((uint64_t)(a)))
+#define PROBE2(name,a,b)        _PROBE(name, "8@%0 8@%1", "r"((uint64_t)(a)), "r"((uint64_t)(b)))
+#define PROBE3(name,a,b,c)      _PROBE(name, "8@%0 8@%1 8@%2", "r"((uint64_t)(a)), "r"((uint64_t)(b)), "r"((uint64_t)(c)))
+
+#endif
+
+#else
+
+#define PROBE0(name)
+#define PROBE1(name,a)
+#define PROBE2(name,a,b)
+#define PROBE3(name,a,b,c)
+
+#endif
+
+#endif
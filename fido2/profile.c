@@ -0,0 +1,132 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdint.h>
+#include <string.h>
+
+#include "profile.h"
+#include "device.h"
+#include "log.h"
+
+#ifdef ENABLE_PROFILE
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+} profile_stats;
+
+static const char * const scope_names[PROFILE_SCOPES] =
+{
+    "sha256_transform",
+    "ecc_sign",
+    "aes",
+    "cbor_parse",
+    "ctaphid_write",
+};
+
+static profile_stats stats[PROFILE_SCOPES];
+static uint32_t overhead = 0;
+static uint32_t last_dump = 0;
+static int dirty = 0;
+
+void profile_init()
+{
+    uint32_t t, min = 0xffffffff;
+    int i;
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+    // Only enabled, never zeroed: micros() on the EFM32 tracks CYCCNT too.
+    // Scopes subtract two readings, so where it starts does not matter.
+    *(volatile uint32_t *)0xE000EDFC |= (1 << 24);      // DEMCR.TRCENA
+    *(volatile uint32_t *)0xE0001000 |= 1;              // DWT_CTRL.CYCCNTENA
+#endif
+
+    for (i = 0; i < 64; i++)
+    {
+        t = profile_count();
+        t = profile_count() - t;
+        if (t < min)
+        {
+            min = t;
+        }
+    }
+    overhead = min;
+    profile_reset();
+    last_dump = millis();
+    printf1(TAG_GEN, "profiling in %s, overhead %u\n", PROFILE_UNIT, overhead);
+}
+
+void profile_record(profile_scope scope, uint32_t count)
+{
+    profile_stats * s = &stats[scope];
+
+    count = count > overhead ? count - overhead : 0;
+    if (s->count == 0 || count < s->min)
+    {
+        s->min = count;
+    }
+    if (count > s->max)
+    {
+        s->max = count;
+    }
+    s->total += count;
+    s->count++;
+    dirty = 1;
+}
+
+void profile_dump()
+{
+    profile_stats * s;
+    int i;
+
+    printf1(TAG_GEN, "profile (%s): scope count min avg max total\n", PROFILE_UNIT);
+    for (i = 0; i < PROFILE_SCOPES; i++)
+    {
+        s = &stats[i];
+        if (s->count == 0)
+        {
+            continue;
+        }
+        printf1(TAG_GEN, "  %s %u %u %u %u %llu\n", scope_names[i], s->count, s->min,
+                (uint32_t)(s->total / s->count), s->max, (unsigned long long)s->total);
+    }
+    dirty = 0;
+}
+
+void profile_reset()
+{
+    memset(stats, 0, sizeof(stats));
+    dirty = 0;
+}
+
+void profile_poll()
+{
+    if (dirty && millis() - last_dump > PROFILE_DUMP_MS)
+    {
+        profile_dump();
+        last_dump = millis();
+    }
+}
+
+#endif
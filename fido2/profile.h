@@ -0,0 +1,130 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Cycle counts of hot paths, built with ENABLE_PROFILE (make profile=1).
+ *
+ *      PROFILE_BEGIN(PROFILE_AES);
+ *      ...
+ *      PROFILE_END(PROFILE_AES);
+ *
+ *  BEGIN declares the start count in the enclosing block, so a scope can
+ *  be used once per function and END has to be repeated before an early
+ *  return.  Each scope keeps a count, total, min and max, less the cost of
+ *  an empty BEGIN/END measured by profile_init().  profile_poll() logs the
+ *  table under TAG_GEN every PROFILE_DUMP_MS when there are new samples.
+ *
+ *  The counter is DWT CYCCNT on Cortex-M3/M4/M7/M33, the TSC on x86 and
+ *  clock_gettime() in ns or micros() elsewhere, see PROFILE_UNIT.  It is 32
+ *  bits wide, so a scope must take less than 2^32 units.
+ */
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stdint.h>
+
+#ifndef PROFILE_DUMP_MS
+#define PROFILE_DUMP_MS     10000
+#endif
+
+typedef enum
+{
+    PROFILE_SHA256_TRANSFORM = 0,   // one 64 byte block, software SHA-256
+    PROFILE_ECC_SIGN,               // any ECDSA signature, through the backend
+    PROFILE_AES,                    // one CBC encrypt or decrypt call
+    PROFILE_CBOR_PARSE,             // makeCredential, getAssertion or clientPin request
+    PROFILE_CTAPHID_WRITE,          // buffering a response into HID packets
+    PROFILE_SCOPES,
+} profile_scope;
+
+#ifdef ENABLE_PROFILE
+
+#if defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__)
+
+#define PROFILE_UNIT        "cycles"
+#define DWT_CYCCNT          (*(volatile uint32_t *)0xE0001004)
+
+static inline uint32_t profile_count()
+{
+    return DWT_CYCCNT;
+}
+
+#elif defined(__x86_64__) || defined(__i386__)
+
+#include <x86intrin.h>
+#define PROFILE_UNIT        "tsc"
+
+static inline uint32_t profile_count()
+{
+    return (uint32_t)__rdtsc();
+}
+
+#elif defined(__unix__)
+
+#include <time.h>
+#define PROFILE_UNIT        "ns"
+
+static inline uint32_t profile_count()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+#else
+
+#include "device.h"
+#define PROFILE_UNIT        "us"
+
+static inline uint32_t profile_count()
+{
+    return micros();
+}
+
+#endif
+
+// Starts the counter (DWT needs enabling) and measures the overhead.
+void profile_init();
+
+void profile_record(profile_scope scope, uint32_t count);
+
+// Logs every scope with samples.
+void profile_dump();
+void profile_reset();
+
+// Call when idle, dumps periodically.
+void profile_poll();
+
+#define PROFILE_BEGIN(scope)    uint32_t _profile_##scope = profile_count()
+#define PROFILE_END(scope)      profile_record(scope, profile_count() - _profile_##scope)
+
+#else
+
+#define profile_init()
+#define profile_dump()
+#define profile_reset()
+#define profile_poll()
+#define PROFILE_BEGIN(scope)
+#define PROFILE_END(scope)
+
+#endif
+
+#endif
@@ -0,0 +1,146 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdint.h>
+#include <string.h>
+
+#include "stack_watch.h"
+#include "log.h"
+
+#ifdef ENABLE_STACK_WATCH
+
+#define PAINT           0xA5A5A5A5
+// Left alone below the current frame, for the painting loop itself.
+#define PAINT_MARGIN    256
+
+#if defined(__arm__)
+extern uint32_t __StackLimit;
+extern uint32_t __StackTop;
+#endif
+
+static uint32_t * stack_limit;
+static uint8_t * stack_top;
+
+static stack_watch_entry entries[STACK_WATCH_ENTRIES];
+static int num_entries = 0;
+
+// Paints from the limit to just below the caller.  No calls in here, the
+// area below this frame is what gets overwritten.
+static void __attribute__((noinline)) stack_paint()
+{
+    volatile uint32_t * p = stack_limit;
+    volatile uint32_t * end = (uint32_t *)((uint8_t *)&p - PAINT_MARGIN);
+
+    while (p < end)
+    {
+        *p++ = PAINT;
+    }
+}
+
+#if !defined(__arm__)
+// Makes sure the pages below main are mapped before painting them.
+static void __attribute__((noinline)) stack_map()
+{
+    volatile uint8_t area[STACK_WATCH_SIZE];
+    area[0] = 0;
+    area[sizeof(area) - 1] = 0;
+}
+#endif
+
+void stack_watch_init()
+{
+#if defined(__arm__)
+    stack_limit = &__StackLimit;
+    stack_top = (uint8_t *)&__StackTop;
+#else
+    uint8_t here;
+    stack_map();
+    stack_top = &here;
+    stack_limit = (uint32_t *)(((uintptr_t)&here - STACK_WATCH_SIZE + 4096) & ~(uintptr_t)3);
+#endif
+    stack_paint();
+}
+
+void stack_watch_begin()
+{
+    stack_paint();
+}
+
+void stack_watch_end(uint8_t hid_cmd, uint8_t cmd)
+{
+    uint32_t * p = stack_limit;
+    uint32_t depth;
+    int i;
+
+    while (*p == PAINT)
+    {
+        p++;
+    }
+    depth = stack_top - (uint8_t *)p;
+
+    for (i = 0; i < num_entries; i++)
+    {
+        if (entries[i].hid_cmd == hid_cmd && entries[i].cmd == cmd)
+        {
+            break;
+        }
+    }
+    if (i == num_entries)
+    {
+        if (num_entries == STACK_WATCH_ENTRIES)
+        {
+            return;
+        }
+        num_entries++;
+        entries[i].hid_cmd = hid_cmd;
+        entries[i].cmd = cmd;
+        entries[i].count = 0;
+        entries[i].peak = 0;
+    }
+
+    entries[i].count++;
+    if (depth > entries[i].peak)
+    {
+        entries[i].peak = depth;
+        printf1(TAG_TIME, "stack: %02x/%02x peak %d of %d bytes\n", hid_cmd, cmd,
+                depth, (int)(stack_top - (uint8_t *)stack_limit));
+    }
+}
+
+int stack_watch_report(uint8_t * buf, int len)
+{
+    uint32_t size = stack_top - (uint8_t *)stack_limit;
+    int n = (len - (int)sizeof(size)) / (int)sizeof(stack_watch_entry);
+
+    if (n < 0)
+    {
+        return 0;
+    }
+    if (n > num_entries)
+    {
+        n = num_entries;
+    }
+    memmove(buf, &size, sizeof(size));
+    memmove(buf + sizeof(size), entries, n * sizeof(stack_watch_entry));
+    return sizeof(size) + n * sizeof(stack_watch_entry);
+}
+
+#endif
@@ -0,0 +1,73 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Stack high watermarks per command, built with ENABLE_STACK_WATCH
+ *  (make stack_watch=1, which also emits -fstack-usage .su files).
+ *
+ *  Before a command the unused part of the stack is painted with a known
+ *  word, after it the lowest overwritten word gives the depth reached.
+ *  The peak per command is logged under TAG_TIME when it grows and is
+ *  returned by the CTAPHID_STACK_WATCH vendor command.
+ *
+ *  On ARM the stack is __StackLimit..__StackTop from the startup file,
+ *  elsewhere STACK_WATCH_SIZE bytes below the frame of stack_watch_init().
+ */
+#ifndef _STACK_WATCH_H
+#define _STACK_WATCH_H
+
+#include <stdint.h>
+
+#define STACK_WATCH_ENTRIES     16
+
+#ifndef STACK_WATCH_SIZE
+#define STACK_WATCH_SIZE        (64 * 1024)
+#endif
+
+typedef struct
+{
+    uint8_t hid_cmd;            // CTAPHID_CBOR or CTAPHID_MSG
+    uint8_t cmd;                // CTAP command or U2F INS
+    uint16_t count;
+    uint32_t peak;              // bytes
+} __attribute__((packed)) stack_watch_entry;
+
+#ifdef ENABLE_STACK_WATCH
+
+// Call first thing in main().
+void stack_watch_init();
+
+void stack_watch_begin();
+void stack_watch_end(uint8_t hid_cmd, uint8_t cmd);
+
+// Copies the size of the stack (uint32_t) followed by the entries to buf.
+// @return bytes written
+int stack_watch_report(uint8_t * buf, int len);
+
+#else
+
+#define stack_watch_init()
+#define stack_watch_begin()
+#define stack_watch_end(hid_cmd, cmd)
+
+#endif
+
+#endif
@@ -34,6 +34,20 @@
 #define ERR_KEY_SPACE_TAKEN (-2)
 #define ERR_KEY_SPACE_EMPTY (-2)
 
+// Resident (discoverable) credentials.  Slots are fixed size and live at the
+// end of the state so an erased page or an older, shorter state file reads
+// as all slots free.
+#define RK_NUM              8
+#define RK_RPID_TAG_SIZE    4       // leading bytes of rpIdHash kept per slot
+#define RK_SLOT_MARKER      0x3C
+
+typedef struct
+{
+    uint8_t in_use;                 // RK_SLOT_MARKER if taken, 0xff if free
+    uint8_t rp_tag[RK_RPID_TAG_SIZE];
+    struct Credential credential;   // encrypted, same as the credential ID
+} __attribute__((packed)) CTAP_residentKey;
+
 typedef struct
 {
     // Pin information
@@ -44,8 +58,25 @@ typedef struct
 
     uint16_t key_lens[MAX_KEYS];
     uint8_t key_space[KEY_SPACE_BYTES];
+
+    CTAP_residentKey rks[RK_NUM];
+
+    // Commit record, last so it is programmed last.  Of the two copies the
+    // one with a valid and higher seq is current.
+    uint32_t seq;
+    uint32_t seq_inverse;
 } AuthenticatorState;
 
+// Parts of the state, for ctap_state_dirty()
+#define STATE_PIN           0x01
+#define STATE_PIN_TRIES     0x02
+#define STATE_KEYS          0x04
+#define STATE_RKS           0x08
+#define STATE_ALL           0x0f
+
+// Lazy updates are written at most this long (ms) after they are made
+#define STATE_FLUSH_DEADLINE    2000
+
 
 typedef struct
 {
@@ -33,6 +33,10 @@ void ctap_init()
 {
     printf("STUB: ctap_init\n");
 }
+
+void ctap_state_poll()
+{
+}
 #endif
 
 #if defined(STUB_CTAPHID)
@@ -27,6 +27,7 @@
 #include "device.h"
 #include "wallet.h"
 #include "app.h"
+#include "metrics.h"
 
 // void u2f_response_writeback(uint8_t * buf, uint8_t len);
 static int16_t u2f_register(struct u2f_register_request * req);
@@ -117,6 +118,8 @@ end:
     u2f_response_writeback(&byte,1);
 
     printf1(TAG_U2F,"u2f resp: "); dump_hex1(TAG_U2F, _u2f_resp->data, _u2f_resp->length);
+
+    ctap_state_commit();
 }
 
 
@@ -198,6 +201,7 @@ static int16_t u2f_authenticate(struct u2f_authenticate_request * req, uint8_t c
     uint32_t count;
     uint8_t hash[32];
     uint8_t * sig = (uint8_t*)req;
+    uint32_t t;
 
     if (control == U2F_AUTHENTICATE_CHECK)
     {
@@ -210,16 +214,23 @@ static int16_t u2f_authenticate(struct u2f_authenticate_request * req, uint8_t c
             return U2F_SW_WRONG_DATA;
         }
     }
+    t = micros();
     if (
             control != U2F_AUTHENTICATE_SIGN ||
             req->khl != U2F_KEY_HANDLE_SIZE  ||
-            u2f_appid_eq(&req->kh, req->app) != 0 ||     // Order of checks is important
-            u2f_load_key(&req->kh, req->app) != 0
-
+            u2f_appid_eq(&req->kh, req->app) != 0      // Order of checks is important
         )
     {
         return U2F_SW_WRONG_PAYLOAD;
     }
+    metrics_record(METRIC_CREDENTIALS, t);
+
+    t = micros();
+    if (u2f_load_key(&req->kh, req->app) != 0)
+    {
+        return U2F_SW_WRONG_PAYLOAD;
+    }
+    metrics_record(METRIC_KEY_DERIVATION, t);
 
 
 
@@ -240,7 +251,9 @@ static int16_t u2f_authenticate(struct u2f_authenticate_request * req, uint8_t c
     crypto_sha256_final(hash);
 
     printf1(TAG_U2F, "sha256: "); dump_hex1(TAG_U2F,hash,32);
+    t = micros();
     crypto_ecc256_sign(hash, 32, sig);
+    metrics_record(METRIC_SIGN, t);
 
     u2f_response_writeback(&up,1);
     u2f_response_writeback((uint8_t *)&count,4);
@@ -257,6 +270,7 @@ static int16_t u2f_register(struct u2f_register_request * req)
     uint8_t pubkey[64];
     uint8_t hash[32];
     uint8_t * sig = (uint8_t*)req;
+    uint32_t t;
 
 
     const uint16_t attest_size = attestation_cert_der_size;
@@ -266,10 +280,12 @@ static int16_t u2f_register(struct u2f_register_request * req)
         return U2F_SW_CONDITIONS_NOT_SATISFIED;
     }
 
+    t = micros();
     if ( u2f_new_keypair(&key_handle, req->app, pubkey) == -1)
     {
         return U2F_SW_INSUFFICIENT_MEMORY;
     }
+    metrics_record(METRIC_KEY_DERIVATION, t);
 
     crypto_sha256_init();
     crypto_sha256_update(i,1);
@@ -287,7 +303,9 @@ static int16_t u2f_register(struct u2f_register_request * req)
     /*printf("check key handle size: %d vs %d\n", U2F_KEY_HANDLE_SIZE, sizeof(struct u2f_key_handle));*/
 
     printf1(TAG_U2F, "sha256: "); dump_hex1(TAG_U2F,hash,32);
+    t = micros();
     crypto_ecc256_sign(hash, 32, sig);
+    metrics_record(METRIC_SIGN, t);
 
     i[0] = 0x5;
     u2f_response_writeback(i,2);
@@ -0,0 +1,183 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdint.h>
+#include <stddef.h>
+#include "wear_counter.h"
+#include "log.h"
+
+// Page layout, in words:
+//   0, 1    seq, ~seq      written after the first record
+//   2, 3    value, ~value  first record
+//   ...     more records, erased (0xffffffff) past the last one
+//
+// A word pair only counts if the second word is the complement of the
+// first, so erased or half written pairs are ignored.
+
+#define ERASED          0xffffffff
+#define FIRST_RECORD    1           // in pairs
+
+static int pair_valid(const uint32_t * w)
+{
+    return w[0] == ~w[1];
+}
+
+// Records are written in order, so the erased ones are all at the end and
+// the first of them can be found by bisection.
+// @return index of the first erased pair, @pairs if the page is full
+static int records_end(const uint32_t * p, int pairs)
+{
+    int lo = FIRST_RECORD, hi = pairs, mid;
+
+    while (lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if (p[2*mid] == ERASED && p[2*mid + 1] == ERASED)
+        {
+            hi = mid;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+static void start_page(wear_counter * c, int page, uint32_t seq, uint32_t value)
+{
+    const wear_counter_flash * f = c->flash;
+
+    f->erase(f->ctx, page);
+    f->write(f->ctx, page, 2*FIRST_RECORD, value);
+    f->write(f->ctx, page, 2*FIRST_RECORD + 1, ~value);
+    f->write(f->ctx, page, 0, seq);
+    f->write(f->ctx, page, 1, ~seq);
+
+    c->page = page;
+    c->word = 2*(FIRST_RECORD + 1);
+    c->seq = seq;
+    c->value = value;
+}
+
+void wear_counter_init(wear_counter * c, const wear_counter_flash * flash, uint32_t start)
+{
+    const uint32_t * p;
+    uint32_t skip = 0;      // pages found to have a header but no record
+    uint32_t best_seq = 0, max_seq = 0;
+    int i, r, end, best;
+    int pairs = flash->page_words / 2;
+
+    c->flash = flash;
+
+    for (i = 0; i < flash->pages; i++)
+    {
+        p = flash->page(flash->ctx, i);
+        if (pair_valid(p) && p[0] > max_seq)
+        {
+            max_seq = p[0];
+        }
+    }
+
+    while (1)
+    {
+        best = -1;
+        for (i = 0; i < flash->pages; i++)
+        {
+            p = flash->page(flash->ctx, i);
+            if (!(skip & (1u << i)) && pair_valid(p) && (best < 0 || p[0] > best_seq))
+            {
+                best = i;
+                best_seq = p[0];
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+
+        p = flash->page(flash->ctx, best);
+        end = records_end(p, pairs);
+        for (r = end - 1; r >= FIRST_RECORD; r--)
+        {
+            if (pair_valid(p + 2*r))
+            {
+                c->value = p[2*r];
+                c->page = best;
+                c->word = 2*end;
+                c->seq = max_seq;
+                printf1(TAG_GEN, "counter at %u, page %d record %d\n", c->value, best, r);
+                return;
+            }
+        }
+
+        printf2(TAG_ERR, "counter page %d has no valid record\n", best);
+        skip |= 1u << best;
+    }
+
+    printf1(TAG_GEN, "formatting counter flash at %u\n", start);
+    start_page(c, 0, max_seq + 1, start);
+}
+
+void wear_counter_format(wear_counter * c, const wear_counter_flash * flash, uint32_t start)
+{
+    const uint32_t * p;
+    uint32_t max_seq = 0;
+    int i;
+
+    c->flash = flash;
+
+    // Outrank anything left in the other pages until they are erased.
+    for (i = 1; i < flash->pages; i++)
+    {
+        p = flash->page(flash->ctx, i);
+        if (pair_valid(p) && p[0] > max_seq)
+        {
+            max_seq = p[0];
+        }
+    }
+
+    printf1(TAG_GEN, "formatting counter flash at %u\n", start);
+    start_page(c, 0, max_seq + 1, start);
+    for (i = 1; i < flash->pages; i++)
+    {
+        flash->erase(flash->ctx, i);
+    }
+}
+
+uint32_t wear_counter_increment(wear_counter * c)
+{
+    const wear_counter_flash * f = c->flash;
+    uint32_t value = c->value + 1;
+
+    if (c->word + 2 > f->page_words)
+    {
+        start_page(c, (c->page + 1) % f->pages, c->seq + 1, value);
+    }
+    else
+    {
+        f->write(f->ctx, c->page, c->word, value);
+        f->write(f->ctx, c->page, c->word + 1, ~value);
+        c->word += 2;
+        c->value = value;
+    }
+    return value;
+}
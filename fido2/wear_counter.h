@@ -0,0 +1,69 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Monotonic counter kept as a log in two or more flash pages.
+ *
+ *  Every increment appends a (value, ~value) record to the live page, so it
+ *  costs two word writes and no search: the position is kept in RAM after
+ *  one scan at boot.  A full page rolls over to the next page in turn,
+ *  which gets erased, its first record and then a (seq, ~seq) header.  The
+ *  page being left is never erased, so power loss at any point falls back
+ *  to a value that was not handed out yet, never to an older one.
+ */
+#ifndef _WEAR_COUNTER_H
+#define _WEAR_COUNTER_H
+
+#include <stdint.h>
+
+// Flash the counter lives in.  Pages are numbered 0..pages-1 within the
+// counter area, erased words read 0xffffffff and writes only clear bits.
+typedef struct
+{
+    void * ctx;
+    int pages;          // 2 to 32
+    int page_words;     // even, at least 4
+    const uint32_t * (*page)(void * ctx, int page);
+    void (*erase)(void * ctx, int page);
+    void (*write)(void * ctx, int page, int word, uint32_t value);
+} wear_counter_flash;
+
+typedef struct
+{
+    const wear_counter_flash * flash;
+    uint32_t value;
+    uint32_t seq;       // highest page sequence number in use
+    int page;           // live page
+    int word;           // next free record in it
+} wear_counter;
+
+// Scans the flash for the live page and last record.  If no page is in use
+// the flash is formatted with the counter at @start.
+void wear_counter_init(wear_counter * c, const wear_counter_flash * flash, uint32_t start);
+
+// Erases the whole area and starts it at @start, whatever it held before.
+// For flash that may hold something other than counter pages.
+void wear_counter_format(wear_counter * c, const wear_counter_flash * flash, uint32_t start);
+
+// Increments the counter and returns the new value.
+uint32_t wear_counter_increment(wear_counter * c);
+
+#endif
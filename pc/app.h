@@ -12,10 +12,25 @@
 
 #define USING_PC
 
+// Logging is compiled out of benchmark builds, see pc/bench_mode.h.
+#ifdef ENABLE_BENCH_MODE
+#define DEBUG_LEVEL 0
+#else
 #define DEBUG_LEVEL 1
+#endif
 
 //#define BRIDGE_TO_WALLET
 
+#define ENABLE_U2F
+
+// Use the fixed-base comb in crypto/p256 for P-256 key derivation and
+// signing.  The table is generated into pc/p256_table.h by the Makefile.
+#define ENABLE_P256_COMB
+
+// Sign secp256k1 (wallet extension) with crypto/secp256k1 instead of
+// micro-ecc.  Needs a 64 bit host, otherwise micro-ecc is still used.
+#define ENABLE_SECP256K1_GLV
+
 void printing_init();
 
 
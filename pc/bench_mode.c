@@ -0,0 +1,161 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "device.h"
+#include "storage.h"
+#include "bench_mode.h"
+
+#ifdef ENABLE_BENCH_MODE
+
+static uint64_t rng_state[4];
+static uint32_t up_delay_ms = 0;
+static uint32_t uv_delay_ms = 0;
+
+static AuthenticatorState state_copies[2];
+
+static uint64_t splitmix64(uint64_t * x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// xoshiro256**
+static uint64_t rng_next()
+{
+    uint64_t * s = rng_state;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+static uint32_t env_u32(const char * name, uint32_t def)
+{
+    const char * v = getenv(name);
+    return v ? (uint32_t)strtoul(v, NULL, 0) : def;
+}
+
+static void sleep_ms(uint32_t ms)
+{
+    struct timespec ts;
+
+    if (ms)
+    {
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = (ms % 1000) * 1000000L;
+        nanosleep(&ts, NULL);
+    }
+}
+
+void bench_mode_init()
+{
+    uint32_t seed32 = env_u32("BENCH_SEED", 1);
+    uint64_t seed = seed32;
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        rng_state[i] = splitmix64(&seed);
+    }
+    up_delay_ms = env_u32("BENCH_UP_MS", 0);
+    uv_delay_ms = env_u32("BENCH_UV_MS", 0);
+
+    fprintf(stderr, "bench mode: seed %u, user presence %u ms, user verification %u ms\n",
+            seed32, up_delay_ms, uv_delay_ms);
+}
+
+int ctap_generate_rng(uint8_t * dst, size_t num)
+{
+    uint64_t r;
+
+    while (num >= 8)
+    {
+        r = rng_next();
+        memmove(dst, &r, 8);
+        dst += 8;
+        num -= 8;
+    }
+    if (num)
+    {
+        r = rng_next();
+        memmove(dst, &r, num);
+    }
+    return 1;
+}
+
+int ctap_user_presence_test()
+{
+    sleep_ms(up_delay_ms);
+    return 1;
+}
+
+int ctap_user_verification(uint8_t arg)
+{
+    sleep_ms(uv_delay_ms);
+    return 1;
+}
+
+void authenticator_read_state(AuthenticatorState * state)
+{
+    memmove(state, &state_copies[0], sizeof(AuthenticatorState));
+}
+
+void authenticator_read_backup_state(AuthenticatorState * state)
+{
+    memmove(state, &state_copies[1], sizeof(AuthenticatorState));
+}
+
+void authenticator_write_state(AuthenticatorState * state, int backup)
+{
+    memmove(&state_copies[backup ? 1 : 0], state, sizeof(AuthenticatorState));
+}
+
+int authenticator_is_backup_initialized()
+{
+    return state_copies[1].is_initialized == INITIALIZED_MARKER;
+}
+
+// Erased, like a new device.
+void authenticator_initialize()
+{
+    memset(state_copies, 0xff, sizeof(state_copies));
+}
+
+#endif
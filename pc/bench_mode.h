@@ -0,0 +1,49 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Deterministic benchmark mode for the PC build, make bench_mode=1.
+ *
+ *  Runs of the same commit should only differ by timing noise, so
+ *  everything that would otherwise carry over or vary between runs is
+ *  replaced:
+ *
+ *  - ctap_generate_rng() is a PRNG seeded from BENCH_SEED (default 1).
+ *    Keys and credentials are predictable, never use it for anything else.
+ *  - The authenticator state and the signature counter are kept in RAM,
+ *    so every run starts from a fresh device.
+ *  - ctap_user_presence_test() and ctap_user_verification() sleep for
+ *    BENCH_UP_MS and BENCH_UV_MS (default 0) and succeed.
+ *  - Logging is compiled out (DEBUG_LEVEL 0, see pc/app.h).
+ *  - The nonce and key pools are refilled before every packet instead of
+ *    while idle (fido2/main.c), so they draw from the PRNG at fixed points.
+ *  - The crypto backend is "soft" unless CRYPTO_BACKEND names another.
+ *
+ *  The in-process benches in tools/bench link this file as their device
+ *  HAL whatever bench_mode is set to, see bench_hal.o in the Makefile.
+ */
+#ifndef _BENCH_MODE_H
+#define _BENCH_MODE_H
+
+// Reads the settings from the environment and prints them to stderr.
+void bench_mode_init();
+
+#endif
@@ -0,0 +1,256 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Backend registry for the PC build.
+ *
+ *  Every backend listed below is run through known answer tests at startup
+ *  and then timed on a makeCredential/clientPin shaped workload.  The
+ *  fastest one that passes is used for the rest of the run.  New backends
+ *  (e.g. SIMD kernels) only need to be added to the list.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crypto_backend.h"
+#include "log.h"
+
+static const crypto_backend * const backends[] =
+{
+    &crypto_backend_soft,
+#ifdef ENABLE_OPENSSL_BACKEND
+    &crypto_backend_openssl,
+#endif
+};
+
+#define BACKEND_COUNT (sizeof(backends)/sizeof(backends[0]))
+
+// Rounds of the benchmark workload per backend.
+#define BACKEND_BENCH_ROUNDS    8
+
+static const uint8_t kat_sha256_abc[32] =
+"\xba\x78\x16\xbf\x8f\x01\xcf\xea\x41\x41\x40\xde\x5d\xae\x22\x23"
+"\xb0\x03\x61\xa3\x96\x17\x7a\x9c\xb4\x10\xff\x61\xf2\x00\x15\xad";
+
+static const uint32_t kat_sha256_iv[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+// NIST SP 800-38A F.2.5, first two blocks
+static const uint8_t kat_aes_key[32] =
+"\x60\x3d\xeb\x10\x15\xca\x71\xbe\x2b\x73\xae\xf0\x85\x7d\x77\x81"
+"\x1f\x35\x2c\x07\x3b\x61\x08\xd7\x2d\x98\x10\xa3\x09\x14\xdf\xf4";
+static const uint8_t kat_aes_iv[16] =
+"\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f";
+static const uint8_t kat_aes_pt[32] =
+"\x6b\xc1\xbe\xe2\x2e\x40\x9f\x96\xe9\x3d\x7e\x11\x73\x93\x17\x2a"
+"\xae\x2d\x8a\x57\x1e\x03\xac\x9c\x9e\xb7\x6f\xac\x45\xaf\x8e\x51";
+static const uint8_t kat_aes_ct[32] =
+"\xf5\x8c\x4c\x04\xd6\xe5\xf1\xba\x77\x9e\xab\xfb\x5f\x7b\xfb\xd6"
+"\x9c\xfc\x4e\x96\x7e\xdb\x80\x8d\x67\x9f\x77\x7b\xc6\x70\x2c\x7d";
+
+// Generator of P-256, the public key for a private key of 1.
+static const uint8_t kat_p256_g[64] =
+"\x6b\x17\xd1\xf2\xe1\x2c\x42\x47\xf8\xbc\xe6\xe5\x63\xa4\x40\xf2"
+"\x77\x03\x7d\x81\x2d\xeb\x33\xa0\xf4\xa1\x39\x45\xd8\x98\xc2\x96"
+"\x4f\xe3\x42\xe2\xfe\x1a\x7f\x9b\x8e\xe7\xeb\x4a\x7c\x0f\x9e\x16"
+"\x2b\xce\x33\x57\x6b\x31\x5e\xce\xcb\xb6\x40\x68\x37\xbf\x51\xf5";
+
+static int self_test_fail(const crypto_backend * b, const char * what)
+{
+    printf2(TAG_ERR, "crypto backend %s failed %s self-test\n", b->name, what);
+    return 0;
+}
+
+int crypto_backend_self_test(const crypto_backend * b)
+{
+    uint32_t state[8];
+    uint8_t buf[64], buf2[64];
+    uint8_t priv[32], priv2[32], pub[64], pub2[64], sig[64];
+    uint8_t secret[32], secret2[32];
+    int i;
+
+    b->sha256_init();
+    b->sha256_update((const uint8_t *)"a", 1);
+    b->sha256_update((const uint8_t *)"bc", 2);
+    b->sha256_final(buf);
+    if (memcmp(buf, kat_sha256_abc, 32) != 0)
+        return self_test_fail(b, "sha256");
+
+    // "abc" padded by hand is a single block.
+    memset(buf, 0, 64);
+    memmove(buf, "abc\x80", 4);
+    buf[63] = 24;
+    memmove(state, kat_sha256_iv, 32);
+    b->sha256_compress(state, buf);
+    for (i = 0; i < 8; i++)
+    {
+        if (state[i] != ((uint32_t)kat_sha256_abc[4 * i] << 24 | kat_sha256_abc[4 * i + 1] << 16 |
+                         kat_sha256_abc[4 * i + 2] << 8 | kat_sha256_abc[4 * i + 3]))
+            return self_test_fail(b, "sha256 compress");
+    }
+
+    // Two calls check that the IV chains, the reset that it doesn't stick.
+    memmove(buf, kat_aes_pt, 32);
+    b->aes256_init(kat_aes_key, kat_aes_iv);
+    b->aes256_encrypt(buf, 16);
+    b->aes256_encrypt(buf + 16, 16);
+    if (memcmp(buf, kat_aes_ct, 32) != 0)
+        return self_test_fail(b, "aes encrypt");
+    b->aes256_reset_iv(kat_aes_iv);
+    b->aes256_decrypt(buf, 32);
+    if (memcmp(buf, kat_aes_pt, 32) != 0)
+        return self_test_fail(b, "aes decrypt");
+
+    memset(priv, 0, 32);
+    priv[31] = 1;
+    if (b->ecc256_compute_public_key(priv, pub) != 1 || memcmp(pub, kat_p256_g, 64) != 0)
+        return self_test_fail(b, "public key");
+
+    // Signatures are randomized, so cross check against the software verify.
+    if (b->ecc256_make_key(pub, priv) != 1)
+        return self_test_fail(b, "make_key");
+    memmove(buf, kat_sha256_abc, 32);
+    if (b->ecc256_sign(priv, buf, 32, sig) != 1 ||
+        crypto_backend_soft.ecc256_verify(pub, buf, 32, sig) != 1 ||
+        b->ecc256_verify(pub, buf, 32, sig) != 1)
+        return self_test_fail(b, "ecdsa");
+    buf[0] ^= 1;
+    if (b->ecc256_verify(pub, buf, 32, sig) != 0)
+        return self_test_fail(b, "ecdsa verify");
+
+    if (b->ecc256_make_key(pub2, priv2) != 1 ||
+        b->ecc256_shared_secret(pub2, priv, secret) != 1 ||
+        crypto_backend_soft.ecc256_shared_secret(pub, priv2, secret2) != 1 ||
+        memcmp(secret, secret2, 32) != 0)
+        return self_test_fail(b, "ecdh");
+
+    // Off curve points must be rejected.
+    memmove(buf2, pub2, 64);
+    buf2[63] ^= 1;
+    if (b->ecc256_shared_secret(buf2, priv, secret) != 0)
+        return self_test_fail(b, "ecdh point check");
+
+    return 1;
+}
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// One makeCredential plus one clientPin exchange, roughly.
+static double bench(const crypto_backend * b)
+{
+    uint32_t state[8];
+    uint8_t data[256], hash[32], priv[32], pub[64], sig[64], secret[32];
+    double t;
+    int i, j;
+
+    memset(data, 0x5a, sizeof(data));
+    b->ecc256_make_key(pub, priv);
+
+    t = now_us();
+    for (i = 0; i < BACKEND_BENCH_ROUNDS; i++)
+    {
+        // An HMAC prepare and compute over 64 bytes is five compressions.
+        memmove(state, kat_sha256_iv, 32);
+        for (j = 0; j < 5; j++)
+        {
+            b->sha256_compress(state, data + 64 * (j % 4));
+        }
+        memmove(priv, state, 32);
+        b->ecc256_compute_public_key(priv, pub);
+
+        b->sha256_init();
+        b->sha256_update(data, sizeof(data));
+        b->sha256_final(hash);
+        b->ecc256_sign(priv, hash, 32, sig);
+
+        b->ecc256_shared_secret(pub, priv, secret);
+        b->aes256_init(secret, NULL);
+        b->aes256_decrypt(data, 64);
+        b->aes256_reset_iv(NULL);
+        b->aes256_encrypt(data, 64);
+    }
+    return (now_us() - t) / BACKEND_BENCH_ROUNDS;
+}
+
+const crypto_backend * crypto_backend_select()
+{
+    const crypto_backend * best = NULL;
+    const char * want = getenv("CRYPTO_BACKEND");
+    double t, best_t = 0;
+    int i;
+
+#ifdef ENABLE_BENCH_MODE
+    // Picking by timing would make runs differ.
+    if (want == NULL)
+    {
+        want = "soft";
+    }
+#endif
+
+    for (i = 0; i < BACKEND_COUNT; i++)
+    {
+        const crypto_backend * b = backends[i];
+
+        if (want != NULL && strcmp(want, b->name) != 0)
+            continue;
+        if (!b->init())
+        {
+            printf1(TAG_GREEN, "crypto backend %s unavailable\n", b->name);
+            continue;
+        }
+        if (!crypto_backend_self_test(b))
+            continue;
+
+        if (want != NULL)
+        {
+            best = b;
+            break;
+        }
+
+        t = bench(b);
+        printf1(TAG_GREEN, "crypto backend %s: %.1f us\n", b->name, t);
+        if (best == NULL || t < best_t)
+        {
+            best = b;
+            best_t = t;
+        }
+    }
+
+    if (best == NULL)
+    {
+        printf("Error, no usable crypto backend%s%s\n",
+                want ? " named " : "", want ? want : "");
+        exit(1);
+    }
+
+    printf1(TAG_GREEN, "using crypto backend %s\n", best->name);
+    return best;
+}
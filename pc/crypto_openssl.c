@@ -0,0 +1,309 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Crypto backend on the host libcrypto, built with `make openssl=1`.
+ *
+ *  The low level SHA256 and EC_KEY interfaces are used on purpose: the HMAC
+ *  midstates need the bare compression function, and the EVP_PKEY layer
+ *  costs more per call than the operations themselves for P-256.
+ */
+#ifdef ENABLE_OPENSSL_BACKEND
+
+#define OPENSSL_SUPPRESS_DEPRECATED
+
+#include <string.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/bn.h>
+#include <openssl/obj_mac.h>
+
+#include "crypto_backend.h"
+#include "device.h"
+
+static SHA256_CTX sha256_ctx;
+
+static EVP_CIPHER_CTX * aes_enc = NULL;
+static EVP_CIPHER_CTX * aes_dec = NULL;
+static uint8_t aes_iv[16];
+
+static EC_GROUP * p256 = NULL;
+static BN_CTX * bn_ctx = NULL;
+
+static int ossl_init()
+{
+    if (p256 != NULL)
+    {
+        return 1;
+    }
+    p256 = EC_GROUP_new_by_curve_name(NID_X9_62_prime256v1);
+    bn_ctx = BN_CTX_new();
+    aes_enc = EVP_CIPHER_CTX_new();
+    aes_dec = EVP_CIPHER_CTX_new();
+    return p256 != NULL && bn_ctx != NULL && aes_enc != NULL && aes_dec != NULL;
+}
+
+static void ossl_sha256_init()
+{
+    SHA256_Init(&sha256_ctx);
+}
+
+static void ossl_sha256_update(const uint8_t * data, size_t len)
+{
+    SHA256_Update(&sha256_ctx, data, len);
+}
+
+static void ossl_sha256_final(uint8_t * hash)
+{
+    SHA256_Final(hash, &sha256_ctx);
+}
+
+static void ossl_sha256_compress(uint32_t * state, const uint8_t * block)
+{
+    SHA256_CTX ctx;
+
+    memmove(ctx.h, state, 32);
+    SHA256_Transform(&ctx, block);
+    memmove(state, ctx.h, 32);
+    OPENSSL_cleanse(&ctx, sizeof(ctx));
+}
+
+// CBC is done here over ECB so encrypt and decrypt share one chaining
+// value, which is what tiny-AES (and ctap.c) expect.
+static void ossl_aes256_reset_iv(const uint8_t * iv)
+{
+    if (iv == NULL)
+    {
+        memset(aes_iv, 0, 16);
+    }
+    else
+    {
+        memmove(aes_iv, iv, 16);
+    }
+}
+
+static void ossl_aes256_init(const uint8_t * key, const uint8_t * iv)
+{
+    EVP_EncryptInit_ex(aes_enc, EVP_aes_256_ecb(), NULL, key, NULL);
+    EVP_CIPHER_CTX_set_padding(aes_enc, 0);
+    EVP_DecryptInit_ex(aes_dec, EVP_aes_256_ecb(), NULL, key, NULL);
+    EVP_CIPHER_CTX_set_padding(aes_dec, 0);
+    ossl_aes256_reset_iv(iv);
+}
+
+static void ossl_aes256_encrypt(uint8_t * buf, int len)
+{
+    int i, outl;
+    for ( ; len >= 16; len -= 16, buf += 16)
+    {
+        for (i = 0; i < 16; i++)
+        {
+            buf[i] ^= aes_iv[i];
+        }
+        EVP_EncryptUpdate(aes_enc, buf, &outl, buf, 16);
+        memmove(aes_iv, buf, 16);
+    }
+}
+
+static void ossl_aes256_decrypt(uint8_t * buf, int len)
+{
+    uint8_t next[16];
+    int i, outl;
+    for ( ; len >= 16; len -= 16, buf += 16)
+    {
+        memmove(next, buf, 16);
+        EVP_DecryptUpdate(aes_dec, buf, &outl, buf, 16);
+        for (i = 0; i < 16; i++)
+        {
+            buf[i] ^= aes_iv[i];
+        }
+        memmove(aes_iv, next, 16);
+    }
+}
+
+static EC_POINT * point_from_bytes(const uint8_t * pubkey)
+{
+    uint8_t buf[65];
+    EC_POINT * pt = EC_POINT_new(p256);
+
+    buf[0] = 0x04;
+    memmove(buf + 1, pubkey, 64);
+    // oct2point rejects coordinates >= p and points off the curve.
+    if (pt != NULL && EC_POINT_oct2point(p256, pt, buf, sizeof(buf), bn_ctx) != 1)
+    {
+        EC_POINT_free(pt);
+        return NULL;
+    }
+    return pt;
+}
+
+static int point_to_bytes(const EC_POINT * pt, uint8_t * pubkey)
+{
+    uint8_t buf[65];
+    if (EC_POINT_point2oct(p256, pt, POINT_CONVERSION_UNCOMPRESSED, buf, sizeof(buf), bn_ctx) != sizeof(buf))
+    {
+        return 0;
+    }
+    memmove(pubkey, buf + 1, 64);
+    return 1;
+}
+
+static BIGNUM * scalar_from_bytes(const uint8_t * privkey)
+{
+    BIGNUM * d = BN_bin2bn(privkey, 32, NULL);
+    if (d != NULL && (BN_is_zero(d) || BN_cmp(d, EC_GROUP_get0_order(p256)) >= 0))
+    {
+        BN_clear_free(d);
+        return NULL;
+    }
+    return d;
+}
+
+static int ossl_ecc256_compute_public_key(const uint8_t * privkey, uint8_t * pubkey)
+{
+    BIGNUM * d = scalar_from_bytes(privkey);
+    EC_POINT * pt = EC_POINT_new(p256);
+    int ret = 0;
+
+    if (d != NULL && pt != NULL && EC_POINT_mul(p256, pt, d, NULL, NULL, bn_ctx) == 1)
+    {
+        ret = point_to_bytes(pt, pubkey);
+    }
+    EC_POINT_free(pt);
+    BN_clear_free(d);
+    return ret;
+}
+
+// Draws from ctap_generate_rng like the other backends do.
+static int ossl_ecc256_make_key(uint8_t * pubkey, uint8_t * privkey)
+{
+    int tries;
+    for (tries = 0; tries < 64; tries++)
+    {
+        if (!ctap_generate_rng(privkey, 32))
+        {
+            return 0;
+        }
+        if (ossl_ecc256_compute_public_key(privkey, pubkey))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int ossl_ecc256_sign(const uint8_t * privkey, const uint8_t * hash, int len, uint8_t * sig)
+{
+    EC_KEY * key = EC_KEY_new();
+    BIGNUM * d = scalar_from_bytes(privkey);
+    ECDSA_SIG * s = NULL;
+    const BIGNUM * r, * sv;
+    int ret = 0;
+
+    if (key == NULL || d == NULL || EC_KEY_set_group(key, p256) != 1 || EC_KEY_set_private_key(key, d) != 1)
+    {
+        goto done;
+    }
+    s = ECDSA_do_sign(hash, len, key);
+    if (s == NULL)
+    {
+        goto done;
+    }
+    ECDSA_SIG_get0(s, &r, &sv);
+    ret = BN_bn2binpad(r, sig, 32) == 32 && BN_bn2binpad(sv, sig + 32, 32) == 32;
+
+done:
+    ECDSA_SIG_free(s);
+    BN_clear_free(d);
+    EC_KEY_free(key);
+    return ret;
+}
+
+static int ossl_ecc256_verify(const uint8_t * pubkey, const uint8_t * hash, int len, const uint8_t * sig)
+{
+    EC_KEY * key = EC_KEY_new();
+    EC_POINT * pt = point_from_bytes(pubkey);
+    ECDSA_SIG * s = ECDSA_SIG_new();
+    BIGNUM * r = BN_bin2bn(sig, 32, NULL);
+    BIGNUM * sv = BN_bin2bn(sig + 32, 32, NULL);
+    int ret = 0;
+
+    if (key == NULL || pt == NULL || s == NULL || r == NULL || sv == NULL ||
+        EC_KEY_set_group(key, p256) != 1 || EC_KEY_set_public_key(key, pt) != 1 ||
+        ECDSA_SIG_set0(s, r, sv) != 1)
+    {
+        BN_free(r);
+        BN_free(sv);
+        goto done;
+    }
+    ret = ECDSA_do_verify(hash, len, s, key) == 1;
+
+done:
+    ECDSA_SIG_free(s);
+    EC_POINT_free(pt);
+    EC_KEY_free(key);
+    return ret;
+}
+
+static int ossl_ecc256_shared_secret(const uint8_t * pubkey, const uint8_t * privkey, uint8_t * secret)
+{
+    EC_POINT * q = point_from_bytes(pubkey);
+    EC_POINT * r = EC_POINT_new(p256);
+    BIGNUM * d = scalar_from_bytes(privkey);
+    uint8_t buf[64];
+    int ret = 0;
+
+    if (q != NULL && r != NULL && d != NULL &&
+        EC_POINT_mul(p256, r, NULL, q, d, bn_ctx) == 1 &&
+        point_to_bytes(r, buf))
+    {
+        memmove(secret, buf, 32);
+        ret = 1;
+    }
+    OPENSSL_cleanse(buf, sizeof(buf));
+    BN_clear_free(d);
+    EC_POINT_free(r);
+    EC_POINT_free(q);
+    return ret;
+}
+
+const crypto_backend crypto_backend_openssl =
+{
+    .name = "openssl",
+    .init = ossl_init,
+    .sha256_init = ossl_sha256_init,
+    .sha256_update = ossl_sha256_update,
+    .sha256_final = ossl_sha256_final,
+    .sha256_compress = ossl_sha256_compress,
+    .aes256_init = ossl_aes256_init,
+    .aes256_reset_iv = ossl_aes256_reset_iv,
+    .aes256_encrypt = ossl_aes256_encrypt,
+    .aes256_decrypt = ossl_aes256_decrypt,
+    .ecc256_compute_public_key = ossl_ecc256_compute_public_key,
+    .ecc256_make_key = ossl_ecc256_make_key,
+    .ecc256_sign = ossl_ecc256_sign,
+    .ecc256_verify = ossl_ecc256_verify,
+    .ecc256_shared_secret = ossl_ecc256_shared_secret,
+};
+
+#endif
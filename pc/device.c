@@ -10,12 +10,18 @@
 #include <unistd.h>
 
 #include "device.h"
+#include "ctaphid.h"
 #include "cbor.h"
 #include "util.h"
 #include "log.h"
+#include "wear_counter.h"
+#include "flash_sim.h"
+#include "probes.h"
+#include "bench_mode.h"
 
 
 void authenticator_initialize();
+static void init_atomic_counter();
 
 int udp_server()
 {
@@ -104,19 +110,89 @@ uint32_t millis()
     return (uint32_t)milliseconds;
 }
 
+uint32_t micros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec*1000000LL + ts.tv_nsec/1000);
+}
+
 
 static int serverfd = 0;
 
+// With CAPTURE_FILE set, every frame in and out is appended there for
+// tools/bench/ctaphid_replay.c.  The file is "CAP1" followed by records of
+// the microseconds since the last record (u32, little endian), the
+// direction (CAPTURE_IN or CAPTURE_OUT) and the 64 byte frame.
+#define CAPTURE_IN      0
+#define CAPTURE_OUT     1
+
+static FILE * capture_file = NULL;
+static uint32_t capture_last;
+
+static void capture_frame(int dir, uint8_t * msg)
+{
+    uint32_t now = micros();
+    uint32_t delta = now - capture_last;
+    uint8_t rec[5];
+
+    capture_last = now;
+    rec[0] = delta;
+    rec[1] = delta >> 8;
+    rec[2] = delta >> 16;
+    rec[3] = delta >> 24;
+    rec[4] = dir;
+    fwrite(rec, 1, sizeof(rec), capture_file);
+    fwrite(msg, 1, HID_MESSAGE_SIZE, capture_file);
+}
+
+static void capture_close()
+{
+    fclose(capture_file);
+}
+
+static void init_capture()
+{
+    const char * path = getenv("CAPTURE_FILE");
+
+    if (path == NULL)
+    {
+        return;
+    }
+    capture_file = fopen(path, "wb");
+    if (capture_file == NULL)
+    {
+        perror("fopen");
+        exit(1);
+    }
+    fwrite("CAP1", 1, 4, capture_file);
+    capture_last = micros();
+    atexit(capture_close);
+}
+
 void usbhid_init()
 {
     // just bridge to UDP for now for pure software testing
     serverfd = udp_server();
+    init_capture();
 }
 
 // Receive 64 byte USB HID message, don't block, return size of packet, return 0 if nothing
 int usbhid_recv(uint8_t * msg)
 {
     int l = udp_recv(serverfd, msg, HID_MESSAGE_SIZE);
+    if (capture_file != NULL)
+    {
+        if (l == HID_MESSAGE_SIZE)
+        {
+            capture_frame(CAPTURE_IN, msg);
+        }
+        else if (l == 0)
+        {
+            // idle, so a killed process loses little
+            fflush(capture_file);
+        }
+    }
     /*if (l && l != HID_MESSAGE_SIZE)*/
     /*{*/
         /*printf("Error, recv'd message of wrong size %d", l);*/
@@ -128,6 +204,10 @@ int usbhid_recv(uint8_t * msg)
 // Send 64 byte USB HID message
 void usbhid_send(uint8_t * msg)
 {
+    if (capture_file != NULL)
+    {
+        capture_frame(CAPTURE_OUT, msg);
+    }
     udp_send(serverfd, msg, HID_MESSAGE_SIZE);
 }
 
@@ -137,10 +217,51 @@ void usbhid_close()
 }
 
 
+#ifdef ENABLE_TRACE_LOG
+static FILE * trace_file = NULL;
+
+// With TRACE_FILE set, trace records are written there raw, for
+// tools/convert_log_to_c.py --elf, instead of being printed.
+void log_trace_output(const uint32_t * rec)
+{
+    if (trace_file == NULL)
+    {
+        log_trace_print(rec);
+        return;
+    }
+    fwrite(rec, 4, TRACE_WORDS(rec[0]), trace_file);
+}
+
+static void init_trace_log()
+{
+    const char * path = getenv("TRACE_FILE");
+
+    if (path != NULL)
+    {
+        trace_file = fopen(path, "wb");
+        if (trace_file == NULL)
+        {
+            perror("fopen");
+            exit(1);
+        }
+        fwrite("TRC1", 1, 4, trace_file);
+    }
+    atexit(log_flush);
+}
+#endif
+
 void device_init()
 {
+#ifdef ENABLE_BENCH_MODE
+    bench_mode_init();
+#endif
+#ifdef ENABLE_TRACE_LOG
+    init_trace_log();
+#endif
     usbhid_init();
 
+    init_atomic_counter();
+
     authenticator_initialize();
 
 }
@@ -162,11 +283,13 @@ void heartbeat()
 
 void ctaphid_write_block(uint8_t * data)
 {
+    PROBE2(write_block, ((CTAPHID_PACKET *)data)->cid, data[4]);
     /*printf("<< "); dump_hex(data, 64);*/
     usbhid_send(data);
 }
 
 
+#ifndef ENABLE_BENCH_MODE
 int ctap_user_presence_test()
 {
     return 1;
@@ -176,17 +299,38 @@ int ctap_user_verification(uint8_t arg)
 {
     return 1;
 }
+#endif
+
 
+// Same shape as the EFM32 counter area, kept in a file across runs.
+#define COUNTER_PAGES       2
+#define COUNTER_PAGE_WORDS  512
+
+#ifdef ENABLE_BENCH_MODE
+const char * counter_file = NULL;       // in RAM, fresh every run
+#else
+const char * counter_file = "authenticator_counter.bin";
+#endif
+
+static flash_sim counter_sim;
+static wear_counter_flash counter_flash;
+static wear_counter counter;
+
+static void init_atomic_counter()
+{
+    flash_sim_init(&counter_sim, COUNTER_PAGES, COUNTER_PAGE_WORDS, counter_file);
+    flash_sim_counter(&counter_sim, &counter_flash);
+    wear_counter_init(&counter, &counter_flash, 25);
+}
 
 uint32_t ctap_atomic_count(int sel)
 {
-    static uint32_t counter1 = 25;
-    static uint32_t counter2 = 25;
-    /*return 713;*/
+    uint32_t count;
     if (sel == 0)
     {
-        printf1(TAG_RED,"counter1: %d\n", counter1);
-        return counter1++;
+        count = wear_counter_increment(&counter);
+        printf1(TAG_RED,"counter1: %d\n", count);
+        return count;
     }
     else
     {
@@ -195,6 +339,9 @@ uint32_t ctap_atomic_count(int sel)
     }
 }
 
+// With ENABLE_BENCH_MODE the RNG and the state live in pc/bench_mode.c.
+#ifndef ENABLE_BENCH_MODE
+
 int ctap_generate_rng(uint8_t * dst, size_t num)
 {
     FILE * urand = fopen("/dev/urandom","r");
@@ -229,11 +376,10 @@ void authenticator_read_state(AuthenticatorState * state)
 
     ret = fread(state, 1, sizeof(AuthenticatorState), f);
     fclose(f);
-    if(ret != sizeof(AuthenticatorState))
-    {
-        perror("fwrite");
-        exit(1);
-    }
+    // Files from older builds, or cut short by a crash while writing, are
+    // padded like erased flash.  Slots read as free and the commit record
+    // as invalid.
+    memset((uint8_t*)state + ret, 0xff, sizeof(AuthenticatorState) - ret);
 
 }
 
@@ -251,11 +397,7 @@ void authenticator_read_backup_state(AuthenticatorState * state )
 
     ret = fread(state, 1, sizeof(AuthenticatorState), f);
     fclose(f);
-    if(ret != sizeof(AuthenticatorState))
-    {
-        perror("fwrite");
-        exit(1);
-    }
+    memset((uint8_t*)state + ret, 0xff, sizeof(AuthenticatorState) - ret);
 }
 
 void authenticator_write_state(AuthenticatorState * state, int backup)
@@ -319,8 +461,7 @@ int authenticator_is_backup_initialized()
     fclose(f);
     if(ret != sizeof(header))
     {
-        perror("fwrite");
-        exit(1);
+        return 0;
     }
 
     return state->is_initialized == INITIALIZED_MARKER;
@@ -398,6 +539,8 @@ void authenticator_initialize()
     }
 }
 
+#endif
+
 
 
 
@@ -0,0 +1,157 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flash_sim.h"
+#include "log.h"
+
+// Returns 0 if the operation has to be dropped, otherwise the mask of bits
+// it gets to change: all of them normally, a random subset if it is the
+// one that is torn by power loss.
+static uint32_t flash_sim_power(flash_sim * f)
+{
+    if (!f->powered)
+    {
+        return 0;
+    }
+    if (f->cut_after >= 0 && f->cut_after-- == 0)
+    {
+        f->powered = 0;
+        return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+    }
+    return 0xffffffff;
+}
+
+static void flash_sim_sync(flash_sim * f, int page, int word, int words)
+{
+    long offset = ((long)page * f->page_words + word) * 4;
+
+    if (f->backing == NULL)
+    {
+        return;
+    }
+    if (fseek(f->backing, offset, SEEK_SET) != 0 ||
+        fwrite(f->data + offset/4, 4, words, f->backing) != words)
+    {
+        perror("fwrite");
+        exit(1);
+    }
+    fflush(f->backing);
+}
+
+void flash_sim_init(flash_sim * f, int pages, int page_words, const char * path)
+{
+    size_t words = (size_t)pages * page_words;
+
+    f->pages = pages;
+    f->page_words = page_words;
+    f->data = malloc(words * 4);
+    f->erases = calloc(pages, sizeof(uint32_t));
+    if (f->data == NULL || f->erases == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    memset(f->data, 0xff, words * 4);
+    f->writes = 0;
+    f->cut_after = -1;
+    f->powered = 1;
+    f->backing = NULL;
+
+    if (path != NULL)
+    {
+        f->backing = fopen(path, "rb+");
+        if (f->backing == NULL)
+        {
+            f->backing = fopen(path, "wb+");
+            if (f->backing == NULL)
+            {
+                perror("fopen");
+                exit(1);
+            }
+            flash_sim_sync(f, 0, 0, words);
+        }
+        else if (fread(f->data, 4, words, f->backing) != words)
+        {
+            printf2(TAG_ERR, "%s is short, rest of the flash reads erased\n", path);
+        }
+    }
+}
+
+void flash_sim_reboot(flash_sim * f)
+{
+    f->cut_after = -1;
+    f->powered = 1;
+}
+
+static const uint32_t * flash_sim_page(void * ctx, int page)
+{
+    flash_sim * f = ctx;
+    return f->data + page * f->page_words;
+}
+
+static void flash_sim_erase(void * ctx, int page)
+{
+    flash_sim * f = ctx;
+    uint32_t * p = f->data + page * f->page_words;
+    uint32_t mask = flash_sim_power(f);
+    int i;
+
+    if (!mask)
+    {
+        return;
+    }
+    for (i = 0; i < f->page_words; i++)
+    {
+        // A torn erase leaves each word partly set, differently per word.
+        p[i] |= (mask == 0xffffffff) ? mask : (mask ^ ((uint32_t)rand() << 16) ^ rand());
+    }
+    f->erases[page]++;
+    flash_sim_sync(f, page, 0, f->page_words);
+}
+
+static void flash_sim_write(void * ctx, int page, int word, uint32_t value)
+{
+    flash_sim * f = ctx;
+    uint32_t mask = flash_sim_power(f);
+
+    if (!mask)
+    {
+        return;
+    }
+    f->data[page * f->page_words + word] &= value | ~mask;
+    f->writes++;
+    flash_sim_sync(f, page, word, 1);
+}
+
+void flash_sim_counter(flash_sim * f, wear_counter_flash * flash)
+{
+    flash->ctx = f;
+    flash->pages = f->pages;
+    flash->page_words = f->page_words;
+    flash->page = flash_sim_page;
+    flash->erase = flash_sim_erase;
+    flash->write = flash_sim_write;
+}
@@ -0,0 +1,59 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  RAM model of a NOR flash for the PC build and benchmarks.
+ *
+ *  Erased words read 0xffffffff and writes can only clear bits, as on the
+ *  EFM32.  Erases are counted per page and writes in total.  Setting
+ *  cut_after makes the n-th following operation tear, leaving a random
+ *  subset of its bits changed, and drops every operation after it until
+ *  flash_sim_reboot(), which is how power loss is injected.
+ */
+#ifndef _FLASH_SIM_H
+#define _FLASH_SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "wear_counter.h"
+
+typedef struct
+{
+    int pages;
+    int page_words;
+    uint32_t * data;
+    uint32_t * erases;          // per page
+    uint32_t writes;
+    FILE * backing;             // optional, kept in sync with data
+    int cut_after;              // operations until power loss, -1 for never
+    int powered;
+} flash_sim;
+
+// Opens a simulated flash of pages * page_words words.  If path is set the
+// contents are loaded from and saved to that file, otherwise it starts erased.
+void flash_sim_init(flash_sim * f, int pages, int page_words, const char * path);
+
+void flash_sim_reboot(flash_sim * f);
+
+// Points a wear_counter_flash at the simulator.
+void flash_sim_counter(flash_sim * f, wear_counter_flash * flash);
+
+#endif
@@ -22,6 +22,16 @@
 //#define DISABLE_CTAPHID_WINK
 //#define DISABLE_CTAPHID_CBOR
 
+// Use the fixed-base comb in crypto/p256 for P-256 key derivation and
+// signing.  `make p256table` generates the 960 byte inc/p256_table.h.
+#define ENABLE_P256_COMB
+
+// Keep the signature counter in two pages with fido2/wear_counter.c.  This
+// moves the end of the application and the auth word down one page, so the
+// bootloader has to be built with it too (efm32boot/inc/app.h) and
+// programmed with EFM32_AUTH_WORD=0x1DFFC.
+//#define ENABLE_WEAR_COUNTER
+
 void printing_init();
 
 //#define TEST
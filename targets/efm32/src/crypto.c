@@ -18,6 +18,11 @@
 #include "aes.h"
 #include "ctap.h"
 #include "log.h"
+#include "app.h"
+
+#ifdef ENABLE_P256_COMB
+#include "p256.h"
+#endif
 
 #include MBEDTLS_CONFIG_FILE
 #include "sha256_alt.h"
@@ -137,6 +142,17 @@ void crypto_sha256_hmac_final(uint8_t * key, uint32_t klen, uint8_t * hmac)
     crypto_sha256_final(hmac);
 }
 
+void crypto_sha256_compress(uint32_t * state, const uint8_t * block)
+{
+    mbedtls_sha256_context ctx;
+
+    mbedtls_sha256_init(&ctx);
+    memmove(ctx.state, state, 32);
+    mbedtls_sha256_process(&ctx, block);
+    memmove(state, ctx.state, 32);
+    mbedtls_sha256_free(&ctx);
+}
+
 
 
 
@@ -174,6 +190,9 @@ void crypto_ecc256_init()
 {
     uECC_set_rng((uECC_RNG_Function)ctap_generate_rng);
     _es256_curve = uECC_secp256r1();
+#ifdef ENABLE_P256_COMB
+    p256_set_rng((p256_rng_function)ctap_generate_rng);
+#endif
     mbedtls_ctr_drbg_init(&ctr_drbg);
 
     if ( mbedtls_ctr_drbg_seed(&ctr_drbg, adc_entropy_func, NULL,
@@ -272,7 +291,11 @@ void crypto_ecc256_sign(uint8_t * data, int len, uint8_t * sig)
 //	mbedtls_mpi_write_binary(&r,sig,32);
 //	mbedtls_mpi_write_binary(&s,sig+32,32);
 
+#ifdef ENABLE_P256_COMB
+    if ( p256_sign(_signing_key, data, len, sig) == 0)
+#else
     if ( uECC_sign(_signing_key, data, len, sig, _es256_curve) == 0)
+#endif
     {
         printf2(TAG_ERR,"error, uECC failed\n");
         exit(1);
@@ -551,7 +574,11 @@ void crypto_ecc256_derive_public_key(uint8_t * data, int len, uint8_t * x, uint8
 //    mbedtls_mpi_write_binary(&Q.X,x,32);
 //    mbedtls_mpi_write_binary(&Q.Y,y,32);
 
+#ifdef ENABLE_P256_COMB
+    p256_compute_public_key(privkey, pubkey);
+#else
     uECC_compute_public_key(privkey, pubkey, _es256_curve);
+#endif
     memmove(x,pubkey,32);
     memmove(y,pubkey+32,32);
 }
@@ -566,21 +593,34 @@ void crypto_ecc256_load_key(uint8_t * data, int len, uint8_t * data2, int len2)
 
 void crypto_ecc256_make_key_pair(uint8_t * pubkey, uint8_t * privkey)
 {
+#ifdef ENABLE_P256_COMB
+    if (p256_make_key(pubkey, privkey) != 1)
+#else
     if (uECC_make_key(pubkey, privkey, _es256_curve) != 1)
+#endif
     {
         printf2(TAG_ERR,"Error, uECC_make_key failed\n");
         exit(1);
     }
 }
 
-void crypto_ecc256_shared_secret(const uint8_t * pubkey, const uint8_t * privkey, uint8_t * shared_secret)
+int crypto_ecc256_precompute()
+{
+#ifdef ENABLE_P256_COMB
+    return p256_precompute();
+#else
+    return 0;
+#endif
+}
+
+int crypto_ecc256_shared_secret(const uint8_t * pubkey, const uint8_t * privkey, uint8_t * shared_secret)
 {
     if (uECC_shared_secret(pubkey, privkey, shared_secret, _es256_curve) != 1)
     {
         printf2(TAG_ERR,"Error, uECC_shared_secret failed\n");
-        exit(1);
+        return 0;
     }
-
+    return 1;
 }
 
 struct AES_ctx aes_ctx;
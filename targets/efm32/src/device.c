@@ -26,6 +26,7 @@
 #include "uECC.h"
 #include "crypto.h"
 #include "nfc.h"
+#include "wear_counter.h"
 
 #ifdef USING_DEV_BOARD
 
@@ -55,19 +56,100 @@
 
 #define PAGE_SIZE		2048
 #define PAGES			64
-#define	COUNTER_PAGE	(PAGES - 3)
 #define	STATE1_PAGE		(PAGES - 2)
 #define	STATE2_PAGE		(PAGES - 1)
 
+// Single page counter used by bootloaders built without ENABLE_WEAR_COUNTER.
+#define LEGACY_COUNTER_PAGE	(PAGES - 3)
+
+#ifdef ENABLE_WEAR_COUNTER
+#define COUNTER_PAGES	2
+#define	COUNTER_PAGE	(PAGES - 2 - COUNTER_PAGES)
+#else
+#define	COUNTER_PAGE	LEGACY_COUNTER_PAGE
+#endif
+
 #define APPLICATION_START_ADDR	0x4000
 #define APPLICATION_START_PAGE	(0x4000/PAGE_SIZE)
 
-#define APPLICATION_END_ADDR	(PAGE_SIZE*(PAGES - 3)-4)		// NOT included in application
-#define APPLICATION_END_PAGE	((PAGES - 3))					// 125 is NOT included in application
+#define APPLICATION_END_ADDR	(PAGE_SIZE*COUNTER_PAGE-4)		// NOT included in application
+#define APPLICATION_END_PAGE	(COUNTER_PAGE)					// NOT included in application
+
+#define AUTH_WORD_ADDR          (PAGE_SIZE*COUNTER_PAGE-4)
+
+
+#ifdef ENABLE_WEAR_COUNTER
+
+static wear_counter counter;
+
+static const uint32_t * counter_page(void * ctx, int page)
+{
+    return (uint32_t *)(PAGE_SIZE * (COUNTER_PAGE + page));
+}
+
+static void counter_erase(void * ctx, int page)
+{
+    MSC_ErasePage((uint32_t *)(PAGE_SIZE * (COUNTER_PAGE + page)));
+}
+
+static void counter_write(void * ctx, int page, int word, uint32_t value)
+{
+    uint32_t * ptr = (uint32_t *)(PAGE_SIZE * (COUNTER_PAGE + page));
+    MSC_WriteWordFast(ptr + word, &value, 4);
+}
+
+static const wear_counter_flash counter_flash = {
+    NULL, COUNTER_PAGES, PAGE_SIZE/4,
+    counter_page, counter_erase, counter_write,
+};
+
+// The old counter zeroed each used word and kept the count in the first
+// non zero one.
+static uint32_t legacy_count()
+{
+    int offset;
+    uint32_t * ptr = PAGE_SIZE * LEGACY_COUNTER_PAGE;
+
+    for (offset = 0; offset < PAGE_SIZE/4; offset += 1)
+    {
+        if (ptr[offset] != 0)
+        {
+            return ptr[offset] == 0xffffffff ? 0 : ptr[offset];
+        }
+    }
+    return 0;
+}
+
+static void init_atomic_counter()
+{
+    // The old layout kept the application, and the bootloader's auth word
+    // in its last word, in the first counter page.  A counter page never
+    // holds a 0 there (it would be ~0xffffffff), so until that page is
+    // erased the area is carried over from the old counter explicitly.
+    uint32_t * legacy_auth = PAGE_SIZE*LEGACY_COUNTER_PAGE - 4;
 
-#define AUTH_WORD_ADDR          (PAGE_SIZE*(PAGES - 3)-4)
+    if (*legacy_auth == 0)
+    {
+        printf1(TAG_GEN,"moving counter from the legacy layout\n");
+        wear_counter_format(&counter, &counter_flash, legacy_count());
+        return;
+    }
+    wear_counter_init(&counter, &counter_flash, legacy_count());
+}
 
 
+uint32_t ctap_atomic_count(int sel)
+{
+    if (sel != 0)
+    {
+        printf2(TAG_ERR,"counter2 not imple\n");
+        exit(1);
+    }
+
+    return wear_counter_increment(&counter);
+}
+
+#else
 
 static void init_atomic_counter()
 {
@@ -127,6 +209,8 @@ uint32_t ctap_atomic_count(int sel)
     return count;
 }
 
+#endif
+
 static uint32_t _color;
 uint32_t get_RBG()
 {
@@ -220,6 +304,8 @@ void heartbeat()
     static uint32_t val = (LED_INIT_VALUE >> 8) & 0xff;
     int but = IS_BUTTON_PRESSED();
 
+    micros();       // see micros()
+
 
     if (state)
     {
@@ -247,6 +333,8 @@ void heartbeat()
     static uint32_t val = (LED_INIT_VALUE >> 8) & 0xff;
     int but = IS_BUTTON_PRESSED();
 
+    micros();       // see micros()
+
 
 
 #if 0
@@ -279,6 +367,21 @@ uint32_t millis()
     return CRYOTIMER->CNT;
 }
 
+// From the DWT cycle counter.  Whole microseconds are moved out of it on
+// every call, so it must be called more often than the counter wraps
+// (~4 minutes at 19 MHz).  heartbeat() takes care of that.
+uint32_t micros()
+{
+    static uint32_t last = 0;
+    static uint32_t us = 0;
+    uint32_t per_us = SystemCoreClockGet() / 1000000;
+    uint32_t elapsed = (DWT->CYCCNT - last) / per_us;
+
+    last += elapsed * per_us;
+    us += elapsed;
+    return us;
+}
+
 
 void usbhid_init()
 {
@@ -423,6 +526,8 @@ void authenticator_read_backup_state(AuthenticatorState * state )
     memmove(state,ptr,sizeof(AuthenticatorState));
 }
 
+// Words are programmed in order, so the commit record at the end of the
+// state only becomes valid once the rest is written.
 void authenticator_write_state(AuthenticatorState * state, int backup)
 {
     uint32_t * ptr;
@@ -508,6 +613,11 @@ void device_init(void)
     CHIP_Init();
     enter_DefaultMode_from_RESET();
 
+    // Cycle counter for micros()
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
     // status LEDS
     GPIO_PinModeSet(LED_RED_PIN,
             gpioModePushPull,
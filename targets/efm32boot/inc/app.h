@@ -22,6 +22,9 @@
 
 #define JUMP_LOC	0x4000
 
+// Must match the application, see efm32/inc/app.h.
+//#define ENABLE_WEAR_COUNTER
+
 #ifdef USING_DEV_BOARD
 #define PUSH_BUTTON		gpioPortF,6
 #else
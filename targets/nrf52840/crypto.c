@@ -169,6 +169,16 @@ void crypto_sha256_hmac_final(uint8_t * key, uint32_t klen, uint8_t * hmac)
     crypto_sha256_final(hmac);
 }
 
+void crypto_sha256_compress(uint32_t * state, const uint8_t * block)
+{
+    SHA256_CTX ctx;
+
+    memmove(ctx.state, state, 32);
+    sha256_transform(&ctx, block);
+    memmove(state, ctx.state, 32);
+    memset(&ctx, 0, sizeof(ctx));
+}
+
 
 void crypto_ecc256_init()
 {
@@ -287,14 +297,19 @@ void crypto_ecc256_make_key_pair(uint8_t * pubkey, uint8_t * privkey)
 
 }
 
-void crypto_ecc256_shared_secret(const uint8_t * pubkey, const uint8_t * privkey, uint8_t * shared_secret)
+int crypto_ecc256_precompute()
+{
+    return 0;
+}
+
+int crypto_ecc256_shared_secret(const uint8_t * pubkey, const uint8_t * privkey, uint8_t * shared_secret)
 {
     if (uECC_shared_secret(pubkey, privkey, shared_secret, uECC_secp256r1()) != 1)
     {
         printf("Error, uECC_shared_secret failed\n");
-        exit(1);
+        return 0;
     }
-
+    return 1;
 }
 
 uint8_t fixed_vector_hmac[32];
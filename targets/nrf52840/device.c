@@ -98,6 +98,21 @@ uint64_t millis()
     return (uint64_t)nrf_drv_rtc_counter_get(&rtc);
 }
 
+// From the DWT cycle counter.  Whole microseconds are moved out of it on
+// every call, so it must be called more often than the counter wraps
+// (~67 seconds at 64 MHz).  heartbeat() takes care of that.
+uint32_t micros()
+{
+    static uint32_t last = 0;
+    static uint32_t us = 0;
+    uint32_t per_us = SystemCoreClock / 1000000;
+    uint32_t elapsed = (DWT->CYCCNT - last) / per_us;
+
+    last += elapsed * per_us;
+    us += elapsed;
+    return us;
+}
+
 
 
 static void rtc_config(void)
@@ -147,6 +162,11 @@ void device_init()
     set_output_terminal(0);
     init_power_clock();
     rtc_config();
+
+    // Cycle counter for micros()
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
     usbhid_init();
 
     srand(millis());
@@ -214,6 +234,7 @@ void heartbeat()
     nrf_gpio_pin_toggle(LED_2);
     nrf_gpio_pin_toggle(LED_3);
     nrf_gpio_pin_toggle(LED_4);
+    micros();       // see micros()
 }
 
 #ifndef TEST_POWER
@@ -0,0 +1,182 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Cost, wear and power loss behaviour of the wear_counter signature
+ *  counter on the simulated flash from pc/flash_sim.c.
+ *
+ *  make counterbench && ./counterbench [increments] [cut trials] > counter.json
+ *
+ *  The geometry matches the EFM32 counter area (2 pages of 512 words).
+ *  Each power cut trial tears a random operation of a random increment,
+ *  reboots and checks that the counter never goes back below the last
+ *  value that was handed out.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "wear_counter.h"
+#include "flash_sim.h"
+
+#define PAGES       2
+#define PAGE_WORDS  512
+
+static uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void free_sim(flash_sim * f)
+{
+    free(f->data);
+    free(f->erases);
+}
+
+// Runs increments on fresh flash and reports the write/erase counts.
+static void bench_cost(int increments)
+{
+    flash_sim sim;
+    wear_counter_flash flash;
+    wear_counter c;
+    uint64_t t;
+    uint32_t erases = 0;
+    int i;
+
+    flash_sim_init(&sim, PAGES, PAGE_WORDS, NULL);
+    flash_sim_counter(&sim, &flash);
+    wear_counter_init(&c, &flash, 0);
+
+    sim.writes = 0;
+    for (i = 0; i < PAGES; i++)
+    {
+        sim.erases[i] = 0;
+    }
+
+    t = now_ns();
+    for (i = 0; i < increments; i++)
+    {
+        wear_counter_increment(&c);
+    }
+    t = now_ns() - t;
+
+    printf("  \"increments\": %d,\n", increments);
+    printf("  \"final_value\": %u,\n", c.value);
+    printf("  \"ns_per_increment\": %.1f,\n", (double)t / increments);
+    printf("  \"writes_per_increment\": %.3f,\n", (double)sim.writes / increments);
+    printf("  \"page_erases\": [");
+    for (i = 0; i < PAGES; i++)
+    {
+        erases += sim.erases[i];
+        printf("%s%u", i ? ", " : "", sim.erases[i]);
+    }
+    printf("],\n");
+    printf("  \"erases_per_increment\": %.5f,\n", (double)erases / increments);
+
+    // Boot time scan of a used area.
+    t = now_ns();
+    wear_counter_init(&c, &flash, 0);
+    printf("  \"init_ns\": %llu,\n", (unsigned long long)(now_ns() - t));
+
+    free_sim(&sim);
+}
+
+static void bench_power_cut(int trials)
+{
+    flash_sim sim;
+    wear_counter_flash flash;
+    wear_counter c;
+    uint32_t issued, v;
+    int t, i, n, failures = 0, lost = 0;
+
+    for (t = 0; t < trials; t++)
+    {
+        flash_sim_init(&sim, PAGES, PAGE_WORDS, NULL);
+        flash_sim_counter(&sim, &flash);
+        wear_counter_init(&c, &flash, 0);
+
+        // Land anywhere, including close to a page rollover.
+        n = rand() % (3 * PAGE_WORDS);
+        for (i = 0; i < n; i++)
+        {
+            wear_counter_increment(&c);
+        }
+        issued = c.value;
+
+        // Rollovers take five operations, records two.
+        sim.cut_after = rand() % 5;
+        wear_counter_increment(&c);
+
+        flash_sim_reboot(&sim);
+        wear_counter_init(&c, &flash, 0);
+        if (c.value < issued)
+        {
+            failures++;
+            fprintf(stderr, "trial %d: counter went back from %u to %u\n", t, issued, c.value);
+        }
+        else if (c.value == issued)
+        {
+            lost++;
+        }
+
+        v = wear_counter_increment(&c);
+        if (v <= issued)
+        {
+            failures++;
+            fprintf(stderr, "trial %d: reissued %u after %u\n", t, v, issued);
+        }
+        free_sim(&sim);
+    }
+
+    printf("  \"power_cut_trials\": %d,\n", trials);
+    printf("  \"power_cut_lost_increments\": %d,\n", lost);
+    printf("  \"power_cut_failures\": %d\n", failures);
+}
+
+int main(int argc, char * argv[])
+{
+    int increments = 100000;
+    int trials = 10000;
+
+    if (argc > 1)
+    {
+        increments = atoi(argv[1]);
+    }
+    if (argc > 2)
+    {
+        trials = atoi(argv[2]);
+    }
+    if (increments < 1 || trials < 0)
+    {
+        printf("usage: %s [increments] [cut trials]\n", argv[0]);
+        return 1;
+    }
+
+    srand(1);
+    printf("{\n  \"pages\": %d,\n  \"page_words\": %d,\n", PAGES, PAGE_WORDS);
+    bench_cost(increments);
+    bench_power_cut(trials);
+    printf("}\n");
+    return 0;
+}
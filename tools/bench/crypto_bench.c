@@ -0,0 +1,223 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Micro-benchmarks for the crypto.h surface, as used by ctap.c.
+ *
+ *  make bench && ./cryptobench [iterations] > bench.json
+ *
+ *  Every operation is timed individually and reported as min, median, p90,
+ *  p99 and max in JSON on stdout.  On x86 the unit is TSC ticks (reference
+ *  cycles, not core cycles under turbo), elsewhere nanoseconds.  The crypto
+ *  backend is chosen as in the PC build, CRYPTO_BACKEND=<name> pins it.
+ *  Inputs and keys come from the pc/bench_mode.c PRNG, seeded by BENCH_SEED.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "crypto.h"
+#include "crypto_backend.h"
+#include "device.h"
+#include "bench_mode.h"
+
+// Same numbering as mbedtls, see fido2/extensions/wallet.c.
+#define MBEDTLS_ECP_DP_SECP256K1    12
+
+#define MAX_SIZE    4096
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TIME_UNIT "tsc"
+static inline uint64_t ticks()
+{
+    return __rdtsc();
+}
+#else
+#define TIME_UNIT "ns"
+static inline uint64_t ticks()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+static int cmp_u64(const void * a, const void * b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t * sorted, int n, int pct)
+{
+    return sorted[(n - 1) * pct / 100];
+}
+
+static int results = 0;
+
+static void report(const char * name, int bytes, uint64_t * samples, int n)
+{
+    uint64_t med;
+
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+    med = percentile(samples, n, 50);
+
+    printf("%s\n    {\"name\": \"%s\", \"bytes\": %d, \"iterations\": %d, "
+           "\"min\": %llu, \"median\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu",
+           results++ ? "," : "", name, bytes, n,
+           (unsigned long long)samples[0], (unsigned long long)med,
+           (unsigned long long)percentile(samples, n, 90),
+           (unsigned long long)percentile(samples, n, 99),
+           (unsigned long long)samples[n - 1]);
+    if (bytes > 0)
+    {
+        printf(", \"median_per_byte\": %.2f", (double)med / bytes);
+    }
+    printf("}");
+}
+
+#define TIMED(samples, i, op) do {      \
+        uint64_t _t = ticks();          \
+        op;                             \
+        samples[i] = ticks() - _t;      \
+    } while (0)
+
+static const int hash_sizes[] = {16, 64, 256, 1024, MAX_SIZE};
+
+int main(int argc, char * argv[])
+{
+    static uint8_t buf[MAX_SIZE];
+    uint8_t key[32], hash[32], sig[64], x[32], y[32];
+    uint8_t pub[64], priv[32], secret[32];
+    crypto_hmac_midstate st;
+    uint64_t * samples;
+    int iters = 500;
+    int i, s;
+
+    if (argc > 1)
+    {
+        iters = atoi(argv[1]);
+    }
+    if (iters < 1)
+    {
+        printf("usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    samples = malloc(iters * sizeof(uint64_t));
+    if (samples == NULL)
+    {
+        perror("malloc");
+        return 1;
+    }
+
+    bench_mode_init();
+    crypto_ecc256_init();
+    ctap_generate_rng(buf, sizeof(buf));
+    ctap_generate_rng(key, sizeof(key));
+
+    printf("{\n  \"backend\": \"%s\",\n  \"unit\": \"%s\",\n  \"results\": [",
+            crypto_backend_current()->name, TIME_UNIT);
+
+    for (s = 0; s < sizeof(hash_sizes)/sizeof(hash_sizes[0]); s++)
+    {
+        for (i = 0; i < iters; i++)
+        {
+            TIMED(samples, i,
+                crypto_sha256_init();
+                crypto_sha256_update(buf, hash_sizes[s]);
+                crypto_sha256_final(hash));
+        }
+        report("sha256", hash_sizes[s], samples, iters);
+    }
+
+    for (i = 0; i < iters; i++)
+    {
+        TIMED(samples, i,
+            crypto_sha256_hmac_init(key, 32, hash);
+            crypto_sha256_update(buf, 64);
+            crypto_sha256_hmac_final(key, 32, hash));
+    }
+    report("hmac", 64, samples, iters);
+
+    crypto_sha256_hmac_prepare(key, 32, &st);
+    for (i = 0; i < iters; i++)
+    {
+        TIMED(samples, i, crypto_sha256_hmac_compute(&st, buf, 64, NULL, 0, hash));
+    }
+    report("hmac_midstate", 64, samples, iters);
+
+    for (s = 64; s <= 1024; s *= 16)
+    {
+        crypto_aes256_init(key, NULL);
+        for (i = 0; i < iters; i++)
+        {
+            TIMED(samples, i, crypto_aes256_encrypt(buf, s));
+        }
+        report("aes256_encrypt", s, samples, iters);
+
+        for (i = 0; i < iters; i++)
+        {
+            TIMED(samples, i, crypto_aes256_decrypt(buf, s));
+        }
+        report("aes256_decrypt", s, samples, iters);
+    }
+
+    for (i = 0; i < iters; i++)
+    {
+        buf[0] = i;
+        TIMED(samples, i, crypto_ecc256_derive_public_key(buf, 32, x, y));
+    }
+    report("ecc256_derive_public_key", 0, samples, iters);
+
+    crypto_ecc256_load_key(buf, 32, NULL, 0);
+    for (i = 0; i < iters; i++)
+    {
+        TIMED(samples, i, crypto_ecc256_sign(hash, 32, sig));
+    }
+    report("ecc256_sign", 0, samples, iters);
+
+    crypto_ecc256_make_key_pair(pub, priv);
+    for (i = 0; i < iters; i++)
+    {
+        TIMED(samples, i, crypto_ecc256_shared_secret(pub, priv, secret));
+    }
+    report("ecc256_shared_secret", 0, samples, iters);
+
+    // Any 32 byte value below the order works as a secp256k1 key.
+    key[0] &= 0x7f;
+    crypto_load_external_key(key, 32);
+    for (i = 0; i < iters; i++)
+    {
+        TIMED(samples, i, crypto_ecdsa_sign(hash, 32, sig, MBEDTLS_ECP_DP_SECP256K1));
+    }
+    report("ecdsa_sign_secp256k1", 0, samples, iters);
+
+    printf("\n  ]\n}\n");
+
+    free(samples);
+    return 0;
+}
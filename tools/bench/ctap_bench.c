@@ -0,0 +1,585 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  In-process throughput of CTAP and U2F commands, without the transport.
+ *
+ *  make ctapbench && ./ctapbench [iterations] > ctap.json
+ *
+ *  Canonical requests are built once and handed to ctap_request() or
+ *  u2f_request() in a loop, so the numbers cover parsing, the command
+ *  logic, crypto and response encoding only.  For each command the JSON
+ *  has ops per second (wall clock) and CPU time per op in microseconds.
+ *
+ *  The RNG, user presence and state come from pc/bench_mode.c, so the
+ *  seed and BENCH_UP_MS/BENCH_UV_MS apply as for make bench_mode=1, and the
+ *  counter is in RAM.  CRYPTO_BACKEND=<name> pins the backend.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cbor.h"
+#include "ctap.h"
+#include "ctap_errors.h"
+#include "u2f.h"
+#include "crypto.h"
+#include "crypto_backend.h"
+#include "cose_key.h"
+#include "device.h"
+#include "storage.h"
+#include "log.h"
+#include "bench_mode.h"
+
+#define RP_ID       "bench.example"
+#define PIN         "1234"
+
+/*
+ *  The rest of the device HAL, pc/device.c is not linked
+ */
+
+static uint32_t counter = 25;
+
+uint32_t ctap_atomic_count(int sel)
+{
+    return ++counter;
+}
+
+uint32_t millis()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint32_t micros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ *  Requests
+ */
+
+typedef struct
+{
+    const char * name;
+    int u2f;
+    uint8_t buf[4096];
+    int len;
+} request;
+
+static CTAP_RESPONSE resp;
+
+static uint8_t client_data_hash[32];
+static uint8_t app_id[32];
+static uint8_t cred_id[256];
+static int cred_id_len = 0;
+static uint8_t key_handle[U2F_KEY_HANDLE_SIZE];
+
+// Platform side of the PIN protocol.
+static uint8_t platform_pub[64], platform_priv[32];
+static uint8_t shared_secret[32];
+
+static void check(CborError err)
+{
+    if (err != CborNoError)
+    {
+        printf("cbor error %d building a request\n", err);
+        exit(1);
+    }
+}
+
+static void start_request(request * r, const char * name, uint8_t cmd, CborEncoder * enc)
+{
+    r->name = name;
+    r->u2f = 0;
+    r->buf[0] = cmd;
+    cbor_encoder_init(enc, r->buf + 1, sizeof(r->buf) - 1, 0);
+}
+
+static void end_request(request * r, CborEncoder * enc)
+{
+    r->len = 1 + cbor_encoder_get_buffer_size(enc, r->buf + 1);
+}
+
+static void build_get_info(request * r)
+{
+    r->name = "get_info";
+    r->u2f = 0;
+    r->buf[0] = CTAP_GET_INFO;
+    r->len = 1;
+}
+
+static void build_make_credential(request * r)
+{
+    CborEncoder enc, map, sub, arr, param;
+    uint8_t user_id[16];
+
+    memset(user_id, 0x55, sizeof(user_id));
+    start_request(r, "make_credential", CTAP_MAKE_CREDENTIAL, &enc);
+    check(cbor_encoder_create_map(&enc, &map, 4));
+
+    check(cbor_encode_uint(&map, MC_clientDataHash));
+    check(cbor_encode_byte_string(&map, client_data_hash, 32));
+
+    check(cbor_encode_uint(&map, MC_rp));
+    check(cbor_encoder_create_map(&map, &sub, 1));
+    check(cbor_encode_text_stringz(&sub, "id"));
+    check(cbor_encode_text_stringz(&sub, RP_ID));
+    check(cbor_encoder_close_container(&map, &sub));
+
+    check(cbor_encode_uint(&map, MC_user));
+    check(cbor_encoder_create_map(&map, &sub, 2));
+    check(cbor_encode_text_stringz(&sub, "id"));
+    check(cbor_encode_byte_string(&sub, user_id, sizeof(user_id)));
+    check(cbor_encode_text_stringz(&sub, "name"));
+    check(cbor_encode_text_stringz(&sub, "bench"));
+    check(cbor_encoder_close_container(&map, &sub));
+
+    check(cbor_encode_uint(&map, MC_pubKeyCredParams));
+    check(cbor_encoder_create_array(&map, &arr, 1));
+    check(cbor_encoder_create_map(&arr, &param, 2));
+    check(cbor_encode_text_stringz(&param, "alg"));
+    check(cbor_encode_int(&param, COSE_ALG_ES256));
+    check(cbor_encode_text_stringz(&param, "type"));
+    check(cbor_encode_text_stringz(&param, "public-key"));
+    check(cbor_encoder_close_container(&arr, &param));
+    check(cbor_encoder_close_container(&map, &arr));
+
+    check(cbor_encoder_close_container(&enc, &map));
+    end_request(r, &enc);
+}
+
+// The real credential is last, so the whole list is looked at.
+static void build_get_assertion(request * r, const char * name, int allow)
+{
+    CborEncoder enc, map, arr, desc;
+    uint8_t fake[sizeof(cred_id)];
+    int i;
+
+    start_request(r, name, CTAP_GET_ASSERTION, &enc);
+    check(cbor_encoder_create_map(&enc, &map, 3));
+
+    check(cbor_encode_uint(&map, GA_rpId));
+    check(cbor_encode_text_stringz(&map, RP_ID));
+
+    check(cbor_encode_uint(&map, GA_clientDataHash));
+    check(cbor_encode_byte_string(&map, client_data_hash, 32));
+
+    check(cbor_encode_uint(&map, GA_allowList));
+    check(cbor_encoder_create_array(&map, &arr, allow));
+    for (i = 0; i < allow; i++)
+    {
+        ctap_generate_rng(fake, cred_id_len);
+        check(cbor_encoder_create_map(&arr, &desc, 2));
+        check(cbor_encode_text_stringz(&desc, "id"));
+        check(cbor_encode_byte_string(&desc, i == allow - 1 ? cred_id : fake, cred_id_len));
+        check(cbor_encode_text_stringz(&desc, "type"));
+        check(cbor_encode_text_stringz(&desc, "public-key"));
+        check(cbor_encoder_close_container(&arr, &desc));
+    }
+    check(cbor_encoder_close_container(&map, &arr));
+
+    check(cbor_encoder_close_container(&enc, &map));
+    end_request(r, &enc);
+}
+
+static void encode_platform_key(CborEncoder * map)
+{
+    CborEncoder key;
+
+    check(cbor_encode_uint(map, CP_keyAgreement));
+    check(cbor_encoder_create_map(map, &key, 5));
+    check(cbor_encode_int(&key, COSE_KEY_LABEL_KTY));
+    check(cbor_encode_int(&key, COSE_KEY_KTY_EC2));
+    check(cbor_encode_int(&key, COSE_KEY_LABEL_ALG));
+    check(cbor_encode_int(&key, COSE_ALG_ECDH_ES_HKDF_256));
+    check(cbor_encode_int(&key, COSE_KEY_LABEL_CRV));
+    check(cbor_encode_int(&key, COSE_KEY_CRV_P256));
+    check(cbor_encode_int(&key, COSE_KEY_LABEL_X));
+    check(cbor_encode_byte_string(&key, platform_pub, 32));
+    check(cbor_encode_int(&key, COSE_KEY_LABEL_Y));
+    check(cbor_encode_byte_string(&key, platform_pub + 32, 32));
+    check(cbor_encoder_close_container(map, &key));
+}
+
+// Subcommands without a key, getRetries and getKeyAgreement.
+static void build_client_pin(request * r, const char * name, int sub)
+{
+    CborEncoder enc, map;
+
+    start_request(r, name, CTAP_CLIENT_PIN, &enc);
+    check(cbor_encoder_create_map(&enc, &map, 2));
+    check(cbor_encode_uint(&map, CP_pinProtocol));
+    check(cbor_encode_uint(&map, 1));
+    check(cbor_encode_uint(&map, CP_subCommand));
+    check(cbor_encode_uint(&map, sub));
+    check(cbor_encoder_close_container(&enc, &map));
+    end_request(r, &enc);
+}
+
+static void build_set_pin(request * r)
+{
+    CborEncoder enc, map;
+    crypto_hmac_midstate st;
+    uint8_t pin_enc[64], pin_auth[32];
+
+    memset(pin_enc, 0, sizeof(pin_enc));
+    memmove(pin_enc, PIN, strlen(PIN));
+    crypto_aes256_init(shared_secret, NULL);
+    crypto_aes256_encrypt(pin_enc, sizeof(pin_enc));
+    crypto_sha256_hmac_prepare(shared_secret, 32, &st);
+    crypto_sha256_hmac_compute(&st, pin_enc, sizeof(pin_enc), NULL, 0, pin_auth);
+
+    start_request(r, "client_pin_set_pin", CTAP_CLIENT_PIN, &enc);
+    check(cbor_encoder_create_map(&enc, &map, 5));
+    check(cbor_encode_uint(&map, CP_pinProtocol));
+    check(cbor_encode_uint(&map, 1));
+    check(cbor_encode_uint(&map, CP_subCommand));
+    check(cbor_encode_uint(&map, CP_cmdSetPin));
+    encode_platform_key(&map);
+    check(cbor_encode_uint(&map, CP_pinAuth));
+    check(cbor_encode_byte_string(&map, pin_auth, 16));
+    check(cbor_encode_uint(&map, CP_newPinEnc));
+    check(cbor_encode_byte_string(&map, pin_enc, sizeof(pin_enc)));
+    check(cbor_encoder_close_container(&enc, &map));
+    end_request(r, &enc);
+}
+
+static void build_get_pin_token(request * r)
+{
+    CborEncoder enc, map;
+    uint8_t pin_hash[32];
+
+    crypto_sha256_init();
+    crypto_sha256_update((uint8_t *)PIN, strlen(PIN));
+    crypto_sha256_final(pin_hash);
+    crypto_aes256_init(shared_secret, NULL);
+    crypto_aes256_encrypt(pin_hash, 16);
+
+    start_request(r, "client_pin_get_pin_token", CTAP_CLIENT_PIN, &enc);
+    check(cbor_encoder_create_map(&enc, &map, 4));
+    check(cbor_encode_uint(&map, CP_pinProtocol));
+    check(cbor_encode_uint(&map, 1));
+    check(cbor_encode_uint(&map, CP_subCommand));
+    check(cbor_encode_uint(&map, CP_cmdGetPinToken));
+    encode_platform_key(&map);
+    check(cbor_encode_uint(&map, CP_pinHashEnc));
+    check(cbor_encode_byte_string(&map, pin_hash, 16));
+    check(cbor_encoder_close_container(&enc, &map));
+    end_request(r, &enc);
+}
+
+static void build_u2f(request * r, const char * name, uint8_t ins, uint8_t p1)
+{
+    struct u2f_request_apdu * apdu = (struct u2f_request_apdu *)r->buf;
+    int len = 64;
+
+    r->name = name;
+    r->u2f = 1;
+    memset(apdu, 0, sizeof(*apdu));
+    apdu->ins = ins;
+    apdu->p1 = p1;
+    memmove(apdu->payload, client_data_hash, 32);
+    memmove(apdu->payload + 32, app_id, 32);
+    if (ins == U2F_AUTHENTICATE)
+    {
+        apdu->payload[64] = U2F_KEY_HANDLE_SIZE;
+        memmove(apdu->payload + 65, key_handle, U2F_KEY_HANDLE_SIZE);
+        len += 1 + U2F_KEY_HANDLE_SIZE;
+    }
+    apdu->LC2 = len >> 8;
+    apdu->LC3 = len & 0xff;
+    r->len = U2F_APDU_SIZE + len;
+}
+
+/*
+ *  Running
+ */
+
+// @return 1 if the command succeeded
+static int run(request * r)
+{
+    uint8_t status;
+
+    ctap_response_init(&resp);
+    if (r->u2f)
+    {
+        u2f_request((struct u2f_request_apdu *)r->buf, &resp);
+        return resp.length >= 2 && resp.data[resp.length - 2] == 0x90 && resp.data[resp.length - 1] == 0;
+    }
+    status = ctap_request(r->buf, r->len, &resp);
+    return status == CTAP1_ERR_SUCCESS;
+}
+
+static void run_or_exit(request * r)
+{
+    if (!run(r))
+    {
+        printf("%s failed\n", r->name);
+        exit(1);
+    }
+}
+
+// Finds the byte string under integer key @label in the response map, or
+// in the map under @outer if it is not 0.
+static int response_bytes(int outer, int label, uint8_t * out, size_t * len)
+{
+    CborParser parser;
+    CborValue it, map, inner;
+    int key;
+
+    check(cbor_parser_init(resp.data, resp.length, 0, &parser, &it));
+    check(cbor_value_enter_container(&it, &map));
+    while (!cbor_value_at_end(&map))
+    {
+        check(cbor_value_get_int_checked(&map, &key));
+        check(cbor_value_advance(&map));
+        if (outer && key == outer)
+        {
+            check(cbor_value_enter_container(&map, &inner));
+            while (!cbor_value_at_end(&inner))
+            {
+                check(cbor_value_get_int_checked(&inner, &key));
+                check(cbor_value_advance(&inner));
+                if (key == label)
+                {
+                    return cbor_value_copy_byte_string(&inner, out, len, NULL) == CborNoError;
+                }
+                check(cbor_value_advance(&inner));
+            }
+            return 0;
+        }
+        if (!outer && key == label)
+        {
+            return cbor_value_copy_byte_string(&map, out, len, NULL) == CborNoError;
+        }
+        check(cbor_value_advance(&map));
+    }
+    return 0;
+}
+
+static void make_credential_id(request * mc)
+{
+    uint8_t auth_data[512];
+    size_t len = sizeof(auth_data);
+
+    run_or_exit(mc);
+    if (!response_bytes(0, RESP_authData, auth_data, &len) || len < 55)
+    {
+        printf("no authData in make_credential response\n");
+        exit(1);
+    }
+    // rpIdHash, flags, counter, aaguid, length, credential id
+    cred_id_len = (auth_data[53] << 8) | auth_data[54];
+    if (cred_id_len > sizeof(cred_id) || 55 + cred_id_len > len)
+    {
+        printf("bad credential id length %d\n", cred_id_len);
+        exit(1);
+    }
+    memmove(cred_id, auth_data + 55, cred_id_len);
+}
+
+static void make_key_handle(request * reg)
+{
+    run_or_exit(reg);
+    // 0x05, public key, handle length, handle, ...
+    if (resp.data[1 + U2F_EC_PUBKEY_SIZE] != U2F_KEY_HANDLE_SIZE)
+    {
+        printf("unexpected key handle length %d\n", resp.data[1 + U2F_EC_PUBKEY_SIZE]);
+        exit(1);
+    }
+    memmove(key_handle, resp.data + 2 + U2F_EC_PUBKEY_SIZE, U2F_KEY_HANDLE_SIZE);
+}
+
+// Gets the authenticator's key agreement key and derives shared_secret.
+static void agree_key()
+{
+    request r;
+    uint8_t pub[64];
+    size_t len = 32;
+
+    build_client_pin(&r, "client_pin_get_key_agreement", CP_cmdGetKeyAgreement);
+    run_or_exit(&r);
+    if (!response_bytes(RESP_keyAgreement, COSE_KEY_LABEL_X, pub, &len) || len != 32 ||
+        (len = 32, !response_bytes(RESP_keyAgreement, COSE_KEY_LABEL_Y, pub + 32, &len)) || len != 32)
+    {
+        printf("no key agreement key in response\n");
+        exit(1);
+    }
+    crypto_ecc256_make_key_pair(platform_pub, platform_priv);
+    if (!crypto_ecc256_shared_secret(pub, platform_priv, shared_secret))
+    {
+        printf("invalid key agreement key in response\n");
+        exit(1);
+    }
+    crypto_sha256_init();
+    crypto_sha256_update(shared_secret, 32);
+    crypto_sha256_final(shared_secret);
+}
+
+static void reset_device()
+{
+    request r;
+
+    r.name = "reset";
+    r.u2f = 0;
+    r.buf[0] = CTAP_RESET;
+    r.len = 1;
+    run_or_exit(&r);
+}
+
+static uint64_t wall_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t cpu_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int results = 0;
+
+static void report(const char * name, int iters, uint64_t wall, uint64_t cpu)
+{
+    printf("%s\n    {\"name\": \"%s\", \"iterations\": %d, \"ops_per_sec\": %.1f, "
+           "\"cpu_us_per_op\": %.2f, \"wall_us_per_op\": %.2f}",
+           results++ ? "," : "", name, iters,
+           iters / (wall / 1e9), cpu / 1e3 / iters, wall / 1e3 / iters);
+}
+
+static void bench(request * r, int iters)
+{
+    uint64_t w, c;
+    int i;
+
+    run_or_exit(r);
+    w = wall_ns();
+    c = cpu_ns();
+    for (i = 0; i < iters; i++)
+    {
+        if (!run(r))
+        {
+            printf("%s failed on iteration %d\n", r->name, i);
+            exit(1);
+        }
+    }
+    c = cpu_ns() - c;
+    w = wall_ns() - w;
+    report(r->name, iters, w, c);
+}
+
+// setPin only works once, so the device is reset between iterations and
+// only the setPin request itself is timed.
+static void bench_set_pin(int iters)
+{
+    request r;
+    uint64_t w = 0, c = 0, w0, c0;
+    int i;
+
+    for (i = 0; i < iters; i++)
+    {
+        reset_device();
+        agree_key();
+        build_set_pin(&r);
+        w0 = wall_ns();
+        c0 = cpu_ns();
+        if (!run(&r))
+        {
+            printf("%s failed on iteration %d\n", r.name, i);
+            exit(1);
+        }
+        c += cpu_ns() - c0;
+        w += wall_ns() - w0;
+    }
+    report(r.name, iters, w, c);
+}
+
+static request mc, reg, scratch;
+
+int main(int argc, char * argv[])
+{
+    static const int allow_sizes[] = {1, 5, 20};
+    static const char * const allow_names[] = {"get_assertion_1", "get_assertion_5", "get_assertion_20"};
+    request * r = &scratch;
+    int iters = 200;
+    int i;
+
+    if (argc > 1)
+    {
+        iters = atoi(argv[1]);
+    }
+    if (iters < 1)
+    {
+        printf("usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    set_logging_mask(0);
+    bench_mode_init();
+    ctap_init();
+
+    ctap_generate_rng(client_data_hash, 32);
+    ctap_generate_rng(app_id, 32);
+
+    build_make_credential(&mc);
+    make_credential_id(&mc);
+    build_u2f(&reg, "u2f_register", U2F_REGISTER, 0);
+    make_key_handle(&reg);
+
+    printf("{\n  \"backend\": \"%s\",\n  \"unit\": \"us\",\n  \"results\": [",
+            crypto_backend_current()->name);
+
+    build_get_info(r);
+    bench(r, iters);
+    bench(&mc, iters);
+    for (i = 0; i < 3; i++)
+    {
+        build_get_assertion(r, allow_names[i], allow_sizes[i]);
+        bench(r, iters);
+    }
+    bench(&reg, iters);
+    build_u2f(r, "u2f_authenticate", U2F_AUTHENTICATE, U2F_AUTHENTICATE_SIGN);
+    bench(r, iters);
+
+    // The PIN commands come last, once a PIN is set the others need pinAuth.
+    build_client_pin(r, "client_pin_get_retries", CP_cmdGetRetries);
+    bench(r, iters);
+    build_client_pin(r, "client_pin_get_key_agreement", CP_cmdGetKeyAgreement);
+    bench(r, iters);
+    bench_set_pin(iters);
+    agree_key();
+    build_get_pin_token(r);
+    bench(r, iters);
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
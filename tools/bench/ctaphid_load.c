@@ -0,0 +1,963 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Load generator for the CTAPHID over UDP transport of the PC build.
+ *
+ *  make loadgen && ./main & ./loadgen [options] > load.json
+ *
+ *      -c cids      concurrent channels, default 4
+ *      -d seconds   run time, default 10
+ *      -r rate      open loop: requests per second over all channels, with
+ *                   latency measured from the scheduled start.  0 (the
+ *                   default) runs closed loop, each channel sending its
+ *                   next request as soon as the last one completes
+ *      -m mix       weights, default ping=1,get_info=1,make_credential=1,
+ *                   get_assertion=4,u2f_authenticate=2
+ *      -a sizes     allow list sizes for get_assertion, default 1,5,20
+ *      -t ms        timeout per request, default 2000
+ *      -b us        back off before resending after CHANNEL_BUSY, default 500
+ *
+ *  pc/device.c listens on 8111 and always answers to 7112 on localhost, so
+ *  only one generator can run at a time.  Requests are sent whole, the
+ *  responses are matched to channels by CID.  A request that gets BUSY is
+ *  resent after the back off and its latency includes the wait.  After a
+ *  timeout the channel is resynchronised with an INIT on its CID.
+ *
+ *  Prints JSON: per operation the requests, ok, errors, busy responses,
+ *  timeouts, throughput and p50/p99/p999/max latency in microseconds.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEVICE_PORT         8111
+#define HOST_PORT           7112
+
+#define HID_SIZE            64
+#define INIT_PAYLOAD        (HID_SIZE - 7)
+#define CONT_PAYLOAD        (HID_SIZE - 5)
+#define MAX_MESSAGE         7609
+
+#define CTAPHID_PING        0x81
+#define CTAPHID_MSG         0x83
+#define CTAPHID_INIT        0x86
+#define CTAPHID_CBOR        0x90
+#define CTAPHID_KEEPALIVE   0xbb
+#define CTAPHID_ERROR       0xbf
+#define ERR_CHANNEL_BUSY    0x06
+#define BROADCAST_CID       0xffffffff
+
+#define CTAP_MAKE_CREDENTIAL    0x01
+#define CTAP_GET_ASSERTION      0x02
+#define CTAP_GET_INFO           0x04
+
+#define MAX_CIDS            64
+#define MAX_OPS             16
+#define MAX_PENDING         (1 << 16)
+
+#define RP_ID               "loadgen.example"
+
+typedef struct
+{
+    uint64_t * v;
+    int n, cap;
+} samples;
+
+typedef struct
+{
+    char name[32];
+    int weight;
+    uint8_t cmd;
+    uint8_t req[4096];      // 20 descriptors with 128 byte ids fit
+    int req_len;
+    uint64_t requests, ok, errors, busy, timeouts;
+    samples lat;
+} operation;
+
+typedef struct
+{
+    uint32_t cid;
+    int active;             // request in flight
+    int resync;             // waiting for the INIT reply to nonce
+    operation * op;
+    uint64_t start;         // scheduled start, us
+    uint64_t deadline;
+    uint64_t resend_at;     // after BUSY, 0 when sent
+    uint8_t nonce[8];
+
+    uint8_t resp[MAX_MESSAGE];
+    uint8_t resp_cmd;
+    int resp_len, resp_expect, resp_seq;
+} channel;
+
+static operation ops[MAX_OPS];
+static int nops = 0;
+static int total_weight = 0;
+
+static channel chans[MAX_CIDS];
+static int nchans = 4;
+
+static int sock;
+static struct sockaddr_in device_addr;
+
+static uint64_t timeout_us = 2000000;
+static uint64_t backoff_us = 500;
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void samples_add(samples * s, uint64_t v)
+{
+    if (s->n == s->cap)
+    {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->v = realloc(s->v, s->cap * sizeof(uint64_t));
+        if (s->v == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    s->v[s->n++] = v;
+}
+
+static int cmp_u64(const void * a, const void * b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const samples * s, int permille)
+{
+    return s->n ? s->v[(s->n - 1) * permille / 1000] : 0;
+}
+
+/*
+ *  CTAPHID framing
+ */
+
+static void send_packet(uint8_t * pkt)
+{
+    if (sendto(sock, pkt, HID_SIZE, 0, (struct sockaddr *)&device_addr, sizeof(device_addr)) < 0)
+    {
+        perror("sendto");
+        exit(1);
+    }
+}
+
+static void send_message(uint32_t cid, uint8_t cmd, const uint8_t * data, int len)
+{
+    uint8_t pkt[HID_SIZE];
+    int n, off = 0, seq = 0;
+
+    memset(pkt, 0, sizeof(pkt));
+    memmove(pkt, &cid, 4);
+    pkt[4] = cmd;
+    pkt[5] = len >> 8;
+    pkt[6] = len & 0xff;
+    n = len < INIT_PAYLOAD ? len : INIT_PAYLOAD;
+    memmove(pkt + 7, data, n);
+    send_packet(pkt);
+    off = n;
+
+    while (off < len)
+    {
+        memset(pkt + 4, 0, HID_SIZE - 4);
+        pkt[4] = seq++;
+        n = len - off < CONT_PAYLOAD ? len - off : CONT_PAYLOAD;
+        memmove(pkt + 5, data + off, n);
+        send_packet(pkt);
+        off += n;
+    }
+}
+
+// Adds a packet to the channel's response.  Returns 1 once it is complete.
+static int add_packet(channel * c, const uint8_t * pkt)
+{
+    int n;
+
+    if (pkt[4] & 0x80)
+    {
+        if (pkt[4] == CTAPHID_KEEPALIVE)
+        {
+            return 0;
+        }
+        c->resp_cmd = pkt[4];
+        c->resp_expect = (pkt[5] << 8) | pkt[6];
+        if (c->resp_expect > MAX_MESSAGE)
+        {
+            c->resp_expect = MAX_MESSAGE;
+        }
+        n = c->resp_expect < INIT_PAYLOAD ? c->resp_expect : INIT_PAYLOAD;
+        memmove(c->resp, pkt + 7, n);
+        c->resp_len = n;
+        c->resp_seq = 0;
+    }
+    else
+    {
+        if (c->resp_expect == 0 || pkt[4] != c->resp_seq)
+        {
+            return 0;
+        }
+        n = c->resp_expect - c->resp_len;
+        n = n < CONT_PAYLOAD ? n : CONT_PAYLOAD;
+        memmove(c->resp + c->resp_len, pkt + 5, n);
+        c->resp_len += n;
+        c->resp_seq++;
+    }
+    if (c->resp_len >= c->resp_expect)
+    {
+        c->resp_expect = 0;
+        return 1;
+    }
+    return 0;
+}
+
+// Receives one packet, waiting up to @wait_us.  Returns its channel, the
+// broadcast channel @bc for the broadcast CID, or NULL.
+static channel * recv_packet(uint64_t wait_us, uint8_t * pkt, channel * bc)
+{
+    struct pollfd pfd = {sock, POLLIN, 0};
+    struct timespec ts = {wait_us / 1000000, wait_us % 1000000 * 1000};
+    uint32_t cid;
+    int i;
+
+    if (ppoll(&pfd, 1, &ts, NULL) <= 0)
+    {
+        return NULL;
+    }
+    if (recv(sock, pkt, HID_SIZE, 0) != HID_SIZE)
+    {
+        return NULL;
+    }
+    memmove(&cid, pkt, 4);
+    if (cid == BROADCAST_CID)
+    {
+        return bc;
+    }
+    for (i = 0; i < nchans; i++)
+    {
+        if (chans[i].cid == cid)
+        {
+            return &chans[i];
+        }
+    }
+    return NULL;
+}
+
+// Blocking request used while setting up.  Returns the response length.
+static int transact(channel * c, uint8_t cmd, const uint8_t * data, int len)
+{
+    uint8_t pkt[HID_SIZE];
+    uint64_t end = now_us() + timeout_us;
+
+    send_message(c->cid, cmd, data, len);
+    c->resp_expect = 0;
+    while (now_us() < end)
+    {
+        if (recv_packet(10000, pkt, c) == c && add_packet(c, pkt))
+        {
+            return c->resp_len;
+        }
+    }
+    fprintf(stderr, "no reply to command %02x, is ./main running?\n", cmd);
+    exit(1);
+}
+
+static void random_bytes(uint8_t * buf, int len)
+{
+    while (len--)
+    {
+        *buf++ = rand();
+    }
+}
+
+static uint32_t open_channel()
+{
+    channel bc;
+    uint8_t nonce[8];
+    uint32_t cid;
+
+    memset(&bc, 0, sizeof(bc));
+    bc.cid = BROADCAST_CID;
+    random_bytes(nonce, sizeof(nonce));
+    do
+    {
+        transact(&bc, CTAPHID_INIT, nonce, sizeof(nonce));
+    }
+    while (bc.resp_cmd != CTAPHID_INIT || bc.resp_len < 12 || memcmp(bc.resp, nonce, 8) != 0);
+    memmove(&cid, bc.resp + 8, 4);
+    return cid;
+}
+
+/*
+ *  Requests
+ */
+
+static int cbor_head(uint8_t * p, int major, uint64_t v)
+{
+    int i, n;
+
+    if (v < 24)
+    {
+        p[0] = (major << 5) | v;
+        return 1;
+    }
+    n = v < 0x100 ? 1 : v < 0x10000 ? 2 : 4;
+    p[0] = (major << 5) | (n == 1 ? 24 : n == 2 ? 25 : 26);
+    for (i = 0; i < n; i++)
+    {
+        p[n - i] = v >> (8 * i);
+    }
+    return n + 1;
+}
+
+static int cbor_bytes(uint8_t * p, const uint8_t * data, int len)
+{
+    int n = cbor_head(p, 2, len);
+    memmove(p + n, data, len);
+    return n + len;
+}
+
+static int cbor_text(uint8_t * p, const char * s)
+{
+    int n = cbor_head(p, 3, strlen(s));
+    memmove(p + n, s, strlen(s));
+    return n + strlen(s);
+}
+
+// @return the item after the one at @p, NULL if it runs past @end
+static const uint8_t * cbor_skip(const uint8_t * p, const uint8_t * end)
+{
+    int major, info, i;
+    uint64_t v = 0;
+
+    if (p >= end) return NULL;
+    major = *p >> 5;
+    info = *p++ & 0x1f;
+    if (info < 24)
+    {
+        v = info;
+    }
+    else if (info <= 27)
+    {
+        for (i = 0; i < (1 << (info - 24)); i++)
+        {
+            if (p >= end) return NULL;
+            v = (v << 8) | *p++;
+        }
+    }
+    else
+    {
+        return NULL;
+    }
+
+    switch (major)
+    {
+        case 2:
+        case 3:
+            return (uint64_t)(end - p) >= v ? p + v : NULL;
+        case 4:
+        case 5:
+            for (v *= (major == 5) ? 2 : 1; v && p; v--)
+            {
+                p = cbor_skip(p, end);
+            }
+            return p;
+        case 6:
+            return cbor_skip(p, end);
+        default:
+            return p;
+    }
+}
+
+static uint8_t client_data_hash[32];
+static uint8_t cred_id[128];
+static int cred_id_len;
+static uint8_t key_handle[255];
+static int key_handle_len;
+static uint8_t app_id[32];
+
+static int build_make_credential(uint8_t * p)
+{
+    uint8_t user_id[16];
+    int n = 0;
+
+    memset(user_id, 0x55, sizeof(user_id));
+    p[n++] = CTAP_MAKE_CREDENTIAL;
+    n += cbor_head(p + n, 5, 4);
+    n += cbor_head(p + n, 0, 1);
+    n += cbor_bytes(p + n, client_data_hash, 32);
+    n += cbor_head(p + n, 0, 2);
+    n += cbor_head(p + n, 5, 1);
+    n += cbor_text(p + n, "id");
+    n += cbor_text(p + n, RP_ID);
+    n += cbor_head(p + n, 0, 3);
+    n += cbor_head(p + n, 5, 2);
+    n += cbor_text(p + n, "id");
+    n += cbor_bytes(p + n, user_id, sizeof(user_id));
+    n += cbor_text(p + n, "name");
+    n += cbor_text(p + n, "loadgen");
+    n += cbor_head(p + n, 0, 4);
+    n += cbor_head(p + n, 4, 1);
+    n += cbor_head(p + n, 5, 2);
+    n += cbor_text(p + n, "alg");
+    n += cbor_head(p + n, 1, 6);       // -7, ES256
+    n += cbor_text(p + n, "type");
+    n += cbor_text(p + n, "public-key");
+    return n;
+}
+
+// The real credential is last, so the whole list is looked at.
+static int build_get_assertion(uint8_t * p, int allow)
+{
+    uint8_t fake[128];
+    int n = 0, i;
+
+    p[n++] = CTAP_GET_ASSERTION;
+    n += cbor_head(p + n, 5, 3);
+    n += cbor_head(p + n, 0, 1);
+    n += cbor_text(p + n, RP_ID);
+    n += cbor_head(p + n, 0, 2);
+    n += cbor_bytes(p + n, client_data_hash, 32);
+    n += cbor_head(p + n, 0, 3);
+    n += cbor_head(p + n, 4, allow);
+    for (i = 0; i < allow; i++)
+    {
+        random_bytes(fake, cred_id_len);
+        n += cbor_head(p + n, 5, 2);
+        n += cbor_text(p + n, "id");
+        n += cbor_bytes(p + n, i == allow - 1 ? cred_id : fake, cred_id_len);
+        n += cbor_text(p + n, "type");
+        n += cbor_text(p + n, "public-key");
+    }
+    return n;
+}
+
+static int build_u2f(uint8_t * p, uint8_t ins, uint8_t p1, int with_handle)
+{
+    int n = 7;
+
+    p[0] = 0;
+    p[1] = ins;
+    p[2] = p1;
+    p[3] = 0;
+    memmove(p + n, client_data_hash, 32);
+    n += 32;
+    memmove(p + n, app_id, 32);
+    n += 32;
+    if (with_handle)
+    {
+        p[n++] = key_handle_len;
+        memmove(p + n, key_handle, key_handle_len);
+        n += key_handle_len;
+    }
+    p[4] = 0;
+    p[5] = (n - 7) >> 8;
+    p[6] = (n - 7) & 0xff;
+    return n;
+}
+
+// Makes the credential and U2F key handle the requests refer to.
+static void setup_credentials(channel * c)
+{
+    uint8_t req[4096];
+    const uint8_t * p, * end, * auth_data = NULL;
+    uint64_t pairs;
+    int len, info;
+
+    random_bytes(client_data_hash, 32);
+    random_bytes(app_id, 32);
+
+    len = transact(c, CTAPHID_CBOR, req, build_make_credential(req));
+    if (len < 2 || c->resp[0] != 0)
+    {
+        fprintf(stderr, "make_credential failed: %02x\n", len ? c->resp[0] : 0);
+        exit(1);
+    }
+    // {1: fmt, 2: authData, 3: attStmt}
+    p = c->resp + 1;
+    end = c->resp + len;
+    pairs = *p++ & 0x1f;
+    while (pairs-- && p && p < end)
+    {
+        if (*p == 0x02)
+        {
+            p++;
+            info = *p & 0x1f;
+            auth_data = p + 1 + (info < 24 ? 0 : 1 << (info - 24));
+            break;
+        }
+        p = cbor_skip(cbor_skip(p, end), end);
+    }
+    if (auth_data == NULL)
+    {
+        fprintf(stderr, "make_credential response has no authData\n");
+        exit(1);
+    }
+    // rpIdHash, flags, counter, aaguid, length, credential id
+    cred_id_len = (auth_data[53] << 8) | auth_data[54];
+    if (cred_id_len > sizeof(cred_id))
+    {
+        fprintf(stderr, "credential id too long: %d\n", cred_id_len);
+        exit(1);
+    }
+    memmove(cred_id, auth_data + 55, cred_id_len);
+
+    len = transact(c, CTAPHID_MSG, req, build_u2f(req, 0x01, 0, 0));
+    if (len < 70 || c->resp[len - 2] != 0x90 || c->resp[0] != 0x05)
+    {
+        fprintf(stderr, "u2f register failed\n");
+        exit(1);
+    }
+    // 0x05, public key, handle length, handle, ...
+    key_handle_len = c->resp[66];
+    memmove(key_handle, c->resp + 67, key_handle_len);
+}
+
+static operation * add_op(const char * name, uint8_t cmd)
+{
+    operation * op;
+
+    if (nops == MAX_OPS)
+    {
+        fprintf(stderr, "too many operations\n");
+        exit(1);
+    }
+    op = &ops[nops++];
+    memset(op, 0, sizeof(*op));
+    snprintf(op->name, sizeof(op->name), "%s", name);
+    op->cmd = cmd;
+    return op;
+}
+
+static int mix_weight(const char * mix, const char * name)
+{
+    const char * p = mix;
+    int len = strlen(name);
+
+    while ((p = strstr(p, name)) != NULL)
+    {
+        if ((p == mix || p[-1] == ',') && p[len] == '=')
+        {
+            return atoi(p + len + 1);
+        }
+        p += len;
+    }
+    return 0;
+}
+
+static void setup_ops(const char * mix, const char * sizes)
+{
+    char name[32];
+    const char * s;
+    operation * op;
+    int n, allow, ga, sizes_count;
+
+    op = add_op("ping", CTAPHID_PING);
+    op->weight = mix_weight(mix, "ping");
+    op->req_len = 64;
+    random_bytes(op->req, op->req_len);
+
+    op = add_op("get_info", CTAPHID_CBOR);
+    op->weight = mix_weight(mix, "get_info");
+    op->req[0] = CTAP_GET_INFO;
+    op->req_len = 1;
+
+    op = add_op("make_credential", CTAPHID_CBOR);
+    op->weight = mix_weight(mix, "make_credential");
+    op->req_len = build_make_credential(op->req);
+
+    // The get_assertion weight is split over the allow list sizes.
+    ga = mix_weight(mix, "get_assertion");
+    for (s = sizes; *s; )
+    {
+        allow = atoi(s);
+        if (allow < 1 || allow > 20)
+        {
+            fprintf(stderr, "allow list size %d not in 1..20\n", allow);
+            exit(1);
+        }
+        snprintf(name, sizeof(name), "get_assertion_%d", allow);
+        op = add_op(name, CTAPHID_CBOR);
+        op->weight = ga;
+        op->req_len = build_get_assertion(op->req, allow);
+        while (*s && *s != ',') s++;
+        if (*s) s++;
+    }
+
+    op = add_op("u2f_authenticate", CTAPHID_MSG);
+    op->weight = mix_weight(mix, "u2f_authenticate");
+    op->req_len = build_u2f(op->req, 0x02, 0x03, 1);
+
+    // Each size gets the whole get_assertion weight, so the others are
+    // scaled up to keep the ratios.
+    sizes_count = nops - 4;
+    for (n = 0; n < nops; n++)
+    {
+        if (strncmp(ops[n].name, "get_assertion", 13) != 0)
+        {
+            ops[n].weight *= sizes_count;
+        }
+        total_weight += ops[n].weight;
+    }
+    if (total_weight == 0)
+    {
+        fprintf(stderr, "empty mix\n");
+        exit(1);
+    }
+}
+
+static operation * pick_op()
+{
+    int r = rand() % total_weight, i;
+
+    for (i = 0; i < nops - 1; i++)
+    {
+        if (r < ops[i].weight)
+        {
+            break;
+        }
+        r -= ops[i].weight;
+    }
+    return &ops[i];
+}
+
+/*
+ *  Load
+ */
+
+static uint64_t pending[MAX_PENDING];
+static int pending_head = 0, pending_tail = 0;
+static uint64_t arrivals_dropped = 0;
+
+static void start_request(channel * c, operation * op, uint64_t start)
+{
+    c->active = 1;
+    c->op = op;
+    c->start = start;
+    c->resend_at = 0;
+    c->resp_expect = 0;
+    c->deadline = now_us() + timeout_us;
+    op->requests++;
+    send_message(c->cid, op->cmd, op->req, op->req_len);
+}
+
+static void resync(channel * c)
+{
+    c->active = 0;
+    c->resync = 1;
+    c->resp_expect = 0;
+    c->deadline = now_us() + timeout_us;
+    random_bytes(c->nonce, sizeof(c->nonce));
+    send_message(c->cid, CTAPHID_INIT, c->nonce, sizeof(c->nonce));
+}
+
+static int response_ok(channel * c)
+{
+    operation * op = c->op;
+
+    if (c->resp_cmd != op->cmd)
+    {
+        return 0;
+    }
+    switch (op->cmd)
+    {
+        case CTAPHID_PING:
+            return c->resp_len == op->req_len && memcmp(c->resp, op->req, op->req_len) == 0;
+        case CTAPHID_CBOR:
+            return c->resp_len >= 1 && c->resp[0] == 0;
+        case CTAPHID_MSG:
+            return c->resp_len >= 2 && c->resp[c->resp_len - 2] == 0x90 && c->resp[c->resp_len - 1] == 0;
+    }
+    return 0;
+}
+
+static void complete(channel * c)
+{
+    operation * op = c->op;
+    uint64_t now = now_us();
+
+    if (c->resync)
+    {
+        if (c->resp_cmd == CTAPHID_INIT && c->resp_len >= 8 && memcmp(c->resp, c->nonce, 8) == 0)
+        {
+            c->resync = 0;
+        }
+        return;
+    }
+    if (!c->active)
+    {
+        return;
+    }
+    if (c->resp_cmd == CTAPHID_ERROR && c->resp_len >= 1 && c->resp[0] == ERR_CHANNEL_BUSY)
+    {
+        op->busy++;
+        c->resend_at = now + backoff_us;
+        return;
+    }
+    if (response_ok(c))
+    {
+        op->ok++;
+    }
+    else
+    {
+        op->errors++;
+    }
+    samples_add(&op->lat, now - c->start);
+    c->active = 0;
+}
+
+static void run(uint64_t duration_us, double rate)
+{
+    uint8_t pkt[HID_SIZE];
+    uint64_t now, stop, next_arrival, interval, wake;
+    channel * c;
+    int i, busy;
+
+    now = now_us();
+    stop = now + duration_us;
+    next_arrival = now;
+    interval = rate > 0 ? (uint64_t)(1000000.0 / rate) : 0;
+
+    while (1)
+    {
+        now = now_us();
+
+        if (rate > 0)
+        {
+            for (; next_arrival <= now && next_arrival < stop; next_arrival += interval)
+            {
+                if (pending_head - pending_tail == MAX_PENDING)
+                {
+                    arrivals_dropped++;
+                    continue;
+                }
+                pending[pending_head++ % MAX_PENDING] = next_arrival;
+            }
+        }
+
+        busy = 0;
+        for (i = 0; i < nchans; i++)
+        {
+            c = &chans[i];
+            if (c->active && c->resend_at && now >= c->resend_at)
+            {
+                c->resend_at = 0;
+                c->resp_expect = 0;
+                c->deadline = now + timeout_us;
+                send_message(c->cid, c->op->cmd, c->op->req, c->op->req_len);
+            }
+            if ((c->active || c->resync) && now > c->deadline)
+            {
+                if (c->active)
+                {
+                    c->op->timeouts++;
+                    samples_add(&c->op->lat, now - c->start);
+                }
+                resync(c);
+            }
+            if (!c->active && !c->resync && now < stop)
+            {
+                if (rate == 0)
+                {
+                    start_request(c, pick_op(), now);
+                }
+                else if (pending_tail != pending_head)
+                {
+                    start_request(c, pick_op(), pending[pending_tail++ % MAX_PENDING]);
+                }
+            }
+            busy |= c->active || c->resync;
+        }
+
+        if (!busy && now >= stop)
+        {
+            break;
+        }
+
+        // Sleep until a response, the next arrival or the next deadline,
+        // spinning would take CPU from ./main on the same host.
+        wake = now < stop ? stop : UINT64_MAX;
+        if (rate > 0 && next_arrival < wake)
+        {
+            wake = next_arrival;
+        }
+        for (i = 0; i < nchans; i++)
+        {
+            c = &chans[i];
+            if ((c->active || c->resync) && c->deadline < wake)
+            {
+                wake = c->deadline;
+            }
+            if (c->active && c->resend_at && c->resend_at < wake)
+            {
+                wake = c->resend_at;
+            }
+        }
+
+        c = recv_packet(wake > now ? wake - now : 0, pkt, NULL);
+        while (c != NULL)
+        {
+            if (add_packet(c, pkt))
+            {
+                complete(c);
+            }
+            c = recv_packet(0, pkt, NULL);
+        }
+    }
+}
+
+static void report(const char * mode, double rate, uint64_t elapsed_us)
+{
+    operation * op;
+    samples all = {NULL, 0, 0};
+    uint64_t requests = 0, ok = 0, errors = 0, busy = 0, timeouts = 0;
+    double secs = elapsed_us / 1e6;
+    int i, j, printed = 0;
+
+    printf("{\n  \"mode\": \"%s\",\n  \"cids\": %d,\n  \"target_rate\": %.1f,\n"
+           "  \"seconds\": %.3f,\n  \"unit\": \"us\",\n  \"results\": [",
+           mode, nchans, rate, secs);
+    for (i = 0; i < nops; i++)
+    {
+        op = &ops[i];
+        if (op->weight == 0)
+        {
+            continue;
+        }
+        qsort(op->lat.v, op->lat.n, sizeof(uint64_t), cmp_u64);
+        for (j = 0; j < op->lat.n; j++)
+        {
+            samples_add(&all, op->lat.v[j]);
+        }
+        printf("%s\n    {\"name\": \"%s\", \"requests\": %llu, \"ok\": %llu, \"errors\": %llu, "
+               "\"busy\": %llu, \"timeouts\": %llu, \"per_second\": %.1f, "
+               "\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+               printed++ ? "," : "", op->name,
+               (unsigned long long)op->requests, (unsigned long long)op->ok,
+               (unsigned long long)op->errors, (unsigned long long)op->busy,
+               (unsigned long long)op->timeouts, op->ok / secs,
+               (unsigned long long)percentile(&op->lat, 500),
+               (unsigned long long)percentile(&op->lat, 990),
+               (unsigned long long)percentile(&op->lat, 999),
+               (unsigned long long)(op->lat.n ? op->lat.v[op->lat.n - 1] : 0));
+        requests += op->requests;
+        ok += op->ok;
+        errors += op->errors;
+        busy += op->busy;
+        timeouts += op->timeouts;
+    }
+    qsort(all.v, all.n, sizeof(uint64_t), cmp_u64);
+    printf("\n  ],\n  \"total\": {\"requests\": %llu, \"ok\": %llu, \"errors\": %llu, "
+           "\"busy\": %llu, \"busy_rate\": %.4f, \"timeouts\": %llu, \"arrivals_dropped\": %llu, "
+           "\"per_second\": %.1f, \"p50\": %llu, \"p99\": %llu, \"p999\": %llu}\n}\n",
+           (unsigned long long)requests, (unsigned long long)ok, (unsigned long long)errors,
+           (unsigned long long)busy, requests ? (double)busy / (requests + busy) : 0.0,
+           (unsigned long long)timeouts, (unsigned long long)arrivals_dropped, ok / secs,
+           (unsigned long long)percentile(&all, 500),
+           (unsigned long long)percentile(&all, 990),
+           (unsigned long long)percentile(&all, 999));
+    free(all.v);
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-c cids] [-d seconds] [-r rate] [-m mix] [-a sizes] [-t ms] [-b us]\n", name);
+    exit(1);
+}
+
+int main(int argc, char * argv[])
+{
+    const char * mix = "ping=1,get_info=1,make_credential=1,get_assertion=4,u2f_authenticate=2";
+    const char * sizes = "1,5,20";
+    struct sockaddr_in addr;
+    double seconds = 10, rate = 0;
+    uint64_t t;
+    int opt, i, bufsize = 1 << 20;
+
+    while ((opt = getopt(argc, argv, "c:d:r:m:a:t:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c': nchans = atoi(optarg); break;
+            case 'd': seconds = atof(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'm': mix = optarg; break;
+            case 'a': sizes = optarg; break;
+            case 't': timeout_us = atoi(optarg) * 1000ULL; break;
+            case 'b': backoff_us = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (nchans < 1 || nchans > MAX_CIDS || seconds <= 0 || rate < 0)
+    {
+        usage(argv[0]);
+    }
+    srand(time(NULL));
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(HOST_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        return 1;
+    }
+    memset(&device_addr, 0, sizeof(device_addr));
+    device_addr.sin_family = AF_INET;
+    device_addr.sin_port = htons(DEVICE_PORT);
+    device_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    for (i = 0; i < nchans; i++)
+    {
+        memset(&chans[i], 0, sizeof(channel));
+        chans[i].cid = open_channel();
+    }
+    setup_credentials(&chans[0]);
+    setup_ops(mix, sizes);
+
+    t = now_us();
+    run(seconds * 1e6, rate);
+    report(rate > 0 ? "open" : "closed", rate, now_us() - t);
+    return 0;
+}
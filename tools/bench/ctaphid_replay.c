@@ -0,0 +1,499 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Replays a CTAPHID capture against the UDP transport of the PC build and
+ *  diffs the responses with the captured ones.
+ *
+ *  CAPTURE_FILE=trace.cap ./main      record, see usbhid_recv in pc/device.c
+ *  make replay && ./main & ./replay [options] trace.cap > replay.json
+ *
+ *      -s speed     1 (the default) sends at the captured times, 10 ten
+ *                   times faster, 0 as fast as possible
+ *      -t ms        how long to wait for missing responses at the end,
+ *                   default 1000
+ *      -v count     mismatching frames printed to stderr, default 10
+ *
+ *  The authenticator hands out its own CIDs, so a channel that was opened
+ *  by an INIT in the capture is mapped to whatever CID the replayed INIT
+ *  with the same nonce gets, and frames are rewritten both ways.  Frames on
+ *  it are held back until that INIT is answered.  Responses are compared in
+ *  order per channel, KEEPALIVE frames are only counted since they depend
+ *  on timing.
+ *
+ *  Signatures and new credentials only come out the same when the capture
+ *  and the replay both run against a fresh ./main built with bench_mode=1
+ *  (see pc/bench_mode.h).  Against other builds the mismatch count is still
+ *  useful, the timing numbers are useful either way.
+ *
+ *  Prints JSON with the frame counts and the captured and replayed
+ *  duration.  Exits with 2 if any response was different, missing or extra.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEVICE_PORT         8111
+#define HOST_PORT           7112
+
+#define HID_SIZE            64
+#define CTAPHID_INIT        0x86
+#define CTAPHID_KEEPALIVE   0xbb
+#define BROADCAST_CID       0xffffffff
+
+// Offsets in an INIT response frame
+#define INIT_NONCE          7
+#define INIT_NEW_CID        15
+#define INIT_RESP_SIZE      17
+
+#define CAPTURE_IN          0
+#define CAPTURE_OUT         1
+#define CAPTURE_RECORD      (5 + HID_SIZE)
+
+#define MAX_CHANNELS        4096
+
+typedef struct
+{
+    uint64_t t;             // us since the start of the capture
+    int dir;
+    int next;               // next expected response on the same channel
+    uint8_t data[HID_SIZE];
+} frame;
+
+typedef struct
+{
+    uint32_t cid;           // in the capture
+    uint32_t act;           // in the replay
+    int allocated;          // opened by an INIT in the capture
+    int mapped;             // act is known
+    uint8_t nonce[8];
+    int head;               // next expected response, -1 if none
+    int tail;
+} channel;
+
+static frame * frames;
+static int nframes = 0;
+
+static channel chans[MAX_CHANNELS];
+static int nchans = 0;
+
+static int sock;
+static struct sockaddr_in device_addr;
+
+static uint64_t expected = 0, matched = 0, mismatched = 0, extra = 0;
+static uint64_t keepalives = 0, unmapped = 0, sent = 0;
+static int verbose = 10;
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static uint32_t frame_cid(const uint8_t * pkt)
+{
+    uint32_t cid;
+    memmove(&cid, pkt, 4);
+    return cid;
+}
+
+static int is_init_response(const uint8_t * pkt)
+{
+    return pkt[4] == CTAPHID_INIT && ((pkt[5] << 8) | pkt[6]) >= INIT_RESP_SIZE;
+}
+
+static channel * find_channel(uint32_t cid)
+{
+    int i;
+    for (i = 0; i < nchans; i++)
+    {
+        if (chans[i].cid == cid)
+        {
+            return &chans[i];
+        }
+    }
+    return NULL;
+}
+
+static channel * find_replayed(uint32_t act)
+{
+    int i;
+    for (i = 0; i < nchans; i++)
+    {
+        if (chans[i].mapped && chans[i].act == act)
+        {
+            return &chans[i];
+        }
+    }
+    return NULL;
+}
+
+static channel * add_channel(uint32_t cid)
+{
+    channel * c;
+
+    if (nchans == MAX_CHANNELS)
+    {
+        fprintf(stderr, "more than %d channels in the capture\n", MAX_CHANNELS);
+        exit(1);
+    }
+    c = &chans[nchans++];
+    memset(c, 0, sizeof(channel));
+    c->cid = cid;
+    c->act = cid;
+    c->mapped = 1;
+    c->head = c->tail = -1;
+    return c;
+}
+
+static void load_capture(const char * path)
+{
+    FILE * f = fopen(path, "rb");
+    uint8_t rec[CAPTURE_RECORD];
+    uint64_t t = 0;
+    int cap = 0;
+
+    if (f == NULL)
+    {
+        perror(path);
+        exit(1);
+    }
+    if (fread(rec, 1, 4, f) != 4 || memcmp(rec, "CAP1", 4) != 0)
+    {
+        fprintf(stderr, "%s is not a capture\n", path);
+        exit(1);
+    }
+    while (fread(rec, 1, CAPTURE_RECORD, f) == CAPTURE_RECORD)
+    {
+        if (nframes == cap)
+        {
+            cap = cap ? cap * 2 : 4096;
+            frames = realloc(frames, cap * sizeof(frame));
+            if (frames == NULL)
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        t += rec[0] | (rec[1] << 8) | (rec[2] << 16) | ((uint32_t)rec[3] << 24);
+        frames[nframes].t = t;
+        frames[nframes].dir = rec[4];
+        frames[nframes].next = -1;
+        memmove(frames[nframes].data, rec + 5, HID_SIZE);
+        nframes++;
+    }
+    fclose(f);
+}
+
+// Sets up the channels and the expected responses on each.
+static void index_capture()
+{
+    channel * c, * n;
+    frame * f;
+    uint32_t cid;
+    int i;
+
+    for (i = 0; i < nframes; i++)
+    {
+        f = &frames[i];
+        cid = frame_cid(f->data);
+        if ((c = find_channel(cid)) == NULL)
+        {
+            c = add_channel(cid);
+        }
+        if (f->dir != CAPTURE_OUT || f->data[4] == CTAPHID_KEEPALIVE)
+        {
+            continue;
+        }
+
+        if (cid == BROADCAST_CID && is_init_response(f->data))
+        {
+            memmove(&cid, f->data + INIT_NEW_CID, 4);
+            if (find_channel(cid) == NULL)
+            {
+                n = add_channel(cid);
+                n->allocated = 1;
+                n->mapped = 0;
+                memmove(n->nonce, f->data + INIT_NONCE, 8);
+            }
+        }
+
+        if (c->tail < 0)
+        {
+            c->head = i;
+        }
+        else
+        {
+            frames[c->tail].next = i;
+        }
+        c->tail = i;
+        expected++;
+    }
+}
+
+static void print_diff(int index, const uint8_t * want, const uint8_t * got)
+{
+    int i;
+
+    if (verbose-- <= 0)
+    {
+        return;
+    }
+    fprintf(stderr, "frame %d differs\n  want", index);
+    for (i = 0; i < HID_SIZE; i++)
+    {
+        fprintf(stderr, " %02x", want[i]);
+    }
+    fprintf(stderr, "\n  got ");
+    for (i = 0; i < HID_SIZE; i++)
+    {
+        fprintf(stderr, " %02x", got[i]);
+    }
+    fprintf(stderr, "\n");
+}
+
+// Maps the CID of a replayed response back to the capture and checks it
+// against the next expected response on that channel.
+static void handle_response(uint8_t * pkt)
+{
+    channel * c, * n;
+    uint32_t cid = frame_cid(pkt);
+    int i;
+
+    if (pkt[4] == CTAPHID_KEEPALIVE)
+    {
+        keepalives++;
+        return;
+    }
+    if ((c = find_replayed(cid)) == NULL)
+    {
+        extra++;
+        if (verbose-- > 0)
+        {
+            fprintf(stderr, "response on unknown cid %08x\n", cid);
+        }
+        return;
+    }
+    memmove(pkt, &c->cid, 4);
+
+    if (is_init_response(pkt))
+    {
+        memmove(&cid, pkt + INIT_NEW_CID, 4);
+        if (c->cid == BROADCAST_CID)
+        {
+            for (i = 0; i < nchans; i++)
+            {
+                n = &chans[i];
+                if (n->allocated && !n->mapped && memcmp(n->nonce, pkt + INIT_NONCE, 8) == 0)
+                {
+                    n->act = cid;
+                    n->mapped = 1;
+                    break;
+                }
+            }
+        }
+        if ((n = find_replayed(cid)) != NULL)
+        {
+            memmove(pkt + INIT_NEW_CID, &n->cid, 4);
+        }
+    }
+
+    if (c->head < 0)
+    {
+        extra++;
+        if (verbose-- > 0)
+        {
+            fprintf(stderr, "extra response on cid %08x\n", c->cid);
+        }
+        return;
+    }
+    if (memcmp(frames[c->head].data, pkt, HID_SIZE) == 0)
+    {
+        matched++;
+    }
+    else
+    {
+        mismatched++;
+        print_diff(c->head, frames[c->head].data, pkt);
+    }
+    c->head = frames[c->head].next;
+}
+
+// Handles responses until @until (us), or until one arrives if @once.
+static void receive(uint64_t until, int once)
+{
+    struct pollfd pfd = {sock, POLLIN, 0};
+    uint8_t pkt[HID_SIZE];
+    struct timespec ts;
+    uint64_t now;
+
+    while ((now = now_us()) < until)
+    {
+        ts.tv_sec = (until - now) / 1000000;
+        ts.tv_nsec = (until - now) % 1000000 * 1000;
+        if (ppoll(&pfd, 1, &ts, NULL) <= 0)
+        {
+            continue;
+        }
+        if (recv(sock, pkt, HID_SIZE, 0) != HID_SIZE)
+        {
+            continue;
+        }
+        handle_response(pkt);
+        if (once)
+        {
+            return;
+        }
+    }
+}
+
+static void send_frame(const uint8_t * data, uint64_t timeout)
+{
+    uint8_t pkt[HID_SIZE];
+    channel * c = find_channel(frame_cid(data));
+    uint64_t deadline = now_us() + timeout;
+
+    memmove(pkt, data, HID_SIZE);
+    while (!c->mapped && now_us() < deadline)
+    {
+        receive(deadline, 1);
+    }
+    if (c->mapped)
+    {
+        memmove(pkt, &c->act, 4);
+    }
+    else
+    {
+        unmapped++;
+    }
+    if (sendto(sock, pkt, HID_SIZE, 0, (struct sockaddr *)&device_addr, sizeof(device_addr)) < 0)
+    {
+        perror("sendto");
+        exit(1);
+    }
+    sent++;
+}
+
+static int outstanding()
+{
+    int i;
+    for (i = 0; i < nchans; i++)
+    {
+        if (chans[i].head >= 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr, "usage: %s [-s speed] [-t ms] [-v count] capture\n", name);
+    exit(1);
+}
+
+int main(int argc, char * argv[])
+{
+    struct sockaddr_in addr;
+    double speed = 1;
+    uint64_t drain_us = 1000000, start, due, elapsed, missing;
+    int opt, i, bufsize = 1 << 20;
+
+    while ((opt = getopt(argc, argv, "s:t:v:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': speed = atof(optarg); break;
+            case 't': drain_us = atoi(optarg) * 1000ULL; break;
+            case 'v': verbose = atoi(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || speed < 0)
+    {
+        usage(argv[0]);
+    }
+    load_capture(argv[optind]);
+    index_capture();
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(HOST_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        return 1;
+    }
+    memset(&device_addr, 0, sizeof(device_addr));
+    device_addr.sin_family = AF_INET;
+    device_addr.sin_port = htons(DEVICE_PORT);
+    device_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    start = now_us();
+    for (i = 0; i < nframes; i++)
+    {
+        if (frames[i].dir != CAPTURE_IN)
+        {
+            continue;
+        }
+        if (speed > 0)
+        {
+            due = start + (frames[i].t - frames[0].t) / speed;
+            receive(due, 0);
+        }
+        send_frame(frames[i].data, drain_us);
+    }
+    due = now_us() + drain_us;
+    while (outstanding() && now_us() < due)
+    {
+        receive(due, 1);
+    }
+    elapsed = now_us() - start;
+
+    missing = expected - matched - mismatched;
+    printf("{\n  \"frames\": %d, \"sent\": %llu, \"expected\": %llu, \"matched\": %llu, "
+           "\"mismatched\": %llu, \"missing\": %llu, \"extra\": %llu, \"keepalives\": %llu, "
+           "\"unmapped\": %llu,\n  \"captured_ms\": %.1f, \"replayed_ms\": %.1f, \"speed\": %.2f\n}\n",
+           nframes, (unsigned long long)sent, (unsigned long long)expected,
+           (unsigned long long)matched, (unsigned long long)mismatched,
+           (unsigned long long)missing, (unsigned long long)extra,
+           (unsigned long long)keepalives, (unsigned long long)unmapped,
+           nframes ? (frames[nframes - 1].t - frames[0].t) / 1e3 : 0.0, elapsed / 1e3, speed);
+    return mismatched || missing || extra ? 2 : 0;
+}
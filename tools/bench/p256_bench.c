@@ -0,0 +1,180 @@
+/*
+   Copyright 2018 Conor Patrick
+
+   Permission is hereby granted, free of charge, to any person obtaining a copy of
+   this software and associated documentation files (the "Software"), to deal in
+   the Software without restriction, including without limitation the rights to
+   use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+   of the Software, and to permit persons to whom the Software is furnished to do
+   so, subject to the following conditions:
+
+   The above copyright notice and this permission notice shall be included in all
+   copies or substantial portions of the Software.
+
+   THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+   IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+   FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+   AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+   LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+   OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+   SOFTWARE.
+*/
+/*
+ *  Compares the P-256 module (fixed-base comb and ECDH ladder) against
+ *  micro-ecc.
+ *
+ *  make p256bench && ./p256bench [iterations]
+ *
+ *  Every result is cross checked: public keys and shared secrets must match
+ *  and comb signatures must verify with uECC_verify.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "uECC.h"
+#include "p256.h"
+
+static int rng(uint8_t * dst, unsigned num)
+{
+    static FILE * urand = NULL;
+    if (urand == NULL)
+    {
+        urand = fopen("/dev/urandom", "r");
+        if (urand == NULL)
+        {
+            perror("fopen");
+            exit(1);
+        }
+    }
+    return fread(dst, 1, num, urand) == num;
+}
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void report(const char * name, double t_uecc, double t_comb, int iters)
+{
+    printf("%-20s uECC %9.1f us   p256 %9.1f us   speedup %.2fx\n",
+            name, t_uecc / iters, t_comb / iters, t_uecc / t_comb);
+}
+
+int main(int argc, char * argv[])
+{
+    const struct uECC_Curve_t * curve = uECC_secp256r1();
+    uint8_t priv[32], pub[64], pub2[64], hash[32], sig[64];
+    uint8_t priv2[32], secret[32], secret2[32];
+    double t, t_uecc = 0, t_comb = 0;
+    int iters = 200;
+    int i;
+
+    if (argc > 1)
+    {
+        iters = atoi(argv[1]);
+    }
+
+    uECC_set_rng(rng);
+    p256_set_rng(rng);
+
+    for (i = 0; i < iters; i++)
+    {
+        if (uECC_make_key(pub, priv, curve) != 1)
+        {
+            printf("uECC_make_key failed\n");
+            return 1;
+        }
+
+        t = now_us();
+        uECC_compute_public_key(priv, pub, curve);
+        t_uecc += now_us() - t;
+
+        t = now_us();
+        p256_compute_public_key(priv, pub2);
+        t_comb += now_us() - t;
+
+        if (memcmp(pub, pub2, 64) != 0)
+        {
+            printf("public key mismatch\n");
+            return 1;
+        }
+    }
+    report("compute_public_key", t_uecc, t_comb, iters);
+
+    t_uecc = t_comb = 0;
+    for (i = 0; i < iters; i++)
+    {
+        rng(hash, sizeof(hash));
+
+        t = now_us();
+        uECC_sign(priv, hash, sizeof(hash), sig, curve);
+        t_uecc += now_us() - t;
+
+        t = now_us();
+        p256_sign(priv, hash, sizeof(hash), sig);
+        t_comb += now_us() - t;
+
+        if (uECC_verify(pub, hash, sizeof(hash), sig, curve) != 1)
+        {
+            printf("signature does not verify\n");
+            return 1;
+        }
+    }
+    report("sign", t_uecc, t_comb, iters);
+
+    // Same again with the nonce taken from the idle-time pool.
+    t_uecc = t_comb = 0;
+    for (i = 0; i < iters; i++)
+    {
+        rng(hash, sizeof(hash));
+
+        t = now_us();
+        uECC_sign(priv, hash, sizeof(hash), sig, curve);
+        t_uecc += now_us() - t;
+
+        while (p256_precompute())
+            ;
+
+        t = now_us();
+        p256_sign(priv, hash, sizeof(hash), sig);
+        t_comb += now_us() - t;
+
+        if (uECC_verify(pub, hash, sizeof(hash), sig, curve) != 1)
+        {
+            printf("presigned signature does not verify\n");
+            return 1;
+        }
+    }
+    report("sign (presigned)", t_uecc, t_comb, iters);
+
+    t_uecc = t_comb = 0;
+    for (i = 0; i < iters; i++)
+    {
+        if (uECC_make_key(pub2, priv2, curve) != 1)
+        {
+            printf("uECC_make_key failed\n");
+            return 1;
+        }
+
+        t = now_us();
+        uECC_shared_secret(pub2, priv, secret, curve);
+        t_uecc += now_us() - t;
+
+        t = now_us();
+        p256_shared_secret(pub2, priv, secret2);
+        t_comb += now_us() - t;
+
+        if (memcmp(secret, secret2, 32) != 0)
+        {
+            printf("shared secret mismatch\n");
+            return 1;
+        }
+    }
+    report("shared_secret", t_uecc, t_comb, iters);
+
+    return 0;
+}
@@ -1,26 +1,146 @@
-import sys
+import sys, struct, re
 from sys import argv
 
-if len(argv) != 2:
-    print("usage: %s <input-log>" % argv[0]);
+# Converts the 64 byte HID packet dumps in a log into C string literals.
+#
+# With --elf, the input is a binary trace (ENABLE_TRACE_LOG, see fido2/log.h)
+# and the format strings are read from the trace_fmt section of the binary
+# that wrote it.  --text prints the decoded log instead of converting it.
+
+def usage():
+    print("usage: %s [--elf <binary> [--text]] <input-log>" % argv[0]);
     sys.exit(1)
 
-log = open(argv[1]).readlines()
+TRACE_KIND_PAD = 1
+TRACE_KIND_LOG = 2
+TRACE_KIND_HEX = 3
 
-nums = []
+TAGS = ['', 'MC', 'GA', 'CP', 'ERR', 'PARSE', 'CTAP', 'U2F', 'DUMP',
+        'DEBUG', 'DEBUG', 'TIME', 'HID', 'USB', 'WALLET', 'STOR']
+
+SPEC = re.compile(r'%([-+ #0-9.]*)([hlzjt]*)([a-zA-Z%])')
 
-for x in log:
-    parse = []
-    for i in x.split(' '):
+def elf_section(path, name):
+    elf = open(path, 'rb').read()
+    if elf[:4] != b'\x7fELF':
+        raise ValueError('%s is not an ELF file' % path)
+    end = '<' if elf[5] == 1 else '>'
+    if elf[4] == 2:
+        shoff, = struct.unpack_from(end + 'Q', elf, 0x28)
+        shentsize, shnum, shstrndx = struct.unpack_from(end + 'HHH', elf, 0x3a)
+        fmt = end + 'IIQQQQIIQQ'
+    else:
+        shoff, = struct.unpack_from(end + 'I', elf, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from(end + 'HHH', elf, 0x2e)
+        fmt = end + 'IIIIIIIIII'
+    sections = [struct.unpack_from(fmt, elf, shoff + i * shentsize) for i in range(shnum)]
+    strtab = sections[shstrndx]
+    for s in sections:
+        n = elf[strtab[4] + s[0]:].split(b'\0', 1)[0].decode()
+        if n == name:
+            return elf[s[4]:s[4] + s[5]]
+    raise ValueError('%s has no %s section' % (path, name))
+
+def format_record(fmt, words):
+    args = list(words)
+    out = ''
+    pos = 0
+    for m in SPEC.finditer(fmt):
+        out += fmt[pos:m.start()]
+        pos = m.end()
+        flags, longs, conv = m.groups()
+        if conv == '%':
+            out += '%'
+            continue
         try:
-            n = int(i,16)
-            parse.append(n)
-        except:
-            pass
-    if len(parse) == 0:
-        continue
-    assert(len(parse) == 64)
-    nums.append(parse)
+            if conv in 'fFeEgGaA':
+                v = struct.unpack('<d', struct.pack('<II', args.pop(0), args.pop(0)))[0]
+            elif conv == 's':
+                n = args.pop(0)
+                raw = struct.pack('<%dI' % ((n + 3) // 4), *args[:(n + 3) // 4])
+                del args[:(n + 3) // 4]
+                v = raw[:n].decode('utf-8', 'replace')
+            elif conv == 'p' or longs.strip('h'):
+                v = args.pop(0) | (args.pop(0) << 32)
+            else:
+                v = args.pop(0)
+                if conv in 'di' and v & 0x80000000:
+                    v -= 1 << 32
+        except IndexError:
+            out += m.group(0)
+            continue
+        if conv == 'p':
+            out += '0x%x' % v
+        elif conv == 'u':
+            out += ('%' + flags + 'd') % v
+        else:
+            out += ('%' + flags + conv) % v
+    return out + fmt[pos:]
+
+# Yields (text, packet) per record, packet is the bytes of a hex dump.
+def decode_trace(data, fmts):
+    if data[:4] != b'TRC1':
+        raise ValueError('not a trace file')
+    off = 4
+    while off + 4 <= len(data):
+        header, = struct.unpack_from('<I', data, off)
+        words = header & 0xffff
+        tag = TAGS[(header >> 16) & 0x1f]
+        kind = header >> 24
+        rec = struct.unpack_from('<%dI' % words, data, off)
+        off += words * 4
+        prefix = '[%s] ' % tag if tag else ''
+        if kind == TRACE_KIND_HEX:
+            packet = data[off - words * 4 + 12:][:rec[2]]
+            text = ' '.join('%02x' % x for x in packet) + ' \n'
+            if rec[1] != rec[2]:
+                text += '... (%d bytes)\n' % rec[1]
+            yield text, packet
+        elif kind == TRACE_KIND_LOG:
+            fmt = fmts[rec[1]:].split(b'\0', 1)[0].decode()
+            yield prefix + format_record(fmt, rec[2:]), None
+
+args = argv[1:]
+elf = None
+text = False
+while len(args) > 1 and args[0].startswith('--'):
+    if args[0] == '--elf':
+        elf = args[1]
+        args = args[2:]
+    elif args[0] == '--text':
+        text = True
+        args = args[1:]
+    else:
+        usage()
+if len(args) != 1 or (text and elf is None):
+    usage()
+
+nums = []
+
+if elf is not None:
+    fmts = elf_section(elf, 'trace_fmt')
+    for line, packet in decode_trace(open(args[0], 'rb').read(), fmts):
+        if text:
+            sys.stdout.write(line)
+        elif packet is not None and len(packet) == 64:
+            nums.append(list(packet))
+    if text:
+        sys.exit(0)
+else:
+    log = open(args[0]).readlines()
+
+    for x in log:
+        parse = []
+        for i in x.split(' '):
+            try:
+                n = int(i,16)
+                parse.append(n)
+            except:
+                pass
+        if len(parse) == 0:
+            continue
+        assert(len(parse) == 64)
+        nums.append(parse)
 
 hexlines = []
 
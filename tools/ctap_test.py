@@ -28,7 +28,7 @@ from fido2.ctap import CtapError
 from fido2.ctap1 import CTAP1
 from fido2.ctap2 import *
 from fido2.cose import *
-from fido2.utils import Timeout
+from fido2.utils import Timeout, hmac_sha256
 import sys,os,time
 from random import randint
 from binascii import hexlify
@@ -44,6 +44,13 @@ def ForceU2F(client,device):
     client._do_get_assertion = client._ctap1_get_assertion
 
 
+def VerifyEd25519(cose_key, message, signature):
+    from cryptography.hazmat.primitives.asymmetric.ed25519 import Ed25519PublicKey
+    # OKP key: kty 1, alg -8, crv 6 (Ed25519), x
+    assert(cose_key[1] == 1 and cose_key[3] == -8 and cose_key[-1] == 6)
+    Ed25519PublicKey.from_public_bytes(cose_key[-2]).verify(signature, message)
+
+
 class Packet(object):
     def __init__(self,data):
         l = len(data)
@@ -108,6 +115,14 @@ class Tester():
             cmd,payload = self.dev._dev.InternalRecv()
         return cmd, payload
 
+    # pinAuth arguments for a raw self.ctap request, none without a pin.
+    def pin_args(self, client_data_hash, pin):
+        if pin is None:
+            return {}
+        pin_token = self.client.pin_protocol.get_pin_token(pin)
+        return {'pin_auth': hmac_sha256(pin_token, client_data_hash)[:16],
+                'pin_protocol': self.client.pin_protocol.VERSION}
+
     def check_error(self,data,err=None):
         assert(len(data) == 1)
         if err is None:
@@ -484,6 +499,13 @@ class Tester():
                 creds.append(cred)
             print('PASS')
 
+            print('make credential with names too long to store')
+            long_rp = {'id': rp['id'], 'name': 'R' * 40}
+            long_user = {'id': user['id'], 'name': 'U' * 70, 'displayName': 'D' * 70}
+            attest, data = self.client.make_credential(long_rp, long_user, challenge, pin = PIN, exclude_list = [])
+            attest.verify(data.hash)
+            print('PASS')
+
             if PIN is not None:
                 print('make credential with wrong pin code')
                 try:
@@ -532,6 +554,74 @@ class Tester():
                 ass.verify(client_data.hash, cred.public_key)
             print('PASS')
 
+            print('get assertion with the valid credential after 24 others')
+            id_len = len(creds[0].credential_id)
+            allow_list = [{'id': os.urandom(id_len), 'type': 'public-key'} for i in range(0,24)]
+            allow_list.append({'id': creds[0].credential_id, 'type': 'public-key'})
+            assertions, client_data = self.client.get_assertion(rp['id'], challenge, allow_list, pin = PIN)
+            assert(len(assertions) == 1)
+            assertions[0].verify(client_data.hash, creds[0].public_key)
+            print('PASS')
+
+            print('get assertion with a malformed allow list entry')
+            cdh = os.urandom(32)
+            good = {'id': creds[0].credential_id, 'type': 'public-key'}
+            # 0x13 is CTAP2_ERR_INVALID_CBOR_TYPE, which fido2.ctap doesn't name
+            for bad, err in ((b'not a map', 0x13), ({'id': creds[0].credential_id}, CtapError.ERR.MISSING_PARAMETER)):
+                try:
+                    self.ctap.get_assertion(rp['id'], cdh, [good, bad], **self.pin_args(cdh, PIN))
+                    raise RuntimeError('malformed allow list entry accepted')
+                except CtapError as e:
+                    assert(e.code == err)
+            print('PASS')
+
+            print('get assertion with non-canonical CBOR')
+            rp_id = b'\x6b' + rp['id'].encode()     # text(11)
+            cdh = b'\x58\x20' + os.urandom(32)     # bytes(32)
+            for raw in (b'\xa2\x02' + cdh + b'\x01' + rp_id,                  # keys out of order
+                        b'\xa3\x01' + rp_id + b'\x01' + rp_id + b'\x02' + cdh,  # duplicate key
+                        b'\xa2\x18\x01' + rp_id + b'\x02' + cdh,              # key 1 in two bytes
+                        b'\xa2\x01\x78\x0b' + rp_id[1:] + b'\x02' + cdh):     # length 11 in two bytes
+                resp = self.send_data(CTAPHID.CBOR, b'\x02' + raw)   # authenticatorGetAssertion
+                self.check_error(resp, CtapError.ERR.INVALID_CBOR)
+            print('PASS')
+
+            print('get assertion for resident keys across two RPs')
+            cdh = os.urandom(32)
+            key_params = [{'type': 'public-key', 'alg': ES256.ALGORITHM}]
+            rk_creds = {'examplo.org': [], 'examplo.com': []}
+            for rp_id, count in (('examplo.org', 3), ('examplo.com', 2)):
+                for i in range(0,count):
+                    rk_user = {'id': b'rk_user_%d' % i, 'name': 'RK User %d' % i}
+                    attest = self.ctap.make_credential(cdh, {'id': rp_id, 'name': 'RkRP'}, rk_user, key_params,
+                                                       options = {'rk': True}, **self.pin_args(cdh, PIN))
+                    attest.verify(cdh)
+                    rk_creds[rp_id].append(attest.auth_data.credential_data)
+            for rp_id, made in rk_creds.items():
+                first = self.ctap.get_assertion(rp_id, cdh, **self.pin_args(cdh, PIN))
+                assert(first.number_of_credentials == len(made))
+                assertions = [first] + [self.ctap.get_next_assertion() for i in range(1,len(made))]
+                ids = [a.credential['id'] for a in assertions]
+                assert(sorted(ids) == sorted([c.credential_id for c in made]))
+                for a in assertions:
+                    cred = [c for c in made if c.credential_id == a.credential['id']][0]
+                    a.verify(cdh, cred.public_key)
+                try:
+                    self.ctap.get_next_assertion()
+                    raise RuntimeError('getNextAssertion past the last credential')
+                except CtapError as e:
+                    assert(e.code == CtapError.ERR.NOT_ALLOWED)
+            print('PASS')
+
+            print('make credential and get assertion with EdDSA')
+            attest, data = self.client.make_credential(rp, user, challenge, algos = [-8], pin = PIN, exclude_list = [])
+            attest.verify(data.hash)
+            ed_cred = attest.auth_data.credential_data
+            allow_list = [{'id': ed_cred.credential_id, 'type': 'public-key'}]
+            assertions, client_data = self.client.get_assertion(rp['id'], challenge, allow_list, pin = PIN)
+            VerifyEd25519(ed_cred.public_key, assertions[0].auth_data + client_data.hash, assertions[0].signature)
+            print('PASS')
+
         print('Reset device')
         try:
             self.ctap.reset()
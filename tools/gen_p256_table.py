@@ -0,0 +1,85 @@
+#!/usr/bin/env python
+#
+# Generates the fixed-base comb table for the P-256 generator used by
+# crypto/p256/p256.c.
+#
+# Usage: gen_p256_table.py <teeth> <tables> > crypto/p256/p256_table.h
+#
+# The table holds tables * (2^teeth - 1) affine points of 64 bytes each, so
+# pick the parameters according to the flash budget of the target:
+#
+#   teeth tables   size    doublings  additions
+#     4     1       960 B     63         64
+#     5     2      3968 B     25         52
+#     6     4     16128 B     10         44
+#
+# Entry [b][c-1] is  sum_i bit_i(c) * 2^((b*teeth + i)*d) * G,
+# where d = ceil(256 / (teeth*tables)).  Coordinates are stored in Montgomery
+# form (x * 2^256 mod p) as 32 bit little endian limbs.
+#
+import sys
+
+p = 2**256 - 2**224 + 2**192 + 2**96 - 1
+a = p - 3
+Gx = 0x6b17d1f2e12c4247f8bce6e563a440f277037d812deb33a0f4a13945d898c296
+Gy = 0x4fe342e2fe1a7f9b8ee7eb4a7c0f9e162bce33576b315ececbb6406837bf51f5
+
+def inv(x):
+    return pow(x, p - 2, p)
+
+def add(P, Q):
+    if P is None: return Q
+    if Q is None: return P
+    if P[0] == Q[0]:
+        if (P[1] + Q[1]) % p == 0:
+            return None
+        l = (3 * P[0] * P[0] + a) * inv(2 * P[1]) % p
+    else:
+        l = (Q[1] - P[1]) * inv(Q[0] - P[0]) % p
+    x = (l * l - P[0] - Q[0]) % p
+    return (x, (l * (P[0] - x) - P[1]) % p)
+
+def mul(k, P):
+    R = None
+    while k:
+        if k & 1:
+            R = add(R, P)
+        P = add(P, P)
+        k >>= 1
+    return R
+
+def fe(x):
+    x = (x << 256) % p
+    return 'P256_FE(' + ', '.join('0x%08x' % ((x >> (32 * i)) & 0xffffffff) for i in range(8)) + ')'
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        print('usage: %s <teeth> <tables>' % sys.argv[0], file=sys.stderr)
+        sys.exit(1)
+
+    teeth = int(sys.argv[1])
+    tables = int(sys.argv[2])
+    if teeth < 1 or tables < 1 or teeth * tables > 256:
+        print('invalid comb parameters', file=sys.stderr)
+        sys.exit(1)
+
+    d = (256 + teeth * tables - 1) // (teeth * tables)
+
+    print('// Generated by tools/gen_p256_table.py %d %d, do not edit.' % (teeth, tables))
+    print('#define P256_COMB_TEETH     %d' % teeth)
+    print('#define P256_COMB_TABLES    %d' % tables)
+    print('#define P256_COMB_SPACING   %d' % d)
+    print('')
+    print('static const p256_affine p256_comb[P256_COMB_TABLES][(1 << P256_COMB_TEETH) - 1] = {')
+    for b in range(tables):
+        base = [mul(2 ** ((b * teeth + i) * d), (Gx, Gy)) for i in range(teeth)]
+        print('  {')
+        for c in range(1, 1 << teeth):
+            P = None
+            for i in range(teeth):
+                if c & (1 << i):
+                    P = add(P, base[i])
+            print('    { %s,' % fe(P[0]))
+            print('      %s },' % fe(P[1]))
+        print('  },')
+    print('};')
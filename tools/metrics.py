@@ -0,0 +1,77 @@
+#  Copyright 2018 Conor Patrick
+#
+#  Permission is hereby granted, free of charge, to any person obtaining a copy of
+#  this software and associated documentation files (the "Software"), to deal in
+#  the Software without restriction, including without limitation the rights to
+#  use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+#  of the Software, and to permit persons to whom the Software is furnished to do
+#  so, subject to the following conditions:
+#
+#  The above copyright notice and this permission notice shall be included in all
+#  copies or substantial portions of the Software.
+#
+#  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+#  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+#  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+#  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+#  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+#  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+#  SOFTWARE.
+
+# Reads the latency histograms kept by the authenticator (fido2/metrics.h)
+# with the CTAPHID_METRICS vendor command and prints them as JSON.
+#
+#   python tools/metrics.py [--reset]
+
+from __future__ import print_function, absolute_import, unicode_literals
+
+from fido2.hid import CtapHidDevice
+import sys,json,struct
+
+CTAPHID_METRICS = 0x41      # TYPE_INIT is added by CtapHidDevice
+
+METRICS_READ = 0x00
+METRICS_READ_RESET = 0x01
+
+COMMANDS = ['other', 'make_credential', 'get_assertion', 'get_next_assertion',
+            'client_pin', 'u2f_register', 'u2f_authenticate']
+PHASES = ['reassembly', 'parse', 'pin', 'credentials', 'key_derivation',
+          'sign', 'encode', 'writeback', 'total']
+
+def bucket_bounds(i, buckets, bucket0):
+    lo = 0 if i == 0 else bucket0 << (i - 1)
+    hi = None if i == buckets - 1 else bucket0 << i
+    return lo, hi
+
+def decode(data):
+    version, ncmd, nphase, nbucket, bucket0 = struct.unpack_from('<BBBBI', data, 0)
+    if version != 1:
+        raise ValueError('unknown metrics version %d' % version)
+    off = 8
+    maxes = struct.unpack_from('<%dI' % (ncmd * nphase), data, off)
+    off += 4 * ncmd * nphase
+    counts = struct.unpack_from('<%dH' % (ncmd * nphase * nbucket), data, off)
+
+    out = {'bucket0_us': bucket0, 'commands': {}}
+    for c in range(ncmd):
+        phases = {}
+        for p in range(nphase):
+            hist = counts[(c * nphase + p) * nbucket:(c * nphase + p + 1) * nbucket]
+            if sum(hist) == 0:
+                continue
+            phases[PHASES[p] if p < len(PHASES) else str(p)] = {
+                'count': sum(hist),
+                'max_us': maxes[c * nphase + p],
+                'buckets': [[bucket_bounds(i, nbucket, bucket0), n] for i, n in enumerate(hist) if n],
+            }
+        if phases:
+            out['commands'][COMMANDS[c] if c < len(COMMANDS) else str(c)] = phases
+    return out
+
+if __name__ == '__main__':
+    dev = next(CtapHidDevice.list_devices(), None)
+    if not dev:
+        raise RuntimeError('No FIDO device found')
+    arg = METRICS_READ_RESET if '--reset' in sys.argv[1:] else METRICS_READ
+    data = dev.call(CTAPHID_METRICS, struct.pack('B', arg))
+    print(json.dumps(decode(bytearray(data)), indent=2))